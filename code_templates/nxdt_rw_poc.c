@@ -28,11 +28,38 @@
 #include "legal_info.h"
 #include "cert.h"
 #include "usb.h"
+#include "dump_pipeline.h"
+#include "digest.h"
+#include "dat.h"
+#include "sd_writer.h"
 
 #define BLOCK_SIZE      USB_TRANSFER_BUFFER_SIZE
 #define WAIT_TIME_LIMIT 30
 #define OUTDIR          APP_TITLE
 
+#define DUMP_PIPELINE_BUFFER_COUNT  4   /* Lets the read stage stay a few blocks ahead of the write stage. */
+
+#define NSP_HASH_QUEUE_SIZE     4   /* Max number of NCA data blocks waiting to be hashed. */
+
+#define NSP_BATCH_QUEUE_PATH        DEVOPTAB_SDMC_DEVICE "/" OUTDIR "/nsp_batch_queue.bin"
+#define NSP_BATCH_QUEUE_MAGIC       0x5150534E  /* "NSPQ". */
+#define NSP_BATCH_QUEUE_VERSION     1
+#define NSP_BATCH_TICKET_CACHE_SIZE 16          /* Tickets kept around to avoid retrieving them again while preparing other titles. */
+
+#define USB_BATCH_MAX_FILE_COUNT    1024
+#define USB_BATCH_MAX_FILE_SIZE     0x100000    /* 1 MiB. Bigger files are sent on their own. */
+
+#define DIGEST_BENCHMARK_SIZE       0x20000000  /* 512 MiB. Capped to the trimmed gamecard size. */
+
+#define DUMP_CHECKPOINT_MAGIC       0x54504B43  /* "CKPT". */
+#define DUMP_CHECKPOINT_VERSION     1
+#define DUMP_CHECKPOINT_INTERVAL    0x10000000  /* 256 MiB. Only used for dumps written to the SD card. */
+#define DUMP_CHECKPOINT_TAIL_SIZE   0x10000     /* 64 KiB. Read back from the output file to make sure it still holds the data covered by a checkpoint. */
+#define DUMP_CHECKPOINT_EXTENSION   ".ckpt"
+
+#define SD_WRITE_FLUSH_INTERVAL     0x4000000   /* 64 MiB. Bounds the amount of buffered data lost if the console crashes while dumping to the SD card. */
+#define SD_WRITE_LANE_COUNT         2           /* Pipelines writing to different ConcatenationFile parts at the same time. Keeps more than one FS request in flight. */
+
 /* Type definitions. */
 
 typedef struct _Menu Menu;
@@ -41,6 +68,8 @@ typedef u32  (*MenuElementOptionGetterFunction)(void);
 typedef void (*MenuElementOptionSetterFunction)(u32 idx);
 typedef bool (*MenuElementFunction)(void *userdata);
 
+typedef bool (*ResumeTailReadFunction)(void *userdata, void *buf, u64 size, u64 offset);
+
 typedef struct {
     u32 selected;                                   ///< Used to keep track of the selected option.
     MenuElementOptionGetterFunction getter_func;    ///< Pointer to a function to be called the first time an option value is loaded. Should be set to NULL if not used.
@@ -86,24 +115,142 @@ typedef enum {
 typedef struct
 {
     FILE *fp;
-    void *data;
-    size_t data_size;
+    SdWriter sd_writer;                 ///< Used instead of 'fp' while dumping to the SD card.
+    SdSplitWriter *sd_split_writer;     ///< If set, spanDumpPipeline() runs a pipeline for each lane instead of using the provided write stage.
     size_t data_written;
     size_t total_size;
-    bool read_error;
-    bool write_error;
+    u64 resume_offset;
     bool transfer_cancelled;
 } SharedThreadData;
 
+typedef enum {
+    DumpCheckpointType_Xci = 0,
+    DumpCheckpointType_Nsp = 1
+} DumpCheckpointType;
+
+typedef struct {
+    u32 magic;                                      ///< DUMP_CHECKPOINT_MAGIC.
+    u32 version;                                    ///< DUMP_CHECKPOINT_VERSION.
+    u8 type;                                        ///< DumpCheckpointType.
+    u8 reserved[3];
+    u32 payload_size;                               ///< Size of the type-specific data stored right after this header.
+    u8 source_hash[SHA256_HASH_SIZE];               ///< Identifies the dump source, the dump options and the application build. Checkpoints with a different source hash are discarded.
+    u64 output_size;
+    u64 stream_offset;                              ///< Dumped data stream offset covered by this checkpoint.
+    u64 file_offset;                                ///< Output file offset that matches 'stream_offset'. All data up to this point was flushed before saving the checkpoint.
+    u32 completed_part_count;                       ///< ConcatenationFile parts fully written before 'file_offset'.
+    u32 tail_size;
+    u8 tail_hash[SHA256_HASH_SIZE];                 ///< SHA-256 checksum of the 'tail_size' bytes right before 'file_offset'.
+} DumpCheckpointHeader;
+
+NXDT_ASSERT(DumpCheckpointHeader, 0x70);
+
+typedef struct {
+    char *path;                                     ///< Set to NULL if checkpoints are disabled.
+    u8 type;                                        ///< DumpCheckpointType.
+    u8 source_hash[SHA256_HASH_SIZE];
+    u64 output_size;
+    u64 base_offset;                                ///< Output file offset for the start of the dumped data stream (e.g. right after the gamecard key area).
+    u64 last_offset;                                ///< Data stream offset covered by the last saved (or loaded) checkpoint.
+    bool available;                                 ///< Set to true if a checkpoint for this dump is stored on the SD card. Partial dumps are kept around if this is set.
+} DumpCheckpointContext;
+
+typedef struct {
+    char name[0x80];                                ///< "{partition_name}/{entry_name}" string.
+    u64 offset;                                     ///< Hash FS entry offset (relative to the start of the gamecard image).
+    HashFileSystemEntryHashContext hash_ctx;
+} HfsVerificationEntry;
+
+typedef struct {
+    HfsVerificationEntry *entries;
+    u32 entry_count;
+    Thread thread;
+    bool thread_started;
+    const void *data;                               ///< Data block to be processed by the verification thread.
+    u64 data_size;                                  ///< Set to zero by the verification thread once it's done with the current data block.
+    u64 data_offset;                                ///< Data block offset (relative to the start of the gamecard image).
+    bool exit;
+} HfsVerificationData;
+
 typedef struct {
     SharedThreadData shared_thread_data;
-    u32 xci_crc, full_xci_crc;
+    u64 card_data_size;                             ///< Trimmed gamecard size. Data past this point is known 0xFF padding, which is synthesized instead of being read.
+    DigestEngine *digest_engine;                    ///< Set to NULL if checksum calculation is disabled. Calculates all digests from the XCI image (without the key area) in a single pass.
+    HfsVerificationData *hfs_verification_data;     ///< Set to NULL if Hash FS entry verification is disabled.
+    DumpCheckpointContext *checkpoint;              ///< Set to NULL if checkpoints are disabled.
 } XciThreadData;
 
 typedef struct {
-    SharedThreadData shared_thread_data;
-    HashFileSystemContext *hfs_ctx;
-} HfsThreadData;
+    HfsVerificationData *hfs_verification_data;
+    u64 base_offset;                                ///< Gamecard image offset for the start of the dumped data stream.
+} HfsVerificationStageData;
+
+typedef struct {
+    NcaContext *nca_ctx;                            ///< One entry per content. The meta NCA context is always the last one.
+    NcaContext *meta_nca_ctx;
+    ContentMetaContext cnmt_ctx;
+    ProgramInfoContext *program_info_ctx;
+    u32 program_count;
+    NacpContext *nacp_ctx;
+    u32 control_count;
+    LegalInfoContext *legal_info_ctx;
+    u32 legal_info_count;
+    Ticket tik;
+    bool retrieve_tik_cert;
+    u8 *raw_cert_chain;
+    u64 raw_cert_chain_size;
+    PartitionFileSystemFileContext pfs_file_ctx;
+    u32 content_type_ctx_count;                     ///< Number of NCA contexts that may hold content type context data (authoringtool xmls, icons).
+    bool generate_authoringtool_data;
+    u64 nsp_header_size;
+    u64 nsp_size;
+} NspDumpContext;
+
+typedef struct {
+    Ticket tickets[NSP_BATCH_TICKET_CACHE_SIZE];
+    u32 ticket_count;
+    u32 ticket_idx;                                 ///< Next cache slot to be overwritten once the ticket cache is full.
+    char cert_issuer[0x40];                         ///< Signature issuer for the cached certificate chain.
+    u8 *raw_cert_chain;
+    u64 raw_cert_chain_size;
+} NspLookupCache;
+
+typedef enum {
+    NspBatchEntryStatus_Pending = 0,
+    NspBatchEntryStatus_Done    = 1,
+    NspBatchEntryStatus_Failed  = 2
+} NspBatchEntryStatus;
+
+typedef struct {
+    u64 title_id;
+    u32 version;
+    u8 meta_type;                                   ///< NcmContentMetaType.
+    u8 storage_id;                                  ///< NcmStorageId. NcmStorageId_Any may be used with nspBatchCreateJob().
+    u8 status;                                      ///< NspBatchEntryStatus.
+    u8 reserved;
+} NspBatchEntry;
+
+NXDT_ASSERT(NspBatchEntry, 0x10);
+
+typedef struct {
+    u32 magic;                                      ///< NSP_BATCH_QUEUE_MAGIC.
+    u32 version;                                    ///< NSP_BATCH_QUEUE_VERSION.
+    u32 entry_count;
+    u32 reserved;
+} NspBatchQueueHeader;
+
+NXDT_ASSERT(NspBatchQueueHeader, 0x10);
+
+typedef struct {
+    NspBatchEntry *entries;
+    u32 entry_count;
+    NspLookupCache lookup_cache;
+    Thread prepare_thread;
+    bool prepare_thread_started;
+    u32 prepare_idx;                                ///< Entry handled by the last prepare operation.
+    TitleInfo *prepare_title_info;
+    NspDumpContext *prepare_dump_ctx;               ///< Set to NULL if the last prepare operation failed.
+} NspBatchJob;
 
 typedef struct {
     void *data;
@@ -111,8 +258,48 @@ typedef struct {
     size_t total_size;
     bool error;
     bool transfer_cancelled;
+    NspDumpContext *dump_ctx;                       ///< Prepared ahead of time by the batch scheduler. If NULL, the dump thread prepares its own. Always freed by the dump thread.
 } NspThreadData;
 
+typedef struct {
+    const void *data;
+    u64 size;
+} NspHashBlock;
+
+typedef struct {
+    Sha256Context sha256_ctx;
+    NspHashBlock blocks[NSP_HASH_QUEUE_SIZE];       ///< Data blocks waiting to be hashed. The first one is being processed by the hash thread.
+    u32 head;
+    u32 count;
+    Thread thread;
+    bool thread_started;
+    bool exit;
+} NspHashData;
+
+typedef struct {
+    u32 content_idx;                                ///< NCA being dumped when the checkpoint was saved.
+    u32 content_count;
+    u64 content_offset;                             ///< Offset within the current NCA.
+    Sha256Context sha256_ctx;                       ///< Running hash for the current NCA.
+    u8 content_hashes[][SHA256_HASH_SIZE];          ///< One entry per NCA. Only valid for NCAs dumped before the current one.
+} NspCheckpointState;
+
+/// Used by the dump pipeline stages while dumping a single NCA from a NSP.
+typedef struct {
+    NspThreadData *nsp_thread_data;
+    NspDumpContext *dump_ctx;
+    NcaContext *nca_ctx;
+    u32 content_idx;
+    u64 nsp_offset;                                 ///< NSP offset for the start of the NCA.
+    bool dirty_header;
+    NspHashData *nsp_hash_data;
+    FILE *fd;                                       ///< Set to NULL while dumping to the SD card or a USB host.
+    SdWriter *sd_writer;
+    DumpCheckpointContext *checkpoint;
+    NspCheckpointState *checkpoint_state;           ///< Set to NULL if checkpoints are disabled.
+    u32 checkpoint_state_size;
+} NspNcaStageData;
+
 typedef struct {
     TitleInfo *title_info;
     u32 content_idx;
@@ -121,20 +308,60 @@ typedef struct {
 typedef struct {
     SharedThreadData shared_thread_data;
     NcaContext *nca_ctx;
+    SdSplitWriter sd_split_writer;
 } NcaThreadData;
 
+typedef struct {
+    SdSplitWriter *writer;
+    u32 lane_idx;
+} SplitWriteStageData;
+
 typedef struct {
     SharedThreadData shared_thread_data;
     PartitionFileSystemContext *pfs_ctx;
     bool use_layeredfs_dir;
+    SdSplitWriter sd_split_writer;
 } PfsThreadData;
 
 typedef struct {
     SharedThreadData shared_thread_data;
     RomFileSystemContext *romfs_ctx;
     bool use_layeredfs_dir;
+    SdSplitWriter sd_split_writer;
 } RomFsThreadData;
 
+typedef enum {
+    ExtractedFsType_Hfs   = 0,
+    ExtractedFsType_Pfs   = 1,
+    ExtractedFsType_RomFs = 2
+} ExtractedFsType;
+
+typedef struct {
+    void *fs_entry;                                 ///< HashFileSystemEntry, PartitionFileSystemEntry or RomFileSystemFileEntry.
+    u64 size;
+    u64 stream_offset;                              ///< Offset of this entry's data within the extracted data stream.
+} ExtractedFsEntry;
+
+/// Extracted filesystem dumps treat the data from all file entries as a single stream, laid out back to back in entry order.
+/// This lets the dump pipeline work on them the same way it works on raw dumps. The write stage switches output files as needed.
+typedef struct {
+    SharedThreadData shared_thread_data;
+    u8 fs_type;                                     ///< ExtractedFsType.
+    void *fs_ctx;                                   ///< HashFileSystemContext, PartitionFileSystemContext or RomFileSystemContext.
+    ExtractedFsEntry *entries;
+    u32 entry_count;
+    HfsVerificationData *hfs_verification_data;     ///< Set to NULL if Hash FS entry verification is disabled. Only used with Hash FS partitions.
+    char *filename;                                 ///< Output directory. Freed by saveExtractedFileSystemData().
+    size_t filename_len;
+    char path[FS_MAX_PATH];                         ///< Output path for the current file entry.
+    u32 read_idx;                                   ///< Current file entry for the read stage.
+    u32 verify_idx;                                 ///< Current file entry for the Hash FS verification stage.
+    u32 write_idx;                                  ///< Number of file entries opened by the write stage so far.
+    UsbFileBatchEntry *batch_entries;               ///< Only used while dumping to a USB host.
+    char *batch_paths;
+    u32 batch_file_count;                           ///< File entries left from the last batch sent to the USB host.
+} ExtractedFsThreadData;
+
 /* Function prototypes. */
 
 static void utilsScanPads(void);
@@ -182,12 +409,25 @@ static bool saveGameCardInitialData(void *userdata);
 static bool saveGameCardSpecificData(void *userdata);
 static bool saveGameCardIdSet(void *userdata);
 static bool saveGameCardHfsPartition(void *userdata);
-static bool saveGameCardRawHfsPartition(HashFileSystemContext *hfs_ctx);
-static bool saveGameCardExtractedHfsPartition(HashFileSystemContext *hfs_ctx);
+static bool saveGameCardRawHfsPartition(HashFileSystemContext *hfs_ctx, HfsVerificationData *hfs_verification_data);
+static bool saveGameCardExtractedHfsPartition(HashFileSystemContext *hfs_ctx, HfsVerificationData *hfs_verification_data);
 
 static bool saveConsoleLafwBlob(void *userdata);
 
+static bool benchmarkDigestEngine(void *userdata);
+
 static bool saveNintendoSubmissionPackage(void *userdata);
+static bool dumpNintendoSubmissionPackage(TitleInfo *title_info, NspDumpContext *dump_ctx, bool *out_cancelled);
+static bool saveNintendoSubmissionPackageBatch(void *userdata);
+
+static bool nspBatchCreateJob(NspBatchJob *job, const NspBatchEntry *entries, u32 entry_count);
+static bool nspBatchLoadJob(NspBatchJob *job);
+static bool nspBatchSaveJob(NspBatchJob *job);
+static bool nspBatchRunJob(NspBatchJob *job);
+static void nspBatchFreeJob(NspBatchJob *job);
+static int nspBatchEntrySortFunction(const void *a, const void *b);
+static void nspBatchPrepareEntry(NspBatchJob *job, u32 idx);
+static void nspBatchPrepareThreadFunc(void *arg);
 
 static bool saveTicket(void *userdata);
 
@@ -200,24 +440,81 @@ static bool saveExtractedPartitionFsSection(PartitionFileSystemContext *pfs_ctx,
 static bool saveRawRomFsSection(RomFileSystemContext *romfs_ctx, bool use_layeredfs_dir);
 static bool saveExtractedRomFsSection(RomFileSystemContext *romfs_ctx, bool use_layeredfs_dir);
 
-static void xciReadThreadFunc(void *arg);
-
-static void rawHfsReadThreadFunc(void *arg);
-static void extractedHfsReadThreadFunc(void *arg);
-
-static void ncaReadThreadFunc(void *arg);
-
-static void rawPartitionFsReadThreadFunc(void *arg);
-static void extractedPartitionFsReadThreadFunc(void *arg);
-
-static void rawRomFsReadThreadFunc(void *arg);
-static void extractedRomFsReadThreadFunc(void *arg);
-
-static void genericWriteThreadFunc(void *arg);
-
-static bool spanDumpThreads(ThreadFunc read_func, ThreadFunc write_func, void *arg);
+static bool xciReadStageFunc(DumpPipelineBuffer *buf, void *userdata);
+static bool xciRemoveCertificateStageFunc(DumpPipelineBuffer *buf, void *userdata);
+static bool xciWriteStageFunc(DumpPipelineBuffer *buf, void *userdata);
+static bool xciCalculateCheckpointSourceHash(u8 *out, u64 output_size);
+
+static bool rawHfsReadStageFunc(DumpPipelineBuffer *buf, void *userdata);
+static bool hfsVerificationStageFunc(DumpPipelineBuffer *buf, void *userdata);
+
+static bool ncaReadStageFunc(DumpPipelineBuffer *buf, void *userdata);
+
+static bool rawPartitionFsReadStageFunc(DumpPipelineBuffer *buf, void *userdata);
+
+static bool rawRomFsReadStageFunc(DumpPipelineBuffer *buf, void *userdata);
+
+static bool saveExtractedFileSystemData(ExtractedFsThreadData *extracted_fs_thread_data, const char *fs_name);
+static bool extractedFsInitializeEntries(ExtractedFsThreadData *extracted_fs_thread_data);
+static ExtractedFsEntry *extractedFsGetEntryByStreamOffset(ExtractedFsThreadData *extracted_fs_thread_data, u32 *idx, u64 offset);
+static bool extractedFsGenerateOutputPath(ExtractedFsThreadData *extracted_fs_thread_data, ExtractedFsEntry *entry, char *out_path);
+static bool extractedFsSendFileBatchProperties(ExtractedFsThreadData *extracted_fs_thread_data);
+static bool extractedFsOpenNextEntry(ExtractedFsThreadData *extracted_fs_thread_data);
+static bool extractedFsReadStageFunc(DumpPipelineBuffer *buf, void *userdata);
+static bool extractedFsVerificationStageFunc(DumpPipelineBuffer *buf, void *userdata);
+static bool extractedFsWriteStageFunc(DumpPipelineBuffer *buf, void *userdata);
+
+static bool sendResumableFileProperties(u64 file_size, const char *filename, ResumeTailReadFunction read_func, void *userdata, u64 *out_offset);
+static bool readGameCardImageTail(void *userdata, void *buf, u64 size, u64 offset);
+static bool readNcaTail(void *userdata, void *buf, u64 size, u64 offset);
+static bool readRawRomFsTail(void *userdata, void *buf, u64 size, u64 offset);
+
+static bool dumpCheckpointInitialize(DumpCheckpointContext *ctx, const char *filename, u8 type, const u8 *source_hash, u64 output_size, u64 base_offset);
+static bool dumpCheckpointLoad(DumpCheckpointContext *ctx, const char *filename, void *payload, u32 payload_size, DumpCheckpointHeader *out_header, SdWriter *out_writer);
+static bool dumpCheckpointIsDue(DumpCheckpointContext *ctx, u64 stream_offset);
+static bool dumpCheckpointSave(DumpCheckpointContext *ctx, SdWriter *writer, u64 stream_offset, const void *payload, u32 payload_size);
+static void dumpCheckpointDiscard(DumpCheckpointContext *ctx);
+static void dumpCheckpointFree(DumpCheckpointContext *ctx);
+static bool dumpCheckpointGetTailHash(SdWriter *writer, u64 file_offset, u32 *out_size, u8 *out_hash);
+
+static bool writeOutputFileData(FILE *fp, SdWriter *sd_writer, const void *data, u64 size);
+
+static bool genericWriteStageFunc(DumpPipelineBuffer *buf, void *userdata);
+static bool splitWriteStageFunc(DumpPipelineBuffer *buf, void *userdata);
+static bool digestHashStageFunc(DumpPipelineBuffer *buf, void *userdata);
+static bool spanDumpPipeline(const DumpPipelineStage *stages, u32 stage_count, SharedThreadData *shared_thread_data);
+
+static bool hfsVerificationInitialize(HfsVerificationData *hfs_verification_data, u8 hfs_partition_type);
+static bool hfsVerificationAddPartitionEntries(HfsVerificationData *hfs_verification_data, HashFileSystemContext *hfs_ctx);
+static void hfsVerificationSubmitData(HfsVerificationData *hfs_verification_data, const void *data, u64 data_size, u64 offset);
+static void hfsVerificationWaitForIdle(HfsVerificationData *hfs_verification_data);
+static void hfsVerificationPrintResults(HfsVerificationData *hfs_verification_data);
+static void hfsVerificationFree(HfsVerificationData *hfs_verification_data);
+static void hfsVerificationThreadFunc(void *arg);
 
 static void nspThreadFunc(void *arg);
+static bool nspNcaPatchStageFunc(DumpPipelineBuffer *buf, void *userdata);
+static bool nspNcaWriteStageFunc(DumpPipelineBuffer *buf, void *userdata);
+static bool nspPrepareDumpContext(NspDumpContext *dump_ctx, TitleInfo *title_info, NspLookupCache *lookup_cache);
+static void nspFreeDumpContext(NspDumpContext *dump_ctx);
+static void nspCalculateCheckpointSourceHash(u8 *out, TitleInfo *title_info, NspDumpContext *dump_ctx);
+static void nspLookupCacheSeedTicket(NspLookupCache *lookup_cache, TitleInfo *title_info, Ticket *tik);
+static void nspLookupCacheAddTicket(NspLookupCache *lookup_cache, Ticket *tik);
+static u8 *nspLookupCacheGetCertificateChain(NspLookupCache *lookup_cache, const char *issuer, u64 *out_size);
+static void nspLookupCacheFree(NspLookupCache *lookup_cache);
+static bool nspHashInitialize(NspHashData *nsp_hash_data);
+static void nspHashReset(NspHashData *nsp_hash_data);
+static void nspHashSubmitData(NspHashData *nsp_hash_data, const void *data, u64 data_size);
+static void nspHashWaitForBuffer(NspHashData *nsp_hash_data, const void *buf, u64 buf_size);
+static void nspHashGetHash(NspHashData *nsp_hash_data, u8 *out);
+static void nspHashGetState(NspHashData *nsp_hash_data, Sha256Context *out);
+static void nspHashSetState(NspHashData *nsp_hash_data, const Sha256Context *state);
+static void nspHashFree(NspHashData *nsp_hash_data);
+static void nspHashThreadFunc(void *arg);
+static bool writeFileContextHeaderDataToFile(const void *data, u64 data_size, void *userdata);
+static bool writeFileContextHeaderDataToSdWriter(const void *data, u64 data_size, void *userdata);
+
+static u8 printDatLookupResult(const char *prefix, u64 size, const DigestResult *digest_result, u8 digest_mask);
 
 static u32 getOutputStorageOption(void);
 static void setOutputStorageOption(u32 idx);
@@ -237,6 +534,9 @@ static void setGameCardCalculateChecksumOption(u32 idx);
 static u32 getGameCardWriteRawHfsPartitionOption(void);
 static void setGameCardWriteRawHfsPartitionOption(u32 idx);
 
+static u32 getGameCardVerifyHfsEntriesOption(void);
+static void setGameCardVerifyHfsEntriesOption(u32 idx);
+
 static u32 getNspSetDownloadDistributionOption(void);
 static void setNspSetDownloadDistributionOption(u32 idx);
 
@@ -355,6 +655,18 @@ static MenuElement *g_xciMenuElements[] = {
         },
         .userdata = NULL
     },
+    &(MenuElement){
+        .str = "verify hfs entries",
+        .child_menu = NULL,
+        .task_func = NULL,
+        .element_options = &(MenuElementOption){
+            .selected = 0,
+            .getter_func = &getGameCardVerifyHfsEntriesOption,
+            .setter_func = &setGameCardVerifyHfsEntriesOption,
+            .options = g_noYesStrings
+        },
+        .userdata = NULL
+    },
     &g_storageMenuElement,
     NULL
 };
@@ -413,6 +725,18 @@ static MenuElement *g_gameCardHfsMenuElements[] = {
         },
         .userdata = NULL
     },
+    &(MenuElement){
+        .str = "verify hfs entries",
+        .child_menu = NULL,
+        .task_func = NULL,
+        .element_options = &(MenuElementOption){
+            .selected = 0,
+            .getter_func = &getGameCardVerifyHfsEntriesOption,
+            .setter_func = &setGameCardVerifyHfsEntriesOption,
+            .options = g_noYesStrings
+        },
+        .userdata = NULL
+    },
     &g_storageMenuElement,
     NULL
 };
@@ -493,6 +817,13 @@ static MenuElement *g_gameCardMenuElements[] = {
         .element_options = NULL,
         .userdata = NULL
     },
+    &(MenuElement){
+        .str = "benchmark digest engine",
+        .child_menu = NULL,
+        .task_func = &benchmarkDigestEngine,
+        .element_options = NULL,
+        .userdata = NULL
+    },
     &g_storageMenuElement,
     NULL
 };
@@ -859,6 +1190,13 @@ static MenuElement *g_rootMenuElements[] = {
         .element_options = NULL,
         .userdata = NULL
     },
+    &(MenuElement){
+        .str = "batch nsp dump (all user titles)",
+        .child_menu = NULL,
+        .task_func = &saveNintendoSubmissionPackageBatch,
+        .element_options = NULL,
+        .userdata = NULL
+    },
     &(MenuElement){
         .str = "system titles menu",
         .child_menu = &g_systemTitlesMenu,
@@ -878,7 +1216,12 @@ static Menu g_rootMenu = {
 };
 
 static Mutex g_conMutex = 0, g_fileMutex = 0;
-static CondVar g_readCondvar = 0, g_writeCondvar = 0;
+
+static Mutex g_hfsVerificationMutex = 0;
+static CondVar g_hfsVerificationSubmitCondvar = 0, g_hfsVerificationDoneCondvar = 0;
+
+static Mutex g_nspHashMutex = 0;
+static CondVar g_nspHashSubmitCondvar = 0, g_nspHashDoneCondvar = 0;
 
 static char path[FS_MAX_PATH] = {0};
 
@@ -2182,7 +2525,7 @@ static bool saveGameCardImage(void *userdata)
 {
     (void)userdata;
 
-    u64 gc_size = 0, free_space = 0;
+    u64 gc_size = 0, free_space = 0, resume_offset = 0;
 
     u32 key_area_crc = 0;
     GameCardKeyArea gc_key_area = {0};
@@ -2190,6 +2533,16 @@ static bool saveGameCardImage(void *userdata)
 
     XciThreadData xci_thread_data = {0};
     SharedThreadData *shared_thread_data = &(xci_thread_data.shared_thread_data);
+    HfsVerificationData hfs_verification_data = {0};
+
+    DigestEngine digest_engine = {0};
+    DigestResult digest_result = {0};
+    char digest_str[(SHA256_HASH_SIZE * 2) + 1] = {0};
+
+    DumpCheckpointContext checkpoint = {0};
+    DumpCheckpointHeader checkpoint_header = {0};
+    DigestEngineState digest_state = {0};
+    u8 source_hash[SHA256_HASH_SIZE] = {0};
 
     char *filename = NULL;
     u32 dev_idx = g_storageMenuElementOption.selected;
@@ -2198,20 +2551,25 @@ static bool saveGameCardImage(void *userdata)
     bool keep_certificate = (bool)getGameCardKeepCertificateOption();
     bool trim_dump = (bool)getGameCardTrimDumpOption();
     bool calculate_checksum = (bool)getGameCardCalculateChecksumOption();
+    bool verify_hfs_entries = (bool)getGameCardVerifyHfsEntriesOption();
 
     bool success = false;
 
-    consolePrint("gamecard image dump\nprepend key area: %s | keep certificate: %s | trim dump: %s | calculate checksum: %s\n\n", prepend_key_area ? "yes" : "no", keep_certificate ? "yes" : "no", trim_dump ? "yes" : "no", calculate_checksum ? "yes" : "no");
+    consolePrint("gamecard image dump\nprepend key area: %s | keep certificate: %s | trim dump: %s | calculate checksum: %s | verify hfs entries: %s\n\n", prepend_key_area ? "yes" : "no", \
+                 keep_certificate ? "yes" : "no", trim_dump ? "yes" : "no", calculate_checksum ? "yes" : "no", verify_hfs_entries ? "yes" : "no");
 
-    if ((!trim_dump && !gamecardGetTotalSize(&gc_size)) || (trim_dump && !gamecardGetTrimmedSize(&gc_size)) || !gc_size)
+    if ((!trim_dump && !gamecardGetTotalSize(&gc_size)) || !gamecardGetTrimmedSize(&(xci_thread_data.card_data_size)) || !xci_thread_data.card_data_size)
     {
         consolePrint("failed to get gamecard size!\n");
         goto end;
     }
 
+    if (trim_dump) gc_size = xci_thread_data.card_data_size;
+
     shared_thread_data->total_size = gc_size;
 
     consolePrint("gamecard size: 0x%lX\n", gc_size);
+    if (!trim_dump) consolePrint("padding size: 0x%lX\n", gc_size - xci_thread_data.card_data_size);
 
     if (prepend_key_area)
     {
@@ -2221,33 +2579,100 @@ static bool saveGameCardImage(void *userdata)
 
         memcpy(&(gc_key_area.initial_data), &(gc_security_information.initial_data), sizeof(GameCardInitialData));
 
-        if (calculate_checksum)
+        if (calculate_checksum) key_area_crc = crc32Calculate(&gc_key_area, sizeof(GameCardKeyArea));
+
+        consolePrint("gamecard size (with key area): 0x%lX\n", gc_size);
+    }
+
+    if (verify_hfs_entries)
+    {
+        if (!hfsVerificationInitialize(&hfs_verification_data, HashFileSystemPartitionType_None)) goto end;
+        xci_thread_data.hfs_verification_data = &hfs_verification_data;
+    }
+
+    if (calculate_checksum)
+    {
+        /* Calculate all digests needed to verify the dump against no-intro / nswdb with a single read. */
+        if (!digestEngineInitialize(&digest_engine, DigestTypeMask_All, NULL))
         {
-            key_area_crc = crc32Calculate(&gc_key_area, sizeof(GameCardKeyArea));
-            xci_thread_data.full_xci_crc = key_area_crc;
+            consolePrint("failed to initialize digest engine!\n");
+            goto end;
         }
 
-        consolePrint("gamecard size (with key area): 0x%lX\n", gc_size);
+        xci_thread_data.digest_engine = &digest_engine;
     }
 
     snprintf(path, MAX_ELEMENTS(path), " [%s][%s][%s].xci", prepend_key_area ? "KA" : "NKA", keep_certificate ? "C" : "NC", trim_dump ? "T" : "NT");
     filename = generateOutputGameCardFileName("Gamecard", path, true);
     if (!filename) goto end;
 
-    if (dev_idx == 1)
+    /* Only dumps written to the SD card are checkpointed. */
+    if (dev_idx == 0)
     {
-        if (!usbSendFileProperties(gc_size, filename))
+        if (!xciCalculateCheckpointSourceHash(source_hash, gc_size) || \
+            !dumpCheckpointInitialize(&checkpoint, filename, DumpCheckpointType_Xci, source_hash, gc_size, prepend_key_area ? sizeof(GameCardKeyArea) : 0))
         {
-            consolePrint("failed to send file properties for \"%s\"!\n", filename);
+            consolePrint("failed to initialize xci checkpoint!\n");
             goto end;
         }
 
-        if (prepend_key_area && !usbSendFileData(&gc_key_area, sizeof(GameCardKeyArea)))
+        xci_thread_data.checkpoint = &checkpoint;
+
+        /* Pick up where we left off if a previous dump was interrupted. The output file is opened by this call. */
+        if (dumpCheckpointLoad(&checkpoint, filename, &digest_state, sizeof(DigestEngineState), &checkpoint_header, &(shared_thread_data->sd_writer)))
+        {
+            shared_thread_data->resume_offset = shared_thread_data->data_written = checkpoint_header.stream_offset;
+
+            /* Running digests are part of the checkpoint, but Hash FS entry verification needs the full image. */
+            if (calculate_checksum && !digestEngineImportState(&digest_engine, &digest_state))
+            {
+                consolePrint("failed to restore digest engine state!\n");
+                goto end;
+            }
+
+            if (verify_hfs_entries)
+            {
+                consolePrint("hfs entry verification skipped for resumed dump\n");
+
+                hfsVerificationFree(&hfs_verification_data);
+                xci_thread_data.hfs_verification_data = NULL;
+
+                verify_hfs_entries = false;
+            }
+        }
+    }
+
+    if (dev_idx == 1)
+    {
+        if (!sendResumableFileProperties(gc_size, filename, readGameCardImageTail, &xci_thread_data, &resume_offset)) goto end;
+
+        if (resume_offset)
+        {
+            /* The key area is never part of the resumed data. Both checksums and Hash FS entry verification need the full image, so they're skipped. */
+            shared_thread_data->resume_offset = shared_thread_data->data_written = (prepend_key_area ? (resume_offset - sizeof(GameCardKeyArea)) : resume_offset);
+
+            if (calculate_checksum || verify_hfs_entries)
+            {
+                consolePrint("checksum calculation and hfs entry verification skipped for resumed dump\n");
+
+                hfsVerificationFree(&hfs_verification_data);
+                xci_thread_data.hfs_verification_data = NULL;
+
+                digestEngineFree(&digest_engine);
+                xci_thread_data.digest_engine = NULL;
+
+                calculate_checksum = verify_hfs_entries = false;
+            }
+        }
+
+        if (prepend_key_area && !resume_offset && !usbSendFileData(&gc_key_area, sizeof(GameCardKeyArea)))
         {
             consolePrint("failed to send gamecard key area data!\n");
             goto end;
         }
-    } else {
+    } else
+    if (!sdWriterIsOpen(&(shared_thread_data->sd_writer)))
+    {
         if (!utilsGetFileSystemStatsByPath(filename, NULL, &free_space))
         {
             consolePrint("failed to retrieve free space from selected device\n");
@@ -2264,9 +2689,10 @@ static bool saveGameCardImage(void *userdata)
 
         if (dev_idx == 0)
         {
-            if (gc_size > FAT32_FILESIZE_LIMIT && !utilsCreateConcatenationFile(filename))
+            /* Preallocate the whole output file and write to it straight through the FS sysmodule. ConcatenationFiles are created as needed. */
+            if (!sdWriterCreate(&(shared_thread_data->sd_writer), filename, gc_size, SD_WRITE_FLUSH_INTERVAL))
             {
-                consolePrint("failed to create concatenation file for \"%s\"!\n", filename);
+                consolePrint("failed to create \"%s\"!\n", filename);
                 goto end;
             }
         } else {
@@ -2275,18 +2701,18 @@ static bool saveGameCardImage(void *userdata)
                 consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
                 goto end;
             }
-        }
 
-        shared_thread_data->fp = fopen(filename, "wb");
-        if (!shared_thread_data->fp)
-        {
-            consolePrint("failed to open \"%s\" for writing!\n", filename);
-            goto end;
-        }
+            shared_thread_data->fp = fopen(filename, "wb");
+            if (!shared_thread_data->fp)
+            {
+                consolePrint("failed to open \"%s\" for writing!\n", filename);
+                goto end;
+            }
 
-        ftruncate(fileno(shared_thread_data->fp), (off_t)shared_thread_data->total_size);
+            ftruncate(fileno(shared_thread_data->fp), (off_t)shared_thread_data->total_size);
+        }
 
-        if (prepend_key_area && fwrite(&gc_key_area, 1, sizeof(GameCardKeyArea), shared_thread_data->fp) != sizeof(GameCardKeyArea))
+        if (prepend_key_area && !writeOutputFileData(shared_thread_data->fp, &(shared_thread_data->sd_writer), &gc_key_area, sizeof(GameCardKeyArea)))
         {
             consolePrint("failed to write gamecard key area data!\n");
             goto end;
@@ -2295,30 +2721,61 @@ static bool saveGameCardImage(void *userdata)
 
     consoleRefresh();
 
-    success = spanDumpThreads(xciReadThreadFunc, genericWriteThreadFunc, &xci_thread_data);
+    HfsVerificationStageData hfs_stage_data = { xci_thread_data.hfs_verification_data, 0 };
+    DumpPipelineStage stages[4] = {0};
+    u32 stage_count = 0;
+
+    stages[stage_count++] = (DumpPipelineStage){ .type = DumpPipelineStageType_Read, .name = "gamecard read", .func = xciReadStageFunc, .userdata = &xci_thread_data, .cpu_id = 1 };
+
+    if (verify_hfs_entries) stages[stage_count++] = (DumpPipelineStage){ .type = DumpPipelineStageType_Hash, .name = "hfs verify", .func = hfsVerificationStageFunc, .userdata = &hfs_stage_data, .cpu_id = 0 };
+
+    if (!keep_certificate && !shared_thread_data->resume_offset) stages[stage_count++] = (DumpPipelineStage){ .type = DumpPipelineStageType_Process, .name = "remove cert", .func = xciRemoveCertificateStageFunc, \
+                                                                                                              .userdata = NULL, .cpu_id = 0 };
+
+    /* Digests are updated by the write stage, since checkpoints need them to match the data written so far. */
+    stages[stage_count++] = (DumpPipelineStage){ .type = DumpPipelineStageType_Write, .name = "write", .func = xciWriteStageFunc, .userdata = &xci_thread_data, .cpu_id = 2 };
+
+    /* Nothing left to dump if the USB host already holds the whole file. */
+    success = (shared_thread_data->data_written >= shared_thread_data->total_size || spanDumpPipeline(stages, stage_count, shared_thread_data));
 
     if (success)
     {
         consolePrint("successfully saved xci as \"%s\"\n", filename);
 
-        if (calculate_checksum)
+        if (calculate_checksum && digestEngineFinalize(&digest_engine, &digest_result))
         {
             if (prepend_key_area) consolePrint("key area crc: %08X | ", key_area_crc);
-            consolePrint("xci crc: %08X", xci_thread_data.xci_crc);
-            if (prepend_key_area) consolePrint(" | xci crc (with key area): %08X", xci_thread_data.full_xci_crc);
+            consolePrint("xci crc: %08X", digest_result.crc32);
+            if (prepend_key_area) consolePrint(" | xci crc (with key area): %08X", utilsCrc32Combine(key_area_crc, digest_result.crc32, shared_thread_data->total_size));
             consolePrint("\n");
+
+            for(u8 i = DigestType_Md5; i < DigestType_Count; i++)
+            {
+                digestGenerateString(&digest_result, i, digest_str, sizeof(digest_str));
+                consolePrint("xci %s: %s\n", digestGetTypeName(i), digest_str);
+            }
+
+            /* The digests we just calculated are all we need to verify the dump, so the output file is never read back. */
+            if (configGetInteger("gamecard/checksum_lookup_method") != ConfigChecksumLookupMethod_None) printDatLookupResult("xci", shared_thread_data->total_size, &digest_result, DigestTypeMask_All);
         }
 
+        if (verify_hfs_entries) hfsVerificationPrintResults(&hfs_verification_data);
+
         consoleRefresh();
     }
 
 end:
-    if (shared_thread_data->fp)
+    /* Partial dumps are kept around if they can be resumed later, unless the user cancelled them. */
+    bool keep_partial_dump = (!success && checkpoint.available && !shared_thread_data->transfer_cancelled);
+
+    if (shared_thread_data->fp || sdWriterIsOpen(&(shared_thread_data->sd_writer)))
     {
-        fclose(shared_thread_data->fp);
+        if (shared_thread_data->fp) fclose(shared_thread_data->fp);
         shared_thread_data->fp = NULL;
 
-        if (!success && dev_idx != 1)
+        sdWriterClose(&(shared_thread_data->sd_writer));
+
+        if (!success && dev_idx != 1 && !keep_partial_dump)
         {
             if (dev_idx == 0)
             {
@@ -2330,8 +2787,21 @@ end:
         }
     }
 
+    if (keep_partial_dump)
+    {
+        consolePrint("partial dump kept, it will be resumed the next time it's started\n");
+    } else {
+        dumpCheckpointDiscard(&checkpoint);
+    }
+
+    dumpCheckpointFree(&checkpoint);
+
     if (filename) free(filename);
 
+    hfsVerificationFree(&hfs_verification_data);
+
+    digestEngineFree(&digest_engine);
+
     return success;
 }
 
@@ -2529,7 +2999,9 @@ static bool saveGameCardHfsPartition(void *userdata)
 {
     u32 hfs_partition_type = (userdata ? *((u32*)userdata) : HashFileSystemPartitionType_None);
     bool write_raw_hfs_partition = (bool)getGameCardWriteRawHfsPartitionOption();
+    bool verify_hfs_entries = (bool)getGameCardVerifyHfsEntriesOption();
     HashFileSystemContext hfs_ctx = {0};
+    HfsVerificationData hfs_verification_data = {0};
 
     bool success = false;
 
@@ -2545,27 +3017,36 @@ static bool saveGameCardHfsPartition(void *userdata)
         goto end;
     }
 
-    success = (write_raw_hfs_partition ? saveGameCardRawHfsPartition(&hfs_ctx) : saveGameCardExtractedHfsPartition(&hfs_ctx));
+    if (verify_hfs_entries && !hfsVerificationInitialize(&hfs_verification_data, (u8)hfs_partition_type)) goto end;
+
+    success = (write_raw_hfs_partition ? saveGameCardRawHfsPartition(&hfs_ctx, verify_hfs_entries ? &hfs_verification_data : NULL) : \
+                                         saveGameCardExtractedHfsPartition(&hfs_ctx, verify_hfs_entries ? &hfs_verification_data : NULL));
+
+    if (success && verify_hfs_entries)
+    {
+        hfsVerificationPrintResults(&hfs_verification_data);
+        consoleRefresh();
+    }
 
 end:
+    hfsVerificationFree(&hfs_verification_data);
+
     hfsFreeContext(&hfs_ctx);
 
     return success;
 }
 
-static bool saveGameCardRawHfsPartition(HashFileSystemContext *hfs_ctx)
+static bool saveGameCardRawHfsPartition(HashFileSystemContext *hfs_ctx, HfsVerificationData *hfs_verification_data)
 {
     u64 free_space = 0;
 
-    HfsThreadData hfs_thread_data = {0};
-    SharedThreadData *shared_thread_data = &(hfs_thread_data.shared_thread_data);
+    SharedThreadData shared_thread_data_obj = {0}, *shared_thread_data = &shared_thread_data_obj;
 
     char *filename = NULL;
     u32 dev_idx = g_storageMenuElementOption.selected;
 
     bool success = false;
 
-    hfs_thread_data.hfs_ctx = hfs_ctx;
     shared_thread_data->total_size = hfs_ctx->size;
 
     consolePrint("raw %s hfs partition size: 0x%lX\n", hfs_ctx->name, hfs_ctx->size);
@@ -2598,9 +3079,11 @@ static bool saveGameCardRawHfsPartition(HashFileSystemContext *hfs_ctx)
 
         if (dev_idx == 0)
         {
-            if (shared_thread_data->total_size > FAT32_FILESIZE_LIMIT && !utilsCreateConcatenationFile(filename))
+            /* Preallocate the whole output file and write to it straight through the FS sysmodule. ConcatenationFiles are created as needed. */
+            /* A single lane is used: gamecard reads are serialized by the gamecard interface, so multiple lanes would only interleave reads and seek around the SD card. */
+            if (!sdWriterCreate(&(shared_thread_data->sd_writer), filename, shared_thread_data->total_size, SD_WRITE_FLUSH_INTERVAL))
             {
-                consolePrint("failed to create concatenation file for \"%s\"!\n", filename);
+                consolePrint("failed to create \"%s\"!\n", filename);
                 goto end;
             }
         } else {
@@ -2609,21 +3092,32 @@ static bool saveGameCardRawHfsPartition(HashFileSystemContext *hfs_ctx)
                 consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
                 goto end;
             }
-        }
 
-        shared_thread_data->fp = fopen(filename, "wb");
-        if (!shared_thread_data->fp)
-        {
-            consolePrint("failed to open \"%s\" for writing!\n", filename);
-            goto end;
-        }
+            shared_thread_data->fp = fopen(filename, "wb");
+            if (!shared_thread_data->fp)
+            {
+                consolePrint("failed to open \"%s\" for writing!\n", filename);
+                goto end;
+            }
 
-        ftruncate(fileno(shared_thread_data->fp), (off_t)shared_thread_data->total_size);
+            ftruncate(fileno(shared_thread_data->fp), (off_t)shared_thread_data->total_size);
+        }
     }
 
     consoleRefresh();
 
-    success = spanDumpThreads(rawHfsReadThreadFunc, genericWriteThreadFunc, &hfs_thread_data);
+    HfsVerificationStageData hfs_stage_data = { hfs_verification_data, hfs_ctx->offset };
+
+    DumpPipelineStage stages[] = {
+        { .type = DumpPipelineStageType_Read,  .name = "hfs read",   .func = rawHfsReadStageFunc,      .userdata = hfs_ctx,            .cpu_id = 1 },
+        { .type = DumpPipelineStageType_Hash,  .name = "hfs verify", .func = hfsVerificationStageFunc, .userdata = &hfs_stage_data,    .cpu_id = 0 },
+        { .type = DumpPipelineStageType_Write, .name = "write",      .func = genericWriteStageFunc,    .userdata = shared_thread_data, .cpu_id = 2 }
+    };
+
+    /* Skip the verification stage if we're not verifying Hash FS entries. */
+    if (!hfs_verification_data) stages[1] = stages[2];
+
+    success = spanDumpPipeline(stages, MAX_ELEMENTS(stages) - (hfs_verification_data ? 0 : 1), shared_thread_data);
 
     if (success)
     {
@@ -2632,11 +3126,13 @@ static bool saveGameCardRawHfsPartition(HashFileSystemContext *hfs_ctx)
     }
 
 end:
-    if (shared_thread_data->fp)
+    if (shared_thread_data->fp || sdWriterIsOpen(&(shared_thread_data->sd_writer)))
     {
-        fclose(shared_thread_data->fp);
+        if (shared_thread_data->fp) fclose(shared_thread_data->fp);
         shared_thread_data->fp = NULL;
 
+        sdWriterClose(&(shared_thread_data->sd_writer));
+
         if (!success && dev_idx != 1)
         {
             if (dev_idx == 0)
@@ -2654,37 +3150,20 @@ end:
     return success;
 }
 
-static bool saveGameCardExtractedHfsPartition(HashFileSystemContext *hfs_ctx)
+static bool saveGameCardExtractedHfsPartition(HashFileSystemContext *hfs_ctx, HfsVerificationData *hfs_verification_data)
 {
-    u64 data_size = 0;
-
-    HfsThreadData hfs_thread_data = {0};
-    SharedThreadData *shared_thread_data = &(hfs_thread_data.shared_thread_data);
-
-    bool success = false;
-
-    if (!hfsGetTotalDataSize(hfs_ctx, &data_size))
-    {
-        consolePrint("failed to calculate extracted %s hfs partition size!\n", hfs_ctx->name);
-        goto end;
-    }
-
-    if (!data_size)
-    {
-        consolePrint("%s hfs partition is empty!\n", hfs_ctx->name);
-        goto end;
-    }
-
-    hfs_thread_data.hfs_ctx = hfs_ctx;
-    shared_thread_data->total_size = data_size;
+    ExtractedFsThreadData extracted_fs_thread_data = {0};
+    char hfs_path[FS_MAX_PATH] = {0}, fs_name[0x40] = {0};
 
-    consolePrint("extracted %s hfs partition size: 0x%lX\n", hfs_ctx->name, data_size);
-    consoleRefresh();
+    snprintf(hfs_path, MAX_ELEMENTS(hfs_path), "/%s", hfs_ctx->name);
+    snprintf(fs_name, MAX_ELEMENTS(fs_name), "%s hfs partition", hfs_ctx->name);
 
-    success = spanDumpThreads(extractedHfsReadThreadFunc, genericWriteThreadFunc, &hfs_thread_data);
+    extracted_fs_thread_data.fs_type = ExtractedFsType_Hfs;
+    extracted_fs_thread_data.fs_ctx = hfs_ctx;
+    extracted_fs_thread_data.hfs_verification_data = hfs_verification_data;
+    extracted_fs_thread_data.filename = generateOutputGameCardFileName("HFS/Extracted", hfs_path, true);
 
-end:
-    return success;
+    return saveExtractedFileSystemData(&extracted_fs_thread_data, fs_name);
 }
 
 static bool saveConsoleLafwBlob(void *userdata)
@@ -2729,68 +3208,156 @@ end:
     return success;
 }
 
-static bool saveNintendoSubmissionPackage(void *userdata)
+static bool benchmarkDigestEngine(void *userdata)
 {
-    if (!userdata) return false;
+    (void)userdata;
 
-    TitleInfo *title_info = (TitleInfo*)userdata;
-    TitleApplicationMetadata *app_metadata = title_info->app_metadata;
+    const char *pass_names[] = { "plain read", "read + digests", "digests only (memory)" };
+    u64 pass_times[MAX_ELEMENTS(pass_names)] = {0};
 
-    NspThreadData nsp_thread_data = {0};
-    Thread dump_thread = {0};
+    u64 card_data_size = 0, bench_size = 0, blksize = 0, start_tick = 0;
+    u8 *buf = NULL;
 
-    time_t start = 0, btn_cancel_start_tmr = 0, btn_cancel_end_tmr = 0;
-    bool btn_cancel_cur_state = false, btn_cancel_prev_state = false, success = false;
+    DigestEngine digest_engine = {0};
+    DigestResult digest_result = {0};
 
-    u64 prev_size = 0;
-    u8 prev_time = 0, percent = 0;
+    bool success = false;
 
-    consolePrint("%s info:\n\n", title_info->meta_key.type == NcmContentMetaType_Application ? "base application" : \
-                                (title_info->meta_key.type == NcmContentMetaType_Patch ? "update" : \
-                                (title_info->meta_key.type == NcmContentMetaType_AddOnContent ? "dlc" : "dlc update")));
+    consolePrint("digest engine benchmark\n\n");
 
-    if (app_metadata)
+    if (!gamecardGetTrimmedSize(&card_data_size) || !card_data_size)
     {
-        consolePrint("name: %s\n", app_metadata->lang_entry.name);
-        consolePrint("publisher: %s\n", app_metadata->lang_entry.author);
+        consolePrint("failed to get gamecard size!\n");
+        goto end;
     }
 
-    consolePrint("source storage: %s\n", titleGetNcmStorageIdName(title_info->storage_id));
-    consolePrint("title id: %016lX\n", title_info->meta_key.id);
-    consolePrint("version: %u (%u.%u.%u-%u.%u)\n", title_info->version.value, title_info->version.system_version.major, title_info->version.system_version.minor, \
-                                                   title_info->version.system_version.micro, title_info->version.system_version.major_relstep, \
-                                                   title_info->version.system_version.minor_relstep);
-    consolePrint("content count: %u\n", title_info->content_count);
-    consolePrint("size: %s\n", title_info->size_str);
-    consolePrint("______________________________\n\n");
-
-    consoleRefresh();
-
-    /* Create dump thread. */
-    nsp_thread_data.data = title_info;
-    utilsCreateThread(&dump_thread, nspThreadFunc, &nsp_thread_data, 2);
+    bench_size = MIN(card_data_size, DIGEST_BENCHMARK_SIZE);
 
-    /* Wait until the background thread calculates the NSP size. */
-    while(!nsp_thread_data.total_size && !nsp_thread_data.error) utilsAppletLoopDelay();
+    /* Two buffers are used, so the next block can be read while the previous one is being hashed. */
+    if (!(buf = usbAllocatePageAlignedBuffer(BLOCK_SIZE * 2)))
+    {
+        consolePrint("buf alloc failed\n");
+        goto end;
+    }
 
-    if (nsp_thread_data.error)
+    if (!digestEngineInitialize(&digest_engine, DigestTypeMask_All, NULL))
     {
-        utilsJoinThread(&dump_thread);
-        return false;
+        consolePrint("failed to initialize digest engine!\n");
+        goto end;
     }
 
-    /* Start dump. */
-    start = time(NULL);
+    consolePrint("benchmark size: 0x%lX bytes\n\n", bench_size);
+    consoleRefresh();
 
-    while(nsp_thread_data.data_written < nsp_thread_data.total_size)
+    for(u32 pass = 0; pass < MAX_ELEMENTS(pass_names); pass++)
     {
-        g_appletStatus = appletMainLoop();
-        if (!g_appletStatus)
+        start_tick = armGetSystemTick();
+
+        for(u64 offset = 0, i = 0; offset < bench_size; offset += blksize, i++)
         {
-            mutexLock(&g_fileMutex);
-            nsp_thread_data.transfer_cancelled = true;
-            mutexUnlock(&g_fileMutex);
-        }
+            u8 *cur_buf = (buf + ((i % 2) * BLOCK_SIZE));
+            blksize = MIN(BLOCK_SIZE, bench_size - offset);
+
+            /* The last pass hashes whatever data is already available in memory. */
+            if (pass < 2 && !gamecardReadStorage(cur_buf, blksize, offset))
+            {
+                consolePrint("failed to read gamecard data at offset 0x%lX!\n", offset);
+                goto end;
+            }
+
+            if (pass > 0) digestEngineUpdate(&digest_engine, cur_buf, blksize);
+        }
+
+        if (pass > 0) digestEngineFinalize(&digest_engine, &digest_result);
+
+        pass_times[pass] = armTicksToNs(armGetSystemTick() - start_tick);
+
+        consolePrint("%s: %lu ms (%.2f MiB/s)\n", pass_names[pass], pass_times[pass] / 1000000, ((double)bench_size / 1048576.0) / ((double)pass_times[pass] / 1000000000.0));
+        consoleRefresh();
+    }
+
+    consolePrint("\nread + digests throughput: %.2f%% of plain read throughput\n\n", ((double)pass_times[0] * 100.0) / (double)pass_times[1]);
+
+    for(u8 i = 0; i < DigestType_Count; i++) consolePrint("%s hasher busy time: %lu ms\n", digestGetTypeName(i), digest_engine.hashers[i].busy_time / 1000000);
+
+    success = true;
+
+end:
+    digestEngineFree(&digest_engine);
+
+    if (buf) free(buf);
+
+    return success;
+}
+
+static bool saveNintendoSubmissionPackage(void *userdata)
+{
+    if (!userdata) return false;
+    return dumpNintendoSubmissionPackage((TitleInfo*)userdata, NULL, NULL);
+}
+
+static bool dumpNintendoSubmissionPackage(TitleInfo *title_info, NspDumpContext *dump_ctx, bool *out_cancelled)
+{
+    if (!title_info) return false;
+
+    TitleApplicationMetadata *app_metadata = title_info->app_metadata;
+
+    NspThreadData nsp_thread_data = {0};
+    Thread dump_thread = {0};
+
+    time_t start = 0, btn_cancel_start_tmr = 0, btn_cancel_end_tmr = 0;
+    bool btn_cancel_cur_state = false, btn_cancel_prev_state = false, success = false;
+
+    u64 prev_size = 0;
+    u8 prev_time = 0, percent = 0;
+
+    consolePrint("%s info:\n\n", title_info->meta_key.type == NcmContentMetaType_Application ? "base application" : \
+                                (title_info->meta_key.type == NcmContentMetaType_Patch ? "update" : \
+                                (title_info->meta_key.type == NcmContentMetaType_AddOnContent ? "dlc" : "dlc update")));
+
+    if (app_metadata)
+    {
+        consolePrint("name: %s\n", app_metadata->lang_entry.name);
+        consolePrint("publisher: %s\n", app_metadata->lang_entry.author);
+    }
+
+    consolePrint("source storage: %s\n", titleGetNcmStorageIdName(title_info->storage_id));
+    consolePrint("title id: %016lX\n", title_info->meta_key.id);
+    consolePrint("version: %u (%u.%u.%u-%u.%u)\n", title_info->version.value, title_info->version.system_version.major, title_info->version.system_version.minor, \
+                                                   title_info->version.system_version.micro, title_info->version.system_version.major_relstep, \
+                                                   title_info->version.system_version.minor_relstep);
+    consolePrint("content count: %u\n", title_info->content_count);
+    consolePrint("size: %s\n", title_info->size_str);
+    consolePrint("______________________________\n\n");
+
+    consoleRefresh();
+
+    /* Create dump thread. */
+    nsp_thread_data.data = title_info;
+    nsp_thread_data.dump_ctx = dump_ctx;
+    utilsCreateThread(&dump_thread, nspThreadFunc, &nsp_thread_data, 2);
+
+    /* Wait until the background thread calculates the NSP size. */
+    while(!nsp_thread_data.total_size && !nsp_thread_data.error) utilsAppletLoopDelay();
+
+    if (nsp_thread_data.error)
+    {
+        utilsJoinThread(&dump_thread);
+        return false;
+    }
+
+    /* Start dump. */
+    start = time(NULL);
+
+    while(nsp_thread_data.data_written < nsp_thread_data.total_size)
+    {
+        g_appletStatus = appletMainLoop();
+        if (!g_appletStatus)
+        {
+            mutexLock(&g_fileMutex);
+            nsp_thread_data.transfer_cancelled = true;
+            mutexUnlock(&g_fileMutex);
+        }
 
         if (nsp_thread_data.error || nsp_thread_data.transfer_cancelled) break;
 
@@ -2857,1869 +3424,3076 @@ static bool saveNintendoSubmissionPackage(void *userdata)
 
     consoleRefresh();
 
+    if (out_cancelled) *out_cancelled = nsp_thread_data.transfer_cancelled;
+
     return success;
 }
 
-static bool saveTicket(void *userdata)
+static bool saveNintendoSubmissionPackageBatch(void *userdata)
 {
-    TitleInfo *title_info = (TitleInfo*)userdata;
-
-    u8 content_type = 0;
-    NcmContentInfo *content_info = NULL;
-    NcaContext *nca_ctx = NULL;
+    (void)userdata;
 
-    Ticket tik = {0};
+    NspBatchJob *job = NULL;
+    NspBatchEntry *entries = NULL, *tmp_entries = NULL;
+    u32 entry_count = 0, app_count = 0;
 
-    u32 crc = 0;
-    char *filename = NULL;
+    TitleApplicationMetadata **app_metadata = NULL;
+    TitleUserApplicationData user_app_data = {0};
 
-    bool remove_console_data = (bool)getTicketRemoveConsoleDataOption();
     bool success = false;
 
-    if (!title_info || title_info->meta_key.type < NcmContentMetaType_Application || title_info->meta_key.type == NcmContentMetaType_Delta || \
-        title_info->meta_key.type > NcmContentMetaType_DataPatch)
-    {
-        consolePrint("invalid title info object\n");
-        return false;
-    }
-
-    /* Get a NcmContentInfo entry for a potential NCA with a rights ID. */
-    content_type = ((title_info->meta_key.type == NcmContentMetaType_Application || title_info->meta_key.type == NcmContentMetaType_Patch) ? NcmContentType_Program : NcmContentType_Data);
-    content_info = titleGetContentInfoByTypeAndIdOffset(title_info, content_type, 0);
-    if (!content_info)
-    {
-        consolePrint("content info entry with type 0x%X unavailable\n", content_type);
-        return false;
-    }
-
-    /* Allocate buffer for NCA context. */
-    if (!(nca_ctx = calloc(1, sizeof(NcaContext))))
+    if (!(job = calloc(1, sizeof(NspBatchJob))))
     {
-        consolePrint("nca ctx calloc failed\n");
+        consolePrint("batch job alloc failed\n");
         goto end;
     }
 
-    /* Initialize NCA context. */
-    if (!ncaInitializeContext(nca_ctx, title_info->storage_id, (title_info->storage_id == NcmStorageId_GameCard ? HashFileSystemPartitionType_Secure : 0), \
-                              &(title_info->meta_key), content_info, &tik))
+    /* Resume an interrupted batch, if there's one. */
+    if (nspBatchLoadJob(job))
     {
-        consolePrint("nca initialize ctx failed\n");
+        consolePrint("resuming interrupted batch (%u entries)\n", job->entry_count);
+        consoleRefresh();
+        success = nspBatchRunJob(job);
         goto end;
     }
 
-    /* Check if a ticket was retrieved. */
-    if (!nca_ctx->rights_id_available)
+    /* Queue every user title available in the system. */
+    app_metadata = titleGetApplicationMetadataEntries(false, &app_count);
+    if (!app_metadata || !app_count)
     {
-        consolePrint("rights id unavailable in target title -- this title doesn't use titlekey crypto\nthere's no ticket to be retrieved\n");
+        consolePrint("no user titles available\n");
         goto end;
     }
 
-    if (!nca_ctx->titlekey_retrieved)
+    for(u32 i = 0; i < app_count; i++)
     {
-        consolePrint("failed to retrieve ticket (unavailable?)\ntry launching nxdumptool while overriding the title you wish to dump a ticket from\n");
-        goto end;
-    }
+        if (!titleGetUserApplicationData(app_metadata[i]->title_id, &user_app_data)) continue;
 
-    /* Remove console-specific data, if needed. */
-    if (remove_console_data && tikIsPersonalizedTicket(&tik) && !tikConvertPersonalizedTicketToCommonTicket(&tik, NULL, NULL))
-    {
-        consolePrint("failed to convert personalized ticket to common ticket\n");
-        goto end;
-    }
+        TitleInfo *title_infos[] = { user_app_data.app_info, user_app_data.patch_info, user_app_data.aoc_info, user_app_data.aoc_patch_info };
 
-    /* Save ticket. */
-    crc = crc32Calculate(tik.data, tik.size);
-    snprintf(path, MAX_ELEMENTS(path), " (%08X).tik", crc);
+        for(u32 j = 0; j < MAX_ELEMENTS(title_infos); j++)
+        {
+            for(TitleInfo *cur_title_info = title_infos[j]; cur_title_info; cur_title_info = cur_title_info->next)
+            {
+                // skip titles that are available in more than one storage
+                bool dup = false;
 
-    filename = generateOutputTitleFileName(title_info, "Ticket", path);
-    if (!filename) goto end;
+                for(u32 k = 0; k < entry_count; k++)
+                {
+                    if (entries[k].title_id == cur_title_info->meta_key.id && entries[k].version == cur_title_info->version.value)
+                    {
+                        dup = true;
+                        break;
+                    }
+                }
 
-    if (!saveFileData(filename, tik.data, tik.size)) goto end;
+                if (dup) continue;
 
-    consolePrint("rights id: %s\n", tik.rights_id_str);
-    consolePrint("encrypted titlekey: %s\n", tik.enc_titlekey_str);
-    consolePrint("decrypted titlekey: %s\n\n", tik.dec_titlekey_str);
+                if (!(tmp_entries = realloc(entries, (entry_count + 1) * sizeof(NspBatchEntry))))
+                {
+                    consolePrint("batch entries realloc failed\n");
+                    goto end;
+                }
 
-    consolePrint("successfully saved ticket as \"%s\"\n", filename);
-    success = true;
+                entries = tmp_entries;
+                tmp_entries = NULL;
 
-end:
-    if (filename) free(filename);
+                NspBatchEntry *entry = &(entries[entry_count++]);
+                memset(entry, 0, sizeof(NspBatchEntry));
 
-    if (nca_ctx) free(nca_ctx);
+                entry->title_id = cur_title_info->meta_key.id;
+                entry->version = cur_title_info->version.value;
+                entry->meta_type = cur_title_info->meta_key.type;
+                entry->storage_id = cur_title_info->storage_id;
+            }
+        }
 
-    return success;
-}
+        titleFreeUserApplicationData(&user_app_data);
+    }
 
-static bool saveNintendoContentArchive(void *userdata)
-{
-    if (!userdata) return false;
+    if (!nspBatchCreateJob(job, entries, entry_count))
+    {
+        consolePrint("failed to create batch job\n");
+        goto end;
+    }
 
-    NcaUserData *nca_user_data = (NcaUserData*)userdata;
-    TitleInfo *title_info = nca_user_data->title_info;
-    NcmContentInfo *content_info = &(title_info->content_infos[nca_user_data->content_idx]);
+    consolePrint("batch job created (%u entries)\n", job->entry_count);
+    consoleRefresh();
 
-    NcaThreadData nca_thread_data = {0};
-    SharedThreadData *shared_thread_data = &(nca_thread_data.shared_thread_data);
+    success = nspBatchRunJob(job);
 
-    u64 free_space = 0;
-    char *filename = NULL, subdir[0x20] = {0};
-    u32 dev_idx = g_storageMenuElementOption.selected;
+end:
+    titleFreeUserApplicationData(&user_app_data);
 
-    bool success = false;
+    if (entries) free(entries);
 
-    /* Allocate buffer for NCA context. */
-    if (!(nca_thread_data.nca_ctx = calloc(1, sizeof(NcaContext))))
-    {
-        consolePrint("nca ctx calloc failed\n");
-        goto end;
-    }
+    if (app_metadata) free(app_metadata);
 
-    /* Initialize NCA context. */
-    if (!ncaInitializeContext(nca_thread_data.nca_ctx, title_info->storage_id, (title_info->storage_id == NcmStorageId_GameCard ? HashFileSystemPartitionType_Secure : 0), \
-                              &(title_info->meta_key), content_info, NULL))
+    if (job)
     {
-        consolePrint("nca initialize ctx failed\n");
-        goto end;
+        nspBatchFreeJob(job);
+        free(job);
     }
 
-    shared_thread_data->total_size = nca_thread_data.nca_ctx->content_size;
+    return success;
+}
 
-    consolePrint("nca size: 0x%lX\n", shared_thread_data->total_size);
+static bool nspBatchCreateJob(NspBatchJob *job, const NspBatchEntry *entries, u32 entry_count)
+{
+    if (!job || !entries || !entry_count) return false;
 
-    snprintf(path, MAX_ELEMENTS(path), "/%s.%s", nca_thread_data.nca_ctx->content_id_str, content_info->content_type == NcmContentType_Meta ? "cnmt.nca" : "nca");
-    snprintf(subdir, MAX_ELEMENTS(subdir), "NCA/%s", nca_thread_data.nca_ctx->storage_id == NcmStorageId_BuiltInSystem ? "System" : "User");
-    filename = generateOutputTitleFileName(title_info, subdir, path);
-    if (!filename) goto end;
+    nspBatchFreeJob(job);
 
-    if (dev_idx == 1)
+    if (!(job->entries = calloc(entry_count, sizeof(NspBatchEntry))))
     {
-        if (!usbSendFileProperties(shared_thread_data->total_size, filename))
-        {
-            consolePrint("failed to send file properties for \"%s\"!\n", filename);
-            goto end;
-        }
-    } else {
-        if (!utilsGetFileSystemStatsByPath(filename, NULL, &free_space))
-        {
-            consolePrint("failed to retrieve free space from selected device\n");
-            goto end;
-        }
+        consolePrint("batch entries calloc failed\n");
+        return false;
+    }
 
-        if (shared_thread_data->total_size >= free_space)
-        {
-            consolePrint("dump size exceeds free space\n");
-            goto end;
-        }
+    for(u32 i = 0; i < entry_count; i++)
+    {
+        const NspBatchEntry *entry = &(entries[i]);
+        NspBatchEntry *job_entry = &(job->entries[job->entry_count]);
+        TitleInfo *title_info = NULL;
 
-        utilsCreateDirectoryTree(filename, false);
+        memcpy(job_entry, entry, sizeof(NspBatchEntry));
+        job_entry->status = NspBatchEntryStatus_Pending;
 
-        if (dev_idx == 0)
+        // resolve the source storage for titles that don't provide one, since it's used to sort the queue
+        if (entry->storage_id == NcmStorageId_Any)
         {
-            if (shared_thread_data->total_size > FAT32_FILESIZE_LIMIT && !utilsCreateConcatenationFile(filename))
-            {
-                consolePrint("failed to create concatenation file for \"%s\"!\n", filename);
-                goto end;
-            }
-        } else {
-            if (g_umsDevices[dev_idx - 2].fs_type < UsbHsFsDeviceFileSystemType_exFAT && shared_thread_data->total_size > FAT32_FILESIZE_LIMIT)
+            if (!(title_info = titleGetInfoFromStorageByTitleId(NcmStorageId_Any, entry->title_id)) || title_info->meta_key.type != entry->meta_type)
             {
-                consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
-                goto end;
+                consolePrint("title %016lX not found, skipping\n", entry->title_id);
+                titleFreeTitleInfo(&title_info);
+                continue;
             }
-        }
 
-        shared_thread_data->fp = fopen(filename, "wb");
-        if (!shared_thread_data->fp)
-        {
-            consolePrint("failed to open \"%s\" for writing!\n", filename);
-            goto end;
+            job_entry->storage_id = title_info->storage_id;
+            job_entry->version = title_info->version.value;
+
+            titleFreeTitleInfo(&title_info);
         }
 
-        ftruncate(fileno(shared_thread_data->fp), (off_t)shared_thread_data->total_size);
+        job->entry_count++;
     }
 
-    consoleRefresh();
+    if (!job->entry_count) return false;
 
-    success = spanDumpThreads(ncaReadThreadFunc, genericWriteThreadFunc, &nca_thread_data);
+    // group titles by source storage to avoid switching back and forth between them
+    qsort(job->entries, job->entry_count, sizeof(NspBatchEntry), &nspBatchEntrySortFunction);
 
-    if (success)
+    return nspBatchSaveJob(job);
+}
+
+static bool nspBatchLoadJob(NspBatchJob *job)
+{
+    if (!job) return false;
+
+    NspBatchQueueHeader header = {0};
+    FILE *fd = NULL;
+    bool success = false;
+
+    nspBatchFreeJob(job);
+
+    if (!(fd = fopen(NSP_BATCH_QUEUE_PATH, "rb"))) return false;
+
+    if (fread(&header, 1, sizeof(NspBatchQueueHeader), fd) != sizeof(NspBatchQueueHeader) || header.magic != NSP_BATCH_QUEUE_MAGIC || \
+        header.version != NSP_BATCH_QUEUE_VERSION || !header.entry_count)
     {
-        consolePrint("successfully saved nca as \"%s\"\n", filename);
-        consoleRefresh();
+        consolePrint("invalid batch queue file, ignoring it\n");
+        goto end;
     }
 
-end:
-    if (shared_thread_data->fp)
+    if (!(job->entries = calloc(header.entry_count, sizeof(NspBatchEntry))) || \
+        fread(job->entries, sizeof(NspBatchEntry), header.entry_count, fd) != header.entry_count)
     {
-        fclose(shared_thread_data->fp);
+        consolePrint("failed to read batch queue entries\n");
+        goto end;
+    }
+
+    job->entry_count = header.entry_count;
+
+    success = true;
+
+end:
+    fclose(fd);
+
+    if (!success)
+    {
+        nspBatchFreeJob(job);
+        remove(NSP_BATCH_QUEUE_PATH);
+    }
+
+    return success;
+}
+
+static bool nspBatchSaveJob(NspBatchJob *job)
+{
+    if (!job || !job->entries || !job->entry_count) return false;
+
+    NspBatchQueueHeader header = { .magic = NSP_BATCH_QUEUE_MAGIC, .version = NSP_BATCH_QUEUE_VERSION, .entry_count = job->entry_count };
+    FILE *fd = NULL;
+    bool success = false;
+
+    utilsCreateDirectoryTree(NSP_BATCH_QUEUE_PATH, false);
+
+    if (!(fd = fopen(NSP_BATCH_QUEUE_PATH, "wb")))
+    {
+        consolePrint("failed to open batch queue file\n");
+        return false;
+    }
+
+    success = (fwrite(&header, 1, sizeof(NspBatchQueueHeader), fd) == sizeof(NspBatchQueueHeader) && \
+               fwrite(job->entries, sizeof(NspBatchEntry), job->entry_count, fd) == job->entry_count);
+
+    fclose(fd);
+
+    if (!success) consolePrint("failed to write batch queue file\n");
+
+    utilsCommitSdCardFileSystemChanges();
+
+    return success;
+}
+
+static bool nspBatchRunJob(NspBatchJob *job)
+{
+    if (!job || !job->entries || !job->entry_count) return false;
+
+    TitleInfo *title_info = NULL;
+    NspDumpContext *dump_ctx = NULL;
+    u32 done_count = 0, failed_count = 0, pending_count = 0;
+    bool cancelled = false;
+
+    job->prepare_idx = UINT32_MAX;
+
+    for(u32 i = 0; i < job->entry_count; i++)
+    {
+        NspBatchEntry *entry = &(job->entries[i]);
+        if (entry->status != NspBatchEntryStatus_Pending) continue;
+
+        // wait for the prepare thread, if it's running
+        if (job->prepare_thread_started)
+        {
+            utilsJoinThread(&(job->prepare_thread));
+            job->prepare_thread_started = false;
+        }
+
+        // prepare this entry right away if the prepare thread didn't take care of it
+        if (job->prepare_idx != i) nspBatchPrepareEntry(job, i);
+
+        title_info = job->prepare_title_info;
+        dump_ctx = job->prepare_dump_ctx;
+
+        job->prepare_title_info = NULL;
+        job->prepare_dump_ctx = NULL;
+
+        if (dump_ctx)
+        {
+            // prepare the next pending entry while this one is being dumped
+            for(u32 j = (i + 1); j < job->entry_count; j++)
+            {
+                if (job->entries[j].status != NspBatchEntryStatus_Pending) continue;
+
+                job->prepare_idx = j;
+                job->prepare_thread_started = utilsCreateThread(&(job->prepare_thread), nspBatchPrepareThreadFunc, job, 0);
+                if (!job->prepare_thread_started) job->prepare_idx = UINT32_MAX;
+
+                break;
+            }
+
+            consolePrint("\nbatch entry %u / %u\n", i + 1, job->entry_count);
+            consoleRefresh();
+
+            entry->status = (dumpNintendoSubmissionPackage(title_info, dump_ctx, &cancelled) ? NspBatchEntryStatus_Done : NspBatchEntryStatus_Failed);
+
+            // the dump context is always freed by the dump thread
+            free(dump_ctx);
+            dump_ctx = NULL;
+        } else {
+            consolePrint("failed to prepare title %016lX, skipping\n", entry->title_id);
+            entry->status = NspBatchEntryStatus_Failed;
+        }
+
+        titleFreeTitleInfo(&title_info);
+
+        // keep the current entry queued if the process was cancelled
+        if (cancelled || !g_appletStatus)
+        {
+            entry->status = NspBatchEntryStatus_Pending;
+            cancelled = true;
+            break;
+        }
+
+        nspBatchSaveJob(job);
+    }
+
+    // free data prepared in advance if we bailed out early
+    if (job->prepare_thread_started)
+    {
+        utilsJoinThread(&(job->prepare_thread));
+        job->prepare_thread_started = false;
+    }
+
+    titleFreeTitleInfo(&(job->prepare_title_info));
+
+    if (job->prepare_dump_ctx)
+    {
+        nspFreeDumpContext(job->prepare_dump_ctx);
+        free(job->prepare_dump_ctx);
+        job->prepare_dump_ctx = NULL;
+    }
+
+    for(u32 i = 0; i < job->entry_count; i++)
+    {
+        switch(job->entries[i].status)
+        {
+            case NspBatchEntryStatus_Done:
+                done_count++;
+                break;
+            case NspBatchEntryStatus_Failed:
+                failed_count++;
+                break;
+            default:
+                pending_count++;
+                break;
+        }
+    }
+
+    consolePrint("\nbatch summary: %u done, %u failed, %u pending\n", done_count, failed_count, pending_count);
+
+    if (pending_count)
+    {
+        nspBatchSaveJob(job);
+        consolePrint("batch queue saved, it will be resumed the next time a batch dump is started\n");
+    } else {
+        remove(NSP_BATCH_QUEUE_PATH);
+        utilsCommitSdCardFileSystemChanges();
+    }
+
+    consoleRefresh();
+
+    return (!cancelled && !failed_count);
+}
+
+static void nspBatchFreeJob(NspBatchJob *job)
+{
+    if (!job) return;
+
+    if (job->prepare_thread_started) utilsJoinThread(&(job->prepare_thread));
+
+    titleFreeTitleInfo(&(job->prepare_title_info));
+
+    if (job->prepare_dump_ctx)
+    {
+        nspFreeDumpContext(job->prepare_dump_ctx);
+        free(job->prepare_dump_ctx);
+    }
+
+    if (job->entries) free(job->entries);
+
+    nspLookupCacheFree(&(job->lookup_cache));
+
+    memset(job, 0, sizeof(NspBatchJob));
+}
+
+static int nspBatchEntrySortFunction(const void *a, const void *b)
+{
+    const NspBatchEntry *entry_1 = (const NspBatchEntry*)a;
+    const NspBatchEntry *entry_2 = (const NspBatchEntry*)b;
+
+    // gamecard titles go first so the gamecard can be removed as soon as possible, followed by eMMC and SD card titles
+    const u8 storage_order[] = { NcmStorageId_GameCard, NcmStorageId_BuiltInUser, NcmStorageId_SdCard };
+    u32 storage_idx_1 = MAX_ELEMENTS(storage_order), storage_idx_2 = MAX_ELEMENTS(storage_order);
+
+    for(u32 i = 0; i < MAX_ELEMENTS(storage_order); i++)
+    {
+        if (entry_1->storage_id == storage_order[i]) storage_idx_1 = i;
+        if (entry_2->storage_id == storage_order[i]) storage_idx_2 = i;
+    }
+
+    if (storage_idx_1 != storage_idx_2) return (storage_idx_1 < storage_idx_2 ? -1 : 1);
+
+    if (entry_1->title_id != entry_2->title_id) return (entry_1->title_id < entry_2->title_id ? -1 : 1);
+
+    if (entry_1->meta_type != entry_2->meta_type) return (entry_1->meta_type < entry_2->meta_type ? -1 : 1);
+
+    return 0;
+}
+
+static void nspBatchPrepareEntry(NspBatchJob *job, u32 idx)
+{
+    NspBatchEntry *entry = &(job->entries[idx]);
+    TitleInfo *title_info = NULL;
+    NspDumpContext *dump_ctx = NULL;
+
+    job->prepare_idx = idx;
+    job->prepare_title_info = NULL;
+    job->prepare_dump_ctx = NULL;
+
+    if (!(title_info = titleGetInfoFromStorageByTitleId(entry->storage_id, entry->title_id)))
+    {
+        consolePrint("title %016lX not found in %s\n", entry->title_id, titleGetNcmStorageIdName(entry->storage_id));
+        return;
+    }
+
+    if (title_info->meta_key.type != entry->meta_type || title_info->version.value != entry->version)
+    {
+        consolePrint("title %016lX changed since it was queued\n", entry->title_id);
+        goto end;
+    }
+
+    if (!(dump_ctx = calloc(1, sizeof(NspDumpContext))))
+    {
+        consolePrint("nsp dump ctx calloc failed\n");
+        goto end;
+    }
+
+    if (!nspPrepareDumpContext(dump_ctx, title_info, &(job->lookup_cache)))
+    {
+        free(dump_ctx);
+        dump_ctx = NULL;
+    }
+
+end:
+    if (dump_ctx)
+    {
+        job->prepare_title_info = title_info;
+        job->prepare_dump_ctx = dump_ctx;
+    } else {
+        titleFreeTitleInfo(&title_info);
+    }
+}
+
+static void nspBatchPrepareThreadFunc(void *arg)
+{
+    NspBatchJob *job = (NspBatchJob*)arg;
+    if (job) nspBatchPrepareEntry(job, job->prepare_idx);
+    threadExit();
+}
+
+static bool saveTicket(void *userdata)
+{
+    TitleInfo *title_info = (TitleInfo*)userdata;
+
+    u8 content_type = 0;
+    NcmContentInfo *content_info = NULL;
+    NcaContext *nca_ctx = NULL;
+
+    Ticket tik = {0};
+
+    u32 crc = 0;
+    char *filename = NULL;
+
+    bool remove_console_data = (bool)getTicketRemoveConsoleDataOption();
+    bool success = false;
+
+    if (!title_info || title_info->meta_key.type < NcmContentMetaType_Application || title_info->meta_key.type == NcmContentMetaType_Delta || \
+        title_info->meta_key.type > NcmContentMetaType_DataPatch)
+    {
+        consolePrint("invalid title info object\n");
+        return false;
+    }
+
+    /* Get a NcmContentInfo entry for a potential NCA with a rights ID. */
+    content_type = ((title_info->meta_key.type == NcmContentMetaType_Application || title_info->meta_key.type == NcmContentMetaType_Patch) ? NcmContentType_Program : NcmContentType_Data);
+    content_info = titleGetContentInfoByTypeAndIdOffset(title_info, content_type, 0);
+    if (!content_info)
+    {
+        consolePrint("content info entry with type 0x%X unavailable\n", content_type);
+        return false;
+    }
+
+    /* Allocate buffer for NCA context. */
+    if (!(nca_ctx = calloc(1, sizeof(NcaContext))))
+    {
+        consolePrint("nca ctx calloc failed\n");
+        goto end;
+    }
+
+    /* Initialize NCA context. */
+    if (!ncaInitializeContext(nca_ctx, title_info->storage_id, (title_info->storage_id == NcmStorageId_GameCard ? HashFileSystemPartitionType_Secure : 0), \
+                              &(title_info->meta_key), content_info, &tik))
+    {
+        consolePrint("nca initialize ctx failed\n");
+        goto end;
+    }
+
+    /* Check if a ticket was retrieved. */
+    if (!nca_ctx->rights_id_available)
+    {
+        consolePrint("rights id unavailable in target title -- this title doesn't use titlekey crypto\nthere's no ticket to be retrieved\n");
+        goto end;
+    }
+
+    if (!nca_ctx->titlekey_retrieved)
+    {
+        consolePrint("failed to retrieve ticket (unavailable?)\ntry launching nxdumptool while overriding the title you wish to dump a ticket from\n");
+        goto end;
+    }
+
+    /* Remove console-specific data, if needed. */
+    if (remove_console_data && tikIsPersonalizedTicket(&tik) && !tikConvertPersonalizedTicketToCommonTicket(&tik, NULL, NULL))
+    {
+        consolePrint("failed to convert personalized ticket to common ticket\n");
+        goto end;
+    }
+
+    /* Save ticket. */
+    crc = crc32Calculate(tik.data, tik.size);
+    snprintf(path, MAX_ELEMENTS(path), " (%08X).tik", crc);
+
+    filename = generateOutputTitleFileName(title_info, "Ticket", path);
+    if (!filename) goto end;
+
+    if (!saveFileData(filename, tik.data, tik.size)) goto end;
+
+    consolePrint("rights id: %s\n", tik.rights_id_str);
+    consolePrint("encrypted titlekey: %s\n", tik.enc_titlekey_str);
+    consolePrint("decrypted titlekey: %s\n\n", tik.dec_titlekey_str);
+
+    consolePrint("successfully saved ticket as \"%s\"\n", filename);
+    success = true;
+
+end:
+    if (filename) free(filename);
+
+    if (nca_ctx) free(nca_ctx);
+
+    return success;
+}
+
+static bool saveNintendoContentArchive(void *userdata)
+{
+    if (!userdata) return false;
+
+    NcaUserData *nca_user_data = (NcaUserData*)userdata;
+    TitleInfo *title_info = nca_user_data->title_info;
+    NcmContentInfo *content_info = &(title_info->content_infos[nca_user_data->content_idx]);
+
+    NcaThreadData nca_thread_data = {0};
+    SharedThreadData *shared_thread_data = &(nca_thread_data.shared_thread_data);
+
+    u64 free_space = 0;
+    char *filename = NULL, subdir[0x20] = {0};
+    u32 dev_idx = g_storageMenuElementOption.selected;
+
+    DigestEngine digest_engine = {0};
+    DigestResult digest_result = {0};
+    bool dat_loaded = false, digest_engine_init = false;
+
+    NcaPrefetchStats prefetch_stats = {0};
+
+    bool success = false;
+
+    /* Allocate buffer for NCA context. */
+    if (!(nca_thread_data.nca_ctx = calloc(1, sizeof(NcaContext))))
+    {
+        consolePrint("nca ctx calloc failed\n");
+        goto end;
+    }
+
+    /* Initialize NCA context. */
+    if (!ncaInitializeContext(nca_thread_data.nca_ctx, title_info->storage_id, (title_info->storage_id == NcmStorageId_GameCard ? HashFileSystemPartitionType_Secure : 0), \
+                              &(title_info->meta_key), content_info, NULL))
+    {
+        consolePrint("nca initialize ctx failed\n");
+        goto end;
+    }
+
+    shared_thread_data->total_size = nca_thread_data.nca_ctx->content_size;
+
+    consolePrint("nca size: 0x%lX\n", shared_thread_data->total_size);
+
+    /* DAT files are loaded in the background. Let the user know why we're stalling if they're not ready yet. */
+    if (datIsLoading())
+    {
+        consolePrint("waiting for dat files to load...\n");
+        consoleRefresh();
+    }
+
+    dat_loaded = (datGetEntryCount() > 0);
+
+    snprintf(path, MAX_ELEMENTS(path), "/%s.%s", nca_thread_data.nca_ctx->content_id_str, content_info->content_type == NcmContentType_Meta ? "cnmt.nca" : "nca");
+    snprintf(subdir, MAX_ELEMENTS(subdir), "NCA/%s", nca_thread_data.nca_ctx->storage_id == NcmStorageId_BuiltInSystem ? "System" : "User");
+    filename = generateOutputTitleFileName(title_info, subdir, path);
+    if (!filename) goto end;
+
+    if (dev_idx == 1)
+    {
+        if (!sendResumableFileProperties(shared_thread_data->total_size, filename, readNcaTail, nca_thread_data.nca_ctx, &(shared_thread_data->resume_offset))) goto end;
+        shared_thread_data->data_written = shared_thread_data->resume_offset;
+    } else {
+        if (!utilsGetFileSystemStatsByPath(filename, NULL, &free_space))
+        {
+            consolePrint("failed to retrieve free space from selected device\n");
+            goto end;
+        }
+
+        if (shared_thread_data->total_size >= free_space)
+        {
+            consolePrint("dump size exceeds free space\n");
+            goto end;
+        }
+
+        utilsCreateDirectoryTree(filename, false);
+
+        if (dev_idx == 0)
+        {
+            /* Preallocate the whole output file and write to it straight through the FS sysmodule. ConcatenationFiles are created as needed. */
+            /* NCA data can be read in any order, so ConcatenationFile parts are filled in parallel. We can't do this if we need to hash the data, though. */
+            if (shared_thread_data->total_size > SD_WRITER_PART_SIZE && dat_loaded) consolePrint("dat entries loaded, writing sequentially to hash nca data in order\n");
+
+            if (shared_thread_data->total_size > SD_WRITER_PART_SIZE && !dat_loaded)
+            {
+                if (!sdSplitWriterCreate(&(nca_thread_data.sd_split_writer), filename, shared_thread_data->total_size, SD_WRITE_LANE_COUNT, SD_WRITE_FLUSH_INTERVAL))
+                {
+                    consolePrint("failed to create \"%s\"!\n", filename);
+                    goto end;
+                }
+
+                shared_thread_data->sd_split_writer = &(nca_thread_data.sd_split_writer);
+            } else
+            if (!sdWriterCreate(&(shared_thread_data->sd_writer), filename, shared_thread_data->total_size, SD_WRITE_FLUSH_INTERVAL))
+            {
+                consolePrint("failed to create \"%s\"!\n", filename);
+                goto end;
+            }
+        } else {
+            if (g_umsDevices[dev_idx - 2].fs_type < UsbHsFsDeviceFileSystemType_exFAT && shared_thread_data->total_size > FAT32_FILESIZE_LIMIT)
+            {
+                consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
+                goto end;
+            }
+
+            shared_thread_data->fp = fopen(filename, "wb");
+            if (!shared_thread_data->fp)
+            {
+                consolePrint("failed to open \"%s\" for writing!\n", filename);
+                goto end;
+            }
+
+            ftruncate(fileno(shared_thread_data->fp), (off_t)shared_thread_data->total_size);
+        }
+    }
+
+    /* Only hash NCA data if we have something to compare it against, and if we're dumping the whole file. */
+    if (!shared_thread_data->resume_offset && dat_loaded)
+    {
+        if (!(digest_engine_init = digestEngineInitialize(&digest_engine, DigestTypeMask_Crc32 | DigestTypeMask_Sha1 | DigestTypeMask_Sha256, NULL)))
+        {
+            consolePrint("failed to initialize digest engine\n");
+            goto end;
+        }
+    }
+
+    consoleRefresh();
+
+    DumpPipelineStage stages[] = {
+        { .type = DumpPipelineStageType_Read,  .name = "nca read", .func = ncaReadStageFunc,      .userdata = nca_thread_data.nca_ctx, .cpu_id = 1 },
+        { .type = DumpPipelineStageType_Hash,  .name = "hash",     .func = digestHashStageFunc,   .userdata = &digest_engine,          .cpu_id = 0 },
+        { .type = DumpPipelineStageType_Write, .name = "write",    .func = genericWriteStageFunc, .userdata = shared_thread_data,      .cpu_id = 2 }
+    };
+
+    /* Skip the hash stage if we're not calculating any digests. */
+    if (!digest_engine_init) stages[1] = stages[2];
+
+    /* Only account for reads issued by this dump. */
+    ncaResetPrefetchStats();
+
+    /* Nothing left to dump if the USB host already holds the whole file. */
+    success = (shared_thread_data->data_written >= shared_thread_data->total_size || \
+               spanDumpPipeline(stages, MAX_ELEMENTS(stages) - (digest_engine_init ? 0 : 1), shared_thread_data));
+
+    if (success)
+    {
+        consolePrint("successfully saved nca as \"%s\"\n", filename);
+
+        ncaGetPrefetchStats(&prefetch_stats);
+        if (prefetch_stats.requested_size) consolePrint("prefetch: %lu reads | 0x%lX / 0x%lX bytes hit (%lu%%) | 0x%lX bytes read ahead\n", prefetch_stats.read_count, prefetch_stats.hit_size, \
+                                                        prefetch_stats.requested_size, (prefetch_stats.hit_size * 100) / prefetch_stats.requested_size, prefetch_stats.prefetched_size);
+
+        if (digest_engine_init && digestEngineFinalize(&digest_engine, &digest_result)) printDatLookupResult("nca", shared_thread_data->total_size, &digest_result, digest_engine.type_mask);
+
+        consoleRefresh();
+    }
+
+end:
+    if (shared_thread_data->fp || sdWriterIsOpen(&(shared_thread_data->sd_writer)) || shared_thread_data->sd_split_writer)
+    {
+        if (shared_thread_data->fp) fclose(shared_thread_data->fp);
+        shared_thread_data->fp = NULL;
+
+        sdWriterClose(&(shared_thread_data->sd_writer));
+
+        sdSplitWriterClose(&(nca_thread_data.sd_split_writer));
+        shared_thread_data->sd_split_writer = NULL;
+
+        if (!success && dev_idx != 1)
+        {
+            if (dev_idx == 0)
+            {
+                utilsRemoveConcatenationFile(filename);
+                utilsCommitSdCardFileSystemChanges();
+            } else {
+                remove(filename);
+            }
+        }
+    }
+
+    if (digest_engine_init) digestEngineFree(&digest_engine);
+
+    if (filename) free(filename);
+
+    if (nca_thread_data.nca_ctx) free(nca_thread_data.nca_ctx);
+
+    return success;
+}
+
+static bool saveNintendoContentArchiveFsSection(void *userdata)
+{
+    NcaFsSectionContext *nca_fs_ctx = (NcaFsSectionContext*)userdata;
+    NcaContext *nca_ctx = (nca_fs_ctx ? nca_fs_ctx->nca_ctx : NULL);
+
+    /* Sanity checks. */
+
+    if (!g_ncaUserTitleInfo || !nca_fs_ctx || !nca_ctx || !nca_fs_ctx->enabled || nca_fs_ctx->section_type > NcaFsSectionType_Nca0RomFs || \
+        (nca_fs_ctx->section_type == NcaFsSectionType_Nca0RomFs && g_ncaBasePatchTitleInfo))
+    {
+        consolePrint("invalid nca fs parameters!\n");
+        return false;
+    }
+
+    if (nca_fs_ctx->has_sparse_layer)
+    {
+        if (!g_ncaBasePatchTitleInfo)
+        {
+            consolePrint("the selected nca fs section holds a sparse storage\na matching patch of at least v%u must be selected\n", nca_ctx->title_version.value);
+            return false;
+        } else
+        if (g_ncaBasePatchTitleInfo->version.value < nca_ctx->title_version.value)
+        {
+            consolePrint("the selected patch doesn't meet the sparse storage version requirement!\nv%u < v%u\n", g_ncaBasePatchTitleInfo->version.value, nca_ctx->title_version.value);
+            return false;
+        }
+    }
+
+    if (nca_fs_ctx->section_type == NcaFsSectionType_PatchRomFs && !g_ncaBasePatchTitleInfo)
+    {
+        consolePrint("patch romfs section selected but no base app provided\n");
+        return false;
+    }
+
+    u8 title_type = nca_ctx->title_type;
+    u8 content_type = nca_ctx->content_type;
+    u8 section_type = nca_fs_ctx->section_type;
+
+    NcmContentInfo *base_patch_content_info = (g_ncaBasePatchTitleInfo ? titleGetContentInfoByTypeAndIdOffset(g_ncaBasePatchTitleInfo, content_type, nca_ctx->id_offset) : NULL);
+    NcaContext *base_patch_nca_ctx = NULL;
+    NcaFsSectionContext *base_patch_nca_fs_ctx = NULL;
+
+    PartitionFileSystemContext pfs_ctx = {0};
+    RomFileSystemContext romfs_ctx = {0};
+
+    bool write_raw_section = (bool)getNcaFsWriteRawSectionOption();
+    bool use_layeredfs_dir = (bool)getNcaFsUseLayeredFsDirOption();
+    bool success = false;
+
+    /* Override LayeredFS flag, if needed. */
+    if (use_layeredfs_dir && \
+        (title_type == NcmContentMetaType_Unknown || (title_type > NcmContentMetaType_SystemData && title_type < NcmContentMetaType_Application) || \
+        (title_type == NcmContentMetaType_SystemProgram && (content_type != NcmContentType_Program || nca_fs_ctx->section_idx != 0)) || \
+        (title_type == NcmContentMetaType_SystemData && (content_type != NcmContentType_Data || nca_fs_ctx->section_idx != 0)) || \
+        ((title_type == NcmContentMetaType_Application || title_type == NcmContentMetaType_Patch) && (content_type != NcmContentType_Program || nca_fs_ctx->section_idx > 1)) || \
+        ((title_type == NcmContentMetaType_AddOnContent || title_type == NcmContentMetaType_DataPatch) && (content_type != NcmContentType_Data || nca_fs_ctx->section_idx != 0))))
+    {
+        consolePrint("layeredfs setting disabled (unsupported by current content/section type combo)\n");
+        use_layeredfs_dir = false;
+    }
+
+    /* Initialize base/patch NCA context, if needed. */
+    if (g_ncaBasePatchTitleInfo)
+    {
+        if (!base_patch_content_info)
+        {
+            consolePrint("unable to find content with type %s and id offset %u in selected base/patch title!\n", titleGetNcmContentTypeName(content_type), nca_ctx->id_offset);
+            goto end;
+        }
+
+        base_patch_nca_ctx = calloc(1, sizeof(NcaContext));
+        if (!base_patch_nca_ctx)
+        {
+            consolePrint("failed to allocate memory for base/patch nca ctx!\n");
+            goto end;
+        }
+
+        if (!ncaInitializeContext(base_patch_nca_ctx, g_ncaBasePatchTitleInfo->storage_id, (g_ncaBasePatchTitleInfo->storage_id == NcmStorageId_GameCard ? HashFileSystemPartitionType_Secure : 0), \
+                                  &(g_ncaBasePatchTitleInfo->meta_key), base_patch_content_info, NULL))
+        {
+            consolePrint("failed to initialize base/patch nca ctx!\n");
+            goto end;
+        }
+
+        /* Use a matching NCA FS section entry. */
+        base_patch_nca_fs_ctx = &(base_patch_nca_ctx->fs_ctx[nca_fs_ctx->section_idx]);
+    }
+
+    if (section_type == NcaFsSectionType_PartitionFs)
+    {
+        /* Select the right NCA FS section context, depending on the sparse layer flag. */
+        NcaFsSectionContext *pfs_nca_fs_ctx = (nca_fs_ctx->has_sparse_layer ? base_patch_nca_fs_ctx : nca_fs_ctx);
+
+        /* Initialize PartitionFS context. */
+        if (!pfsInitializeContext(&pfs_ctx, pfs_nca_fs_ctx))
+        {
+            consolePrint("pfs initialize ctx failed!\n");
+            goto end;
+        }
+
+        success = (write_raw_section ? saveRawPartitionFsSection(&pfs_ctx, use_layeredfs_dir) : saveExtractedPartitionFsSection(&pfs_ctx, use_layeredfs_dir));
+    } else {
+        /* Select the right base/patch NCA FS section contexts. */
+        NcaFsSectionContext *base_nca_fs_ctx = (section_type == NcaFsSectionType_PatchRomFs ? base_patch_nca_fs_ctx : nca_fs_ctx);
+        NcaFsSectionContext *patch_nca_fs_ctx = (section_type == NcaFsSectionType_PatchRomFs ? nca_fs_ctx : base_patch_nca_fs_ctx);
+
+        /* Initialize RomFS context. */
+        if (!romfsInitializeContext(&romfs_ctx, base_nca_fs_ctx, patch_nca_fs_ctx))
+        {
+            consolePrint("romfs initialize ctx failed!\n");
+            goto end;
+        }
+
+        success = (write_raw_section ? saveRawRomFsSection(&romfs_ctx, use_layeredfs_dir) : saveExtractedRomFsSection(&romfs_ctx, use_layeredfs_dir));
+    }
+
+end:
+    romfsFreeContext(&romfs_ctx);
+
+    pfsFreeContext(&pfs_ctx);
+
+    if (base_patch_nca_ctx) free(base_patch_nca_ctx);
+
+    return success;
+}
+
+static bool saveRawPartitionFsSection(PartitionFileSystemContext *pfs_ctx, bool use_layeredfs_dir)
+{
+    u64 free_space = 0;
+
+    PfsThreadData pfs_thread_data = {0};
+    SharedThreadData *shared_thread_data = &(pfs_thread_data.shared_thread_data);
+
+    NcaFsSectionContext *nca_fs_ctx = pfs_ctx->nca_fs_ctx;
+    NcaContext *nca_ctx = nca_fs_ctx->nca_ctx;
+
+    u64 title_id = nca_ctx->title_id;
+    u8 title_type = nca_ctx->title_type;
+
+    char subdir[0x20] = {0}, *filename = NULL;
+    u32 dev_idx = g_storageMenuElementOption.selected;
+
+    bool success = false;
+
+    pfs_thread_data.pfs_ctx = pfs_ctx;
+    pfs_thread_data.use_layeredfs_dir = use_layeredfs_dir;
+    shared_thread_data->total_size = pfs_ctx->size;
+
+    consolePrint("raw partitionfs section size: 0x%lX\n", pfs_ctx->size);
+
+    if (use_layeredfs_dir)
+    {
+        /* Only use base title IDs if we're dealing with patches. */
+        title_id = (title_type == NcmContentMetaType_Patch ? titleGetApplicationIdByPatchId(title_id) : \
+                   (title_type == NcmContentMetaType_DataPatch ? titleGetAddOnContentIdByDataPatchId(title_id) : title_id));
+
+        filename = generateOutputLayeredFsFileName(title_id + nca_ctx->id_offset, NULL, "exefs.nsp");
+    } else {
+        snprintf(subdir, MAX_ELEMENTS(subdir), "NCA FS/%s/Raw", nca_ctx->storage_id == NcmStorageId_BuiltInSystem ? "System" : "User");
+        snprintf(path, MAX_ELEMENTS(path), "/%s #%u (%s)/Section #%u (%s).nsp", titleGetNcmContentTypeName(nca_ctx->content_type), nca_ctx->id_offset, nca_ctx->content_id_str, \
+                                                                                nca_fs_ctx->section_idx, ncaGetFsSectionTypeName(nca_fs_ctx));
+
+        TitleInfo *title_info = (title_id == g_ncaUserTitleInfo->meta_key.id ? g_ncaUserTitleInfo : g_ncaBasePatchTitleInfo);
+        filename = generateOutputTitleFileName(title_info, subdir, path);
+    }
+
+    if (!filename) goto end;
+
+    if (dev_idx == 1)
+    {
+        if (!usbSendFileProperties(shared_thread_data->total_size, filename))
+        {
+            consolePrint("failed to send file properties for \"%s\"!\n", filename);
+            goto end;
+        }
+    } else {
+        if (!utilsGetFileSystemStatsByPath(filename, NULL, &free_space))
+        {
+            consolePrint("failed to retrieve free space from selected device\n");
+            goto end;
+        }
+
+        if (shared_thread_data->total_size >= free_space)
+        {
+            consolePrint("dump size exceeds free space\n");
+            goto end;
+        }
+
+        utilsCreateDirectoryTree(filename, false);
+
+        if (dev_idx == 0)
+        {
+            /* Preallocate the whole output file and write to it straight through the FS sysmodule. ConcatenationFiles are created as needed. */
+            /* NCA FS section data can be read in any order, so ConcatenationFile parts are filled in parallel. */
+            if (shared_thread_data->total_size > SD_WRITER_PART_SIZE)
+            {
+                if (!sdSplitWriterCreate(&(pfs_thread_data.sd_split_writer), filename, shared_thread_data->total_size, SD_WRITE_LANE_COUNT, SD_WRITE_FLUSH_INTERVAL))
+                {
+                    consolePrint("failed to create \"%s\"!\n", filename);
+                    goto end;
+                }
+
+                shared_thread_data->sd_split_writer = &(pfs_thread_data.sd_split_writer);
+            } else
+            if (!sdWriterCreate(&(shared_thread_data->sd_writer), filename, shared_thread_data->total_size, SD_WRITE_FLUSH_INTERVAL))
+            {
+                consolePrint("failed to create \"%s\"!\n", filename);
+                goto end;
+            }
+        } else {
+            if (g_umsDevices[dev_idx - 2].fs_type < UsbHsFsDeviceFileSystemType_exFAT && shared_thread_data->total_size > FAT32_FILESIZE_LIMIT)
+            {
+                consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
+                goto end;
+            }
+
+            shared_thread_data->fp = fopen(filename, "wb");
+            if (!shared_thread_data->fp)
+            {
+                consolePrint("failed to open \"%s\" for writing!\n", filename);
+                goto end;
+            }
+
+            ftruncate(fileno(shared_thread_data->fp), (off_t)shared_thread_data->total_size);
+        }
+    }
+
+    consoleRefresh();
+
+    DumpPipelineStage stages[] = {
+        { .type = DumpPipelineStageType_Read,  .name = "partitionfs read", .func = rawPartitionFsReadStageFunc, .userdata = pfs_ctx,            .cpu_id = 1 },
+        { .type = DumpPipelineStageType_Write, .name = "write",            .func = genericWriteStageFunc,       .userdata = shared_thread_data, .cpu_id = 2 }
+    };
+
+    success = spanDumpPipeline(stages, MAX_ELEMENTS(stages), shared_thread_data);
+
+    if (success)
+    {
+        consolePrint("successfully saved raw partitionfs section as \"%s\"\n", filename);
+        consoleRefresh();
+    }
+
+end:
+    if (shared_thread_data->fp || sdWriterIsOpen(&(shared_thread_data->sd_writer)) || shared_thread_data->sd_split_writer)
+    {
+        if (shared_thread_data->fp) fclose(shared_thread_data->fp);
+        shared_thread_data->fp = NULL;
+
+        sdWriterClose(&(shared_thread_data->sd_writer));
+
+        sdSplitWriterClose(&(pfs_thread_data.sd_split_writer));
+        shared_thread_data->sd_split_writer = NULL;
+
+        if (!success && dev_idx != 1)
+        {
+            if (dev_idx == 0)
+            {
+                utilsRemoveConcatenationFile(filename);
+                utilsCommitSdCardFileSystemChanges();
+            } else {
+                remove(filename);
+            }
+        }
+    }
+
+    if (filename) free(filename);
+
+    return success;
+}
+
+static bool saveExtractedPartitionFsSection(PartitionFileSystemContext *pfs_ctx, bool use_layeredfs_dir)
+{
+    ExtractedFsThreadData extracted_fs_thread_data = {0};
+
+    NcaFsSectionContext *nca_fs_ctx = pfs_ctx->nca_fs_ctx;
+    NcaContext *nca_ctx = nca_fs_ctx->nca_ctx;
+
+    u64 title_id = nca_ctx->title_id;
+    u8 title_type = nca_ctx->title_type;
+
+    char pfs_path[FS_MAX_PATH] = {0}, subdir[0x20] = {0};
+
+    if (use_layeredfs_dir)
+    {
+        /* Only use base title IDs if we're dealing with patches. */
+        title_id = (title_type == NcmContentMetaType_Patch ? titleGetApplicationIdByPatchId(title_id) : \
+                   (title_type == NcmContentMetaType_DataPatch ? titleGetAddOnContentIdByDataPatchId(title_id) : title_id));
+
+        extracted_fs_thread_data.filename = generateOutputLayeredFsFileName(title_id + nca_ctx->id_offset, NULL, "exefs");
+    } else {
+        snprintf(subdir, MAX_ELEMENTS(subdir), "NCA FS/%s/Extracted", nca_ctx->storage_id == NcmStorageId_BuiltInSystem ? "System" : "User");
+        snprintf(pfs_path, MAX_ELEMENTS(pfs_path), "/%s #%u (%s)/Section #%u (%s)", titleGetNcmContentTypeName(nca_ctx->content_type), nca_ctx->id_offset, nca_ctx->content_id_str, \
+                                                                                    nca_fs_ctx->section_idx, ncaGetFsSectionTypeName(nca_fs_ctx));
+
+        TitleInfo *title_info = (title_id == g_ncaUserTitleInfo->meta_key.id ? g_ncaUserTitleInfo : g_ncaBasePatchTitleInfo);
+        extracted_fs_thread_data.filename = generateOutputTitleFileName(title_info, subdir, pfs_path);
+    }
+
+    extracted_fs_thread_data.fs_type = ExtractedFsType_Pfs;
+    extracted_fs_thread_data.fs_ctx = pfs_ctx;
+
+    return saveExtractedFileSystemData(&extracted_fs_thread_data, "partitionfs section");
+}
+
+static bool saveRawRomFsSection(RomFileSystemContext *romfs_ctx, bool use_layeredfs_dir)
+{
+    u64 free_space = 0;
+
+    RomFsThreadData romfs_thread_data = {0};
+    SharedThreadData *shared_thread_data = &(romfs_thread_data.shared_thread_data);
+
+    NcaFsSectionContext *nca_fs_ctx = romfs_ctx->default_storage_ctx->nca_fs_ctx;
+    NcaContext *nca_ctx = nca_fs_ctx->nca_ctx;
+
+    u64 title_id = nca_ctx->title_id;
+    u8 title_type = nca_ctx->title_type;
+
+    char subdir[0x20] = {0}, *filename = NULL;
+    u32 dev_idx = g_storageMenuElementOption.selected;
+
+    bool success = false;
+
+    romfs_thread_data.romfs_ctx = romfs_ctx;
+    romfs_thread_data.use_layeredfs_dir = use_layeredfs_dir;
+    shared_thread_data->total_size = romfs_ctx->size;
+
+    consolePrint("raw romfs section size: 0x%lX\n", romfs_ctx->size);
+
+    if (use_layeredfs_dir)
+    {
+        /* Only use base title IDs if we're dealing with patches. */
+        title_id = (title_type == NcmContentMetaType_Patch ? titleGetApplicationIdByPatchId(title_id) : \
+                   (title_type == NcmContentMetaType_DataPatch ? titleGetAddOnContentIdByDataPatchId(title_id) : title_id));
+
+        filename = generateOutputLayeredFsFileName(title_id + nca_ctx->id_offset, NULL, "romfs.bin");
+    } else {
+        snprintf(subdir, MAX_ELEMENTS(subdir), "NCA FS/%s/Raw", nca_ctx->storage_id == NcmStorageId_BuiltInSystem ? "System" : "User");
+        snprintf(path, MAX_ELEMENTS(path), "/%s #%u (%s)/Section #%u (%s).bin", titleGetNcmContentTypeName(nca_ctx->content_type), nca_ctx->id_offset, nca_ctx->content_id_str, \
+                                                                                nca_fs_ctx->section_idx, ncaGetFsSectionTypeName(nca_fs_ctx));
+
+        TitleInfo *title_info = (title_id == g_ncaUserTitleInfo->meta_key.id ? g_ncaUserTitleInfo : g_ncaBasePatchTitleInfo);
+        filename = generateOutputTitleFileName(title_info, subdir, path);
+    }
+
+    if (!filename) goto end;
+
+    if (dev_idx == 1)
+    {
+        if (!sendResumableFileProperties(shared_thread_data->total_size, filename, readRawRomFsTail, romfs_ctx, &(shared_thread_data->resume_offset))) goto end;
+        shared_thread_data->data_written = shared_thread_data->resume_offset;
+    } else {
+        if (!utilsGetFileSystemStatsByPath(filename, NULL, &free_space))
+        {
+            consolePrint("failed to retrieve free space from selected device\n");
+            goto end;
+        }
+
+        if (shared_thread_data->total_size >= free_space)
+        {
+            consolePrint("dump size exceeds free space\n");
+            goto end;
+        }
+
+        utilsCreateDirectoryTree(filename, false);
+
+        if (dev_idx == 0)
+        {
+            /* Preallocate the whole output file and write to it straight through the FS sysmodule. ConcatenationFiles are created as needed. */
+            /* NCA FS section data can be read in any order, so ConcatenationFile parts are filled in parallel. */
+            if (shared_thread_data->total_size > SD_WRITER_PART_SIZE)
+            {
+                if (!sdSplitWriterCreate(&(romfs_thread_data.sd_split_writer), filename, shared_thread_data->total_size, SD_WRITE_LANE_COUNT, SD_WRITE_FLUSH_INTERVAL))
+                {
+                    consolePrint("failed to create \"%s\"!\n", filename);
+                    goto end;
+                }
+
+                shared_thread_data->sd_split_writer = &(romfs_thread_data.sd_split_writer);
+            } else
+            if (!sdWriterCreate(&(shared_thread_data->sd_writer), filename, shared_thread_data->total_size, SD_WRITE_FLUSH_INTERVAL))
+            {
+                consolePrint("failed to create \"%s\"!\n", filename);
+                goto end;
+            }
+        } else {
+            if (g_umsDevices[dev_idx - 2].fs_type < UsbHsFsDeviceFileSystemType_exFAT && shared_thread_data->total_size > FAT32_FILESIZE_LIMIT)
+            {
+                consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
+                goto end;
+            }
+
+            shared_thread_data->fp = fopen(filename, "wb");
+            if (!shared_thread_data->fp)
+            {
+                consolePrint("failed to open \"%s\" for writing!\n", filename);
+                goto end;
+            }
+
+            ftruncate(fileno(shared_thread_data->fp), (off_t)shared_thread_data->total_size);
+        }
+    }
+
+    consoleRefresh();
+
+    DumpPipelineStage stages[] = {
+        { .type = DumpPipelineStageType_Read,  .name = "romfs read", .func = rawRomFsReadStageFunc, .userdata = romfs_ctx,          .cpu_id = 1 },
+        { .type = DumpPipelineStageType_Write, .name = "write",      .func = genericWriteStageFunc, .userdata = shared_thread_data, .cpu_id = 2 }
+    };
+
+    /* Nothing left to dump if the USB host already holds the whole file. */
+    success = (shared_thread_data->data_written >= shared_thread_data->total_size || spanDumpPipeline(stages, MAX_ELEMENTS(stages), shared_thread_data));
+
+    if (success)
+    {
+        consolePrint("successfully saved raw romfs section as \"%s\"\n", filename);
+        consoleRefresh();
+    }
+
+end:
+    if (shared_thread_data->fp || sdWriterIsOpen(&(shared_thread_data->sd_writer)) || shared_thread_data->sd_split_writer)
+    {
+        if (shared_thread_data->fp) fclose(shared_thread_data->fp);
         shared_thread_data->fp = NULL;
 
-        if (!success && dev_idx != 1)
-        {
-            if (dev_idx == 0)
-            {
-                utilsRemoveConcatenationFile(filename);
-                utilsCommitSdCardFileSystemChanges();
-            } else {
-                remove(filename);
-            }
-        }
+        sdWriterClose(&(shared_thread_data->sd_writer));
+
+        sdSplitWriterClose(&(romfs_thread_data.sd_split_writer));
+        shared_thread_data->sd_split_writer = NULL;
+
+        if (!success && dev_idx != 1)
+        {
+            if (dev_idx == 0)
+            {
+                utilsRemoveConcatenationFile(filename);
+                utilsCommitSdCardFileSystemChanges();
+            } else {
+                remove(filename);
+            }
+        }
+    }
+
+    if (filename) free(filename);
+
+    return success;
+}
+
+static bool saveExtractedRomFsSection(RomFileSystemContext *romfs_ctx, bool use_layeredfs_dir)
+{
+    ExtractedFsThreadData extracted_fs_thread_data = {0};
+
+    NcaFsSectionContext *nca_fs_ctx = romfs_ctx->default_storage_ctx->nca_fs_ctx;
+    NcaContext *nca_ctx = nca_fs_ctx->nca_ctx;
+
+    u64 title_id = nca_ctx->title_id;
+    u8 title_type = nca_ctx->title_type;
+
+    char romfs_path[FS_MAX_PATH] = {0}, subdir[0x20] = {0};
+
+    if (use_layeredfs_dir)
+    {
+        /* Only use base title IDs if we're dealing with patches. */
+        title_id = (title_type == NcmContentMetaType_Patch ? titleGetApplicationIdByPatchId(title_id) : \
+                   (title_type == NcmContentMetaType_DataPatch ? titleGetAddOnContentIdByDataPatchId(title_id) : title_id));
+
+        extracted_fs_thread_data.filename = generateOutputLayeredFsFileName(title_id + nca_ctx->id_offset, NULL, "romfs");
+    } else {
+        snprintf(subdir, MAX_ELEMENTS(subdir), "NCA FS/%s/Extracted", nca_ctx->storage_id == NcmStorageId_BuiltInSystem ? "System" : "User");
+        snprintf(romfs_path, MAX_ELEMENTS(romfs_path), "/%s #%u (%s)/Section #%u (%s)", titleGetNcmContentTypeName(nca_ctx->content_type), nca_ctx->id_offset, nca_ctx->content_id_str, \
+                                                                                        nca_fs_ctx->section_idx, ncaGetFsSectionTypeName(nca_fs_ctx));
+
+        TitleInfo *title_info = (title_id == g_ncaUserTitleInfo->meta_key.id ? g_ncaUserTitleInfo : g_ncaBasePatchTitleInfo);
+        extracted_fs_thread_data.filename = generateOutputTitleFileName(title_info, subdir, romfs_path);
+    }
+
+    extracted_fs_thread_data.fs_type = ExtractedFsType_RomFs;
+    extracted_fs_thread_data.fs_ctx = romfs_ctx;
+
+    return saveExtractedFileSystemData(&extracted_fs_thread_data, "romfs section");
+}
+
+static bool xciReadStageFunc(DumpPipelineBuffer *buf, void *userdata)
+{
+    XciThreadData *xci_thread_data = (XciThreadData*)userdata;
+    u64 card_data_size = xci_thread_data->card_data_size, read_size = 0;
+
+    /* Data past the trimmed gamecard size is known 0xFF padding, which is synthesized instead of being read. */
+    /* The pipeline keeps a few blocks in flight, so we read straight into its buffers instead of using a gamecard stream. */
+    if (buf->offset < card_data_size)
+    {
+        read_size = MIN(buf->data_size, card_data_size - buf->offset);
+        if (!gamecardReadStorage(buf->data, read_size, buf->offset)) return false;
+    }
+
+    if (read_size < buf->data_size) memset(buf->data + read_size, 0xFF, buf->data_size - read_size);
+
+    return true;
+}
+
+static bool xciRemoveCertificateStageFunc(DumpPipelineBuffer *buf, void *userdata)
+{
+    (void)userdata;
+
+    if (buf->offset == 0) memset(buf->data + GAMECARD_CERTIFICATE_OFFSET, 0xFF, sizeof(FsGameCardCertificate));
+
+    return true;
+}
+
+static bool xciWriteStageFunc(DumpPipelineBuffer *buf, void *userdata)
+{
+    XciThreadData *xci_thread_data = (XciThreadData*)userdata;
+    SharedThreadData *shared_thread_data = &(xci_thread_data->shared_thread_data);
+    DigestEngineState digest_state = {0};
+    u64 offset = (buf->offset + buf->input_size);
+
+    /* Hash the current block in the background while it's being written. */
+    digestEngineUpdate(xci_thread_data->digest_engine, buf->data, buf->data_size);
+
+    bool success = genericWriteStageFunc(buf, shared_thread_data);
+
+    /* The buffer is given back to the read stage as soon as we return. */
+    digestEngineWaitForIdle(xci_thread_data->digest_engine);
+
+    /* Save a checkpoint if enough data has been written since the last one. Both the output file and the digests cover all data up to this offset. */
+    if (success && dumpCheckpointIsDue(xci_thread_data->checkpoint, offset))
+    {
+        if (xci_thread_data->digest_engine) digestEngineExportState(xci_thread_data->digest_engine, &digest_state);
+        dumpCheckpointSave(xci_thread_data->checkpoint, &(shared_thread_data->sd_writer), offset, &digest_state, sizeof(DigestEngineState));
     }
 
-    if (filename) free(filename);
+    return success;
+}
 
-    if (nca_thread_data.nca_ctx) free(nca_thread_data.nca_ctx);
+static bool xciCalculateCheckpointSourceHash(u8 *out, u64 output_size)
+{
+    GameCardHeader gc_header = {0};
+    Sha256Context sha256_ctx = {0};
+    u8 options[] = { (u8)getGameCardPrependKeyAreaOption(), (u8)getGameCardKeepCertificateOption(), (u8)getGameCardTrimDumpOption(), (u8)getGameCardCalculateChecksumOption() };
 
-    return success;
+    if (!gamecardGetHeader(&gc_header)) return false;
+
+    /* Digest states are stored as-is, so checkpoints saved by a different build are discarded as well. */
+    sha256ContextCreate(&sha256_ctx);
+    sha256ContextUpdate(&sha256_ctx, GIT_REV, strlen(GIT_REV));
+    sha256ContextUpdate(&sha256_ctx, &gc_header, sizeof(GameCardHeader));
+    sha256ContextUpdate(&sha256_ctx, options, sizeof(options));
+    sha256ContextUpdate(&sha256_ctx, &output_size, sizeof(u64));
+    sha256ContextGetHash(&sha256_ctx, out);
+
+    return true;
 }
 
-static bool saveNintendoContentArchiveFsSection(void *userdata)
+static bool rawHfsReadStageFunc(DumpPipelineBuffer *buf, void *userdata)
 {
-    NcaFsSectionContext *nca_fs_ctx = (NcaFsSectionContext*)userdata;
-    NcaContext *nca_ctx = (nca_fs_ctx ? nca_fs_ctx->nca_ctx : NULL);
+    return hfsReadPartitionData((HashFileSystemContext*)userdata, buf->data, buf->data_size, buf->offset);
+}
 
-    /* Sanity checks. */
+static bool hfsVerificationStageFunc(DumpPipelineBuffer *buf, void *userdata)
+{
+    HfsVerificationStageData *stage_data = (HfsVerificationStageData*)userdata;
 
-    if (!g_ncaUserTitleInfo || !nca_fs_ctx || !nca_ctx || !nca_fs_ctx->enabled || nca_fs_ctx->section_type > NcaFsSectionType_Nca0RomFs || \
-        (nca_fs_ctx->section_type == NcaFsSectionType_Nca0RomFs && g_ncaBasePatchTitleInfo))
+    /* The buffer is given back to the read stage once the write stage is done with it, so we can't let the verification thread work on it in the background. */
+    hfsVerificationSubmitData(stage_data->hfs_verification_data, buf->data, buf->data_size, stage_data->base_offset + buf->offset);
+    hfsVerificationWaitForIdle(stage_data->hfs_verification_data);
+
+    return true;
+}
+
+static bool ncaReadStageFunc(DumpPipelineBuffer *buf, void *userdata)
+{
+    return ncaReadContentFile((NcaContext*)userdata, buf->data, buf->data_size, buf->offset);
+}
+
+static bool rawPartitionFsReadStageFunc(DumpPipelineBuffer *buf, void *userdata)
+{
+    return pfsReadPartitionData((PartitionFileSystemContext*)userdata, buf->data, buf->data_size, buf->offset);
+}
+
+static bool rawRomFsReadStageFunc(DumpPipelineBuffer *buf, void *userdata)
+{
+    return romfsReadFileSystemData((RomFileSystemContext*)userdata, buf->data, buf->data_size, buf->offset);
+}
+
+static bool saveExtractedFileSystemData(ExtractedFsThreadData *extracted_fs_thread_data, const char *fs_name)
+{
+    SharedThreadData *shared_thread_data = &(extracted_fs_thread_data->shared_thread_data);
+
+    u64 free_space = 0;
+    u32 dev_idx = g_storageMenuElementOption.selected;
+
+    bool success = false;
+
+    if (!extracted_fs_thread_data->filename) goto end;
+
+    extracted_fs_thread_data->filename_len = strlen(extracted_fs_thread_data->filename);
+
+    if (!extractedFsInitializeEntries(extracted_fs_thread_data))
     {
-        consolePrint("invalid nca fs parameters!\n");
-        return false;
+        consolePrint("failed to retrieve %s file entries!\n", fs_name);
+        goto end;
     }
 
-    if (nca_fs_ctx->has_sparse_layer)
+    if (!shared_thread_data->total_size)
     {
-        if (!g_ncaBasePatchTitleInfo)
+        consolePrint("%s is empty!\n", fs_name);
+        goto end;
+    }
+
+    consolePrint("extracted %s size: 0x%lX\n", fs_name, shared_thread_data->total_size);
+
+    if (dev_idx == 1)
+    {
+        /* Small files are sent to the host device in batches, which avoids a full command round trip per file. */
+        extracted_fs_thread_data->batch_entries = calloc(USB_BATCH_MAX_FILE_COUNT, sizeof(UsbFileBatchEntry));
+        extracted_fs_thread_data->batch_paths = calloc(USB_BATCH_MAX_FILE_COUNT, FS_MAX_PATH);
+        if (!extracted_fs_thread_data->batch_entries || !extracted_fs_thread_data->batch_paths)
         {
-            consolePrint("the selected nca fs section holds a sparse storage\na matching patch of at least v%u must be selected\n", nca_ctx->title_version.value);
-            return false;
-        } else
-        if (g_ncaBasePatchTitleInfo->version.value < nca_ctx->title_version.value)
+            consolePrint("failed to allocate usb file batch buffers!\n");
+            goto end;
+        }
+    } else {
+        if (!utilsGetFileSystemStatsByPath(extracted_fs_thread_data->filename, NULL, &free_space))
         {
-            consolePrint("the selected patch doesn't meet the sparse storage version requirement!\nv%u < v%u\n", g_ncaBasePatchTitleInfo->version.value, nca_ctx->title_version.value);
-            return false;
+            consolePrint("failed to retrieve free space from selected device\n");
+            goto end;
+        }
+
+        if (shared_thread_data->total_size >= free_space)
+        {
+            consolePrint("dump size exceeds free space\n");
+            goto end;
         }
     }
 
-    if (nca_fs_ctx->section_type == NcaFsSectionType_PatchRomFs && !g_ncaBasePatchTitleInfo)
+    consoleRefresh();
+
+    DumpPipelineStage stages[] = {
+        { .type = DumpPipelineStageType_Read,  .name = "fs read",    .func = extractedFsReadStageFunc,         .userdata = extracted_fs_thread_data, .cpu_id = 1 },
+        { .type = DumpPipelineStageType_Hash,  .name = "hfs verify", .func = extractedFsVerificationStageFunc, .userdata = extracted_fs_thread_data, .cpu_id = 0 },
+        { .type = DumpPipelineStageType_Write, .name = "write",      .func = extractedFsWriteStageFunc,        .userdata = extracted_fs_thread_data, .cpu_id = 2 }
+    };
+
+    /* Skip the verification stage if we're not verifying Hash FS entries. */
+    if (!extracted_fs_thread_data->hfs_verification_data) stages[1] = stages[2];
+
+    success = spanDumpPipeline(stages, MAX_ELEMENTS(stages) - (extracted_fs_thread_data->hfs_verification_data ? 0 : 1), shared_thread_data);
+
+    /* Empty file entries past the last data block haven't been created yet. */
+    while(success && extracted_fs_thread_data->write_idx < extracted_fs_thread_data->entry_count) success = extractedFsOpenNextEntry(extracted_fs_thread_data);
+
+    if (shared_thread_data->fp)
     {
-        consolePrint("patch romfs section selected but no base app provided\n");
-        return false;
+        fclose(shared_thread_data->fp);
+        shared_thread_data->fp = NULL;
+        if (dev_idx == 0) utilsCommitSdCardFileSystemChanges();
     }
 
-    u8 title_type = nca_ctx->title_type;
-    u8 content_type = nca_ctx->content_type;
-    u8 section_type = nca_fs_ctx->section_type;
+    if (success)
+    {
+        consolePrint("successfully saved extracted %s data to \"%s\"\n", fs_name, extracted_fs_thread_data->filename);
+        consoleRefresh();
+    } else
+    if (dev_idx != 1 && extracted_fs_thread_data->write_idx)
+    {
+        utilsDeleteDirectoryRecursively(extracted_fs_thread_data->filename);
+        if (dev_idx == 0) utilsCommitSdCardFileSystemChanges();
+    }
 
-    NcmContentInfo *base_patch_content_info = (g_ncaBasePatchTitleInfo ? titleGetContentInfoByTypeAndIdOffset(g_ncaBasePatchTitleInfo, content_type, nca_ctx->id_offset) : NULL);
-    NcaContext *base_patch_nca_ctx = NULL;
-    NcaFsSectionContext *base_patch_nca_fs_ctx = NULL;
+end:
+    if (extracted_fs_thread_data->batch_paths) free(extracted_fs_thread_data->batch_paths);
+    if (extracted_fs_thread_data->batch_entries) free(extracted_fs_thread_data->batch_entries);
 
-    PartitionFileSystemContext pfs_ctx = {0};
-    RomFileSystemContext romfs_ctx = {0};
+    if (extracted_fs_thread_data->entries) free(extracted_fs_thread_data->entries);
 
-    bool write_raw_section = (bool)getNcaFsWriteRawSectionOption();
-    bool use_layeredfs_dir = (bool)getNcaFsUseLayeredFsDirOption();
-    bool success = false;
+    if (extracted_fs_thread_data->filename) free(extracted_fs_thread_data->filename);
 
-    /* Override LayeredFS flag, if needed. */
-    if (use_layeredfs_dir && \
-        (title_type == NcmContentMetaType_Unknown || (title_type > NcmContentMetaType_SystemData && title_type < NcmContentMetaType_Application) || \
-        (title_type == NcmContentMetaType_SystemProgram && (content_type != NcmContentType_Program || nca_fs_ctx->section_idx != 0)) || \
-        (title_type == NcmContentMetaType_SystemData && (content_type != NcmContentType_Data || nca_fs_ctx->section_idx != 0)) || \
-        ((title_type == NcmContentMetaType_Application || title_type == NcmContentMetaType_Patch) && (content_type != NcmContentType_Program || nca_fs_ctx->section_idx > 1)) || \
-        ((title_type == NcmContentMetaType_AddOnContent || title_type == NcmContentMetaType_DataPatch) && (content_type != NcmContentType_Data || nca_fs_ctx->section_idx != 0))))
+    return success;
+}
+
+static bool extractedFsInitializeEntries(ExtractedFsThreadData *extracted_fs_thread_data)
+{
+    void *fs_ctx = extracted_fs_thread_data->fs_ctx;
+    ExtractedFsEntry *entries = NULL, *tmp_entries = NULL;
+    u32 entry_count = 0, entry_capacity = 0;
+    u64 stream_offset = 0;
+
+    switch(extracted_fs_thread_data->fs_type)
     {
-        consolePrint("layeredfs setting disabled (unsupported by current content/section type combo)\n");
-        use_layeredfs_dir = false;
+        case ExtractedFsType_Hfs:
+            entry_count = entry_capacity = hfsGetEntryCount((HashFileSystemContext*)fs_ctx);
+            break;
+        case ExtractedFsType_Pfs:
+            entry_count = entry_capacity = pfsGetEntryCount((PartitionFileSystemContext*)fs_ctx);
+            break;
+        case ExtractedFsType_RomFs:
+            /* The RomFS file table has to be traversed to know how many file entries it holds. */
+            romfsResetFileTableOffset((RomFileSystemContext*)fs_ctx);
+            break;
+        default:
+            return false;
     }
 
-    /* Initialize base/patch NCA context, if needed. */
-    if (g_ncaBasePatchTitleInfo)
+    if (entry_capacity && !(entries = calloc(entry_capacity, sizeof(ExtractedFsEntry)))) return false;
+
+    for(u32 i = 0; extracted_fs_thread_data->fs_type == ExtractedFsType_RomFs || i < entry_count; i++)
     {
-        if (!base_patch_content_info)
+        void *fs_entry = NULL;
+        u64 size = 0;
+
+        switch(extracted_fs_thread_data->fs_type)
         {
-            consolePrint("unable to find content with type %s and id offset %u in selected base/patch title!\n", titleGetNcmContentTypeName(content_type), nca_ctx->id_offset);
-            goto end;
+            case ExtractedFsType_Hfs:
+            {
+                HashFileSystemEntry *hfs_entry = hfsGetEntryByIndex((HashFileSystemContext*)fs_ctx, i);
+                if (hfs_entry) size = hfs_entry->size;
+                fs_entry = hfs_entry;
+                break;
+            }
+            case ExtractedFsType_Pfs:
+            {
+                PartitionFileSystemEntry *pfs_entry = pfsGetEntryByIndex((PartitionFileSystemContext*)fs_ctx, i);
+                if (pfs_entry) size = pfs_entry->size;
+                fs_entry = pfs_entry;
+                break;
+            }
+            default:
+            {
+                RomFileSystemContext *romfs_ctx = (RomFileSystemContext*)fs_ctx;
+                RomFileSystemFileEntry *romfs_file_entry = NULL;
+
+                if (!romfsCanMoveToNextFileEntry(romfs_ctx)) break;
+
+                if (!(romfs_file_entry = romfsGetCurrentFileEntry(romfs_ctx)) || !romfsMoveToNextFileEntry(romfs_ctx)) goto end;
+
+                /* Grow the entry array as needed. */
+                if (i >= entry_capacity)
+                {
+                    entry_capacity = (entry_capacity ? (entry_capacity * 2) : 0x100);
+
+                    if (!(tmp_entries = realloc(entries, entry_capacity * sizeof(ExtractedFsEntry)))) goto end;
+
+                    entries = tmp_entries;
+                    tmp_entries = NULL;
+                }
+
+                size = romfs_file_entry->size;
+                fs_entry = romfs_file_entry;
+                entry_count = (i + 1);
+                break;
+            }
         }
 
-        base_patch_nca_ctx = calloc(1, sizeof(NcaContext));
-        if (!base_patch_nca_ctx)
+        if (!fs_entry)
         {
-            consolePrint("failed to allocate memory for base/patch nca ctx!\n");
+            /* We've reached the end of the RomFS file table. */
+            if (extracted_fs_thread_data->fs_type == ExtractedFsType_RomFs) break;
             goto end;
         }
 
-        if (!ncaInitializeContext(base_patch_nca_ctx, g_ncaBasePatchTitleInfo->storage_id, (g_ncaBasePatchTitleInfo->storage_id == NcmStorageId_GameCard ? HashFileSystemPartitionType_Secure : 0), \
-                                  &(g_ncaBasePatchTitleInfo->meta_key), base_patch_content_info, NULL))
+        entries[i].fs_entry = fs_entry;
+        entries[i].size = size;
+        entries[i].stream_offset = stream_offset;
+
+        stream_offset += size;
+    }
+
+    extracted_fs_thread_data->entries = entries;
+    extracted_fs_thread_data->entry_count = entry_count;
+    extracted_fs_thread_data->shared_thread_data.total_size = stream_offset;
+
+    return true;
+
+end:
+    if (entries) free(entries);
+
+    return false;
+}
+
+static ExtractedFsEntry *extractedFsGetEntryByStreamOffset(ExtractedFsThreadData *extracted_fs_thread_data, u32 *idx, u64 offset)
+{
+    /* Each stage gets data blocks in stream order, so it only needs to keep track of its current file entry. Empty file entries are skipped. */
+    while(*idx < extracted_fs_thread_data->entry_count && offset >= (extracted_fs_thread_data->entries[*idx].stream_offset + extracted_fs_thread_data->entries[*idx].size)) (*idx)++;
+
+    return (*idx < extracted_fs_thread_data->entry_count ? &(extracted_fs_thread_data->entries[*idx]) : NULL);
+}
+
+static bool extractedFsGenerateOutputPath(ExtractedFsThreadData *extracted_fs_thread_data, ExtractedFsEntry *entry, char *out_path)
+{
+    u32 dev_idx = g_storageMenuElementOption.selected;
+    size_t filename_len = extracted_fs_thread_data->filename_len;
+    char *entry_name = NULL;
+
+    switch(extracted_fs_thread_data->fs_type)
+    {
+        case ExtractedFsType_Hfs:
+            entry_name = hfsGetEntryName((HashFileSystemContext*)extracted_fs_thread_data->fs_ctx, (HashFileSystemEntry*)entry->fs_entry);
+            break;
+        case ExtractedFsType_Pfs:
+            entry_name = pfsGetEntryName((PartitionFileSystemContext*)extracted_fs_thread_data->fs_ctx, (PartitionFileSystemEntry*)entry->fs_entry);
+            break;
+        default:
+            /* RomFS paths already start with a path separator. */
+            memcpy(out_path, extracted_fs_thread_data->filename, filename_len);
+            return romfsGeneratePathFromFileEntry((RomFileSystemContext*)extracted_fs_thread_data->fs_ctx, (RomFileSystemFileEntry*)entry->fs_entry, out_path + filename_len, \
+                                                  FS_MAX_PATH - filename_len, dev_idx != 0 ? RomFileSystemPathIllegalCharReplaceType_IllegalFsChars : \
+                                                                                             RomFileSystemPathIllegalCharReplaceType_KeepAsciiCharsOnly);
+    }
+
+    if (!entry_name) return false;
+
+    snprintf(out_path, FS_MAX_PATH, "%s/%s", extracted_fs_thread_data->filename, entry_name);
+    utilsReplaceIllegalCharacters(out_path + filename_len + 1, dev_idx == 0);
+
+    return true;
+}
+
+static bool extractedFsSendFileBatchProperties(ExtractedFsThreadData *extracted_fs_thread_data)
+{
+    UsbFileBatchEntry *batch_entries = extracted_fs_thread_data->batch_entries;
+    u32 idx = extracted_fs_thread_data->write_idx, count = 0;
+    bool success = false;
+
+    /* Collect consecutive small file entries, starting with the one about to be opened. */
+    while(count < USB_BATCH_MAX_FILE_COUNT && (idx + count) < extracted_fs_thread_data->entry_count)
+    {
+        ExtractedFsEntry *entry = &(extracted_fs_thread_data->entries[idx + count]);
+        char *batch_path = (extracted_fs_thread_data->batch_paths + (count * FS_MAX_PATH));
+
+        /* Big files are sent on their own. */
+        if (count && entry->size > USB_BATCH_MAX_FILE_SIZE) break;
+
+        if (!extractedFsGenerateOutputPath(extracted_fs_thread_data, entry, batch_path)) return false;
+
+        batch_entries[count].filename = batch_path;
+        batch_entries[count].file_size = entry->size;
+        count++;
+
+        if (entry->size > USB_BATCH_MAX_FILE_SIZE) break;
+    }
+
+    if (!count) return false;
+
+    success = (count == 1 ? usbSendFileProperties(batch_entries[0].file_size, batch_entries[0].filename) : usbSendFileBatchProperties(batch_entries, count));
+    if (success) extracted_fs_thread_data->batch_file_count = count;
+
+    return success;
+}
+
+static bool extractedFsOpenNextEntry(ExtractedFsThreadData *extracted_fs_thread_data)
+{
+    SharedThreadData *shared_thread_data = &(extracted_fs_thread_data->shared_thread_data);
+    ExtractedFsEntry *entry = NULL;
+    char *path = extracted_fs_thread_data->path;
+    u32 dev_idx = g_storageMenuElementOption.selected;
+
+    if (extracted_fs_thread_data->write_idx >= extracted_fs_thread_data->entry_count) return false;
+
+    if (dev_idx == 1)
+    {
+        /* Send file properties for the next batch of files, if needed. */
+        if (!extracted_fs_thread_data->batch_file_count && !extractedFsSendFileBatchProperties(extracted_fs_thread_data))
         {
-            consolePrint("failed to initialize base/patch nca ctx!\n");
-            goto end;
+            consolePrint("failed to send file properties!\n");
+            return false;
         }
 
-        /* Use a matching NCA FS section entry. */
-        base_patch_nca_fs_ctx = &(base_patch_nca_ctx->fs_ctx[nca_fs_ctx->section_idx]);
+        extracted_fs_thread_data->batch_file_count--;
+        extracted_fs_thread_data->write_idx++;
+
+        return true;
     }
 
-    if (section_type == NcaFsSectionType_PartitionFs)
+    /* Close the previous file. */
+    if (shared_thread_data->fp)
     {
-        /* Select the right NCA FS section context, depending on the sparse layer flag. */
-        NcaFsSectionContext *pfs_nca_fs_ctx = (nca_fs_ctx->has_sparse_layer ? base_patch_nca_fs_ctx : nca_fs_ctx);
+        fclose(shared_thread_data->fp);
+        shared_thread_data->fp = NULL;
+        utilsCommitSdCardFileSystemChanges();
+    }
 
-        /* Initialize PartitionFS context. */
-        if (!pfsInitializeContext(&pfs_ctx, pfs_nca_fs_ctx))
+    entry = &(extracted_fs_thread_data->entries[extracted_fs_thread_data->write_idx++]);
+
+    /* Generate output path. */
+    if (!extractedFsGenerateOutputPath(extracted_fs_thread_data, entry, path))
+    {
+        consolePrint("failed to generate output path for file entry #%u!\n", extracted_fs_thread_data->write_idx - 1);
+        return false;
+    }
+
+    /* Create directory tree. */
+    utilsCreateDirectoryTree(path, false);
+
+    if (dev_idx == 0)
+    {
+        /* Create ConcatenationFile if we're dealing with a big file + SD card as the output storage. */
+        if (entry->size > FAT32_FILESIZE_LIMIT && !utilsCreateConcatenationFile(path))
         {
-            consolePrint("pfs initialize ctx failed!\n");
-            goto end;
+            consolePrint("failed to create concatenation file for \"%s\"!\n", path);
+            return false;
         }
-
-        success = (write_raw_section ? saveRawPartitionFsSection(&pfs_ctx, use_layeredfs_dir) : saveExtractedPartitionFsSection(&pfs_ctx, use_layeredfs_dir));
     } else {
-        /* Select the right base/patch NCA FS section contexts. */
-        NcaFsSectionContext *base_nca_fs_ctx = (section_type == NcaFsSectionType_PatchRomFs ? base_patch_nca_fs_ctx : nca_fs_ctx);
-        NcaFsSectionContext *patch_nca_fs_ctx = (section_type == NcaFsSectionType_PatchRomFs ? nca_fs_ctx : base_patch_nca_fs_ctx);
+        /* Don't handle file chunks on FAT12/FAT16/FAT32 formatted UMS devices. */
+        if (g_umsDevices[dev_idx - 2].fs_type < UsbHsFsDeviceFileSystemType_exFAT && entry->size > FAT32_FILESIZE_LIMIT)
+        {
+            consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
+            return false;
+        }
+    }
+
+    /* Open output file. */
+    if (!(shared_thread_data->fp = fopen(path, "wb")))
+    {
+        consolePrint("failed to open \"%s\" for writing!\n", path);
+        return false;
+    }
+
+    /* Set file size. */
+    ftruncate(fileno(shared_thread_data->fp), (off_t)entry->size);
+
+    return true;
+}
+
+static bool extractedFsReadStageFunc(DumpPipelineBuffer *buf, void *userdata)
+{
+    ExtractedFsThreadData *extracted_fs_thread_data = (ExtractedFsThreadData*)userdata;
+    void *fs_ctx = extracted_fs_thread_data->fs_ctx;
+    u64 buf_offset = 0;
+
+    /* Data blocks may span multiple file entries. */
+    while(buf_offset < buf->data_size)
+    {
+        ExtractedFsEntry *entry = extractedFsGetEntryByStreamOffset(extracted_fs_thread_data, &(extracted_fs_thread_data->read_idx), buf->offset + buf_offset);
+        if (!entry) return false;
+
+        u64 entry_offset = (buf->offset + buf_offset - entry->stream_offset), read_size = MIN(buf->data_size - buf_offset, entry->size - entry_offset);
+        u8 *out = (buf->data + buf_offset);
+        bool success = false;
 
-        /* Initialize RomFS context. */
-        if (!romfsInitializeContext(&romfs_ctx, base_nca_fs_ctx, patch_nca_fs_ctx))
+        switch(extracted_fs_thread_data->fs_type)
         {
-            consolePrint("romfs initialize ctx failed!\n");
-            goto end;
+            case ExtractedFsType_Hfs:
+                success = hfsReadEntryData((HashFileSystemContext*)fs_ctx, (HashFileSystemEntry*)entry->fs_entry, out, read_size, entry_offset);
+                break;
+            case ExtractedFsType_Pfs:
+                success = pfsReadEntryData((PartitionFileSystemContext*)fs_ctx, (PartitionFileSystemEntry*)entry->fs_entry, out, read_size, entry_offset);
+                break;
+            default:
+                success = romfsReadFileEntryData((RomFileSystemContext*)fs_ctx, (RomFileSystemFileEntry*)entry->fs_entry, out, read_size, entry_offset);
+                break;
         }
 
-        success = (write_raw_section ? saveRawRomFsSection(&romfs_ctx, use_layeredfs_dir) : saveExtractedRomFsSection(&romfs_ctx, use_layeredfs_dir));
+        if (!success) return false;
+
+        buf_offset += read_size;
     }
 
-end:
-    romfsFreeContext(&romfs_ctx);
+    return true;
+}
 
-    pfsFreeContext(&pfs_ctx);
+static bool extractedFsVerificationStageFunc(DumpPipelineBuffer *buf, void *userdata)
+{
+    ExtractedFsThreadData *extracted_fs_thread_data = (ExtractedFsThreadData*)userdata;
+    HashFileSystemContext *hfs_ctx = (HashFileSystemContext*)extracted_fs_thread_data->fs_ctx;
+    u64 buf_offset = 0;
 
-    if (base_patch_nca_ctx) free(base_patch_nca_ctx);
+    /* Hash FS entries aren't necessarily contiguous within the gamecard image, so data from each one of them is submitted on its own. */
+    while(buf_offset < buf->data_size)
+    {
+        ExtractedFsEntry *entry = extractedFsGetEntryByStreamOffset(extracted_fs_thread_data, &(extracted_fs_thread_data->verify_idx), buf->offset + buf_offset);
+        if (!entry) return false;
 
-    return success;
+        HashFileSystemEntry *hfs_entry = (HashFileSystemEntry*)entry->fs_entry;
+        u64 entry_offset = (buf->offset + buf_offset - entry->stream_offset), data_size = MIN(buf->data_size - buf_offset, entry->size - entry_offset);
+
+        hfsVerificationSubmitData(extracted_fs_thread_data->hfs_verification_data, buf->data + buf_offset, data_size, hfs_ctx->offset + hfs_ctx->header_size + hfs_entry->offset + entry_offset);
+
+        buf_offset += data_size;
+    }
+
+    /* The buffer is given back to the read stage once the write stage is done with it. */
+    hfsVerificationWaitForIdle(extracted_fs_thread_data->hfs_verification_data);
+
+    return true;
 }
 
-static bool saveRawPartitionFsSection(PartitionFileSystemContext *pfs_ctx, bool use_layeredfs_dir)
+static bool extractedFsWriteStageFunc(DumpPipelineBuffer *buf, void *userdata)
 {
-    u64 free_space = 0;
-
-    PfsThreadData pfs_thread_data = {0};
-    SharedThreadData *shared_thread_data = &(pfs_thread_data.shared_thread_data);
+    ExtractedFsThreadData *extracted_fs_thread_data = (ExtractedFsThreadData*)userdata;
+    SharedThreadData *shared_thread_data = &(extracted_fs_thread_data->shared_thread_data);
+    u64 buf_offset = 0;
 
-    NcaFsSectionContext *nca_fs_ctx = pfs_ctx->nca_fs_ctx;
-    NcaContext *nca_ctx = nca_fs_ctx->nca_ctx;
+    while(buf_offset < buf->data_size)
+    {
+        u64 offset = (buf->offset + buf_offset);
+        ExtractedFsEntry *entry = (extracted_fs_thread_data->write_idx ? &(extracted_fs_thread_data->entries[extracted_fs_thread_data->write_idx - 1]) : NULL);
 
-    u64 title_id = nca_ctx->title_id;
-    u8 title_type = nca_ctx->title_type;
+        /* Switch to the output file holding the current data. Empty files are created along the way. */
+        while(!entry || offset >= (entry->stream_offset + entry->size))
+        {
+            if (!extractedFsOpenNextEntry(extracted_fs_thread_data)) return false;
+            entry = &(extracted_fs_thread_data->entries[extracted_fs_thread_data->write_idx - 1]);
+        }
 
-    char subdir[0x20] = {0}, *filename = NULL;
-    u32 dev_idx = g_storageMenuElementOption.selected;
+        u64 write_size = MIN(buf->data_size - buf_offset, entry->stream_offset + entry->size - offset);
+        u8 *data = (buf->data + buf_offset);
 
-    bool success = false;
+        if (useUsbHost() ? !usbSendFileData(data, write_size) : !writeOutputFileData(shared_thread_data->fp, &(shared_thread_data->sd_writer), data, write_size)) return false;
 
-    pfs_thread_data.pfs_ctx = pfs_ctx;
-    pfs_thread_data.use_layeredfs_dir = use_layeredfs_dir;
-    shared_thread_data->total_size = pfs_ctx->size;
+        buf_offset += write_size;
+    }
 
-    consolePrint("raw partitionfs section size: 0x%lX\n", pfs_ctx->size);
+    return true;
+}
 
-    if (use_layeredfs_dir)
-    {
-        /* Only use base title IDs if we're dealing with patches. */
-        title_id = (title_type == NcmContentMetaType_Patch ? titleGetApplicationIdByPatchId(title_id) : \
-                   (title_type == NcmContentMetaType_DataPatch ? titleGetAddOnContentIdByDataPatchId(title_id) : title_id));
+static bool sendResumableFileProperties(u64 file_size, const char *filename, ResumeTailReadFunction read_func, void *userdata, u64 *out_offset)
+{
+    UsbFileResumeInfo resume_info = {0};
+    u8 tail_hash[SHA256_HASH_SIZE] = {0};
+    void *buf = NULL;
+    bool success = false;
 
-        filename = generateOutputLayeredFsFileName(title_id + nca_ctx->id_offset, NULL, "exefs.nsp");
-    } else {
-        snprintf(subdir, MAX_ELEMENTS(subdir), "NCA FS/%s/Raw", nca_ctx->storage_id == NcmStorageId_BuiltInSystem ? "System" : "User");
-        snprintf(path, MAX_ELEMENTS(path), "/%s #%u (%s)/Section #%u (%s).nsp", titleGetNcmContentTypeName(nca_ctx->content_type), nca_ctx->id_offset, nca_ctx->content_id_str, \
-                                                                                nca_fs_ctx->section_idx, ncaGetFsSectionTypeName(nca_fs_ctx));
+    *out_offset = 0;
 
-        TitleInfo *title_info = (title_id == g_ncaUserTitleInfo->meta_key.id ? g_ncaUserTitleInfo : g_ncaBasePatchTitleInfo);
-        filename = generateOutputTitleFileName(title_info, subdir, path);
+    if (!usbSendResumableFileProperties(file_size, filename, &resume_info))
+    {
+        consolePrint("failed to send file properties for \"%s\"!\n", filename);
+        return false;
     }
 
-    if (!filename) goto end;
+    if (!resume_info.offset) return true;
 
-    if (dev_idx == 1)
+    consolePrint("usb host already holds 0x%lX bytes, verifying tail block\n", resume_info.offset);
+
+    /* Read the tail block from our data source and compare its checksum against the one calculated by the USB host. */
+    if (resume_info.tail_size)
     {
-        if (!usbSendFileProperties(shared_thread_data->total_size, filename))
+        if (!(buf = usbAllocatePageAlignedBuffer(resume_info.tail_size)) || !read_func(userdata, buf, resume_info.tail_size, resume_info.offset - resume_info.tail_size))
         {
-            consolePrint("failed to send file properties for \"%s\"!\n", filename);
+            consolePrint("failed to read tail block!\n");
+            usbCancelFileTransfer();
             goto end;
         }
+
+        sha256CalculateHash(tail_hash, buf, resume_info.tail_size);
+    }
+
+    if (resume_info.tail_size && !memcmp(tail_hash, resume_info.tail_hash, SHA256_HASH_SIZE))
+    {
+        *out_offset = resume_info.offset;
+        consolePrint("tail block verified, resuming at offset 0x%lX\n", *out_offset);
     } else {
-        if (!utilsGetFileSystemStatsByPath(filename, NULL, &free_space))
-        {
-            consolePrint("failed to retrieve free space from selected device\n");
-            goto end;
-        }
+        consolePrint("tail block mismatch, restarting transfer\n");
+    }
 
-        if (shared_thread_data->total_size >= free_space)
-        {
-            consolePrint("dump size exceeds free space\n");
-            goto end;
-        }
+    success = usbResumeFileTransfer(*out_offset);
+    if (!success) consolePrint("failed to resume file transfer for \"%s\"!\n", filename);
 
-        utilsCreateDirectoryTree(filename, false);
+end:
+    if (buf) free(buf);
 
-        if (dev_idx == 0)
-        {
-            if (shared_thread_data->total_size > FAT32_FILESIZE_LIMIT && !utilsCreateConcatenationFile(filename))
-            {
-                consolePrint("failed to create concatenation file for \"%s\"!\n", filename);
-                goto end;
-            }
-        } else {
-            if (g_umsDevices[dev_idx - 2].fs_type < UsbHsFsDeviceFileSystemType_exFAT && shared_thread_data->total_size > FAT32_FILESIZE_LIMIT)
-            {
-                consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
-                goto end;
-            }
-        }
+    return success;
+}
 
-        shared_thread_data->fp = fopen(filename, "wb");
-        if (!shared_thread_data->fp)
-        {
-            consolePrint("failed to open \"%s\" for writing!\n", filename);
-            goto end;
-        }
+static bool readGameCardImageTail(void *userdata, void *buf, u64 size, u64 offset)
+{
+    XciThreadData *xci_thread_data = (XciThreadData*)userdata;
+    u64 card_read_size = 0;
 
-        ftruncate(fileno(shared_thread_data->fp), (off_t)shared_thread_data->total_size);
+    if (getGameCardPrependKeyAreaOption())
+    {
+        if (offset < sizeof(GameCardKeyArea)) return false;
+        offset -= sizeof(GameCardKeyArea);
     }
 
-    consoleRefresh();
-
-    success = spanDumpThreads(rawPartitionFsReadThreadFunc, genericWriteThreadFunc, &pfs_thread_data);
+    /* The certificate may have been removed from our output, so don't bother with tail blocks overlapping it. */
+    /* This never happens with proper resume offsets, which are always a multiple of USB_TRANSFER_BUFFER_SIZE. */
+    if (offset < (GAMECARD_CERTIFICATE_OFFSET + sizeof(FsGameCardCertificate))) return false;
 
-    if (success)
+    if (offset < xci_thread_data->card_data_size)
     {
-        consolePrint("successfully saved raw partitionfs section as \"%s\"\n", filename);
-        consoleRefresh();
+        card_read_size = MIN(size, xci_thread_data->card_data_size - offset);
+        if (!gamecardReadStorage(buf, card_read_size, offset)) return false;
     }
 
-end:
-    if (shared_thread_data->fp)
-    {
-        fclose(shared_thread_data->fp);
-        shared_thread_data->fp = NULL;
+    /* Data past the trimmed gamecard size is 0xFF padding. */
+    if (card_read_size < size) memset((u8*)buf + card_read_size, 0xFF, size - card_read_size);
 
-        if (!success && dev_idx != 1)
-        {
-            if (dev_idx == 0)
-            {
-                utilsRemoveConcatenationFile(filename);
-                utilsCommitSdCardFileSystemChanges();
-            } else {
-                remove(filename);
-            }
-        }
-    }
+    return true;
+}
 
-    if (filename) free(filename);
+static bool readNcaTail(void *userdata, void *buf, u64 size, u64 offset)
+{
+    return ncaReadContentFile((NcaContext*)userdata, buf, size, offset);
+}
 
-    return success;
+static bool readRawRomFsTail(void *userdata, void *buf, u64 size, u64 offset)
+{
+    return romfsReadFileSystemData((RomFileSystemContext*)userdata, buf, size, offset);
 }
 
-static bool saveExtractedPartitionFsSection(PartitionFileSystemContext *pfs_ctx, bool use_layeredfs_dir)
+static bool dumpCheckpointInitialize(DumpCheckpointContext *ctx, const char *filename, u8 type, const u8 *source_hash, u64 output_size, u64 base_offset)
 {
-    u64 data_size = 0;
+    if (!ctx || !filename || !*filename || !source_hash || !output_size || base_offset >= output_size) return false;
 
-    PfsThreadData pfs_thread_data = {0};
-    SharedThreadData *shared_thread_data = &(pfs_thread_data.shared_thread_data);
+    size_t path_size = (strlen(filename) + strlen(DUMP_CHECKPOINT_EXTENSION) + 1);
+
+    memset(ctx, 0, sizeof(DumpCheckpointContext));
+
+    /* Checkpoints are stored right next to the output file, since it may be a ConcatenationFile (directory). */
+    if (!(ctx->path = malloc(path_size))) return false;
+    snprintf(ctx->path, path_size, "%s" DUMP_CHECKPOINT_EXTENSION, filename);
+
+    ctx->type = type;
+    memcpy(ctx->source_hash, source_hash, SHA256_HASH_SIZE);
+    ctx->output_size = output_size;
+    ctx->base_offset = base_offset;
+
+    return true;
+}
+
+static bool dumpCheckpointLoad(DumpCheckpointContext *ctx, const char *filename, void *payload, u32 payload_size, DumpCheckpointHeader *out_header, SdWriter *out_writer)
+{
+    if (!ctx || !ctx->path || !filename || (payload_size && !payload) || !out_header || !out_writer) return false;
 
+    DumpCheckpointHeader header = {0};
+    FILE *ckpt_fd = NULL;
+    u32 tail_size = 0;
+    u8 tail_hash[SHA256_HASH_SIZE] = {0};
     bool success = false;
 
-    if (!pfsGetTotalDataSize(pfs_ctx, &data_size))
+    if (!(ckpt_fd = fopen(ctx->path, "rb"))) return false;
+
+    if (fread(&header, 1, sizeof(DumpCheckpointHeader), ckpt_fd) != sizeof(DumpCheckpointHeader) || header.magic != DUMP_CHECKPOINT_MAGIC || \
+        header.version != DUMP_CHECKPOINT_VERSION || header.type != ctx->type || header.payload_size != payload_size || \
+        memcmp(header.source_hash, ctx->source_hash, SHA256_HASH_SIZE) != 0 || header.output_size != ctx->output_size || \
+        header.file_offset != (ctx->base_offset + header.stream_offset) || header.file_offset > header.output_size || \
+        (payload_size && fread(payload, 1, payload_size, ckpt_fd) != payload_size))
     {
-        consolePrint("failed to calculate extracted partitionfs section size!\n");
+        consolePrint("invalid or outdated checkpoint, restarting dump\n");
         goto end;
     }
 
-    if (!data_size)
+    /* Make sure the output file still holds the data covered by this checkpoint, then move the write position right to the resume offset. */
+    if (!sdWriterOpen(out_writer, filename, header.output_size, SD_WRITE_FLUSH_INTERVAL) || !dumpCheckpointGetTailHash(out_writer, header.file_offset, &tail_size, tail_hash) || \
+        tail_size != header.tail_size || memcmp(tail_hash, header.tail_hash, SHA256_HASH_SIZE) != 0 || !sdWriterSeek(out_writer, header.file_offset))
     {
-        consolePrint("partitionfs section is empty!\n");
+        consolePrint("checkpoint tail block mismatch, restarting dump\n");
         goto end;
     }
 
-    pfs_thread_data.pfs_ctx = pfs_ctx;
-    pfs_thread_data.use_layeredfs_dir = use_layeredfs_dir;
-    shared_thread_data->total_size = data_size;
+    consolePrint("checkpoint verified, resuming dump at offset 0x%lX", header.file_offset);
+    if (header.output_size > FAT32_FILESIZE_LIMIT) consolePrint(" (%u completed part(s))", header.completed_part_count);
+    consolePrint("\n");
 
-    consolePrint("extracted partitionfs section size: 0x%lX\n", data_size);
-    consoleRefresh();
+    memcpy(out_header, &header, sizeof(DumpCheckpointHeader));
+
+    ctx->last_offset = header.stream_offset;
+    ctx->available = true;
 
-    success = spanDumpThreads(extractedPartitionFsReadThreadFunc, genericWriteThreadFunc, &pfs_thread_data);
+    success = true;
 
 end:
+    fclose(ckpt_fd);
+
+    if (!success)
+    {
+        sdWriterClose(out_writer);
+        remove(ctx->path);
+    }
+
     return success;
 }
 
-static bool saveRawRomFsSection(RomFileSystemContext *romfs_ctx, bool use_layeredfs_dir)
+static bool dumpCheckpointIsDue(DumpCheckpointContext *ctx, u64 stream_offset)
 {
-    u64 free_space = 0;
+    return (ctx && ctx->path && stream_offset >= (ctx->last_offset + DUMP_CHECKPOINT_INTERVAL));
+}
 
-    RomFsThreadData romfs_thread_data = {0};
-    SharedThreadData *shared_thread_data = &(romfs_thread_data.shared_thread_data);
+static bool dumpCheckpointSave(DumpCheckpointContext *ctx, SdWriter *writer, u64 stream_offset, const void *payload, u32 payload_size)
+{
+    if (!ctx || !ctx->path || !sdWriterIsOpen(writer) || (payload_size && !payload)) return false;
 
-    NcaFsSectionContext *nca_fs_ctx = romfs_ctx->default_storage_ctx->nca_fs_ctx;
-    NcaContext *nca_ctx = nca_fs_ctx->nca_ctx;
+    DumpCheckpointHeader header = {0};
+    char tmp_path[FS_MAX_PATH] = {0};
+    FILE *ckpt_fd = NULL;
+    bool success = false;
 
-    u64 title_id = nca_ctx->title_id;
-    u8 title_type = nca_ctx->title_type;
+    header.magic = DUMP_CHECKPOINT_MAGIC;
+    header.version = DUMP_CHECKPOINT_VERSION;
+    header.type = ctx->type;
+    header.payload_size = payload_size;
+    memcpy(header.source_hash, ctx->source_hash, SHA256_HASH_SIZE);
+    header.output_size = ctx->output_size;
+    header.stream_offset = stream_offset;
+    header.file_offset = (ctx->base_offset + stream_offset);
+    header.completed_part_count = (u32)(header.file_offset / SD_WRITER_PART_SIZE);
 
-    char subdir[0x20] = {0}, *filename = NULL;
-    u32 dev_idx = g_storageMenuElementOption.selected;
+    /* Don't try again until another checkpoint interval has elapsed, even if we fail. */
+    ctx->last_offset = stream_offset;
 
-    bool success = false;
+    /* The checkpoint must never cover data that hasn't made it to the SD card yet. */
+    if (!sdWriterFlush(writer) || !dumpCheckpointGetTailHash(writer, header.file_offset, &(header.tail_size), header.tail_hash)) goto end;
 
-    romfs_thread_data.romfs_ctx = romfs_ctx;
-    romfs_thread_data.use_layeredfs_dir = use_layeredfs_dir;
-    shared_thread_data->total_size = romfs_ctx->size;
+    /* Write the new checkpoint to a temporary file first, so we don't end up with a truncated one if we're interrupted midway. */
+    snprintf(tmp_path, MAX_ELEMENTS(tmp_path), "%s.tmp", ctx->path);
 
-    consolePrint("raw romfs section size: 0x%lX\n", romfs_ctx->size);
+    if (!(ckpt_fd = fopen(tmp_path, "wb"))) goto end;
 
-    if (use_layeredfs_dir)
-    {
-        /* Only use base title IDs if we're dealing with patches. */
-        title_id = (title_type == NcmContentMetaType_Patch ? titleGetApplicationIdByPatchId(title_id) : \
-                   (title_type == NcmContentMetaType_DataPatch ? titleGetAddOnContentIdByDataPatchId(title_id) : title_id));
+    success = (fwrite(&header, 1, sizeof(DumpCheckpointHeader), ckpt_fd) == sizeof(DumpCheckpointHeader) && \
+               (!payload_size || fwrite(payload, 1, payload_size, ckpt_fd) == payload_size) && fflush(ckpt_fd) == 0 && fsync(fileno(ckpt_fd)) == 0);
 
-        filename = generateOutputLayeredFsFileName(title_id + nca_ctx->id_offset, NULL, "romfs.bin");
-    } else {
-        snprintf(subdir, MAX_ELEMENTS(subdir), "NCA FS/%s/Raw", nca_ctx->storage_id == NcmStorageId_BuiltInSystem ? "System" : "User");
-        snprintf(path, MAX_ELEMENTS(path), "/%s #%u (%s)/Section #%u (%s).bin", titleGetNcmContentTypeName(nca_ctx->content_type), nca_ctx->id_offset, nca_ctx->content_id_str, \
-                                                                                nca_fs_ctx->section_idx, ncaGetFsSectionTypeName(nca_fs_ctx));
+    fclose(ckpt_fd);
 
-        TitleInfo *title_info = (title_id == g_ncaUserTitleInfo->meta_key.id ? g_ncaUserTitleInfo : g_ncaBasePatchTitleInfo);
-        filename = generateOutputTitleFileName(title_info, subdir, path);
+    if (success)
+    {
+        remove(ctx->path);
+        success = (rename(tmp_path, ctx->path) == 0);
     }
 
-    if (!filename) goto end;
-
-    if (dev_idx == 1)
+end:
+    if (success)
     {
-        if (!usbSendFileProperties(shared_thread_data->total_size, filename))
-        {
-            consolePrint("failed to send file properties for \"%s\"!\n", filename);
-            goto end;
-        }
+        ctx->available = true;
     } else {
-        if (!utilsGetFileSystemStatsByPath(filename, NULL, &free_space))
-        {
-            consolePrint("failed to retrieve free space from selected device\n");
-            goto end;
-        }
-
-        if (shared_thread_data->total_size >= free_space)
-        {
-            consolePrint("dump size exceeds free space\n");
-            goto end;
-        }
+        if (*tmp_path) remove(tmp_path);
+        consolePrint("failed to save checkpoint at offset 0x%lX\n", header.file_offset);
+    }
 
-        utilsCreateDirectoryTree(filename, false);
+    utilsCommitSdCardFileSystemChanges();
 
-        if (dev_idx == 0)
-        {
-            if (shared_thread_data->total_size > FAT32_FILESIZE_LIMIT && !utilsCreateConcatenationFile(filename))
-            {
-                consolePrint("failed to create concatenation file for \"%s\"!\n", filename);
-                goto end;
-            }
-        } else {
-            if (g_umsDevices[dev_idx - 2].fs_type < UsbHsFsDeviceFileSystemType_exFAT && shared_thread_data->total_size > FAT32_FILESIZE_LIMIT)
-            {
-                consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
-                goto end;
-            }
-        }
+    return success;
+}
 
-        shared_thread_data->fp = fopen(filename, "wb");
-        if (!shared_thread_data->fp)
-        {
-            consolePrint("failed to open \"%s\" for writing!\n", filename);
-            goto end;
-        }
+static void dumpCheckpointDiscard(DumpCheckpointContext *ctx)
+{
+    if (!ctx || !ctx->path) return;
 
-        ftruncate(fileno(shared_thread_data->fp), (off_t)shared_thread_data->total_size);
-    }
+    remove(ctx->path);
+    if (ctx->available) utilsCommitSdCardFileSystemChanges();
 
-    consoleRefresh();
+    ctx->last_offset = 0;
+    ctx->available = false;
+}
 
-    success = spanDumpThreads(rawRomFsReadThreadFunc, genericWriteThreadFunc, &romfs_thread_data);
+static void dumpCheckpointFree(DumpCheckpointContext *ctx)
+{
+    if (!ctx) return;
+    if (ctx->path) free(ctx->path);
+    memset(ctx, 0, sizeof(DumpCheckpointContext));
+}
 
-    if (success)
-    {
-        consolePrint("successfully saved raw romfs section as \"%s\"\n", filename);
-        consoleRefresh();
-    }
+static bool dumpCheckpointGetTailHash(SdWriter *writer, u64 file_offset, u32 *out_size, u8 *out_hash)
+{
+    u32 tail_size = (u32)MIN(file_offset, DUMP_CHECKPOINT_TAIL_SIZE);
+    void *buf = NULL;
+    bool success = false;
 
-end:
-    if (shared_thread_data->fp)
-    {
-        fclose(shared_thread_data->fp);
-        shared_thread_data->fp = NULL;
+    if (!tail_size || !(buf = malloc(tail_size))) return false;
 
-        if (!success && dev_idx != 1)
-        {
-            if (dev_idx == 0)
-            {
-                utilsRemoveConcatenationFile(filename);
-                utilsCommitSdCardFileSystemChanges();
-            } else {
-                remove(filename);
-            }
-        }
+    success = sdWriterRead(writer, buf, tail_size, file_offset - tail_size);
+    if (success)
+    {
+        sha256CalculateHash(out_hash, buf, tail_size);
+        *out_size = tail_size;
     }
 
-    if (filename) free(filename);
+    free(buf);
 
     return success;
 }
 
-static bool saveExtractedRomFsSection(RomFileSystemContext *romfs_ctx, bool use_layeredfs_dir)
+static bool writeOutputFileData(FILE *fp, SdWriter *sd_writer, const void *data, u64 size)
 {
-    u64 data_size = 0;
+    /* SD card dumps bypass stdio altogether. */
+    if (sdWriterIsOpen(sd_writer)) return sdWriterWrite(sd_writer, data, size);
 
-    RomFsThreadData romfs_thread_data = {0};
-    SharedThreadData *shared_thread_data = &(romfs_thread_data.shared_thread_data);
+    return (fp && fwrite(data, 1, size, fp) == size);
+}
 
-    bool success = false;
+static bool genericWriteStageFunc(DumpPipelineBuffer *buf, void *userdata)
+{
+    SharedThreadData *shared_thread_data = (SharedThreadData*)userdata;
 
-    if (!romfsGetTotalDataSize(romfs_ctx, false, &data_size))
-    {
-        consolePrint("failed to calculate extracted romfs section size!\n");
-        goto end;
-    }
+    if (useUsbHost()) return usbSendFileData(buf->data, buf->data_size);
 
-    if (!data_size)
-    {
-        consolePrint("romfs section is empty!\n");
-        goto end;
-    }
+    return writeOutputFileData(shared_thread_data->fp, &(shared_thread_data->sd_writer), buf->data, buf->data_size);
+}
 
-    romfs_thread_data.romfs_ctx = romfs_ctx;
-    romfs_thread_data.use_layeredfs_dir = use_layeredfs_dir;
-    shared_thread_data->total_size = data_size;
+static bool splitWriteStageFunc(DumpPipelineBuffer *buf, void *userdata)
+{
+    SplitWriteStageData *stage_data = (SplitWriteStageData*)userdata;
+    return sdSplitWriterWrite(stage_data->writer, stage_data->lane_idx, buf->data, buf->data_size);
+}
 
-    consolePrint("extracted romfs section size: 0x%lX\n", data_size);
-    consoleRefresh();
+static bool digestHashStageFunc(DumpPipelineBuffer *buf, void *userdata)
+{
+    DigestEngine *digest_engine = (DigestEngine*)userdata;
 
-    success = spanDumpThreads(extractedRomFsReadThreadFunc, genericWriteThreadFunc, &romfs_thread_data);
+    /* Buffers are recycled by the pipeline as soon as the write stage is done with them, so we can't let the hashers work on them in the background. */
+    digestEngineUpdate(digest_engine, buf->data, buf->data_size);
+    digestEngineWaitForIdle(digest_engine);
 
-end:
-    return success;
+    return true;
 }
 
-static void xciReadThreadFunc(void *arg)
+static bool spanDumpPipeline(const DumpPipelineStage *stages, u32 stage_count, SharedThreadData *shared_thread_data)
 {
-    void *buf1 = NULL, *buf2 = NULL;
-    XciThreadData *xci_thread_data = (XciThreadData*)arg;
-    SharedThreadData *shared_thread_data = &(xci_thread_data->shared_thread_data);
+    DumpPipeline pipelines[SD_WRITER_MAX_LANE_COUNT] = {0};
+    DumpPipelineStage lane_stages[DUMP_PIPELINE_MAX_STAGE_COUNT] = {0};
+    SplitWriteStageData lane_data[SD_WRITER_MAX_LANE_COUNT] = {0};
+
+    SdSplitWriter *split_writer = shared_thread_data->sd_split_writer;
+    u32 pipeline_count = (split_writer ? split_writer->lane_count : 1), buffer_count = DUMP_PIPELINE_BUFFER_COUNT;
+
+    time_t start = 0, btn_cancel_start_tmr = 0, btn_cancel_end_tmr = 0;
+    bool btn_cancel_cur_state = false, btn_cancel_prev_state = false, running = false, error = false, success = false;
 
-    buf1 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
-    buf2 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
+    u64 prev_size = 0;
+    u8 prev_time = 0, percent = 0;
 
-    if (!shared_thread_data->total_size || !buf1 || !buf2)
+    if (!stage_count || stage_count > DUMP_PIPELINE_MAX_STAGE_COUNT || !pipeline_count || pipeline_count > SD_WRITER_MAX_LANE_COUNT)
     {
-        shared_thread_data->read_error = true;
-        goto end;
+        consolePrint("invalid pipeline parameters\n");
+        return false;
     }
 
-    shared_thread_data->data = NULL;
-    shared_thread_data->data_size = 0;
+    /* Split the buffer pool between all lanes, so we don't use more memory than a regular pipeline. */
+    if (pipeline_count > 1) buffer_count = MAX(DUMP_PIPELINE_BUFFER_COUNT / pipeline_count, 2);
 
-    bool prepend_key_area = (bool)getGameCardPrependKeyAreaOption();
-    bool keep_certificate = (bool)getGameCardKeepCertificateOption();
-    bool calculate_checksum = (bool)getGameCardCalculateChecksumOption();
-
-    for(u64 offset = 0, blksize = BLOCK_SIZE; offset < shared_thread_data->total_size; offset += blksize)
+    for(u32 i = 0; i < pipeline_count; i++)
     {
-        if (blksize > (shared_thread_data->total_size - offset)) blksize = (shared_thread_data->total_size - offset);
-
-        /* Check if the transfer has been cancelled by the user */
-        if (shared_thread_data->transfer_cancelled)
-        {
-            condvarWakeAll(&g_writeCondvar);
-            break;
-        }
+        const DumpPipelineStage *cur_stages = stages;
+        u64 start_offset = shared_thread_data->resume_offset, end_offset = shared_thread_data->total_size;
 
-        /* Read current data chunk */
-        shared_thread_data->read_error = !gamecardReadStorage(buf1, blksize, offset);
-        if (shared_thread_data->read_error)
+        if (split_writer)
         {
-            condvarWakeAll(&g_writeCondvar);
-            break;
-        }
+            /* Each lane gets its own pipeline, covering the input data that maps to its output file region. Only the write stage is replaced. */
+            lane_data[i].writer = split_writer;
+            lane_data[i].lane_idx = i;
 
-        /* Remove certificate */
-        if (!keep_certificate && offset == 0) memset((u8*)buf1 + GAMECARD_CERTIFICATE_OFFSET, 0xFF, sizeof(FsGameCardCertificate));
+            memcpy(lane_stages, stages, stage_count * sizeof(DumpPipelineStage));
+            lane_stages[stage_count - 1].func = splitWriteStageFunc;
+            lane_stages[stage_count - 1].userdata = &(lane_data[i]);
 
-        /* Update checksum */
-        if (calculate_checksum)
-        {
-            xci_thread_data->xci_crc = crc32CalculateWithSeed(xci_thread_data->xci_crc, buf1, blksize);
-            if (prepend_key_area) xci_thread_data->full_xci_crc = crc32CalculateWithSeed(xci_thread_data->full_xci_crc, buf1, blksize);
+            cur_stages = lane_stages;
+            start_offset = split_writer->lane_offsets[i];
+            end_offset = (start_offset + split_writer->lane_sizes[i]);
         }
 
-        /* Wait until the previous data chunk has been written */
-        mutexLock(&g_fileMutex);
-
-        if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
-
-        if (shared_thread_data->write_error)
+        if (!dumpPipelineInitialize(&(pipelines[i]), cur_stages, stage_count, end_offset, start_offset, BLOCK_SIZE, 0, buffer_count))
         {
-            mutexUnlock(&g_fileMutex);
-            break;
+            consolePrint("failed to initialize dump pipeline\n");
+            goto end;
         }
-
-        /* Update shared object. */
-        shared_thread_data->data = buf1;
-        shared_thread_data->data_size = blksize;
-
-        /* Swap buffers. */
-        buf1 = buf2;
-        buf2 = shared_thread_data->data;
-
-        /* Wake up the write thread to continue writing data. */
-        mutexUnlock(&g_fileMutex);
-        condvarWakeAll(&g_writeCondvar);
     }
 
-end:
-    if (buf2) free(buf2);
-    if (buf1) free(buf1);
-
-    threadExit();
-}
-
-static void rawHfsReadThreadFunc(void *arg)
-{
-    void *buf1 = NULL, *buf2 = NULL;
-    HfsThreadData *hfs_thread_data = (HfsThreadData*)arg;
-    SharedThreadData *shared_thread_data = &(hfs_thread_data->shared_thread_data);
-    HashFileSystemContext *hfs_ctx = hfs_thread_data->hfs_ctx;
-
-    buf1 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
-    buf2 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
+    if (pipeline_count > 1)
+    {
+        consolePrint("starting %u pipelines (%u stages each)\n", pipeline_count, stage_count);
+    } else {
+        consolePrint("starting pipeline (%u stages)\n", stage_count);
+    }
 
-    if (!shared_thread_data->total_size || !hfs_ctx || !buf1 || !buf2)
+    for(u32 i = 0; i < pipeline_count; i++)
     {
-        shared_thread_data->read_error = true;
-        goto end;
+        if (!dumpPipelineStart(&(pipelines[i])))
+        {
+            consolePrint("failed to start dump pipeline\n");
+            goto end;
+        }
     }
 
-    shared_thread_data->data = NULL;
-    shared_thread_data->data_size = 0;
+    consolePrint("hold b to cancel\n\n");
+    consoleRefresh();
+
+    start = time(NULL);
 
-    for(u64 offset = 0, blksize = BLOCK_SIZE; offset < shared_thread_data->total_size; offset += blksize)
+    while(true)
     {
-        if (blksize > (shared_thread_data->total_size - offset)) blksize = (shared_thread_data->total_size - offset);
+        size_t size = shared_thread_data->resume_offset;
+        running = error = false;
 
-        /* Check if the transfer has been cancelled by the user */
-        if (shared_thread_data->transfer_cancelled)
+        for(u32 i = 0; i < pipeline_count; i++)
         {
-            condvarWakeAll(&g_writeCondvar);
-            break;
+            running |= dumpPipelineIsRunning(&(pipelines[i]));
+            error |= dumpPipelineHasFailed(&(pipelines[i]));
+            size += (dumpPipelineGetProcessedSize(&(pipelines[i])) - pipelines[i].start_offset);
         }
 
-        /* Read current data chunk */
-        shared_thread_data->read_error = !hfsReadPartitionData(hfs_ctx, buf1, blksize, offset);
-        if (shared_thread_data->read_error)
-        {
-            condvarWakeAll(&g_writeCondvar);
-            break;
-        }
+        if (!running) break;
 
-        /* Wait until the previous data chunk has been written */
-        mutexLock(&g_fileMutex);
+        /* Don't hog a CPU core the pipeline stages could be using. */
+        utilsAppletLoopDelay();
 
-        if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
+        g_appletStatus = appletMainLoop();
 
-        if (shared_thread_data->write_error)
+        /* Don't let the other lanes keep on going if one of them failed. */
+        if (!g_appletStatus || error)
         {
-            mutexUnlock(&g_fileMutex);
+            if (!error) shared_thread_data->transfer_cancelled = true;
+            for(u32 i = 0; i < pipeline_count; i++) dumpPipelineCancel(&(pipelines[i]));
             break;
         }
 
-        /* Update shared object. */
-        shared_thread_data->data = buf1;
-        shared_thread_data->data_size = blksize;
-
-        /* Swap buffers. */
-        buf1 = buf2;
-        buf2 = shared_thread_data->data;
-
-        /* Wake up the write thread to continue writing data. */
-        mutexUnlock(&g_fileMutex);
-        condvarWakeAll(&g_writeCondvar);
-    }
+        struct tm ts = {0};
+        time_t now = time(NULL);
+        localtime_r(&now, &ts);
 
-end:
-    if (buf2) free(buf2);
-    if (buf1) free(buf1);
+        utilsScanPads();
+        btn_cancel_cur_state = (utilsGetButtonsHeld() & HidNpadButton_B);
 
-    threadExit();
-}
+        if (btn_cancel_cur_state && btn_cancel_cur_state != btn_cancel_prev_state)
+        {
+            btn_cancel_start_tmr = now;
+        } else
+        if (btn_cancel_cur_state && btn_cancel_cur_state == btn_cancel_prev_state)
+        {
+            btn_cancel_end_tmr = now;
+            if ((btn_cancel_end_tmr - btn_cancel_start_tmr) >= 3)
+            {
+                shared_thread_data->transfer_cancelled = true;
+                for(u32 i = 0; i < pipeline_count; i++) dumpPipelineCancel(&(pipelines[i]));
+                break;
+            }
+        } else {
+            btn_cancel_start_tmr = btn_cancel_end_tmr = 0;
+        }
 
-static void extractedHfsReadThreadFunc(void *arg)
-{
-    void *buf1 = NULL, *buf2 = NULL;
-    HfsThreadData *hfs_thread_data = (HfsThreadData*)arg;
-    SharedThreadData *shared_thread_data = &(hfs_thread_data->shared_thread_data);
+        btn_cancel_prev_state = btn_cancel_cur_state;
 
-    HashFileSystemContext *hfs_ctx = hfs_thread_data->hfs_ctx;
-    u32 hfs_entry_count = hfsGetEntryCount(hfs_ctx);
+        if (prev_time == ts.tm_sec || prev_size == size) continue;
 
-    char hfs_path[FS_MAX_PATH] = {0}, *filename = NULL;
-    size_t filename_len = 0;
+        percent = (u8)((size * 100) / shared_thread_data->total_size);
 
-    HashFileSystemEntry *hfs_entry = NULL;
-    char *hfs_entry_name = NULL;
+        prev_time = ts.tm_sec;
+        prev_size = size;
 
-    u64 free_space = 0;
-    u32 dev_idx = g_storageMenuElementOption.selected;
+        consolePrint("%lu / %lu (%u%%) | Time elapsed: %lu\n", size, shared_thread_data->total_size, percent, (now - start));
+        consoleRefresh();
+    }
 
-    buf1 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
-    buf2 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
+    consolePrint("\nwaiting for pipeline stages to finish\n");
+    consoleRefresh();
 
-    snprintf(hfs_path, MAX_ELEMENTS(hfs_path), "/%s", hfs_ctx->name);
-    filename = generateOutputGameCardFileName("HFS/Extracted", hfs_path, true);
-    filename_len = (filename ? strlen(filename) : 0);
+    success = true;
+    error = false;
+    shared_thread_data->data_written = shared_thread_data->resume_offset;
 
-    if (!shared_thread_data->total_size || !hfs_entry_count || !buf1 || !buf2 || !filename)
+    for(u32 i = 0; i < pipeline_count; i++)
     {
-        shared_thread_data->read_error = true;
-        goto end;
+        if (!dumpPipelineWait(&(pipelines[i]))) success = false;
+        error |= dumpPipelineHasFailed(&(pipelines[i]));
+        shared_thread_data->data_written += (dumpPipelineGetProcessedSize(&(pipelines[i])) - pipelines[i].start_offset);
     }
 
-    if (dev_idx != 1)
+    if (success)
     {
-        if (!utilsGetFileSystemStatsByPath(filename, NULL, &free_space))
-        {
-            consolePrint("failed to retrieve free space from selected device\n");
-            shared_thread_data->read_error = true;
-            goto end;
-        }
-
-        if (shared_thread_data->total_size >= free_space)
-        {
-            consolePrint("dump size exceeds free space\n");
-            shared_thread_data->read_error = true;
-            goto end;
-        }
+        start = (time(NULL) - start);
+        consolePrint("process completed in %lu seconds\n", start);
+    } else
+    if (error)
+    {
+        consolePrint("i/o error\n");
+    } else {
+        if (useUsbHost()) usbCancelFileTransfer();
+        consolePrint("process cancelled\n");
     }
 
-    /* Loop through all file entries. */
-    for(u32 i = 0; i < hfs_entry_count; i++)
+    /* Display per-stage timing information. */
+    for(u32 i = 0; i < pipeline_count; i++)
     {
-        /* Check if the transfer has been cancelled by the user. */
-        if (shared_thread_data->transfer_cancelled)
-        {
-            condvarWakeAll(&g_writeCondvar);
-            break;
-        }
+        DumpPipeline *pipeline = &(pipelines[i]);
 
-        if (dev_idx != 1)
+        for(u32 j = 0; j < pipeline->stage_count; j++)
         {
-            /* Wait until the previous data chunk has been written */
-            mutexLock(&g_fileMutex);
-            if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
-            mutexUnlock(&g_fileMutex);
+            DumpPipelineStageStats *stats = &(pipeline->stage_ctx[j].stats);
+            if (pipeline_count > 1) consolePrint("lane #%u ", i);
+            consolePrint("%s: %lu ms busy | %lu ms waiting\n", pipeline->stages[j].name, stats->busy_time / 1000000, stats->wait_time / 1000000);
+        }
 
-            if (shared_thread_data->write_error) break;
+        dumpPipelineLogStats(pipeline);
+    }
 
-            /* Close file. */
-            if (shared_thread_data->fp)
-            {
-                fclose(shared_thread_data->fp);
-                shared_thread_data->fp = NULL;
-                utilsCommitSdCardFileSystemChanges();
-            }
-        }
+end:
+    for(u32 i = 0; i < pipeline_count; i++) dumpPipelineFree(&(pipelines[i]));
 
-        /* Retrieve Hash FS file entry information. */
-        shared_thread_data->read_error = ((hfs_entry = hfsGetEntryByIndex(hfs_ctx, i)) == NULL || (hfs_entry_name = hfsGetEntryName(hfs_ctx, hfs_entry)) == NULL);
-        if (shared_thread_data->read_error)
-        {
-            condvarWakeAll(&g_writeCondvar);
-            break;
-        }
+    consoleRefresh();
 
-        /* Generate output path. */
-        snprintf(hfs_path, MAX_ELEMENTS(hfs_path), "%s/%s", filename, hfs_entry_name);
-        utilsReplaceIllegalCharacters(hfs_path + filename_len + 1, dev_idx == 0);
+    return success;
+}
 
-        if (dev_idx == 1)
-        {
-            /* Wait until the previous data chunk has been written */
-            mutexLock(&g_fileMutex);
-            if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
-            mutexUnlock(&g_fileMutex);
+static bool hfsVerificationInitialize(HfsVerificationData *hfs_verification_data, u8 hfs_partition_type)
+{
+    HashFileSystemContext root_hfs_ctx = {0}, hfs_ctx = {0};
+    const char *hfs_partition_name = NULL;
+    bool success = false;
 
-            if (shared_thread_data->write_error) break;
+    memset(hfs_verification_data, 0, sizeof(HfsVerificationData));
 
-            /* Send current file properties */
-            shared_thread_data->read_error = !usbSendFileProperties(hfs_entry->size, hfs_path);
-        } else {
-            /* Create directory tree. */
-            utilsCreateDirectoryTree(hfs_path, false);
+    if (!gamecardGetHashFileSystemContext(HashFileSystemPartitionType_Root, &root_hfs_ctx))
+    {
+        consolePrint("failed to get root hfs partition context!\n");
+        goto end;
+    }
 
-            if (dev_idx == 0)
-            {
-                /* Create ConcatenationFile if we're dealing with a big file + SD card as the output storage. */
-                if (hfs_entry->size > FAT32_FILESIZE_LIMIT && !utilsCreateConcatenationFile(hfs_path))
-                {
-                    consolePrint("failed to create concatenation file for \"%s\"!\n", hfs_path);
-                    shared_thread_data->read_error = true;
-                }
-            } else {
-                /* Don't handle file chunks on FAT12/FAT16/FAT32 formatted UMS devices. */
-                if (g_umsDevices[dev_idx - 2].fs_type < UsbHsFsDeviceFileSystemType_exFAT && hfs_entry->size > FAT32_FILESIZE_LIMIT)
-                {
-                    consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
-                    shared_thread_data->read_error = true;
-                }
-            }
+    /* Use HashFileSystemPartitionType_None to verify all Hash FS partitions from the inserted gamecard. */
+    for(u8 i = HashFileSystemPartitionType_Root; i < HashFileSystemPartitionType_Count; i++)
+    {
+        if (hfs_partition_type != HashFileSystemPartitionType_None && i != hfs_partition_type) continue;
 
-            if (!shared_thread_data->read_error)
-            {
-                /* Open output file. */
-                shared_thread_data->read_error = ((shared_thread_data->fp = fopen(hfs_path, "wb")) == NULL);
-                if (!shared_thread_data->read_error)
-                {
-                    /* Set file size. */
-                    ftruncate(fileno(shared_thread_data->fp), (off_t)hfs_entry->size);
-                } else {
-                    consolePrint("failed to open \"%s\" for writing!\n", hfs_path);
-                }
-            }
-        }
+        /* Skip partitions that aren't available in the inserted gamecard. */
+        hfs_partition_name = hfsGetPartitionNameString(i);
+        if (i != HashFileSystemPartitionType_Root && !hfsGetEntryByName(&root_hfs_ctx, hfs_partition_name)) continue;
 
-        if (shared_thread_data->read_error)
+        if (!gamecardGetHashFileSystemContext(i, &hfs_ctx))
         {
-            condvarWakeAll(&g_writeCondvar);
-            break;
+            consolePrint("failed to get %s hfs partition context!\n", hfs_partition_name);
+            goto end;
         }
 
-        for(u64 offset = 0, blksize = BLOCK_SIZE; offset < hfs_entry->size; offset += blksize)
-        {
-            if (blksize > (hfs_entry->size - offset)) blksize = (hfs_entry->size - offset);
+        success = hfsVerificationAddPartitionEntries(hfs_verification_data, &hfs_ctx);
+        hfsFreeContext(&hfs_ctx);
+        if (!success) goto end;
+    }
 
-            /* Check if the transfer has been cancelled by the user. */
-            if (shared_thread_data->transfer_cancelled)
-            {
-                condvarWakeAll(&g_writeCondvar);
-                break;
-            }
+    success = false;
 
-            /* Read current file data chunk. */
-            shared_thread_data->read_error = !hfsReadEntryData(hfs_ctx, hfs_entry, buf1, blksize, offset);
-            if (shared_thread_data->read_error)
-            {
-                condvarWakeAll(&g_writeCondvar);
-                break;
-            }
+    if (!hfs_verification_data->entry_count)
+    {
+        consolePrint("no hfs entries available for verification!\n");
+        goto end;
+    }
 
-            /* Wait until the previous file data chunk has been written. */
-            mutexLock(&g_fileMutex);
+    /* Run the verification thread on a different core than the dump threads. */
+    hfs_verification_data->thread_started = utilsCreateThread(&(hfs_verification_data->thread), hfsVerificationThreadFunc, hfs_verification_data, 1);
+    if (!hfs_verification_data->thread_started)
+    {
+        consolePrint("failed to create hfs verification thread!\n");
+        goto end;
+    }
 
-            if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
+    success = true;
 
-            if (shared_thread_data->write_error)
-            {
-                mutexUnlock(&g_fileMutex);
-                break;
-            }
+end:
+    hfsFreeContext(&root_hfs_ctx);
 
-            /* Update shared object. */
-            shared_thread_data->data = buf1;
-            shared_thread_data->data_size = blksize;
+    if (!success) hfsVerificationFree(hfs_verification_data);
 
-            /* Swap buffers. */
-            buf1 = buf2;
-            buf2 = shared_thread_data->data;
+    return success;
+}
 
-            /* Wake up the write thread to continue writing data. */
-            mutexUnlock(&g_fileMutex);
-            condvarWakeAll(&g_writeCondvar);
-        }
+static bool hfsVerificationAddPartitionEntries(HfsVerificationData *hfs_verification_data, HashFileSystemContext *hfs_ctx)
+{
+    u32 hfs_entry_count = hfsGetEntryCount(hfs_ctx);
+    HfsVerificationEntry *tmp_entries = NULL, *cur_entry = NULL;
+    HashFileSystemEntry *hfs_entry = NULL;
+    char *hfs_entry_name = NULL;
 
-        if (shared_thread_data->read_error || shared_thread_data->write_error || shared_thread_data->transfer_cancelled) break;
-    }
+    if (!hfs_entry_count) return true;
 
-    if (!shared_thread_data->read_error && !shared_thread_data->write_error && !shared_thread_data->transfer_cancelled)
+    tmp_entries = realloc(hfs_verification_data->entries, (hfs_verification_data->entry_count + hfs_entry_count) * sizeof(HfsVerificationEntry));
+    if (!tmp_entries)
     {
-        /* Wait until the previous file data chunk has been written. */
-        mutexLock(&g_fileMutex);
-        if (shared_thread_data->data_size) condvarWait(&g_readCondvar, &g_fileMutex);
-        mutexUnlock(&g_fileMutex);
-
-        consolePrint("successfully saved extracted hfs partition data to \"%s\"\n", filename);
-        consoleRefresh();
+        consolePrint("failed to allocate memory for %s hfs verification entries!\n", hfs_ctx->name);
+        return false;
     }
 
-end:
-    if (shared_thread_data->fp)
+    hfs_verification_data->entries = tmp_entries;
+    tmp_entries = NULL;
+
+    for(u32 i = 0; i < hfs_entry_count; i++)
     {
-        fclose(shared_thread_data->fp);
-        shared_thread_data->fp = NULL;
+        if (!(hfs_entry = hfsGetEntryByIndex(hfs_ctx, i)) || !(hfs_entry_name = hfsGetEntryName(hfs_ctx, hfs_entry)))
+        {
+            consolePrint("failed to get %s hfs entry #%u!\n", hfs_ctx->name, i);
+            return false;
+        }
+
+        /* Skip entries without a hash target region. */
+        if (!hfs_entry->hash_target_size) continue;
 
-        if ((shared_thread_data->read_error || shared_thread_data->write_error || shared_thread_data->transfer_cancelled) && dev_idx != 1)
+        cur_entry = &(hfs_verification_data->entries[hfs_verification_data->entry_count]);
+
+        if (!hfsInitializeEntryHashContext(&(cur_entry->hash_ctx), hfs_entry))
         {
-            utilsDeleteDirectoryRecursively(filename);
-            if (dev_idx == 0) utilsCommitSdCardFileSystemChanges();
+            consolePrint("failed to initialize hash context for \"%s/%s\"!\n", hfs_ctx->name, hfs_entry_name);
+            return false;
         }
+
+        snprintf(cur_entry->name, MAX_ELEMENTS(cur_entry->name), "%s/%s", hfs_ctx->name, hfs_entry_name);
+        cur_entry->offset = (hfs_ctx->offset + hfs_ctx->header_size + hfs_entry->offset);
+
+        hfs_verification_data->entry_count++;
     }
 
-    if (filename) free(filename);
+    return true;
+}
+
+static void hfsVerificationSubmitData(HfsVerificationData *hfs_verification_data, const void *data, u64 data_size, u64 offset)
+{
+    if (!hfs_verification_data || !hfs_verification_data->thread_started || !data || !data_size) return;
 
-    if (buf2) free(buf2);
-    if (buf1) free(buf1);
+    mutexLock(&g_hfsVerificationMutex);
 
-    threadExit();
+    /* Wait until the previous data block has been processed. This guarantees the buffer it was stored in can be safely reused by the caller. */
+    while(hfs_verification_data->data_size) condvarWait(&g_hfsVerificationDoneCondvar, &g_hfsVerificationMutex);
+
+    hfs_verification_data->data = data;
+    hfs_verification_data->data_size = data_size;
+    hfs_verification_data->data_offset = offset;
+
+    mutexUnlock(&g_hfsVerificationMutex);
+    condvarWakeAll(&g_hfsVerificationSubmitCondvar);
 }
 
-static void ncaReadThreadFunc(void *arg)
+static void hfsVerificationWaitForIdle(HfsVerificationData *hfs_verification_data)
 {
-    void *buf1 = NULL, *buf2 = NULL;
-    NcaThreadData *nca_thread_data = (NcaThreadData*)arg;
-    SharedThreadData *shared_thread_data = &(nca_thread_data->shared_thread_data);
-    NcaContext *nca_ctx = nca_thread_data->nca_ctx;
+    if (!hfs_verification_data || !hfs_verification_data->thread_started) return;
 
-    buf1 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
-    buf2 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
+    mutexLock(&g_hfsVerificationMutex);
+    while(hfs_verification_data->data_size) condvarWait(&g_hfsVerificationDoneCondvar, &g_hfsVerificationMutex);
+    mutexUnlock(&g_hfsVerificationMutex);
+}
 
-    if (!shared_thread_data->total_size || !nca_ctx || !buf1 || !buf2)
-    {
-        shared_thread_data->read_error = true;
-        goto end;
-    }
+static void hfsVerificationPrintResults(HfsVerificationData *hfs_verification_data)
+{
+    HfsVerificationEntry *cur_entry = NULL;
+    u32 valid_count = 0, mismatch_count = 0, skipped_count = 0;
 
-    shared_thread_data->data = NULL;
-    shared_thread_data->data_size = 0;
+    /* Wait until the verification thread is done with the last data block. */
+    hfsVerificationWaitForIdle(hfs_verification_data);
 
-    for(u64 offset = 0, blksize = BLOCK_SIZE; offset < shared_thread_data->total_size; offset += blksize)
+    for(u32 i = 0; i < hfs_verification_data->entry_count; i++)
     {
-        if (blksize > (shared_thread_data->total_size - offset)) blksize = (shared_thread_data->total_size - offset);
-
-        /* Check if the transfer has been cancelled by the user */
-        if (shared_thread_data->transfer_cancelled)
-        {
-            condvarWakeAll(&g_writeCondvar);
-            break;
-        }
+        cur_entry = &(hfs_verification_data->entries[i]);
 
-        /* Read current data chunk */
-        shared_thread_data->read_error = !ncaReadContentFile(nca_ctx, buf1, blksize, offset);
-        if (shared_thread_data->read_error)
+        /* Hash target regions may not have been fully read (e.g. trimmed gamecard image dumps). */
+        if (!hfsIsEntryHashContextComplete(&(cur_entry->hash_ctx)))
         {
-            condvarWakeAll(&g_writeCondvar);
-            break;
+            skipped_count++;
+            continue;
         }
 
-        /* Wait until the previous data chunk has been written */
-        mutexLock(&g_fileMutex);
-
-        if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
-
-        if (shared_thread_data->write_error)
+        if (hfsVerifyEntryHashContext(&(cur_entry->hash_ctx)))
         {
-            mutexUnlock(&g_fileMutex);
-            break;
+            valid_count++;
+        } else {
+            consolePrint("hfs entry hash mismatch: \"%s\"\n", cur_entry->name);
+            mismatch_count++;
         }
+    }
+
+    consolePrint("hfs entry verification: %u valid | %u mismatch(es) | %u skipped\n", valid_count, mismatch_count, skipped_count);
+}
 
-        /* Update shared object. */
-        shared_thread_data->data = buf1;
-        shared_thread_data->data_size = blksize;
+static void hfsVerificationFree(HfsVerificationData *hfs_verification_data)
+{
+    if (!hfs_verification_data) return;
 
-        /* Swap buffers. */
-        buf1 = buf2;
-        buf2 = shared_thread_data->data;
+    if (hfs_verification_data->thread_started)
+    {
+        mutexLock(&g_hfsVerificationMutex);
+        hfs_verification_data->exit = true;
+        mutexUnlock(&g_hfsVerificationMutex);
+        condvarWakeAll(&g_hfsVerificationSubmitCondvar);
 
-        /* Wake up the write thread to continue writing data. */
-        mutexUnlock(&g_fileMutex);
-        condvarWakeAll(&g_writeCondvar);
+        utilsJoinThread(&(hfs_verification_data->thread));
     }
 
-end:
-    if (buf2) free(buf2);
-    if (buf1) free(buf1);
+    if (hfs_verification_data->entries) free(hfs_verification_data->entries);
 
-    threadExit();
+    memset(hfs_verification_data, 0, sizeof(HfsVerificationData));
 }
 
-static void rawPartitionFsReadThreadFunc(void *arg)
+static void hfsVerificationThreadFunc(void *arg)
 {
-    void *buf1 = NULL, *buf2 = NULL;
-    PfsThreadData *pfs_thread_data = (PfsThreadData*)arg;
-    SharedThreadData *shared_thread_data = &(pfs_thread_data->shared_thread_data);
-    PartitionFileSystemContext *pfs_ctx = pfs_thread_data->pfs_ctx;
-
-    buf1 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
-    buf2 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
+    HfsVerificationData *hfs_verification_data = (HfsVerificationData*)arg;
+    HfsVerificationEntry *cur_entry = NULL;
 
-    if (!shared_thread_data->total_size || !pfs_ctx || !buf1 || !buf2)
-    {
-        shared_thread_data->read_error = true;
-        goto end;
-    }
-
-    shared_thread_data->data = NULL;
-    shared_thread_data->data_size = 0;
+    const u8 *data = NULL;
+    u64 data_size = 0, data_offset = 0, data_end_offset = 0, cur_offset = 0;
 
-    for(u64 offset = 0, blksize = BLOCK_SIZE; offset < shared_thread_data->total_size; offset += blksize)
+    while(true)
     {
-        if (blksize > (shared_thread_data->total_size - offset)) blksize = (shared_thread_data->total_size - offset);
+        /* Wait until a new data block has been submitted. */
+        mutexLock(&g_hfsVerificationMutex);
+        while(!hfs_verification_data->data_size && !hfs_verification_data->exit) condvarWait(&g_hfsVerificationSubmitCondvar, &g_hfsVerificationMutex);
 
-        /* Check if the transfer has been cancelled by the user */
-        if (shared_thread_data->transfer_cancelled)
-        {
-            condvarWakeAll(&g_writeCondvar);
-            break;
-        }
+        data = (const u8*)hfs_verification_data->data;
+        data_size = hfs_verification_data->data_size;
+        data_offset = hfs_verification_data->data_offset;
 
-        /* Read current data chunk */
-        shared_thread_data->read_error = !pfsReadPartitionData(pfs_ctx, buf1, blksize, offset);
-        if (shared_thread_data->read_error)
-        {
-            condvarWakeAll(&g_writeCondvar);
-            break;
-        }
+        mutexUnlock(&g_hfsVerificationMutex);
 
-        /* Wait until the previous data chunk has been written */
-        mutexLock(&g_fileMutex);
+        if (!data_size) break;
 
-        if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
+        data_end_offset = (data_offset + data_size);
 
-        if (shared_thread_data->write_error)
+        /* Update the hash contexts from all entries whose hash target regions overlap with the current data block. */
+        for(u32 i = 0; i < hfs_verification_data->entry_count; i++)
         {
-            mutexUnlock(&g_fileMutex);
-            break;
-        }
-
-        /* Update shared object. */
-        shared_thread_data->data = buf1;
-        shared_thread_data->data_size = blksize;
+            cur_entry = &(hfs_verification_data->entries[i]);
+            if (data_end_offset <= cur_entry->offset || hfsIsEntryHashContextComplete(&(cur_entry->hash_ctx))) continue;
 
-        /* Swap buffers. */
-        buf1 = buf2;
-        buf2 = shared_thread_data->data;
+            cur_offset = MAX(data_offset, cur_entry->offset);
+            hfsUpdateEntryHashContext(&(cur_entry->hash_ctx), data + (cur_offset - data_offset), data_end_offset - cur_offset, cur_offset - cur_entry->offset);
+        }
 
-        /* Wake up the write thread to continue writing data. */
-        mutexUnlock(&g_fileMutex);
-        condvarWakeAll(&g_writeCondvar);
+        /* Let the submitter know we're done with this data block. */
+        mutexLock(&g_hfsVerificationMutex);
+        hfs_verification_data->data = NULL;
+        hfs_verification_data->data_size = 0;
+        mutexUnlock(&g_hfsVerificationMutex);
+        condvarWakeAll(&g_hfsVerificationDoneCondvar);
     }
 
-end:
-    if (buf2) free(buf2);
-    if (buf1) free(buf1);
-
     threadExit();
 }
 
-static void extractedPartitionFsReadThreadFunc(void *arg)
+static void nspThreadFunc(void *arg)
 {
-    void *buf1 = NULL, *buf2 = NULL;
-    PfsThreadData *pfs_thread_data = (PfsThreadData*)arg;
-    SharedThreadData *shared_thread_data = &(pfs_thread_data->shared_thread_data);
+    NspThreadData *nsp_thread_data = (NspThreadData*)arg;
 
-    PartitionFileSystemContext *pfs_ctx = pfs_thread_data->pfs_ctx;
-    u32 pfs_entry_count = pfsGetEntryCount(pfs_ctx);
+    TitleInfo *title_info = NULL;
 
-    char pfs_path[FS_MAX_PATH] = {0}, subdir[0x20] = {0}, *filename = NULL;
-    size_t filename_len = 0;
+    bool success = false;
 
-    PartitionFileSystemEntry *pfs_entry = NULL;
-    char *pfs_entry_name = NULL;
+    u64 free_space = 0;
+    u32 dev_idx = g_storageMenuElementOption.selected;
 
-    NcaFsSectionContext *nca_fs_ctx = pfs_ctx->nca_fs_ctx;
-    NcaContext *nca_ctx = nca_fs_ctx->nca_ctx;
+    u8 *buf = NULL;
+    char *filename = NULL;
+    FILE *fd = NULL;
+    SdWriter sd_writer = {0};
 
-    u64 title_id = nca_ctx->title_id;
-    u8 title_type = nca_ctx->title_type;
+    NspDumpContext local_dump_ctx = {0}, *dump_ctx = NULL;
 
-    u64 free_space = 0;
-    u32 dev_idx = g_storageMenuElementOption.selected;
+    u64 nsp_offset = 0;
+    char *tmp_name = NULL;
 
-    buf1 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
-    buf2 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
+    NspHashData nsp_hash_data = {0};
+    u8 sha256_hash[SHA256_HASH_SIZE] = {0};
 
-    if (pfs_thread_data->use_layeredfs_dir)
-    {
-        /* Only use base title IDs if we're dealing with patches. */
-        title_id = (title_type == NcmContentMetaType_Patch ? titleGetApplicationIdByPatchId(title_id) : \
-                   (title_type == NcmContentMetaType_DataPatch ? titleGetAddOnContentIdByDataPatchId(title_id) : title_id));
+    DigestResult digest_result = {0};
+    bool lookup_checksum = false;
+    u32 dat_match_count = 0;
 
-        filename = generateOutputLayeredFsFileName(title_id + nca_ctx->id_offset, NULL, "exefs");
-    } else {
-        snprintf(subdir, MAX_ELEMENTS(subdir), "NCA FS/%s/Extracted", nca_ctx->storage_id == NcmStorageId_BuiltInSystem ? "System" : "User");
-        snprintf(pfs_path, MAX_ELEMENTS(pfs_path), "/%s #%u (%s)/Section #%u (%s)", titleGetNcmContentTypeName(nca_ctx->content_type), nca_ctx->id_offset, nca_ctx->content_id_str, \
-                                                                                    nca_fs_ctx->section_idx, ncaGetFsSectionTypeName(nca_fs_ctx));
+    DumpCheckpointContext checkpoint = {0};
+    DumpCheckpointHeader checkpoint_header = {0};
+    NspCheckpointState *checkpoint_state = NULL;
+    u32 checkpoint_state_size = 0, start_idx = 0;
+    u64 start_offset = 0;
+    u8 source_hash[SHA256_HASH_SIZE] = {0};
 
-        TitleInfo *title_info = (title_id == g_ncaUserTitleInfo->meta_key.id ? g_ncaUserTitleInfo : g_ncaBasePatchTitleInfo);
-        filename = generateOutputTitleFileName(title_info, subdir, pfs_path);
-    }
+    if (!nsp_thread_data || !(title_info = (TitleInfo*)nsp_thread_data->data) || !title_info->content_count || !title_info->content_infos) goto end;
 
-    filename_len = (filename ? strlen(filename) : 0);
+    /* Use the dump context prepared by the batch scheduler, if available. It's freed by this thread either way. */
+    dump_ctx = (nsp_thread_data->dump_ctx ? nsp_thread_data->dump_ctx : &local_dump_ctx);
 
-    if (!shared_thread_data->total_size || !pfs_entry_count || !buf1 || !buf2 || !filename)
+    /* Allocate memory for the NSP header. NCA data buffers are owned by the dump pipeline. */
+    if (!(buf = usbAllocatePageAlignedBuffer(BLOCK_SIZE)))
     {
-        shared_thread_data->read_error = true;
+        consolePrint("buf alloc failed\n");
         goto end;
     }
 
-    if (dev_idx != 1)
+    /* Hash NCA data on a different core than the dump thread. */
+    if (!nspHashInitialize(&nsp_hash_data))
     {
-        if (!utilsGetFileSystemStatsByPath(filename, NULL, &free_space))
-        {
-            consolePrint("failed to retrieve free space from selected device\n");
-            shared_thread_data->read_error = true;
-            goto end;
-        }
-
-        if (shared_thread_data->total_size >= free_space)
-        {
-            consolePrint("dump size exceeds free space\n");
-            shared_thread_data->read_error = true;
-            goto end;
-        }
+        consolePrint("failed to create nsp hash thread\n");
+        goto end;
     }
 
-    /* Loop through all file entries. */
-    for(u32 i = 0; i < pfs_entry_count; i++)
-    {
-        /* Check if the transfer has been cancelled by the user. */
-        if (shared_thread_data->transfer_cancelled)
-        {
-            condvarWakeAll(&g_writeCondvar);
-            break;
-        }
+    /* Generate output path. */
+    filename = generateOutputTitleFileName(title_info, "NSP", ".nsp");
+    if (!filename) goto end;
 
-        if (dev_idx != 1)
-        {
-            /* Wait until the previous data chunk has been written */
-            mutexLock(&g_fileMutex);
-            if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
-            mutexUnlock(&g_fileMutex);
+    /* Get free space on output storage. */
+    if (dev_idx != 1 && !utilsGetFileSystemStatsByPath(filename, NULL, &free_space))
+    {
+        consolePrint("failed to retrieve free space from selected device\n");
+        goto end;
+    }
 
-            if (shared_thread_data->write_error) break;
+    if (!nsp_thread_data->dump_ctx && !nspPrepareDumpContext(dump_ctx, title_info, NULL)) goto end;
 
-            /* Close file. */
-            if (shared_thread_data->fp)
-            {
-                fclose(shared_thread_data->fp);
-                shared_thread_data->fp = NULL;
-                utilsCommitSdCardFileSystemChanges();
-            }
-        }
+    // only dumps written to the sd card are checkpointed
+    if (dev_idx == 0)
+    {
+        checkpoint_state_size = (u32)(sizeof(NspCheckpointState) + (title_info->content_count * SHA256_HASH_SIZE));
+        nspCalculateCheckpointSourceHash(source_hash, title_info, dump_ctx);
 
-        /* Retrieve Partition FS file entry information. */
-        shared_thread_data->read_error = ((pfs_entry = pfsGetEntryByIndex(pfs_ctx, i)) == NULL || (pfs_entry_name = pfsGetEntryName(pfs_ctx, pfs_entry)) == NULL);
-        if (shared_thread_data->read_error)
+        if (!(checkpoint_state = calloc(1, checkpoint_state_size)) || \
+            !dumpCheckpointInitialize(&checkpoint, filename, DumpCheckpointType_Nsp, source_hash, dump_ctx->nsp_size, 0))
         {
-            condvarWakeAll(&g_writeCondvar);
-            break;
+            consolePrint("failed to initialize nsp checkpoint\n");
+            goto end;
         }
 
-        /* Generate output path. */
-        snprintf(pfs_path, MAX_ELEMENTS(pfs_path), "%s/%s", filename, pfs_entry_name);
-        utilsReplaceIllegalCharacters(pfs_path + filename_len + 1, dev_idx == 0);
-
-        if (dev_idx == 1)
+        // pick up where we left off if a previous dump was interrupted -- the output file is opened by this call
+        if (dumpCheckpointLoad(&checkpoint, filename, checkpoint_state, checkpoint_state_size, &checkpoint_header, &sd_writer))
         {
-            /* Wait until the previous data chunk has been written */
-            mutexLock(&g_fileMutex);
-            if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
-            mutexUnlock(&g_fileMutex);
-
-            if (shared_thread_data->write_error) break;
-
-            /* Send current file properties */
-            shared_thread_data->read_error = !usbSendFileProperties(pfs_entry->size, pfs_path);
-        } else {
-            /* Create directory tree. */
-            utilsCreateDirectoryTree(pfs_path, false);
-
-            if (dev_idx == 0)
+            if (checkpoint_state->content_count != title_info->content_count || checkpoint_state->content_idx >= title_info->content_count || \
+                checkpoint_state->content_offset >= dump_ctx->nca_ctx[checkpoint_state->content_idx].content_size)
             {
-                /* Create ConcatenationFile if we're dealing with a big file + SD card as the output storage. */
-                if (pfs_entry->size > FAT32_FILESIZE_LIMIT && !utilsCreateConcatenationFile(pfs_path))
-                {
-                    consolePrint("failed to create concatenation file for \"%s\"!\n", pfs_path);
-                    shared_thread_data->read_error = true;
-                }
+                consolePrint("invalid checkpoint state, restarting dump\n");
+                sdWriterClose(&sd_writer);
+                dumpCheckpointDiscard(&checkpoint);
             } else {
-                /* Don't handle file chunks on FAT12/FAT16/FAT32 formatted UMS devices. */
-                if (g_umsDevices[dev_idx - 2].fs_type < UsbHsFsDeviceFileSystemType_exFAT && pfs_entry->size > FAT32_FILESIZE_LIMIT)
-                {
-                    consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
-                    shared_thread_data->read_error = true;
-                }
-            }
-
-            if (!shared_thread_data->read_error)
-            {
-                /* Open output file. */
-                shared_thread_data->read_error = ((shared_thread_data->fp = fopen(pfs_path, "wb")) == NULL);
-                if (!shared_thread_data->read_error)
-                {
-                    /* Set file size. */
-                    ftruncate(fileno(shared_thread_data->fp), (off_t)pfs_entry->size);
-                } else {
-                    consolePrint("failed to open \"%s\" for writing!\n", pfs_path);
-                }
+                start_idx = checkpoint_state->content_idx;
+                start_offset = checkpoint_state->content_offset;
             }
         }
 
-        if (shared_thread_data->read_error)
+        checkpoint_state->content_count = title_info->content_count;
+    }
+
+    if (dev_idx == 1)
+    {
+        if (!usbSendNspProperties(dump_ctx->nsp_size, filename, (u32)dump_ctx->nsp_header_size))
         {
-            condvarWakeAll(&g_writeCondvar);
-            break;
+            consolePrint("usb send nsp properties failed\n");
+            goto end;
         }
-
-        for(u64 offset = 0, blksize = BLOCK_SIZE; offset < pfs_entry->size; offset += blksize)
+    } else
+    if (!sdWriterIsOpen(&sd_writer))
+    {
+        if (dump_ctx->nsp_size >= free_space)
         {
-            if (blksize > (pfs_entry->size - offset)) blksize = (pfs_entry->size - offset);
+            consolePrint("nsp size exceeds free space\n");
+            goto end;
+        }
+
+        utilsCreateDirectoryTree(filename, false);
 
-            /* Check if the transfer has been cancelled by the user. */
-            if (shared_thread_data->transfer_cancelled)
+        if (dev_idx == 0)
+        {
+            // preallocate the whole nsp and write to it straight through the fs sysmodule -- concatenation files are created as needed
+            // skip header area -- the full header is written once all entries have been dumped
+            if (!sdWriterCreate(&sd_writer, filename, dump_ctx->nsp_size, SD_WRITE_FLUSH_INTERVAL) || !sdWriterSeek(&sd_writer, dump_ctx->nsp_header_size))
             {
-                condvarWakeAll(&g_writeCondvar);
-                break;
+                consolePrint("failed to create \"%s\"!\n", filename);
+                goto end;
             }
-
-            /* Read current file data chunk. */
-            shared_thread_data->read_error = !pfsReadEntryData(pfs_ctx, pfs_entry, buf1, blksize, offset);
-            if (shared_thread_data->read_error)
+        } else {
+            if (g_umsDevices[dev_idx - 2].fs_type < UsbHsFsDeviceFileSystemType_exFAT && dump_ctx->nsp_size > FAT32_FILESIZE_LIMIT)
             {
-                condvarWakeAll(&g_writeCondvar);
-                break;
+                consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
+                goto end;
             }
 
-            /* Wait until the previous file data chunk has been written. */
-            mutexLock(&g_fileMutex);
-
-            if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
-
-            if (shared_thread_data->write_error)
+            if (!(fd = fopen(filename, "wb")))
             {
-                mutexUnlock(&g_fileMutex);
-                break;
+                consolePrint("fopen failed\n");
+                goto end;
             }
 
-            /* Update shared object. */
-            shared_thread_data->data = buf1;
-            shared_thread_data->data_size = blksize;
-
-            /* Swap buffers. */
-            buf1 = buf2;
-            buf2 = shared_thread_data->data;
+            // set file size
+            ftruncate(fileno(fd), (off_t)dump_ctx->nsp_size);
 
-            /* Wake up the write thread to continue writing data. */
-            mutexUnlock(&g_fileMutex);
-            condvarWakeAll(&g_writeCondvar);
+            // skip header area -- the full header is written once all entries have been dumped
+            fseek(fd, (long)dump_ctx->nsp_header_size, SEEK_SET);
         }
-
-        if (shared_thread_data->read_error || shared_thread_data->write_error || shared_thread_data->transfer_cancelled) break;
     }
 
-    if (!shared_thread_data->read_error && !shared_thread_data->write_error && !shared_thread_data->transfer_cancelled)
-    {
-        /* Wait until the previous file data chunk has been written. */
-        mutexLock(&g_fileMutex);
-        if (shared_thread_data->data_size) condvarWait(&g_readCondvar, &g_fileMutex);
-        mutexUnlock(&g_fileMutex);
+    consolePrint("dump process started, please wait. hold b to cancel.\n");
+    consoleRefresh();
 
-        consolePrint("successfully saved extracted partitionfs section data to \"%s\"\n", filename);
-        consoleRefresh();
-    }
+    nsp_offset += dump_ctx->nsp_header_size;
 
-end:
-    if (shared_thread_data->fp)
-    {
-        fclose(shared_thread_data->fp);
-        shared_thread_data->fp = NULL;
+    // set nsp size
+    nsp_thread_data->total_size = dump_ctx->nsp_size;
 
-        if ((shared_thread_data->read_error || shared_thread_data->write_error || shared_thread_data->transfer_cancelled) && dev_idx != 1)
-        {
-            utilsDeleteDirectoryRecursively(filename);
-            if (dev_idx == 0) utilsCommitSdCardFileSystemChanges();
-        }
+    // nca hashes are calculated during the dump process anyway, so they can be looked up right away
+    if (configGetBoolean("nsp/lookup_checksum") && datIsLoading())
+    {
+        consolePrint("waiting for dat files to load...\n");
+        consoleRefresh();
     }
 
-    if (filename) free(filename);
+    lookup_checksum = (configGetBoolean("nsp/lookup_checksum") && datGetEntryCount() > 0);
 
-    if (buf2) free(buf2);
-    if (buf1) free(buf1);
+    // restore ncas dumped before the checkpoint -- their hashes are all we need to update the cnmt and the pfs entry names
+    if (checkpoint.available)
+    {
+        nsp_offset = checkpoint_header.file_offset;
+        nsp_thread_data->data_written = (nsp_offset - dump_ctx->nsp_header_size);
 
-    threadExit();
-}
+        for(u32 i = 0; i < start_idx; i++)
+        {
+            NcaContext *cur_nca_ctx = &(dump_ctx->nca_ctx[i]);
 
-static void rawRomFsReadThreadFunc(void *arg)
-{
-    void *buf1 = NULL, *buf2 = NULL;
-    RomFsThreadData *romfs_thread_data = (RomFsThreadData*)arg;
-    SharedThreadData *shared_thread_data = &(romfs_thread_data->shared_thread_data);
-    RomFileSystemContext *romfs_ctx = romfs_thread_data->romfs_ctx;
+            ncaUpdateContentIdAndHash(cur_nca_ctx, checkpoint_state->content_hashes[i]);
 
-    buf1 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
-    buf2 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
+            if (!cnmtUpdateContentInfo(&(dump_ctx->cnmt_ctx), cur_nca_ctx) || !pfsUpdateEntryNameFromFileContext(&(dump_ctx->pfs_file_ctx), i, cur_nca_ctx->content_id_str))
+            {
+                consolePrint("failed to restore nca #%u from checkpoint\n", i);
+                goto end;
+            }
 
-    if (!shared_thread_data->total_size || !romfs_ctx || !buf1 || !buf2)
-    {
-        shared_thread_data->read_error = true;
-        goto end;
+            if (lookup_checksum)
+            {
+                memcpy(digest_result.sha256, checkpoint_state->content_hashes[i], SHA256_HASH_SIZE);
+                if (datLookupEntry(cur_nca_ctx->content_size, &digest_result, DigestTypeMask_Sha256, NULL, 0) != DatMatchType_None) dat_match_count++;
+            }
+        }
     }
 
-    shared_thread_data->data = NULL;
-    shared_thread_data->data_size = 0;
-
-    for(u64 offset = 0, blksize = BLOCK_SIZE; offset < shared_thread_data->total_size; offset += blksize)
+    // write ncas
+    for(u32 i = start_idx; i < title_info->content_count; i++)
     {
-        if (blksize > (shared_thread_data->total_size - offset)) blksize = (shared_thread_data->total_size - offset);
+        NcaContext *cur_nca_ctx = &(dump_ctx->nca_ctx[i]);
+        u64 nca_start_offset = (i == start_idx ? start_offset : 0);
 
-        /* Check if the transfer has been cancelled by the user */
-        if (shared_thread_data->transfer_cancelled)
-        {
-            condvarWakeAll(&g_writeCondvar);
-            break;
-        }
+        nspHashReset(&nsp_hash_data);
 
-        /* Read current data chunk */
-        shared_thread_data->read_error = !romfsReadFileSystemData(romfs_ctx, buf1, blksize, offset);
-        if (shared_thread_data->read_error)
+        // restore the running hash for the nca we were dumping when the checkpoint was saved
+        if (i == start_idx && start_offset) nspHashSetState(&nsp_hash_data, &(checkpoint_state->sha256_ctx));
+
+        if (cur_nca_ctx->content_type == NcmContentType_Meta && (!cnmtGenerateNcaPatch(&(dump_ctx->cnmt_ctx)) || !ncaEncryptHeader(cur_nca_ctx)))
         {
-            condvarWakeAll(&g_writeCondvar);
-            break;
+            consolePrint("cnmt generate patch failed\n");
+            goto end;
         }
 
-        /* Wait until the previous data chunk has been written */
-        mutexLock(&g_fileMutex);
-
-        if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
-
-        if (shared_thread_data->write_error)
+        if (dev_idx == 1)
         {
-            mutexUnlock(&g_fileMutex);
-            break;
+            tmp_name = pfsGetEntryNameByIndexFromFileContext(&(dump_ctx->pfs_file_ctx), i);
+            if (!usbSendFileProperties(cur_nca_ctx->content_size, tmp_name))
+            {
+                consolePrint("usb send file properties \"%s\" failed\n", tmp_name);
+                goto end;
+            }
         }
 
-        /* Update shared object. */
-        shared_thread_data->data = buf1;
-        shared_thread_data->data_size = blksize;
-
-        /* Swap buffers. */
-        buf1 = buf2;
-        buf2 = shared_thread_data->data;
-
-        /* Wake up the write thread to continue writing data. */
-        mutexUnlock(&g_fileMutex);
-        condvarWakeAll(&g_writeCondvar);
-    }
-
-end:
-    if (buf2) free(buf2);
-    if (buf1) free(buf1);
+        NspNcaStageData nca_stage_data = {
+            .nsp_thread_data = nsp_thread_data,
+            .dump_ctx = dump_ctx,
+            .nca_ctx = cur_nca_ctx,
+            .content_idx = i,
+            .nsp_offset = (nsp_offset - nca_start_offset),
+            .dirty_header = ncaIsHeaderDirty(cur_nca_ctx),
+            .nsp_hash_data = &nsp_hash_data,
+            .fd = fd,
+            .sd_writer = &sd_writer,
+            .checkpoint = &checkpoint,
+            .checkpoint_state = checkpoint_state,
+            .checkpoint_state_size = checkpoint_state_size
+        };
 
-    threadExit();
-}
+        // read and patch upcoming nca blocks while the current one is being hashed and written
+        DumpPipelineStage stages[3] = {0};
+        u32 stage_count = 0;
 
-static void extractedRomFsReadThreadFunc(void *arg)
-{
-    void *buf1 = NULL, *buf2 = NULL;
-    RomFsThreadData *romfs_thread_data = (RomFsThreadData*)arg;
-    SharedThreadData *shared_thread_data = &(romfs_thread_data->shared_thread_data);
+        stages[stage_count++] = (DumpPipelineStage){ .type = DumpPipelineStageType_Read, .name = "nca read", .func = ncaReadStageFunc, .userdata = cur_nca_ctx, .cpu_id = 1 };
 
-    RomFileSystemContext *romfs_ctx = romfs_thread_data->romfs_ctx;
-    RomFileSystemFileEntry *romfs_file_entry = NULL;
+        if (nca_stage_data.dirty_header) stages[stage_count++] = (DumpPipelineStage){ .type = DumpPipelineStageType_Process, .name = "nca patch", .func = nspNcaPatchStageFunc, \
+                                                                                      .userdata = &nca_stage_data, .cpu_id = 0 };
 
-    char romfs_path[FS_MAX_PATH] = {0}, subdir[0x20] = {0}, *filename = NULL;
-    size_t filename_len = 0;
+        stages[stage_count++] = (DumpPipelineStage){ .type = DumpPipelineStageType_Write, .name = "write", .func = nspNcaWriteStageFunc, .userdata = &nca_stage_data, .cpu_id = 2 };
 
-    NcaFsSectionContext *nca_fs_ctx = romfs_ctx->default_storage_ctx->nca_fs_ctx;
-    NcaContext *nca_ctx = nca_fs_ctx->nca_ctx;
+        DumpPipeline pipeline = {0};
 
-    u64 title_id = nca_ctx->title_id;
-    u8 title_type = nca_ctx->title_type;
+        bool nca_dumped = (dumpPipelineInitialize(&pipeline, stages, stage_count, cur_nca_ctx->content_size, nca_start_offset, BLOCK_SIZE, 0, DUMP_PIPELINE_BUFFER_COUNT) && \
+                           dumpPipelineStart(&pipeline) && dumpPipelineWait(&pipeline));
 
-    u64 free_space = 0;
-    u32 dev_idx = g_storageMenuElementOption.selected;
-    u8 romfs_illegal_char_replace_type = (dev_idx != 0 ? RomFileSystemPathIllegalCharReplaceType_IllegalFsChars : RomFileSystemPathIllegalCharReplaceType_KeepAsciiCharsOnly);
+        dumpPipelineLogStats(&pipeline);
+        dumpPipelineFree(&pipeline);
 
-    buf1 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
-    buf2 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
+        if (!nca_dumped)
+        {
+            mutexLock(&g_fileMutex);
+            bool cancelled = nsp_thread_data->transfer_cancelled;
+            mutexUnlock(&g_fileMutex);
 
-    if (romfs_thread_data->use_layeredfs_dir)
-    {
-        /* Only use base title IDs if we're dealing with patches. */
-        title_id = (title_type == NcmContentMetaType_Patch ? titleGetApplicationIdByPatchId(title_id) : \
-                   (title_type == NcmContentMetaType_DataPatch ? titleGetAddOnContentIdByDataPatchId(title_id) : title_id));
+            if (cancelled)
+            {
+                if (dev_idx == 1) usbCancelFileTransfer();
+            } else {
+                consolePrint("failed to dump nca \"%s\"\n", cur_nca_ctx->content_id_str);
+            }
 
-        filename = generateOutputLayeredFsFileName(title_id + nca_ctx->id_offset, NULL, "romfs");
-    } else {
-        snprintf(subdir, MAX_ELEMENTS(subdir), "NCA FS/%s/Extracted", nca_ctx->storage_id == NcmStorageId_BuiltInSystem ? "System" : "User");
-        snprintf(romfs_path, MAX_ELEMENTS(romfs_path), "/%s #%u (%s)/Section #%u (%s)", titleGetNcmContentTypeName(nca_ctx->content_type), nca_ctx->id_offset, nca_ctx->content_id_str, \
-                                                                                        nca_fs_ctx->section_idx, ncaGetFsSectionTypeName(nca_fs_ctx));
+            goto end;
+        }
 
-        TitleInfo *title_info = (title_id == g_ncaUserTitleInfo->meta_key.id ? g_ncaUserTitleInfo : g_ncaBasePatchTitleInfo);
-        filename = generateOutputTitleFileName(title_info, subdir, romfs_path);
-    }
+        nsp_offset += (cur_nca_ctx->content_size - nca_start_offset);
 
-    filename_len = (filename ? strlen(filename) : 0);
+        // get hash -- waits until the hash thread is done with the last data block
+        nspHashGetHash(&nsp_hash_data, sha256_hash);
 
-    if (!shared_thread_data->total_size || !buf1 || !buf2 || !filename)
-    {
-        shared_thread_data->read_error = true;
-        goto end;
-    }
+        // update content id and hash
+        ncaUpdateContentIdAndHash(cur_nca_ctx, sha256_hash);
 
-    snprintf(romfs_path, MAX_ELEMENTS(romfs_path), "%s", filename);
+        // keep track of nca hashes for future checkpoints
+        if (checkpoint_state) memcpy(checkpoint_state->content_hashes[i], sha256_hash, SHA256_HASH_SIZE);
 
-    if (dev_idx != 1)
-    {
-        if (!utilsGetFileSystemStatsByPath(filename, NULL, &free_space))
+        // look up nca hash
+        if (lookup_checksum)
         {
-            consolePrint("failed to retrieve free space from selected device\n");
-            shared_thread_data->read_error = true;
-            goto end;
+            memcpy(digest_result.sha256, sha256_hash, sizeof(sha256_hash));
+            if (datLookupEntry(cur_nca_ctx->content_size, &digest_result, DigestTypeMask_Sha256, NULL, 0) != DatMatchType_None) dat_match_count++;
         }
 
-        if (shared_thread_data->total_size >= free_space)
+        // update cnmt
+        if (!cnmtUpdateContentInfo(&(dump_ctx->cnmt_ctx), cur_nca_ctx))
         {
-            consolePrint("dump size exceeds free space\n");
-            shared_thread_data->read_error = true;
+            consolePrint("cnmt update content info failed\n");
             goto end;
         }
-    }
-
-    /* Reset current file table offset. */
-    romfsResetFileTableOffset(romfs_ctx);
-
-    /* Loop through all file entries. */
-    while(shared_thread_data->data_written < shared_thread_data->total_size && romfsCanMoveToNextFileEntry(romfs_ctx))
-    {
-        /* Check if the transfer has been cancelled by the user. */
-        if (shared_thread_data->transfer_cancelled)
-        {
-            condvarWakeAll(&g_writeCondvar);
-            break;
-        }
 
-        if (dev_idx != 1)
+        // update pfs entry name
+        if (!pfsUpdateEntryNameFromFileContext(&(dump_ctx->pfs_file_ctx), i, cur_nca_ctx->content_id_str))
         {
-            /* Wait until the previous data chunk has been written */
-            mutexLock(&g_fileMutex);
-            if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
-            mutexUnlock(&g_fileMutex);
-
-            if (shared_thread_data->write_error) break;
-
-            /* Close file. */
-            if (shared_thread_data->fp)
-            {
-                fclose(shared_thread_data->fp);
-                shared_thread_data->fp = NULL;
-                utilsCommitSdCardFileSystemChanges();
-            }
+            consolePrint("pfs update entry name failed for nca \"%s\"\n", cur_nca_ctx->content_id_str);
+            goto end;
         }
+    }
 
-        /* Retrieve RomFS file entry information and generate output path. */
-        shared_thread_data->read_error = (!(romfs_file_entry = romfsGetCurrentFileEntry(romfs_ctx)) || \
-                                           !romfsGeneratePathFromFileEntry(romfs_ctx, romfs_file_entry, romfs_path + filename_len, FS_MAX_PATH - filename_len, romfs_illegal_char_replace_type));
-        if (shared_thread_data->read_error)
+    if (dump_ctx->generate_authoringtool_data)
+    {
+        // regenerate cnmt xml
+        if (!cnmtGenerateAuthoringToolXml(&(dump_ctx->cnmt_ctx), dump_ctx->nca_ctx, title_info->content_count))
         {
-            condvarWakeAll(&g_writeCondvar);
-            break;
+            consolePrint("cnmt xml #2 failed\n");
+            goto end;
         }
 
+        // write cnmt xml
         if (dev_idx == 1)
         {
-            /* Wait until the previous data chunk has been written */
-            mutexLock(&g_fileMutex);
-            if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
-            mutexUnlock(&g_fileMutex);
-
-            if (shared_thread_data->write_error) break;
-
-            /* Send current file properties */
-            shared_thread_data->read_error = !usbSendFileProperties(romfs_file_entry->size, romfs_path);
-        } else {
-            /* Create directory tree. */
-            utilsCreateDirectoryTree(romfs_path, false);
-
-            if (dev_idx == 0)
-            {
-                /* Create ConcatenationFile if we're dealing with a big file + SD card as the output storage. */
-                if (romfs_file_entry->size > FAT32_FILESIZE_LIMIT && !utilsCreateConcatenationFile(romfs_path))
-                {
-                    consolePrint("failed to create concatenation file for \"%s\"!\n", romfs_path);
-                    shared_thread_data->read_error = true;
-                }
-            } else {
-                /* Don't handle file chunks on FAT12/FAT16/FAT32 formatted UMS devices. */
-                if (g_umsDevices[dev_idx - 2].fs_type < UsbHsFsDeviceFileSystemType_exFAT && romfs_file_entry->size > FAT32_FILESIZE_LIMIT)
-                {
-                    consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
-                    shared_thread_data->read_error = true;
-                }
-            }
-
-            if (!shared_thread_data->read_error)
+            tmp_name = pfsGetEntryNameByIndexFromFileContext(&(dump_ctx->pfs_file_ctx), dump_ctx->meta_nca_ctx->content_type_ctx_data_idx);
+            if (!usbSendFileProperties(dump_ctx->cnmt_ctx.authoring_tool_xml_size, tmp_name) || !usbSendFileData(dump_ctx->cnmt_ctx.authoring_tool_xml, dump_ctx->cnmt_ctx.authoring_tool_xml_size))
             {
-                /* Open output file. */
-                shared_thread_data->read_error = ((shared_thread_data->fp = fopen(romfs_path, "wb")) == NULL);
-                if (!shared_thread_data->read_error)
-                {
-                    /* Set file size. */
-                    ftruncate(fileno(shared_thread_data->fp), (off_t)romfs_file_entry->size);
-                } else {
-                    consolePrint("failed to open \"%s\" for writing!\n", romfs_path);
-                }
+                consolePrint("send \"%s\" failed\n", tmp_name);
+                goto end;
             }
+        } else {
+            writeOutputFileData(fd, &sd_writer, dump_ctx->cnmt_ctx.authoring_tool_xml, dump_ctx->cnmt_ctx.authoring_tool_xml_size);
         }
 
-        if (shared_thread_data->read_error)
+        nsp_offset += dump_ctx->cnmt_ctx.authoring_tool_xml_size;
+        nsp_thread_data->data_written += dump_ctx->cnmt_ctx.authoring_tool_xml_size;
+
+        // update cnmt xml pfs entry name
+        if (!pfsUpdateEntryNameFromFileContext(&(dump_ctx->pfs_file_ctx), dump_ctx->meta_nca_ctx->content_type_ctx_data_idx, dump_ctx->meta_nca_ctx->content_id_str))
         {
-            condvarWakeAll(&g_writeCondvar);
-            break;
+            consolePrint("pfs update entry name cnmt xml failed\n");
+            goto end;
         }
+    }
 
-        for(u64 offset = 0, blksize = BLOCK_SIZE; offset < romfs_file_entry->size; offset += blksize)
-        {
-            if (blksize > (romfs_file_entry->size - offset)) blksize = (romfs_file_entry->size - offset);
+    // write content type ctx data
+    for(u32 i = 0; i < dump_ctx->content_type_ctx_count; i++)
+    {
+        NcaContext *cur_nca_ctx = &(dump_ctx->nca_ctx[i]);
+        if (!cur_nca_ctx->content_type_ctx) continue;
 
-            /* Check if the transfer has been cancelled by the user. */
-            if (shared_thread_data->transfer_cancelled)
-            {
-                condvarWakeAll(&g_writeCondvar);
-                break;
-            }
+        char *authoring_tool_xml = NULL;
+        u64 authoring_tool_xml_size = 0;
+        u32 data_idx = cur_nca_ctx->content_type_ctx_data_idx;
 
-            /* Read current file data chunk. */
-            shared_thread_data->read_error = !romfsReadFileEntryData(romfs_ctx, romfs_file_entry, buf1, blksize, offset);
-            if (shared_thread_data->read_error)
+        switch(cur_nca_ctx->content_type)
+        {
+            case NcmContentType_Program:
             {
-                condvarWakeAll(&g_writeCondvar);
+                ProgramInfoContext *cur_program_info_ctx = (ProgramInfoContext*)cur_nca_ctx->content_type_ctx;
+                authoring_tool_xml = cur_program_info_ctx->authoring_tool_xml;
+                authoring_tool_xml_size = cur_program_info_ctx->authoring_tool_xml_size;
                 break;
             }
+            case NcmContentType_Control:
+            {
+                NacpContext *cur_nacp_ctx = (NacpContext*)cur_nca_ctx->content_type_ctx;
+                authoring_tool_xml = cur_nacp_ctx->authoring_tool_xml;
+                authoring_tool_xml_size = cur_nacp_ctx->authoring_tool_xml_size;
 
-            /* Wait until the previous file data chunk has been written. */
-            mutexLock(&g_fileMutex);
+                // loop through available icons
+                for(u8 j = 0; j < cur_nacp_ctx->icon_count; j++)
+                {
+                    NacpIconContext *icon_ctx = &(cur_nacp_ctx->icon_ctx[j]);
+
+                    // write icon
+                    if (dev_idx == 1)
+                    {
+                        tmp_name = pfsGetEntryNameByIndexFromFileContext(&(dump_ctx->pfs_file_ctx), data_idx);
+                        if (!usbSendFileProperties(icon_ctx->icon_size, tmp_name) || !usbSendFileData(icon_ctx->icon_data, icon_ctx->icon_size))
+                        {
+                            consolePrint("send \"%s\" failed\n", tmp_name);
+                            goto end;
+                        }
+                    } else {
+                        writeOutputFileData(fd, &sd_writer, icon_ctx->icon_data, icon_ctx->icon_size);
+                    }
+
+                    nsp_offset += icon_ctx->icon_size;
+                    nsp_thread_data->data_written += icon_ctx->icon_size;
 
-            if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
+                    // update pfs entry name
+                    if (!pfsUpdateEntryNameFromFileContext(&(dump_ctx->pfs_file_ctx), data_idx++, cur_nca_ctx->content_id_str))
+                    {
+                        consolePrint("pfs update entry name failed for icon \"%s\" (%u)\n", cur_nca_ctx->content_id_str, icon_ctx->language);
+                        goto end;
+                    }
+                }
 
-            if (shared_thread_data->write_error)
+                break;
+            }
+            case NcmContentType_LegalInformation:
             {
-                mutexUnlock(&g_fileMutex);
+                LegalInfoContext *cur_legal_info_ctx = (LegalInfoContext*)cur_nca_ctx->content_type_ctx;
+                authoring_tool_xml = cur_legal_info_ctx->authoring_tool_xml;
+                authoring_tool_xml_size = cur_legal_info_ctx->authoring_tool_xml_size;
                 break;
             }
-
-            /* Update shared object. */
-            shared_thread_data->data = buf1;
-            shared_thread_data->data_size = blksize;
-
-            /* Swap buffers. */
-            buf1 = buf2;
-            buf2 = shared_thread_data->data;
-
-            /* Wake up the write thread to continue writing data. */
-            mutexUnlock(&g_fileMutex);
-            condvarWakeAll(&g_writeCondvar);
+            default:
+                break;
         }
 
-        if (shared_thread_data->read_error || shared_thread_data->write_error || shared_thread_data->transfer_cancelled) break;
-
-        /* Move to the next file entry. */
-        shared_thread_data->read_error = !romfsMoveToNextFileEntry(romfs_ctx);
-        if (shared_thread_data->read_error)
+        // write xml
+        if (dev_idx == 1)
         {
-            condvarWakeAll(&g_writeCondvar);
-            break;
+            tmp_name = pfsGetEntryNameByIndexFromFileContext(&(dump_ctx->pfs_file_ctx), data_idx);
+            if (!usbSendFileProperties(authoring_tool_xml_size, tmp_name) || !usbSendFileData(authoring_tool_xml, authoring_tool_xml_size))
+            {
+                consolePrint("send \"%s\" failed\n", tmp_name);
+                goto end;
+            }
+        } else {
+            writeOutputFileData(fd, &sd_writer, authoring_tool_xml, authoring_tool_xml_size);
         }
-    }
 
-    if (!shared_thread_data->read_error && !shared_thread_data->write_error && !shared_thread_data->transfer_cancelled)
-    {
-        /* Wait until the previous file data chunk has been written. */
-        mutexLock(&g_fileMutex);
-        if (shared_thread_data->data_size) condvarWait(&g_readCondvar, &g_fileMutex);
-        mutexUnlock(&g_fileMutex);
+        nsp_offset += authoring_tool_xml_size;
+        nsp_thread_data->data_written += authoring_tool_xml_size;
 
-        consolePrint("successfully saved extracted romfs section data to \"%s\"\n", filename);
-        consoleRefresh();
+        // update pfs entry name
+        if (!pfsUpdateEntryNameFromFileContext(&(dump_ctx->pfs_file_ctx), data_idx, cur_nca_ctx->content_id_str))
+        {
+            consolePrint("pfs update entry name failed for xml \"%s\"\n", cur_nca_ctx->content_id_str);
+            goto end;
+        }
     }
 
-end:
-    if (shared_thread_data->fp)
+    if (dump_ctx->retrieve_tik_cert)
     {
-        fclose(shared_thread_data->fp);
-        shared_thread_data->fp = NULL;
-
-        if ((shared_thread_data->read_error || shared_thread_data->write_error || shared_thread_data->transfer_cancelled) && dev_idx != 1)
+        // write ticket
+        if (dev_idx == 1)
         {
-            utilsDeleteDirectoryRecursively(filename);
-            if (dev_idx == 0) utilsCommitSdCardFileSystemChanges();
+            tmp_name = pfsGetEntryNameByIndexFromFileContext(&(dump_ctx->pfs_file_ctx), dump_ctx->pfs_file_ctx.header.entry_count - 2);
+            if (!usbSendFileProperties(dump_ctx->tik.size, tmp_name) || !usbSendFileData(dump_ctx->tik.data, dump_ctx->tik.size))
+            {
+                consolePrint("send \"%s\" failed\n", tmp_name);
+                goto end;
+            }
+        } else {
+            writeOutputFileData(fd, &sd_writer, dump_ctx->tik.data, dump_ctx->tik.size);
         }
-    }
-
-    if (filename) free(filename);
 
-    if (buf2) free(buf2);
-    if (buf1) free(buf1);
+        nsp_offset += dump_ctx->tik.size;
+        nsp_thread_data->data_written += dump_ctx->tik.size;
 
-    threadExit();
-}
+        // write cert
+        if (dev_idx == 1)
+        {
+            tmp_name = pfsGetEntryNameByIndexFromFileContext(&(dump_ctx->pfs_file_ctx), dump_ctx->pfs_file_ctx.header.entry_count - 1);
+            if (!usbSendFileProperties(dump_ctx->raw_cert_chain_size, tmp_name) || !usbSendFileData(dump_ctx->raw_cert_chain, dump_ctx->raw_cert_chain_size))
+            {
+                consolePrint("send \"%s\" failed\n", tmp_name);
+                goto end;
+            }
+        } else {
+            writeOutputFileData(fd, &sd_writer, dump_ctx->raw_cert_chain, dump_ctx->raw_cert_chain_size);
+        }
 
-static void genericWriteThreadFunc(void *arg)
-{
-    SharedThreadData *shared_thread_data = (SharedThreadData*)arg; // UB but we don't care
+        nsp_offset += dump_ctx->raw_cert_chain_size;
+        nsp_thread_data->data_written += dump_ctx->raw_cert_chain_size;
+    }
 
-    while(shared_thread_data->data_written < shared_thread_data->total_size)
+    // write new pfs0 header
+    if (dev_idx == 1)
     {
-        /* Wait until the current file data chunk has been read */
-        mutexLock(&g_fileMutex);
-
-        if (!shared_thread_data->data_size && !shared_thread_data->read_error) condvarWait(&g_writeCondvar, &g_fileMutex);
+        if (!pfsWriteFileContextHeaderToMemoryBuffer(&(dump_ctx->pfs_file_ctx), buf, BLOCK_SIZE, &(dump_ctx->nsp_header_size)))
+        {
+            consolePrint("pfs write header to mem failed\n");
+            goto end;
+        }
 
-        if (shared_thread_data->read_error || shared_thread_data->transfer_cancelled || (!useUsbHost() && !shared_thread_data->fp))
+        if (!usbSendNspHeader(buf, (u32)dump_ctx->nsp_header_size))
         {
-            if (useUsbHost() && shared_thread_data->transfer_cancelled) usbCancelFileTransfer();
-            mutexUnlock(&g_fileMutex);
-            break;
+            consolePrint("send nsp header failed\n");
+            goto end;
         }
+    } else {
+        bool header_written = false;
 
-        /* Write current file data chunk */
-        if (useUsbHost())
+        if (dev_idx == 0)
         {
-            shared_thread_data->write_error = !usbSendFileData(shared_thread_data->data, shared_thread_data->data_size);
+            header_written = (sdWriterSeek(&sd_writer, 0) && pfsWriteFileContextHeader(&(dump_ctx->pfs_file_ctx), writeFileContextHeaderDataToSdWriter, &sd_writer));
         } else {
-            shared_thread_data->write_error = (fwrite(shared_thread_data->data, 1, shared_thread_data->data_size, shared_thread_data->fp) != shared_thread_data->data_size);
+            rewind(fd);
+            header_written = pfsWriteFileContextHeader(&(dump_ctx->pfs_file_ctx), writeFileContextHeaderDataToFile, fd);
         }
 
-        if (!shared_thread_data->write_error)
+        if (!header_written)
         {
-            shared_thread_data->data_written += shared_thread_data->data_size;
-            shared_thread_data->data_size = 0;
+            consolePrint("pfs write header to file failed\n");
+            goto end;
         }
-
-        /* Wake up the read thread to continue reading data */
-        mutexUnlock(&g_fileMutex);
-        condvarWakeAll(&g_readCondvar);
-
-        if (shared_thread_data->write_error) break;
     }
 
-    threadExit();
-}
+    nsp_thread_data->data_written += dump_ctx->nsp_header_size;
 
-static bool spanDumpThreads(ThreadFunc read_func, ThreadFunc write_func, void *arg)
-{
-    SharedThreadData *shared_thread_data = (SharedThreadData*)arg; // UB but we don't care
-    Thread read_thread = {0}, write_thread = {0};
+    if (lookup_checksum) consolePrint("nca dat matches: %u / %u\n", dat_match_count, title_info->content_count);
 
-    time_t start = 0, btn_cancel_start_tmr = 0, btn_cancel_end_tmr = 0;
-    bool btn_cancel_cur_state = false, btn_cancel_prev_state = false, success = false;
+    success = true;
 
-    u64 prev_size = 0;
-    u8 prev_time = 0, percent = 0;
+end:
+    consoleRefresh();
 
-    consolePrint("creating threads\n");
-    utilsCreateThread(&read_thread, read_func, arg, 2);
-    utilsCreateThread(&write_thread, write_func, arg, 2);
+    mutexLock(&g_fileMutex);
+    if (!success && !nsp_thread_data->transfer_cancelled) nsp_thread_data->error = true;
+    mutexUnlock(&g_fileMutex);
 
-    consolePrint("hold b to cancel\n\n");
-    consoleRefresh();
+    /* Make sure the hash thread is no longer using any of our buffers. */
+    nspHashFree(&nsp_hash_data);
 
-    start = time(NULL);
+    /* Partial dumps are kept around if they can be resumed later, unless the user cancelled them. */
+    bool keep_partial_dump = (!success && checkpoint.available && !nsp_thread_data->transfer_cancelled);
 
-    while(shared_thread_data->data_written < shared_thread_data->total_size)
+    if (fd || sdWriterIsOpen(&sd_writer))
     {
-        g_appletStatus = appletMainLoop();
-        if (!g_appletStatus)
+        if (fd) fclose(fd);
+        sdWriterClose(&sd_writer);
+
+        if (!success && dev_idx != 1 && !keep_partial_dump)
         {
-            mutexLock(&g_fileMutex);
-            shared_thread_data->transfer_cancelled = true;
-            mutexUnlock(&g_fileMutex);
+            if (dev_idx == 0)
+            {
+                utilsRemoveConcatenationFile(filename);
+                utilsCommitSdCardFileSystemChanges();
+            } else {
+                remove(filename);
+            }
         }
+    }
 
-        if (shared_thread_data->read_error || shared_thread_data->write_error || shared_thread_data->transfer_cancelled) break;
+    if (keep_partial_dump)
+    {
+        consolePrint("partial dump kept, it will be resumed the next time it's started\n");
+    } else {
+        dumpCheckpointDiscard(&checkpoint);
+    }
 
-        struct tm ts = {0};
-        time_t now = time(NULL);
-        localtime_r(&now, &ts);
+    dumpCheckpointFree(&checkpoint);
 
-        size_t size = shared_thread_data->data_written;
+    if (checkpoint_state) free(checkpoint_state);
 
-        utilsScanPads();
-        btn_cancel_cur_state = (utilsGetButtonsHeld() & HidNpadButton_B);
+    if (dump_ctx) nspFreeDumpContext(dump_ctx);
 
-        if (btn_cancel_cur_state && btn_cancel_cur_state != btn_cancel_prev_state)
-        {
-            btn_cancel_start_tmr = now;
-        } else
-        if (btn_cancel_cur_state && btn_cancel_cur_state == btn_cancel_prev_state)
+    if (filename) free(filename);
+
+    if (buf) free(buf);
+
+    threadExit();
+}
+
+static bool nspNcaPatchStageFunc(DumpPipelineBuffer *buf, void *userdata)
+{
+    NspNcaStageData *nca_stage_data = (NspNcaStageData*)userdata;
+    NcaContext *nca_ctx = nca_stage_data->nca_ctx;
+
+    /* Blocks are processed in order, so this stops being needed as soon as the patched areas have been written to a buffer. */
+    if (!nca_stage_data->dirty_header) return true;
+
+    /* Write re-encrypted headers. */
+    if (!nca_ctx->header_written) ncaWriteEncryptedHeaderDataToMemoryBuffer(nca_ctx, buf->data, buf->data_size, buf->offset);
+
+    if (nca_ctx->content_type_ctx_patch)
+    {
+        /* Write content type context patch. */
+        switch(nca_ctx->content_type)
         {
-            btn_cancel_end_tmr = now;
-            if ((btn_cancel_end_tmr - btn_cancel_start_tmr) >= 3)
-            {
-                mutexLock(&g_fileMutex);
-                shared_thread_data->transfer_cancelled = true;
-                mutexUnlock(&g_fileMutex);
+            case NcmContentType_Meta:
+                cnmtWriteNcaPatch(&(nca_stage_data->dump_ctx->cnmt_ctx), buf->data, buf->data_size, buf->offset);
+                break;
+            case NcmContentType_Control:
+                nacpWriteNcaPatch((NacpContext*)nca_ctx->content_type_ctx, buf->data, buf->data_size, buf->offset);
+                break;
+            default:
                 break;
-            }
-        } else {
-            btn_cancel_start_tmr = btn_cancel_end_tmr = 0;
         }
+    }
 
-        btn_cancel_prev_state = btn_cancel_cur_state;
+    nca_stage_data->dirty_header = (!nca_ctx->header_written || nca_ctx->content_type_ctx_patch);
 
-        if (prev_time == ts.tm_sec || prev_size == size) continue;
+    return true;
+}
 
-        percent = (u8)((size * 100) / shared_thread_data->total_size);
+static bool nspNcaWriteStageFunc(DumpPipelineBuffer *buf, void *userdata)
+{
+    NspNcaStageData *nca_stage_data = (NspNcaStageData*)userdata;
+    NspThreadData *nsp_thread_data = nca_stage_data->nsp_thread_data;
+    u64 nsp_offset = (nca_stage_data->nsp_offset + buf->offset);
+    bool success = false;
 
-        prev_time = ts.tm_sec;
-        prev_size = size;
+    mutexLock(&g_fileMutex);
+    bool cancelled = nsp_thread_data->transfer_cancelled;
+    mutexUnlock(&g_fileMutex);
 
-        consolePrint("%lu / %lu (%u%%) | Time elapsed: %lu\n", size, shared_thread_data->total_size, percent, (now - start));
-        consoleRefresh();
+    if (cancelled) return false;
 
-        utilsAppletLoopDelay();
-    }
+    /* Save a checkpoint if enough data has been written since the last one. Only data from previous blocks has been hashed at this point. */
+    if (dumpCheckpointIsDue(nca_stage_data->checkpoint, nsp_offset))
+    {
+        NspCheckpointState *checkpoint_state = nca_stage_data->checkpoint_state;
 
-    consolePrint("\nwaiting for threads to join\n");
-    consoleRefresh();
+        checkpoint_state->content_idx = nca_stage_data->content_idx;
+        checkpoint_state->content_offset = buf->offset;
+        nspHashGetState(nca_stage_data->nsp_hash_data, &(checkpoint_state->sha256_ctx));
 
-    utilsJoinThread(&read_thread);
-    consolePrint("read_thread done: %lu\n", time(NULL));
+        dumpCheckpointSave(nca_stage_data->checkpoint, nca_stage_data->sd_writer, nsp_offset, checkpoint_state, nca_stage_data->checkpoint_state_size);
+    }
 
-    utilsJoinThread(&write_thread);
-    consolePrint("write_thread done: %lu\n", time(NULL));
+    /* Hash this block in the hash thread while it's being written. */
+    nspHashSubmitData(nca_stage_data->nsp_hash_data, buf->data, buf->data_size);
 
-    if (shared_thread_data->read_error || shared_thread_data->write_error)
-    {
-        consolePrint("i/o error\n");
-    } else
-    if (shared_thread_data->transfer_cancelled)
+    if (useUsbHost())
     {
-        consolePrint("process cancelled\n");
+        success = usbSendFileData(buf->data, buf->data_size);
+        if (!success) consolePrint("send file data failed\n");
     } else {
-        start = (time(NULL) - start);
-        consolePrint("process completed in %lu seconds\n", start);
-        success = true;
+        success = writeOutputFileData(nca_stage_data->fd, nca_stage_data->sd_writer, buf->data, buf->data_size);
+        if (!success) consolePrint("write file data failed\n");
     }
 
-    consoleRefresh();
+    /* The pipeline reuses this buffer as soon as we return. */
+    nspHashWaitForBuffer(nca_stage_data->nsp_hash_data, buf->data, buf->data_size);
 
-    return success;
-}
+    if (success) nsp_thread_data->data_written += buf->input_size;
 
-static void nspThreadFunc(void *arg)
-{
-    NspThreadData *nsp_thread_data = (NspThreadData*)arg;
+    return success;
+}
 
-    TitleInfo *title_info = NULL;
+static bool nspPrepareDumpContext(NspDumpContext *dump_ctx, TitleInfo *title_info, NspLookupCache *lookup_cache)
+{
+    if (!dump_ctx || !title_info || !title_info->content_count || !title_info->content_infos) return false;
 
     bool set_download_type = (bool)getNspSetDownloadDistributionOption();
     bool remove_console_data = (bool)getNspRemoveConsoleDataOption();
@@ -4728,77 +6502,31 @@ static void nspThreadFunc(void *arg)
     bool patch_screenshot = (bool)getNspEnableScreenshotsOption();
     bool patch_video_capture = (bool)getNspEnableVideoCaptureOption();
     bool patch_hdcp = (bool)getNspDisableHdcpOption();
-    bool generate_authoringtool_data = (bool)getNspGenerateAuthoringToolDataOption();
     bool success = false;
 
-    u64 free_space = 0;
-    u32 dev_idx = g_storageMenuElementOption.selected;
-
-    u8 *buf = NULL;
-    char *filename = NULL;
-    FILE *fd = NULL;
-
-    NcaContext *nca_ctx = NULL;
-
-    NcaContext *meta_nca_ctx = NULL;
-    ContentMetaContext cnmt_ctx = {0};
-
-    ProgramInfoContext *program_info_ctx = NULL;
-    u32 program_idx = 0, program_count = 0;
-
-    NacpContext *nacp_ctx = NULL;
-    u32 control_idx = 0, control_count = 0;
-
-    LegalInfoContext *legal_info_ctx = NULL;
-    u32 legal_info_idx = 0, legal_info_count = 0;
-
-    Ticket tik = {0};
+    u32 program_idx = 0, control_idx = 0, legal_info_idx = 0;
     TikCommonBlock *tik_common_block = NULL;
-
-    u8 *raw_cert_chain = NULL;
-    u64 raw_cert_chain_size = 0;
-
-    PartitionFileSystemFileContext pfs_file_ctx = {0};
-    pfsInitializeFileContext(&pfs_file_ctx);
-
     char entry_name[64] = {0};
-    u64 nsp_header_size = 0, nsp_size = 0, nsp_offset = 0;
-    char *tmp_name = NULL;
-
-    Sha256Context sha256_ctx = {0};
-    u8 sha256_hash[SHA256_HASH_SIZE] = {0};
-
-    if (!nsp_thread_data || !(title_info = (TitleInfo*)nsp_thread_data->data) || !title_info->content_count || !title_info->content_infos) goto end;
 
-    /* Allocate memory for the dump process. */
-    if (!(buf = usbAllocatePageAlignedBuffer(BLOCK_SIZE)))
-    {
-        consolePrint("buf alloc failed\n");
-        goto end;
-    }
+    memset(dump_ctx, 0, sizeof(NspDumpContext));
+    pfsInitializeFileContext(&(dump_ctx->pfs_file_ctx));
 
-    /* Generate output path. */
-    filename = generateOutputTitleFileName(title_info, "NSP", ".nsp");
-    if (!filename) goto end;
+    dump_ctx->generate_authoringtool_data = (bool)getNspGenerateAuthoringToolDataOption();
 
-    /* Get free space on output storage. */
-    if (dev_idx != 1 && !utilsGetFileSystemStatsByPath(filename, NULL, &free_space))
-    {
-        consolePrint("failed to retrieve free space from selected device\n");
-        goto end;
-    }
+    // reuse a ticket retrieved for a previous title, if possible
+    if (lookup_cache) nspLookupCacheSeedTicket(lookup_cache, title_info, &(dump_ctx->tik));
 
-    if (!(nca_ctx = calloc(title_info->content_count, sizeof(NcaContext))))
+    if (!(dump_ctx->nca_ctx = calloc(title_info->content_count, sizeof(NcaContext))))
     {
         consolePrint("nca ctx calloc failed\n");
         goto end;
     }
 
     // determine if we should initialize programinfo ctx
-    if (generate_authoringtool_data)
+    if (dump_ctx->generate_authoringtool_data)
     {
-        program_count = titleGetContentCountByType(title_info, NcmContentType_Program);
-        if (program_count && !(program_info_ctx = calloc(program_count, sizeof(ProgramInfoContext))))
+        dump_ctx->program_count = titleGetContentCountByType(title_info, NcmContentType_Program);
+        if (dump_ctx->program_count && !(dump_ctx->program_info_ctx = calloc(dump_ctx->program_count, sizeof(ProgramInfoContext))))
         {
             consolePrint("program info ctx calloc failed\n");
             goto end;
@@ -4806,10 +6534,10 @@ static void nspThreadFunc(void *arg)
     }
 
     // determine if we should initialize nacp ctx
-    if (patch_sua || patch_screenshot || patch_video_capture || patch_hdcp || generate_authoringtool_data)
+    if (patch_sua || patch_screenshot || patch_video_capture || patch_hdcp || dump_ctx->generate_authoringtool_data)
     {
-        control_count = titleGetContentCountByType(title_info, NcmContentType_Control);
-        if (control_count && !(nacp_ctx = calloc(control_count, sizeof(NacpContext))))
+        dump_ctx->control_count = titleGetContentCountByType(title_info, NcmContentType_Control);
+        if (dump_ctx->control_count && !(dump_ctx->nacp_ctx = calloc(dump_ctx->control_count, sizeof(NacpContext))))
         {
             consolePrint("nacp ctx calloc failed\n");
             goto end;
@@ -4817,10 +6545,10 @@ static void nspThreadFunc(void *arg)
     }
 
     // determine if we should initialize legalinfo ctx
-    if (generate_authoringtool_data)
+    if (dump_ctx->generate_authoringtool_data)
     {
-        legal_info_count = titleGetContentCountByType(title_info, NcmContentType_LegalInformation);
-        if (legal_info_count && !(legal_info_ctx = calloc(legal_info_count, sizeof(LegalInfoContext))))
+        dump_ctx->legal_info_count = titleGetContentCountByType(title_info, NcmContentType_LegalInformation);
+        if (dump_ctx->legal_info_count && !(dump_ctx->legal_info_ctx = calloc(dump_ctx->legal_info_count, sizeof(LegalInfoContext))))
         {
             consolePrint("legal info ctx calloc failed\n");
             goto end;
@@ -4828,10 +6556,10 @@ static void nspThreadFunc(void *arg)
     }
 
     // set meta nca as the last nca
-    meta_nca_ctx = &(nca_ctx[title_info->content_count - 1]);
+    dump_ctx->meta_nca_ctx = &(dump_ctx->nca_ctx[title_info->content_count - 1]);
 
-    if (!ncaInitializeContext(meta_nca_ctx, title_info->storage_id, (title_info->storage_id == NcmStorageId_GameCard ? HashFileSystemPartitionType_Secure : 0), \
-                              &(title_info->meta_key), titleGetContentInfoByTypeAndIdOffset(title_info, NcmContentType_Meta, 0), &tik))
+    if (!ncaInitializeContext(dump_ctx->meta_nca_ctx, title_info->storage_id, (title_info->storage_id == NcmStorageId_GameCard ? HashFileSystemPartitionType_Secure : 0), \
+                              &(title_info->meta_key), titleGetContentInfoByTypeAndIdOffset(title_info, NcmContentType_Meta, 0), &(dump_ctx->tik)))
     {
         consolePrint("meta nca initialize ctx failed\n");
         goto end;
@@ -4839,13 +6567,13 @@ static void nspThreadFunc(void *arg)
 
     consolePrint("meta nca initialize ctx succeeded\n");
 
-    if (!cnmtInitializeContext(&cnmt_ctx, meta_nca_ctx))
+    if (!cnmtInitializeContext(&(dump_ctx->cnmt_ctx), dump_ctx->meta_nca_ctx))
     {
         consolePrint("cnmt initialize ctx failed\n");
         goto end;
     }
 
-    consolePrint("cnmt initialize ctx succeeded (%s)\n", meta_nca_ctx->content_id_str);
+    consolePrint("cnmt initialize ctx succeeded (%s)\n", dump_ctx->meta_nca_ctx->content_id_str);
 
     // initialize nca context
     // initialize content type context
@@ -4857,9 +6585,9 @@ static void nspThreadFunc(void *arg)
         NcmContentInfo *content_info = &(title_info->content_infos[i]);
         if (content_info->content_type == NcmContentType_Meta) continue;
 
-        NcaContext *cur_nca_ctx = &(nca_ctx[j]);
+        NcaContext *cur_nca_ctx = &(dump_ctx->nca_ctx[j]);
         if (!ncaInitializeContext(cur_nca_ctx, title_info->storage_id, (title_info->storage_id == NcmStorageId_GameCard ? HashFileSystemPartitionType_Secure : 0), \
-                                  &(title_info->meta_key), content_info, &tik))
+                                  &(title_info->meta_key), content_info, &(dump_ctx->tik)))
         {
             consolePrint("%s #%u initialize nca ctx failed\n", titleGetNcmContentTypeName(content_info->content_type), content_info->id_offset);
             goto end;
@@ -4894,9 +6622,9 @@ static void nspThreadFunc(void *arg)
                 case NcmContentType_Program:
                 {
                     // don't proceed if we didn't allocate programinfo ctx or if we're dealing with a sparse layer
-                    if (!program_count || !program_info_ctx) break;
+                    if (!dump_ctx->program_count || !dump_ctx->program_info_ctx) break;
 
-                    ProgramInfoContext *cur_program_info_ctx = &(program_info_ctx[program_idx]);
+                    ProgramInfoContext *cur_program_info_ctx = &(dump_ctx->program_info_ctx[program_idx]);
 
                     if (!programInfoInitializeContext(cur_program_info_ctx, cur_nca_ctx))
                     {
@@ -4919,9 +6647,9 @@ static void nspThreadFunc(void *arg)
                 case NcmContentType_Control:
                 {
                     // don't proceed if we didn't allocate nacp ctx
-                    if (!control_count || !nacp_ctx) break;
+                    if (!dump_ctx->control_count || !dump_ctx->nacp_ctx) break;
 
-                    NacpContext *cur_nacp_ctx = &(nacp_ctx[control_idx]);
+                    NacpContext *cur_nacp_ctx = &(dump_ctx->nacp_ctx[control_idx]);
 
                     if (!nacpInitializeContext(cur_nacp_ctx, cur_nca_ctx))
                     {
@@ -4935,7 +6663,7 @@ static void nspThreadFunc(void *arg)
                         goto end;
                     }
 
-                    if (generate_authoringtool_data && !nacpGenerateAuthoringToolXml(cur_nacp_ctx, title_info->version.value, cnmtGetRequiredTitleVersion(&cnmt_ctx)))
+                    if (dump_ctx->generate_authoringtool_data && !nacpGenerateAuthoringToolXml(cur_nacp_ctx, title_info->version.value, cnmtGetRequiredTitleVersion(&(dump_ctx->cnmt_ctx))))
                     {
                         consolePrint("nacp xml failed (%s)\n", cur_nca_ctx->content_id_str);
                         goto end;
@@ -4950,9 +6678,9 @@ static void nspThreadFunc(void *arg)
                 case NcmContentType_LegalInformation:
                 {
                     // don't proceed if we didn't allocate legalinfo ctx
-                    if (!legal_info_count || !legal_info_ctx) break;
+                    if (!dump_ctx->legal_info_count || !dump_ctx->legal_info_ctx) break;
 
-                    LegalInfoContext *cur_legal_info_ctx = &(legal_info_ctx[legal_info_idx]);
+                    LegalInfoContext *cur_legal_info_ctx = &(dump_ctx->legal_info_ctx[legal_info_idx]);
 
                     if (!legalInfoInitializeContext(cur_legal_info_ctx, cur_nca_ctx))
                     {
@@ -4984,547 +6712,471 @@ static void nspThreadFunc(void *arg)
 
     // generate cnmt xml right away even though we don't yet have all the data we need
     // This is because we need its size to calculate the full nsp size
-    if (generate_authoringtool_data && !cnmtGenerateAuthoringToolXml(&cnmt_ctx, nca_ctx, title_info->content_count))
+    if (dump_ctx->generate_authoringtool_data && !cnmtGenerateAuthoringToolXml(&(dump_ctx->cnmt_ctx), dump_ctx->nca_ctx, title_info->content_count))
     {
         consolePrint("cnmt xml #1 failed\n");
         goto end;
     }
 
-    bool retrieve_tik_cert = (!remove_titlekey_crypto && tik.size > 0);
-    if (retrieve_tik_cert)
-    {
-        if (!(tik_common_block = tikGetCommonBlockFromTicket(&tik)))
-        {
-            consolePrint("tik common block failed");
-            goto end;
-        }
-
-        if (remove_console_data && tik_common_block->titlekey_type == TikTitleKeyType_Personalized)
-        {
-            if (!tikConvertPersonalizedTicketToCommonTicket(&tik, &raw_cert_chain, &raw_cert_chain_size))
-            {
-                consolePrint("tik convert failed\n");
-                goto end;
-            }
-        } else {
-            raw_cert_chain = (title_info->storage_id == NcmStorageId_GameCard ? certRetrieveRawCertificateChainFromGameCardByRightsId(&(tik_common_block->rights_id), &raw_cert_chain_size) : \
-                                                                                certGenerateRawCertificateChainBySignatureIssuer(tik_common_block->issuer, &raw_cert_chain_size));
-            if (!raw_cert_chain)
-            {
-                consolePrint("cert failed\n");
-                goto end;
-            }
-        }
-    }
-
-    // add nca info
-    for(u32 i = 0; i < title_info->content_count; i++)
-    {
-        NcaContext *cur_nca_ctx = &(nca_ctx[i]);
-        sprintf(entry_name, "%s.%s", cur_nca_ctx->content_id_str, cur_nca_ctx->content_type == NcmContentType_Meta ? "cnmt.nca" : "nca");
-
-        if (!pfsAddEntryInformationToFileContext(&pfs_file_ctx, entry_name, cur_nca_ctx->content_size, NULL))
-        {
-            consolePrint("pfs add entry failed: %s\n", entry_name);
-            goto end;
-        }
-    }
-
-    // add cnmt xml info
-    if (generate_authoringtool_data)
-    {
-        sprintf(entry_name, "%s.cnmt.xml", meta_nca_ctx->content_id_str);
-        if (!pfsAddEntryInformationToFileContext(&pfs_file_ctx, entry_name, cnmt_ctx.authoring_tool_xml_size, &(meta_nca_ctx->content_type_ctx_data_idx)))
-        {
-            consolePrint("pfs add entry failed: %s\n", entry_name);
-            goto end;
-        }
-    }
-
-    // add content type ctx data info
-    u32 limit = generate_authoringtool_data ? (title_info->content_count - 1) : 0;
-    for(u32 i = 0; i < limit; i++)
-    {
-        bool ret = false;
-        NcaContext *cur_nca_ctx = &(nca_ctx[i]);
-        if (!cur_nca_ctx->content_type_ctx) continue;
-
-        switch(cur_nca_ctx->content_type)
-        {
-            case NcmContentType_Program:
-            {
-                ProgramInfoContext *cur_program_info_ctx = (ProgramInfoContext*)cur_nca_ctx->content_type_ctx;
-                sprintf(entry_name, "%s.programinfo.xml", cur_nca_ctx->content_id_str);
-                ret = pfsAddEntryInformationToFileContext(&pfs_file_ctx, entry_name, cur_program_info_ctx->authoring_tool_xml_size, &(cur_nca_ctx->content_type_ctx_data_idx));
-                break;
-            }
-            case NcmContentType_Control:
-            {
-                NacpContext *cur_nacp_ctx = (NacpContext*)cur_nca_ctx->content_type_ctx;
-
-                for(u8 j = 0; j < cur_nacp_ctx->icon_count; j++)
-                {
-                    NacpIconContext *icon_ctx = &(cur_nacp_ctx->icon_ctx[j]);
-                    sprintf(entry_name, "%s.nx.%s.jpg", cur_nca_ctx->content_id_str, nacpGetLanguageString(icon_ctx->language));
-                    if (!pfsAddEntryInformationToFileContext(&pfs_file_ctx, entry_name, icon_ctx->icon_size, j == 0 ? &(cur_nca_ctx->content_type_ctx_data_idx) : NULL))
-                    {
-                        consolePrint("pfs add entry failed: %s\n", entry_name);
-                        goto end;
-                    }
-                }
-
-                sprintf(entry_name, "%s.nacp.xml", cur_nca_ctx->content_id_str);
-                ret = pfsAddEntryInformationToFileContext(&pfs_file_ctx, entry_name, cur_nacp_ctx->authoring_tool_xml_size, !cur_nacp_ctx->icon_count ? &(cur_nca_ctx->content_type_ctx_data_idx) : NULL);
-                break;
-            }
-            case NcmContentType_LegalInformation:
-            {
-                LegalInfoContext *cur_legal_info_ctx = (LegalInfoContext*)cur_nca_ctx->content_type_ctx;
-                sprintf(entry_name, "%s.legalinfo.xml", cur_nca_ctx->content_id_str);
-                ret = pfsAddEntryInformationToFileContext(&pfs_file_ctx, entry_name, cur_legal_info_ctx->authoring_tool_xml_size, &(cur_nca_ctx->content_type_ctx_data_idx));
-                break;
-            }
-            default:
-                break;
-        }
-
-        if (!ret)
-        {
-            consolePrint("pfs add entry failed: %s\n", entry_name);
-            goto end;
-        }
-    }
-
-    // add ticket and cert info
-    if (retrieve_tik_cert)
-    {
-        sprintf(entry_name, "%s.tik", tik.rights_id_str);
-        if (!pfsAddEntryInformationToFileContext(&pfs_file_ctx, entry_name, tik.size, NULL))
-        {
-            consolePrint("pfs add entry failed: %s\n", entry_name);
-            goto end;
-        }
-
-        sprintf(entry_name, "%s.cert", tik.rights_id_str);
-        if (!pfsAddEntryInformationToFileContext(&pfs_file_ctx, entry_name, raw_cert_chain_size, NULL))
-        {
-            consolePrint("pfs add entry failed: %s\n", entry_name);
-            goto end;
-        }
-    }
-
-    // write buffer to memory buffer
-    if (!pfsWriteFileContextHeaderToMemoryBuffer(&pfs_file_ctx, buf, BLOCK_SIZE, &nsp_header_size))
-    {
-        consolePrint("pfs write header to mem #1 failed\n");
-        goto end;
-    }
-
-    nsp_size = (nsp_header_size + pfs_file_ctx.fs_size);
-    consolePrint("nsp header size: 0x%lX | nsp size: 0x%lX\n", nsp_header_size, nsp_size);
-    consoleRefresh();
-
-    if (dev_idx == 1)
-    {
-        if (!usbSendNspProperties(nsp_size, filename, (u32)nsp_header_size))
-        {
-            consolePrint("usb send nsp properties failed\n");
-            goto end;
-        }
-    } else {
-        if (nsp_size >= free_space)
-        {
-            consolePrint("nsp size exceeds free space\n");
-            goto end;
-        }
-
-        utilsCreateDirectoryTree(filename, false);
-
-        if (dev_idx == 0)
-        {
-            if (nsp_size > FAT32_FILESIZE_LIMIT && !utilsCreateConcatenationFile(filename))
-            {
-                consolePrint("failed to create concatenation file for \"%s\"!\n", filename);
-                goto end;
-            }
-        } else {
-            if (g_umsDevices[dev_idx - 2].fs_type < UsbHsFsDeviceFileSystemType_exFAT && nsp_size > FAT32_FILESIZE_LIMIT)
-            {
-                consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
-                goto end;
-            }
-        }
-
-        if (!(fd = fopen(filename, "wb")))
-        {
-            consolePrint("fopen failed\n");
-            goto end;
-        }
-
-        // set file size
-        ftruncate(fileno(fd), (off_t)nsp_size);
-
-        // write placeholder header
-        memset(buf, 0, nsp_header_size);
-        fwrite(buf, 1, nsp_header_size, fd);
-    }
-
-    consolePrint("dump process started, please wait. hold b to cancel.\n");
-    consoleRefresh();
-
-    nsp_offset += nsp_header_size;
-
-    // set nsp size
-    nsp_thread_data->total_size = nsp_size;
-
-    // write ncas
-    for(u32 i = 0; i < title_info->content_count; i++)
+    // drop the seeded ticket if none of the ncas actually uses it
+    if (lookup_cache && dump_ctx->tik.size)
     {
-        NcaContext *cur_nca_ctx = &(nca_ctx[i]);
-        u64 blksize = BLOCK_SIZE;
-
-        memset(&sha256_ctx, 0, sizeof(Sha256Context));
-        sha256ContextCreate(&sha256_ctx);
-
-        if (cur_nca_ctx->content_type == NcmContentType_Meta && (!cnmtGenerateNcaPatch(&cnmt_ctx) || !ncaEncryptHeader(cur_nca_ctx)))
-        {
-            consolePrint("cnmt generate patch failed\n");
-            goto end;
-        }
-
-        bool dirty_header = ncaIsHeaderDirty(cur_nca_ctx);
-
-        if (dev_idx == 1)
-        {
-            tmp_name = pfsGetEntryNameByIndexFromFileContext(&pfs_file_ctx, i);
-            if (!usbSendFileProperties(cur_nca_ctx->content_size, tmp_name))
-            {
-                consolePrint("usb send file properties \"%s\" failed\n", tmp_name);
-                goto end;
-            }
-        }
-
-        for(u64 offset = 0; offset < cur_nca_ctx->content_size; offset += blksize, nsp_offset += blksize, nsp_thread_data->data_written += blksize)
-        {
-            mutexLock(&g_fileMutex);
-            bool cancelled = nsp_thread_data->transfer_cancelled;
-            mutexUnlock(&g_fileMutex);
-
-            if (cancelled)
-            {
-                if (dev_idx == 1) usbCancelFileTransfer();
-                goto end;
-            }
-
-            if ((cur_nca_ctx->content_size - offset) < blksize) blksize = (cur_nca_ctx->content_size - offset);
-
-            // read nca chunk
-            if (!ncaReadContentFile(cur_nca_ctx, buf, blksize, offset))
-            {
-                consolePrint("nca read failed at 0x%lX for \"%s\"\n", offset, cur_nca_ctx->content_id_str);
-                goto end;
-            }
-
-            if (dirty_header)
-            {
-                // write re-encrypted headers
-                if (!cur_nca_ctx->header_written) ncaWriteEncryptedHeaderDataToMemoryBuffer(cur_nca_ctx, buf, blksize, offset);
-
-                if (cur_nca_ctx->content_type_ctx_patch)
-                {
-                    // write content type context patch
-                    switch(cur_nca_ctx->content_type)
-                    {
-                        case NcmContentType_Meta:
-                            cnmtWriteNcaPatch(&cnmt_ctx, buf, blksize, offset);
-                            break;
-                        case NcmContentType_Control:
-                            nacpWriteNcaPatch((NacpContext*)cur_nca_ctx->content_type_ctx, buf, blksize, offset);
-                            break;
-                        default:
-                            break;
-                    }
-                }
-
-                // update flag to avoid entering this code block if it's not needed anymore
-                dirty_header = (!cur_nca_ctx->header_written || cur_nca_ctx->content_type_ctx_patch);
-            }
-
-            // update hash calculation
-            sha256ContextUpdate(&sha256_ctx, buf, blksize);
-
-            // write nca chunk
-            if (dev_idx == 1)
-            {
-                if (!usbSendFileData(buf, blksize))
-                {
-                    consolePrint("send file data failed\n");
-                    goto end;
-                }
-            } else {
-                fwrite(buf, 1, blksize, fd);
-            }
-        }
-
-        // get hash
-        sha256ContextGetHash(&sha256_ctx, sha256_hash);
-
-        // update content id and hash
-        ncaUpdateContentIdAndHash(cur_nca_ctx, sha256_hash);
-
-        // update cnmt
-        if (!cnmtUpdateContentInfo(&cnmt_ctx, cur_nca_ctx))
-        {
-            consolePrint("cnmt update content info failed\n");
-            goto end;
-        }
+        bool tik_used = false;
 
-        // update pfs entry name
-        if (!pfsUpdateEntryNameFromFileContext(&pfs_file_ctx, i, cur_nca_ctx->content_id_str))
-        {
-            consolePrint("pfs update entry name failed for nca \"%s\"\n", cur_nca_ctx->content_id_str);
-            goto end;
-        }
+        for(u32 i = 0; i < title_info->content_count && !tik_used; i++) tik_used = dump_ctx->nca_ctx[i].rights_id_available;
+
+        if (!tik_used) memset(&(dump_ctx->tik), 0, sizeof(Ticket));
     }
 
-    if (generate_authoringtool_data)
+    dump_ctx->retrieve_tik_cert = (!remove_titlekey_crypto && dump_ctx->tik.size > 0);
+    if (dump_ctx->retrieve_tik_cert)
     {
-        // regenerate cnmt xml
-        if (!cnmtGenerateAuthoringToolXml(&cnmt_ctx, nca_ctx, title_info->content_count))
+        if (!(tik_common_block = tikGetCommonBlockFromTicket(&(dump_ctx->tik))))
         {
-            consolePrint("cnmt xml #2 failed\n");
+            consolePrint("tik common block failed");
             goto end;
         }
 
-        // write cnmt xml
-        if (dev_idx == 1)
+        if (remove_console_data && tik_common_block->titlekey_type == TikTitleKeyType_Personalized)
         {
-            tmp_name = pfsGetEntryNameByIndexFromFileContext(&pfs_file_ctx, meta_nca_ctx->content_type_ctx_data_idx);
-            if (!usbSendFileProperties(cnmt_ctx.authoring_tool_xml_size, tmp_name) || !usbSendFileData(cnmt_ctx.authoring_tool_xml, cnmt_ctx.authoring_tool_xml_size))
+            if (!tikConvertPersonalizedTicketToCommonTicket(&(dump_ctx->tik), &(dump_ctx->raw_cert_chain), &(dump_ctx->raw_cert_chain_size)))
             {
-                consolePrint("send \"%s\" failed\n", tmp_name);
+                consolePrint("tik convert failed\n");
                 goto end;
             }
         } else {
-            fwrite(cnmt_ctx.authoring_tool_xml, 1, cnmt_ctx.authoring_tool_xml_size, fd);
+            dump_ctx->raw_cert_chain = (title_info->storage_id == NcmStorageId_GameCard ? certRetrieveRawCertificateChainFromGameCardByRightsId(&(tik_common_block->rights_id), &(dump_ctx->raw_cert_chain_size)) : \
+                                                                                          nspLookupCacheGetCertificateChain(lookup_cache, tik_common_block->issuer, &(dump_ctx->raw_cert_chain_size)));
+            if (!dump_ctx->raw_cert_chain)
+            {
+                consolePrint("cert failed\n");
+                goto end;
+            }
         }
+    }
+
+    // reserve pfs entries for all ncas + ticket + cert (authoringtool data entries are handled on demand)
+    if (!pfsReserveFileContextEntries(&(dump_ctx->pfs_file_ctx), title_info->content_count + 2, (title_info->content_count + 2) * (u32)MAX_ELEMENTS(entry_name)))
+    {
+        consolePrint("pfs reserve entries failed\n");
+        goto end;
+    }
 
-        nsp_offset += cnmt_ctx.authoring_tool_xml_size;
-        nsp_thread_data->data_written += cnmt_ctx.authoring_tool_xml_size;
+    // add nca info
+    for(u32 i = 0; i < title_info->content_count; i++)
+    {
+        NcaContext *cur_nca_ctx = &(dump_ctx->nca_ctx[i]);
+        sprintf(entry_name, "%s.%s", cur_nca_ctx->content_id_str, cur_nca_ctx->content_type == NcmContentType_Meta ? "cnmt.nca" : "nca");
 
-        // update cnmt xml pfs entry name
-        if (!pfsUpdateEntryNameFromFileContext(&pfs_file_ctx, meta_nca_ctx->content_type_ctx_data_idx, meta_nca_ctx->content_id_str))
+        if (!pfsAddEntryInformationToFileContext(&(dump_ctx->pfs_file_ctx), entry_name, cur_nca_ctx->content_size, NULL))
         {
-            consolePrint("pfs update entry name cnmt xml failed\n");
+            consolePrint("pfs add entry failed: %s\n", entry_name);
             goto end;
         }
     }
 
-    // write content type ctx data
-    for(u32 i = 0; i < limit; i++)
+    // add cnmt xml info
+    if (dump_ctx->generate_authoringtool_data)
     {
-        NcaContext *cur_nca_ctx = &(nca_ctx[i]);
-        if (!cur_nca_ctx->content_type_ctx) continue;
+        sprintf(entry_name, "%s.cnmt.xml", dump_ctx->meta_nca_ctx->content_id_str);
+        if (!pfsAddEntryInformationToFileContext(&(dump_ctx->pfs_file_ctx), entry_name, dump_ctx->cnmt_ctx.authoring_tool_xml_size, &(dump_ctx->meta_nca_ctx->content_type_ctx_data_idx)))
+        {
+            consolePrint("pfs add entry failed: %s\n", entry_name);
+            goto end;
+        }
+    }
 
-        char *authoring_tool_xml = NULL;
-        u64 authoring_tool_xml_size = 0;
-        u32 data_idx = cur_nca_ctx->content_type_ctx_data_idx;
+    // add content type ctx data info
+    dump_ctx->content_type_ctx_count = dump_ctx->generate_authoringtool_data ? (title_info->content_count - 1) : 0;
+    for(u32 i = 0; i < dump_ctx->content_type_ctx_count; i++)
+    {
+        bool ret = false;
+        NcaContext *cur_nca_ctx = &(dump_ctx->nca_ctx[i]);
+        if (!cur_nca_ctx->content_type_ctx) continue;
 
         switch(cur_nca_ctx->content_type)
         {
             case NcmContentType_Program:
             {
                 ProgramInfoContext *cur_program_info_ctx = (ProgramInfoContext*)cur_nca_ctx->content_type_ctx;
-                authoring_tool_xml = cur_program_info_ctx->authoring_tool_xml;
-                authoring_tool_xml_size = cur_program_info_ctx->authoring_tool_xml_size;
+                sprintf(entry_name, "%s.programinfo.xml", cur_nca_ctx->content_id_str);
+                ret = pfsAddEntryInformationToFileContext(&(dump_ctx->pfs_file_ctx), entry_name, cur_program_info_ctx->authoring_tool_xml_size, &(cur_nca_ctx->content_type_ctx_data_idx));
                 break;
             }
             case NcmContentType_Control:
             {
                 NacpContext *cur_nacp_ctx = (NacpContext*)cur_nca_ctx->content_type_ctx;
-                authoring_tool_xml = cur_nacp_ctx->authoring_tool_xml;
-                authoring_tool_xml_size = cur_nacp_ctx->authoring_tool_xml_size;
 
-                // loop through available icons
                 for(u8 j = 0; j < cur_nacp_ctx->icon_count; j++)
                 {
                     NacpIconContext *icon_ctx = &(cur_nacp_ctx->icon_ctx[j]);
-
-                    // write icon
-                    if (dev_idx == 1)
-                    {
-                        tmp_name = pfsGetEntryNameByIndexFromFileContext(&pfs_file_ctx, data_idx);
-                        if (!usbSendFileProperties(icon_ctx->icon_size, tmp_name) || !usbSendFileData(icon_ctx->icon_data, icon_ctx->icon_size))
-                        {
-                            consolePrint("send \"%s\" failed\n", tmp_name);
-                            goto end;
-                        }
-                    } else {
-                        fwrite(icon_ctx->icon_data, 1, icon_ctx->icon_size, fd);
-                    }
-
-                    nsp_offset += icon_ctx->icon_size;
-                    nsp_thread_data->data_written += icon_ctx->icon_size;
-
-                    // update pfs entry name
-                    if (!pfsUpdateEntryNameFromFileContext(&pfs_file_ctx, data_idx++, cur_nca_ctx->content_id_str))
+                    sprintf(entry_name, "%s.nx.%s.jpg", cur_nca_ctx->content_id_str, nacpGetLanguageString(icon_ctx->language));
+                    if (!pfsAddEntryInformationToFileContext(&(dump_ctx->pfs_file_ctx), entry_name, icon_ctx->icon_size, j == 0 ? &(cur_nca_ctx->content_type_ctx_data_idx) : NULL))
                     {
-                        consolePrint("pfs update entry name failed for icon \"%s\" (%u)\n", cur_nca_ctx->content_id_str, icon_ctx->language);
+                        consolePrint("pfs add entry failed: %s\n", entry_name);
                         goto end;
                     }
                 }
 
+                sprintf(entry_name, "%s.nacp.xml", cur_nca_ctx->content_id_str);
+                ret = pfsAddEntryInformationToFileContext(&(dump_ctx->pfs_file_ctx), entry_name, cur_nacp_ctx->authoring_tool_xml_size, !cur_nacp_ctx->icon_count ? &(cur_nca_ctx->content_type_ctx_data_idx) : NULL);
                 break;
             }
             case NcmContentType_LegalInformation:
             {
                 LegalInfoContext *cur_legal_info_ctx = (LegalInfoContext*)cur_nca_ctx->content_type_ctx;
-                authoring_tool_xml = cur_legal_info_ctx->authoring_tool_xml;
-                authoring_tool_xml_size = cur_legal_info_ctx->authoring_tool_xml_size;
+                sprintf(entry_name, "%s.legalinfo.xml", cur_nca_ctx->content_id_str);
+                ret = pfsAddEntryInformationToFileContext(&(dump_ctx->pfs_file_ctx), entry_name, cur_legal_info_ctx->authoring_tool_xml_size, &(cur_nca_ctx->content_type_ctx_data_idx));
                 break;
             }
             default:
                 break;
         }
 
-        // write xml
-        if (dev_idx == 1)
+        if (!ret)
         {
-            tmp_name = pfsGetEntryNameByIndexFromFileContext(&pfs_file_ctx, data_idx);
-            if (!usbSendFileProperties(authoring_tool_xml_size, tmp_name) || !usbSendFileData(authoring_tool_xml, authoring_tool_xml_size))
-            {
-                consolePrint("send \"%s\" failed\n", tmp_name);
-                goto end;
-            }
-        } else {
-            fwrite(authoring_tool_xml, 1, authoring_tool_xml_size, fd);
+            consolePrint("pfs add entry failed: %s\n", entry_name);
+            goto end;
         }
+    }
 
-        nsp_offset += authoring_tool_xml_size;
-        nsp_thread_data->data_written += authoring_tool_xml_size;
+    // add ticket and cert info
+    if (dump_ctx->retrieve_tik_cert)
+    {
+        sprintf(entry_name, "%s.tik", dump_ctx->tik.rights_id_str);
+        if (!pfsAddEntryInformationToFileContext(&(dump_ctx->pfs_file_ctx), entry_name, dump_ctx->tik.size, NULL))
+        {
+            consolePrint("pfs add entry failed: %s\n", entry_name);
+            goto end;
+        }
 
-        // update pfs entry name
-        if (!pfsUpdateEntryNameFromFileContext(&pfs_file_ctx, data_idx, cur_nca_ctx->content_id_str))
+        sprintf(entry_name, "%s.cert", dump_ctx->tik.rights_id_str);
+        if (!pfsAddEntryInformationToFileContext(&(dump_ctx->pfs_file_ctx), entry_name, dump_ctx->raw_cert_chain_size, NULL))
         {
-            consolePrint("pfs update entry name failed for xml \"%s\"\n", cur_nca_ctx->content_id_str);
+            consolePrint("pfs add entry failed: %s\n", entry_name);
             goto end;
         }
     }
 
-    if (retrieve_tik_cert)
+    // get full pfs0 header size
+    if (!(dump_ctx->nsp_header_size = pfsGetFileContextFullHeaderSize(&(dump_ctx->pfs_file_ctx))))
     {
-        // write ticket
-        if (dev_idx == 1)
-        {
-            tmp_name = pfsGetEntryNameByIndexFromFileContext(&pfs_file_ctx, pfs_file_ctx.header.entry_count - 2);
-            if (!usbSendFileProperties(tik.size, tmp_name) || !usbSendFileData(tik.data, tik.size))
-            {
-                consolePrint("send \"%s\" failed\n", tmp_name);
-                goto end;
-            }
-        } else {
-            fwrite(tik.data, 1, tik.size, fd);
-        }
+        consolePrint("pfs get full header size failed\n");
+        goto end;
+    }
 
-        nsp_offset += tik.size;
-        nsp_thread_data->data_written += tik.size;
+    dump_ctx->nsp_size = (dump_ctx->nsp_header_size + dump_ctx->pfs_file_ctx.fs_size);
+    consolePrint("nsp header size: 0x%lX | nsp size: 0x%lX\n", dump_ctx->nsp_header_size, dump_ctx->nsp_size);
+    consoleRefresh();
 
-        // write cert
-        if (dev_idx == 1)
-        {
-            tmp_name = pfsGetEntryNameByIndexFromFileContext(&pfs_file_ctx, pfs_file_ctx.header.entry_count - 1);
-            if (!usbSendFileProperties(raw_cert_chain_size, tmp_name) || !usbSendFileData(raw_cert_chain, raw_cert_chain_size))
-            {
-                consolePrint("send \"%s\" failed\n", tmp_name);
-                goto end;
-            }
-        } else {
-            fwrite(raw_cert_chain, 1, raw_cert_chain_size, fd);
-        }
+    success = true;
 
-        nsp_offset += raw_cert_chain_size;
-        nsp_thread_data->data_written += raw_cert_chain_size;
+end:
+    if (!success)
+    {
+        nspFreeDumpContext(dump_ctx);
+    } else
+    if (lookup_cache)
+    {
+        nspLookupCacheAddTicket(lookup_cache, &(dump_ctx->tik));
     }
 
-    // write new pfs0 header
-    if (!pfsWriteFileContextHeaderToMemoryBuffer(&pfs_file_ctx, buf, BLOCK_SIZE, &nsp_header_size))
+    return success;
+}
+
+static void nspFreeDumpContext(NspDumpContext *dump_ctx)
+{
+    if (!dump_ctx) return;
+
+    pfsFreeFileContext(&(dump_ctx->pfs_file_ctx));
+
+    if (dump_ctx->raw_cert_chain) free(dump_ctx->raw_cert_chain);
+
+    if (dump_ctx->legal_info_ctx)
     {
-        consolePrint("pfs write header to mem #2 failed\n");
-        goto end;
+        for(u32 i = 0; i < dump_ctx->legal_info_count; i++) legalInfoFreeContext(&(dump_ctx->legal_info_ctx[i]));
+        free(dump_ctx->legal_info_ctx);
     }
 
-    if (dev_idx == 1)
+    if (dump_ctx->nacp_ctx)
     {
-        if (!usbSendNspHeader(buf, (u32)nsp_header_size))
-        {
-            consolePrint("send nsp header failed\n");
-            goto end;
-        }
-    } else {
-        rewind(fd);
-        fwrite(buf, 1, nsp_header_size, fd);
+        for(u32 i = 0; i < dump_ctx->control_count; i++) nacpFreeContext(&(dump_ctx->nacp_ctx[i]));
+        free(dump_ctx->nacp_ctx);
     }
 
-    nsp_thread_data->data_written += nsp_header_size;
+    if (dump_ctx->program_info_ctx)
+    {
+        for(u32 i = 0; i < dump_ctx->program_count; i++) programInfoFreeContext(&(dump_ctx->program_info_ctx[i]));
+        free(dump_ctx->program_info_ctx);
+    }
 
-    success = true;
+    cnmtFreeContext(&(dump_ctx->cnmt_ctx));
 
-end:
-    consoleRefresh();
+    if (dump_ctx->nca_ctx) free(dump_ctx->nca_ctx);
 
-    mutexLock(&g_fileMutex);
-    if (!success && !nsp_thread_data->transfer_cancelled) nsp_thread_data->error = true;
-    mutexUnlock(&g_fileMutex);
+    memset(dump_ctx, 0, sizeof(NspDumpContext));
+}
+
+static void nspCalculateCheckpointSourceHash(u8 *out, TitleInfo *title_info, NspDumpContext *dump_ctx)
+{
+    Sha256Context sha256_ctx = {0};
+    u8 options[] = { (u8)getNspSetDownloadDistributionOption(), (u8)getNspRemoveConsoleDataOption(), (u8)getNspRemoveTitlekeyCryptoOption(), \
+                     (u8)getNspDisableLinkedAccountRequirementOption(), (u8)getNspEnableScreenshotsOption(), (u8)getNspEnableVideoCaptureOption(), \
+                     (u8)getNspDisableHdcpOption(), (u8)dump_ctx->generate_authoringtool_data };
+
+    /* Hash states are stored as-is, so checkpoints saved by a different build are discarded as well. */
+    sha256ContextCreate(&sha256_ctx);
+    sha256ContextUpdate(&sha256_ctx, GIT_REV, strlen(GIT_REV));
+    sha256ContextUpdate(&sha256_ctx, &(title_info->meta_key), sizeof(NcmContentMetaKey));
+    sha256ContextUpdate(&sha256_ctx, title_info->content_infos, title_info->content_count * sizeof(NcmContentInfo));
+    sha256ContextUpdate(&sha256_ctx, options, sizeof(options));
+    sha256ContextUpdate(&sha256_ctx, &(dump_ctx->nsp_header_size), sizeof(u64));
+    sha256ContextUpdate(&sha256_ctx, &(dump_ctx->nsp_size), sizeof(u64));
+    sha256ContextGetHash(&sha256_ctx, out);
+}
+
+static void nspLookupCacheSeedTicket(NspLookupCache *lookup_cache, TitleInfo *title_info, Ticket *tik)
+{
+    if (!lookup_cache || !title_info || !tik) return;
 
-    if (fd)
+    // the first half of a rights id holds the title id in big endian
+    // tikRetrieveTicketByRightsId() discards the seeded ticket if its rights id doesn't match the one from the nca
+    u64 title_id = __builtin_bswap64(title_info->meta_key.id);
+
+    for(u32 i = 0; i < lookup_cache->ticket_count; i++)
     {
-        fclose(fd);
+        Ticket *cur_tik = &(lookup_cache->tickets[i]);
+        TikCommonBlock *tik_common_block = tikGetCommonBlockFromTicket(cur_tik);
 
-        if (!success && dev_idx != 1)
+        if (tik_common_block && !memcmp(tik_common_block->rights_id.c, &title_id, sizeof(u64)))
         {
-            if (dev_idx == 0)
-            {
-                utilsRemoveConcatenationFile(filename);
-                utilsCommitSdCardFileSystemChanges();
-            } else {
-                remove(filename);
-            }
+            memcpy(tik, cur_tik, sizeof(Ticket));
+            break;
         }
     }
+}
 
-    pfsFreeFileContext(&pfs_file_ctx);
-
-    if (raw_cert_chain) free(raw_cert_chain);
+static void nspLookupCacheAddTicket(NspLookupCache *lookup_cache, Ticket *tik)
+{
+    TikCommonBlock *tik_common_block = NULL, *cur_tik_common_block = NULL;
+    if (!lookup_cache || !tik || !tik->size || !(tik_common_block = tikGetCommonBlockFromTicket(tik))) return;
 
-    if (legal_info_ctx)
+    for(u32 i = 0; i < lookup_cache->ticket_count; i++)
     {
-        for(u32 i = 0; i < legal_info_count; i++) legalInfoFreeContext(&(legal_info_ctx[i]));
-        free(legal_info_ctx);
+        cur_tik_common_block = tikGetCommonBlockFromTicket(&(lookup_cache->tickets[i]));
+        if (cur_tik_common_block && !memcmp(cur_tik_common_block->rights_id.c, tik_common_block->rights_id.c, sizeof(tik_common_block->rights_id.c))) return;
     }
 
-    if (nacp_ctx)
+    memcpy(&(lookup_cache->tickets[lookup_cache->ticket_idx]), tik, sizeof(Ticket));
+
+    lookup_cache->ticket_idx = ((lookup_cache->ticket_idx + 1) % NSP_BATCH_TICKET_CACHE_SIZE);
+    if (lookup_cache->ticket_count < NSP_BATCH_TICKET_CACHE_SIZE) lookup_cache->ticket_count++;
+}
+
+static u8 *nspLookupCacheGetCertificateChain(NspLookupCache *lookup_cache, const char *issuer, u64 *out_size)
+{
+    if (!lookup_cache) return certGenerateRawCertificateChainBySignatureIssuer(issuer, out_size);
+
+    if (!issuer || !out_size) return NULL;
+
+    u8 *raw_cert_chain = NULL;
+
+    // generate the certificate chain if it isn't cached yet -- most tickets share the same signature issuer
+    if (!lookup_cache->raw_cert_chain || strncmp(lookup_cache->cert_issuer, issuer, sizeof(lookup_cache->cert_issuer)) != 0)
     {
-        for(u32 i = 0; i < control_count; i++) nacpFreeContext(&(nacp_ctx[i]));
-        free(nacp_ctx);
+        if (!(raw_cert_chain = certGenerateRawCertificateChainBySignatureIssuer(issuer, out_size))) return NULL;
+
+        if (lookup_cache->raw_cert_chain) free(lookup_cache->raw_cert_chain);
+
+        lookup_cache->raw_cert_chain = raw_cert_chain;
+        lookup_cache->raw_cert_chain_size = *out_size;
+        snprintf(lookup_cache->cert_issuer, sizeof(lookup_cache->cert_issuer), "%s", issuer);
     }
 
-    if (program_info_ctx)
+    // the caller takes ownership of the returned buffer
+    if (!(raw_cert_chain = malloc(lookup_cache->raw_cert_chain_size))) return NULL;
+
+    memcpy(raw_cert_chain, lookup_cache->raw_cert_chain, lookup_cache->raw_cert_chain_size);
+    *out_size = lookup_cache->raw_cert_chain_size;
+
+    return raw_cert_chain;
+}
+
+static void nspLookupCacheFree(NspLookupCache *lookup_cache)
+{
+    if (!lookup_cache) return;
+    if (lookup_cache->raw_cert_chain) free(lookup_cache->raw_cert_chain);
+    memset(lookup_cache, 0, sizeof(NspLookupCache));
+}
+
+static bool nspHashInitialize(NspHashData *nsp_hash_data)
+{
+    memset(nsp_hash_data, 0, sizeof(NspHashData));
+
+    /* Run the hash thread on a different core than the dump thread. */
+    nsp_hash_data->thread_started = utilsCreateThread(&(nsp_hash_data->thread), nspHashThreadFunc, nsp_hash_data, 1);
+
+    return nsp_hash_data->thread_started;
+}
+
+static void nspHashReset(NspHashData *nsp_hash_data)
+{
+    mutexLock(&g_nspHashMutex);
+
+    /* Wait until all pending data blocks have been processed. */
+    while(nsp_hash_data->count) condvarWait(&g_nspHashDoneCondvar, &g_nspHashMutex);
+
+    sha256ContextCreate(&(nsp_hash_data->sha256_ctx));
+
+    mutexUnlock(&g_nspHashMutex);
+}
+
+static void nspHashSubmitData(NspHashData *nsp_hash_data, const void *data, u64 data_size)
+{
+    if (!data || !data_size) return;
+
+    mutexLock(&g_nspHashMutex);
+
+    /* Wait until there's room for another data block. */
+    while(nsp_hash_data->count >= NSP_HASH_QUEUE_SIZE) condvarWait(&g_nspHashDoneCondvar, &g_nspHashMutex);
+
+    NspHashBlock *block = &(nsp_hash_data->blocks[(nsp_hash_data->head + nsp_hash_data->count) % NSP_HASH_QUEUE_SIZE]);
+    block->data = data;
+    block->size = data_size;
+    nsp_hash_data->count++;
+
+    mutexUnlock(&g_nspHashMutex);
+    condvarWakeAll(&g_nspHashSubmitCondvar);
+}
+
+static void nspHashWaitForBuffer(NspHashData *nsp_hash_data, const void *buf, u64 buf_size)
+{
+    const u8 *buf_start = (const u8*)buf, *buf_end = (buf_start + buf_size);
+    bool in_use = false;
+
+    mutexLock(&g_nspHashMutex);
+
+    /* Wait until no pending data block overlaps with the provided buffer. This guarantees it can be safely overwritten by the caller. */
+    do {
+        in_use = false;
+
+        for(u32 i = 0; i < nsp_hash_data->count; i++)
+        {
+            NspHashBlock *block = &(nsp_hash_data->blocks[(nsp_hash_data->head + i) % NSP_HASH_QUEUE_SIZE]);
+            const u8 *block_start = (const u8*)block->data, *block_end = (block_start + block->size);
+
+            if (block_start < buf_end && buf_start < block_end)
+            {
+                in_use = true;
+                break;
+            }
+        }
+
+        if (in_use) condvarWait(&g_nspHashDoneCondvar, &g_nspHashMutex);
+    } while(in_use);
+
+    mutexUnlock(&g_nspHashMutex);
+}
+
+static void nspHashGetHash(NspHashData *nsp_hash_data, u8 *out)
+{
+    mutexLock(&g_nspHashMutex);
+    while(nsp_hash_data->count) condvarWait(&g_nspHashDoneCondvar, &g_nspHashMutex);
+    sha256ContextGetHash(&(nsp_hash_data->sha256_ctx), out);
+    mutexUnlock(&g_nspHashMutex);
+}
+
+static void nspHashGetState(NspHashData *nsp_hash_data, Sha256Context *out)
+{
+    mutexLock(&g_nspHashMutex);
+    while(nsp_hash_data->count) condvarWait(&g_nspHashDoneCondvar, &g_nspHashMutex);
+    memcpy(out, &(nsp_hash_data->sha256_ctx), sizeof(Sha256Context));
+    mutexUnlock(&g_nspHashMutex);
+}
+
+static void nspHashSetState(NspHashData *nsp_hash_data, const Sha256Context *state)
+{
+    mutexLock(&g_nspHashMutex);
+    while(nsp_hash_data->count) condvarWait(&g_nspHashDoneCondvar, &g_nspHashMutex);
+    memcpy(&(nsp_hash_data->sha256_ctx), state, sizeof(Sha256Context));
+    mutexUnlock(&g_nspHashMutex);
+}
+
+static void nspHashFree(NspHashData *nsp_hash_data)
+{
+    if (!nsp_hash_data->thread_started) return;
+
+    mutexLock(&g_nspHashMutex);
+    nsp_hash_data->exit = true;
+    mutexUnlock(&g_nspHashMutex);
+    condvarWakeAll(&g_nspHashSubmitCondvar);
+
+    utilsJoinThread(&(nsp_hash_data->thread));
+
+    memset(nsp_hash_data, 0, sizeof(NspHashData));
+}
+
+static void nspHashThreadFunc(void *arg)
+{
+    NspHashData *nsp_hash_data = (NspHashData*)arg;
+    NspHashBlock block = {0};
+
+    while(true)
     {
-        for(u32 i = 0; i < program_count; i++) programInfoFreeContext(&(program_info_ctx[i]));
-        free(program_info_ctx);
-    }
+        /* Wait until a new data block has been submitted. */
+        mutexLock(&g_nspHashMutex);
+        while(!nsp_hash_data->count && !nsp_hash_data->exit) condvarWait(&g_nspHashSubmitCondvar, &g_nspHashMutex);
 
-    cnmtFreeContext(&cnmt_ctx);
+        /* Pending data blocks are discarded if we're exiting, since the dump has already been aborted. */
+        if (nsp_hash_data->exit)
+        {
+            mutexUnlock(&g_nspHashMutex);
+            break;
+        }
 
-    if (nca_ctx) free(nca_ctx);
+        /* Keep the block in the queue while it's being processed, so its buffer isn't reused in the meantime. */
+        block = nsp_hash_data->blocks[nsp_hash_data->head];
 
-    if (filename) free(filename);
+        mutexUnlock(&g_nspHashMutex);
 
-    if (buf) free(buf);
+        sha256ContextUpdate(&(nsp_hash_data->sha256_ctx), block.data, block.size);
+
+        /* Let the dump thread know we're done with this data block. */
+        mutexLock(&g_nspHashMutex);
+        nsp_hash_data->head = ((nsp_hash_data->head + 1) % NSP_HASH_QUEUE_SIZE);
+        nsp_hash_data->count--;
+        mutexUnlock(&g_nspHashMutex);
+        condvarWakeAll(&g_nspHashDoneCondvar);
+    }
 
     threadExit();
 }
 
+static bool writeFileContextHeaderDataToFile(const void *data, u64 data_size, void *userdata)
+{
+    return (fwrite(data, 1, data_size, (FILE*)userdata) == data_size);
+}
+
+static bool writeFileContextHeaderDataToSdWriter(const void *data, u64 data_size, void *userdata)
+{
+    return sdWriterWrite((SdWriter*)userdata, data, data_size);
+}
+
+static u8 printDatLookupResult(const char *prefix, u64 size, const DigestResult *digest_result, u8 digest_mask)
+{
+    char name[0x200] = {0};
+
+    u8 match_type = datLookupEntry(size, digest_result, digest_mask, name, sizeof(name));
+    if (match_type != DatMatchType_None)
+    {
+        consolePrint("%s dat match (%s): %s\n", prefix, datGetMatchTypeName(match_type), name);
+    } else {
+        consolePrint("%s: no dat match\n", prefix);
+    }
+
+    return match_type;
+}
+
 static u32 getOutputStorageOption(void)
 {
     return (u32)configGetInteger("output_storage");
@@ -5585,6 +7237,16 @@ static void setGameCardWriteRawHfsPartitionOption(u32 idx)
     configSetBoolean("gamecard/write_raw_hfs_partition", (bool)idx);
 }
 
+static u32 getGameCardVerifyHfsEntriesOption(void)
+{
+    return (u32)configGetBoolean("gamecard/verify_hfs_entries");
+}
+
+static void setGameCardVerifyHfsEntriesOption(u32 idx)
+{
+    configSetBoolean("gamecard/verify_hfs_entries", (bool)idx);
+}
+
 static u32 getNspSetDownloadDistributionOption(void)
 {
     return (u32)configGetBoolean("nsp/set_download_distribution");
@@ -0,0 +1,302 @@
+/*
+ * compat.c
+ *
+ * Copyright (c) 2020-2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <zlib.h>
+
+#include "nxdt_utils.h"
+
+/* Global variables. */
+
+/// Events don't map to a single kernel object, so all of them share the same lock and condition variable.
+static pthread_mutex_t g_eventLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_eventCond = PTHREAD_COND_INITIALIZER;
+
+static pthread_mutex_t g_logLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Function prototypes. */
+
+static void *compatThreadTrampoline(void *arg);
+static struct timespec compatGetDeadline(u64 timeout);
+
+NX_INLINE u32 compatGetThreadId(void)
+{
+    return (u32)syscall(SYS_gettid);
+}
+
+NX_INLINE void compatFutexWait(u32 *addr, u32 value)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+NX_INLINE void compatFutexWake(u32 *addr, int count)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+void mutexLock(Mutex *m)
+{
+    u32 tid = compatGetThreadId(), cur = 0;
+
+    while(!atomic_compare_exchange_weak((_Atomic u32*)m, &cur, tid))
+    {
+        if (cur) compatFutexWait(m, cur);
+        cur = 0;
+    }
+}
+
+bool mutexTryLock(Mutex *m)
+{
+    u32 cur = 0;
+    return atomic_compare_exchange_strong((_Atomic u32*)m, &cur, compatGetThreadId());
+}
+
+void mutexUnlock(Mutex *m)
+{
+    atomic_store((_Atomic u32*)m, 0);
+    compatFutexWake(m, 1);
+}
+
+bool mutexIsLockedByCurrentThread(const Mutex *m)
+{
+    return (atomic_load((_Atomic u32*)m) == compatGetThreadId());
+}
+
+Result condvarWait(CondVar *c, Mutex *m)
+{
+    u32 seq = atomic_load((_Atomic u32*)c);
+
+    mutexUnlock(m);
+    compatFutexWait(c, seq);
+    mutexLock(m);
+
+    return 0;
+}
+
+Result condvarWakeAll(CondVar *c)
+{
+    atomic_fetch_add((_Atomic u32*)c, 1);
+    compatFutexWake(c, INT_MAX);
+    return 0;
+}
+
+void eventCreate(Event *e, bool autoclear)
+{
+    pthread_mutex_lock(&g_eventLock);
+    e->signaled = false;
+    e->autoclear = autoclear;
+    pthread_mutex_unlock(&g_eventLock);
+}
+
+void eventFire(Event *e)
+{
+    pthread_mutex_lock(&g_eventLock);
+    e->signaled = true;
+    pthread_cond_broadcast(&g_eventCond);
+    pthread_mutex_unlock(&g_eventLock);
+}
+
+Result eventWait(Event *e, u64 timeout)
+{
+    Waiter waiter = waiterForEvent(e);
+    return waitObjects(NULL, &waiter, 1, timeout);
+}
+
+void eventClear(Event *e)
+{
+    pthread_mutex_lock(&g_eventLock);
+    e->signaled = false;
+    pthread_mutex_unlock(&g_eventLock);
+}
+
+void ueventCreate(UEvent *e, bool autoclear)
+{
+    eventCreate(e, autoclear);
+}
+
+void ueventSignal(UEvent *e)
+{
+    eventFire(e);
+}
+
+Result waitObjects(s32 *idx_out, const Waiter *objects, s32 num_objects, u64 timeout)
+{
+    Result rc = MAKERESULT(Module_Kernel, KernelError_TimedOut);
+    struct timespec deadline = compatGetDeadline(timeout);
+    bool wait_forever = (timeout == UINT64_MAX);
+
+    pthread_mutex_lock(&g_eventLock);
+
+    while(true)
+    {
+        s32 idx = 0;
+
+        for(idx = 0; idx < num_objects; idx++)
+        {
+            if (objects[idx].event->signaled) break;
+        }
+
+        if (idx < num_objects)
+        {
+            if (objects[idx].event->autoclear) objects[idx].event->signaled = false;
+            if (idx_out) *idx_out = idx;
+            rc = 0;
+            break;
+        }
+
+        if (wait_forever)
+        {
+            pthread_cond_wait(&g_eventCond, &g_eventLock);
+        } else
+        if (pthread_cond_timedwait(&g_eventCond, &g_eventLock, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&g_eventLock);
+
+    return rc;
+}
+
+void threadExit(void)
+{
+    pthread_exit(NULL);
+}
+
+u64 armGetSystemTick(void)
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((u64)ts.tv_sec * (u64)1000000000 + (u64)ts.tv_nsec);
+}
+
+u32 crc32Calculate(const void *src, size_t size)
+{
+    return (u32)crc32(0, (const Bytef*)src, (uInt)size);
+}
+
+Result usbDsParseReportData(UsbDsReportData *reportdata, u32 urbId, u32 *requestedSize, u32 *transferredSize)
+{
+    u32 count = MIN(reportdata->report_count, (u32)MAX_ELEMENTS(reportdata->report));
+    UsbDsReportEntry *entry = NULL;
+
+    for(u32 i = 0; i < count; i++)
+    {
+        if (reportdata->report[i].id != urbId) continue;
+        entry = &(reportdata->report[i]);
+        break;
+    }
+
+    if (!entry) return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    /* Status 3 means the URB was completed. Anything else means it was cancelled. */
+    if (entry->urb_status != 3) return MAKERESULT(Module_Kernel, KernelError_Cancelled);
+
+    if (requestedSize) *requestedSize = entry->requestedSize;
+    if (transferredSize) *transferredSize = entry->transferredSize;
+
+    return 0;
+}
+
+bool utilsCreateThread(Thread *out_thread, ThreadFunc func, void *arg, int cpu_id)
+{
+    (void)cpu_id;
+
+    if (!out_thread || !func)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    out_thread->func = func;
+    out_thread->arg = arg;
+
+    int ret = pthread_create(&(out_thread->handle), NULL, compatThreadTrampoline, out_thread);
+    if (ret != 0)
+    {
+        LOG_MSG_ERROR("pthread_create failed! (%d).", ret);
+        return false;
+    }
+
+    return true;
+}
+
+void utilsJoinThread(Thread *thread)
+{
+    if (!thread) return;
+    pthread_join(thread->handle, NULL);
+}
+
+void logWriteFormattedStringToLogFile(u8 level, const char *file_name, int line, const char *func_name, const char *fmt, ...)
+{
+    static const char *level_strs[] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+
+    (void)file_name;
+    (void)line;
+
+    va_list args;
+    va_start(args, fmt);
+
+    pthread_mutex_lock(&g_logLock);
+    fprintf(stderr, "[%s] %s: ", level < MAX_ELEMENTS(level_strs) ? level_strs[level] : "?", func_name);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    pthread_mutex_unlock(&g_logLock);
+
+    va_end(args);
+}
+
+void logWriteBinaryDataToLogFile(const void *data, size_t data_size, u8 level, const char *file_name, int line, const char *func_name, const char *fmt, ...)
+{
+    (void)data;
+    (void)data_size;
+    (void)level;
+    (void)file_name;
+    (void)line;
+    (void)func_name;
+    (void)fmt;
+}
+
+static void *compatThreadTrampoline(void *arg)
+{
+    Thread *thread = (Thread*)arg;
+    thread->func(thread->arg);
+    return NULL;
+}
+
+static struct timespec compatGetDeadline(u64 timeout)
+{
+    struct timespec ts = {0};
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    if (timeout != UINT64_MAX)
+    {
+        u64 ns = ((u64)ts.tv_nsec + (timeout % (u64)1000000000));
+        ts.tv_sec += (time_t)((timeout / (u64)1000000000) + (ns / (u64)1000000000));
+        ts.tv_nsec = (long)(ns % (u64)1000000000);
+    }
+
+    return ts;
+}
@@ -0,0 +1,174 @@
+/*
+ * nx_compat.h
+ *
+ * Copyright (c) 2020-2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __NX_COMPAT_H__
+#define __NX_COMPAT_H__
+
+/* Minimal subset of the libnx API used by usb.c, implemented on top of POSIX threads and Linux futexes. */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef u32 Result;
+
+#define SHA256_HASH_SIZE        0x20
+#define FS_MAX_PATH             0x301
+
+#define BIT(n)                  (1U << (n))
+#define PACKED                  __attribute__((packed))
+#define NX_INLINE               __attribute__((always_inline)) static inline
+
+#define R_SUCCEEDED(res)        ((res) == 0)
+#define R_FAILED(res)           ((res) != 0)
+#define MAKERESULT(module, description) ((((module) & 0x1FF)) | ((description) & 0x1FFF) << 9)
+
+enum {
+    Module_Kernel = 1,
+    Module_Libnx  = 345
+};
+
+enum {
+    KernelError_TimedOut  = 117,
+    KernelError_Cancelled = 118
+};
+
+enum {
+    LibnxError_NotFound = 60
+};
+
+/// Mutex. Holds the thread ID of its owner, or zero if it isn't locked.
+typedef u32 Mutex;
+
+/// Condition variable. Holds a sequence counter bumped on each wake-up.
+typedef u32 CondVar;
+
+void mutexLock(Mutex *m);
+bool mutexTryLock(Mutex *m);
+void mutexUnlock(Mutex *m);
+bool mutexIsLockedByCurrentThread(const Mutex *m);
+
+Result condvarWait(CondVar *c, Mutex *m);
+Result condvarWakeAll(CondVar *c);
+
+/// Kernel/user-mode events. Both share the same implementation here.
+typedef struct {
+    bool signaled;
+    bool autoclear;
+} Event;
+
+typedef Event UEvent;
+
+void eventCreate(Event *e, bool autoclear);
+void eventFire(Event *e);
+Result eventWait(Event *e, u64 timeout);
+void eventClear(Event *e);
+
+void ueventCreate(UEvent *e, bool autoclear);
+void ueventSignal(UEvent *e);
+
+typedef struct {
+    Event *event;
+} Waiter;
+
+NX_INLINE Waiter waiterForEvent(Event *e)
+{
+    Waiter w = { e };
+    return w;
+}
+
+NX_INLINE Waiter waiterForUEvent(UEvent *e)
+{
+    Waiter w = { e };
+    return w;
+}
+
+Result waitObjects(s32 *idx_out, const Waiter *objects, s32 num_objects, u64 timeout);
+#define waitMulti(idx_out, timeout, ...) ({ \
+    Waiter _objects[] = { __VA_ARGS__ }; \
+    waitObjects((idx_out), _objects, sizeof(_objects) / sizeof(Waiter), (timeout)); \
+})
+
+typedef void (*ThreadFunc)(void *);
+
+typedef struct {
+    pthread_t handle;
+    ThreadFunc func;
+    void *arg;
+} Thread;
+
+void threadExit(void) __attribute__((noreturn));
+
+/// System ticks are expressed in nanoseconds.
+u64 armGetSystemTick(void);
+
+NX_INLINE u64 armTicksToNs(u64 tick)
+{
+    return tick;
+}
+
+u32 crc32Calculate(const void *src, size_t size);
+
+/// USB device state and endpoint types.
+typedef enum {
+    UsbState_Detached   = 0,
+    UsbState_Configured = 6
+} UsbState;
+
+typedef struct {
+    u32 id;
+    u32 requestedSize;
+    u32 transferredSize;
+    u32 urb_status;
+} UsbDsReportEntry;
+
+typedef struct {
+    UsbDsReportEntry report[8];
+    u32 report_count;
+} UsbDsReportData;
+
+typedef struct {
+    Event CompletionEvent;
+} UsbDsEndpoint;
+
+Result usbDsParseReportData(UsbDsReportData *reportdata, u32 urbId, u32 *requestedSize, u32 *transferredSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NX_COMPAT_H__ */
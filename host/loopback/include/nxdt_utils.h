@@ -0,0 +1,102 @@
+/*
+ * nxdt_utils.h
+ *
+ * Copyright (c) 2020-2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __NXDT_UTILS_H__
+#define __NXDT_UTILS_H__
+
+/* Stands in for include/core/nxdt_utils.h when building usb.c natively. Only provides what usb.c needs. */
+
+/* C headers. */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <malloc.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/param.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+/* libnx replacement. */
+#include "nx_compat.h"
+
+/* Global defines. */
+#include "defines.h"
+
+/* Logger. */
+#include "nxdt_log.h"
+
+/* LZ4 (de)compression. */
+#define LZ4_STATIC_LINKING_ONLY
+#include "lz4.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Scoped lock macro. */
+#define SCOPED_LOCK(mtx)        for(UtilsScopedLock ANONYMOUS_VARIABLE(scoped_lock) CLEANUP(utilsUnlockScope) = utilsLockScope(mtx); ANONYMOUS_VARIABLE(scoped_lock).cond; ANONYMOUS_VARIABLE(scoped_lock).cond = 0)
+
+/* Scoped try lock macro. */
+#define SCOPED_TRY_LOCK(mtx)    for(UtilsScopedLock ANONYMOUS_VARIABLE(scoped_lock) CLEANUP(utilsUnlockScope) = utilsTryLockScope(mtx); ANONYMOUS_VARIABLE(scoped_lock).cond; ANONYMOUS_VARIABLE(scoped_lock).cond = 0)
+
+/// Used by scoped locks.
+typedef struct {
+    Mutex *mtx;
+    bool lock;
+    int cond;
+} UtilsScopedLock;
+
+/// Thread management functions. The CPU core ID is ignored.
+bool utilsCreateThread(Thread *out_thread, ThreadFunc func, void *arg, int cpu_id);
+void utilsJoinThread(Thread *thread);
+
+/// Wrappers used in scoped locks.
+NX_INLINE UtilsScopedLock utilsLockScope(Mutex *mtx)
+{
+    UtilsScopedLock scoped_lock = { mtx, !mutexIsLockedByCurrentThread(mtx), 1 };
+    if (scoped_lock.lock) mutexLock(scoped_lock.mtx);
+    return scoped_lock;
+}
+
+NX_INLINE UtilsScopedLock utilsTryLockScope(Mutex *mtx)
+{
+    UtilsScopedLock scoped_lock = { mtx, !mutexIsLockedByCurrentThread(mtx), 1 };
+    if (scoped_lock.lock) scoped_lock.cond = (int)mutexTryLock(scoped_lock.mtx);
+    return scoped_lock;
+}
+
+NX_INLINE void utilsUnlockScope(UtilsScopedLock *scoped_lock)
+{
+    if (scoped_lock->lock) mutexUnlock(scoped_lock->mtx);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NXDT_UTILS_H__ */
@@ -0,0 +1,309 @@
+/*
+ * main.c
+ *
+ * Copyright (c) 2020-2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <getopt.h>
+
+#include "nxdt_utils.h"
+#include "usb.h"
+#include "usb_socket.h"
+
+/* Runs the real USB interface code (source/core/usb.c) natively against the host script, using its loopback transport. */
+/* Start the host script with `--loopback <path>` first, then run this program using the same path. */
+
+#define LOOPBACK_SESSION_TIMEOUT    30                          /* 30 seconds. */
+#define LOOPBACK_DEFAULT_FILE_SIZE  0x10000000                  /* 256 MiB. */
+
+/* Type definitions. */
+
+typedef enum {
+    LoopbackDataPattern_Random  = 0,    ///< Incompressible.
+    LoopbackDataPattern_Text    = 1,    ///< Compressible.
+    LoopbackDataPattern_Zeros   = 2     ///< Highly compressible.
+} LoopbackDataPattern;
+
+typedef struct {
+    u64 file_size;
+    u32 file_count;
+    u64 chunk_size;
+    bool batch;
+    bool in_place;
+    u8 pattern;
+} LoopbackOptions;
+
+/* Function prototypes. */
+
+static void loopbackPrintUsage(const char *argv0);
+static bool loopbackWaitForSession(void);
+static void loopbackFillBuffer(u8 *buf, u64 size, u64 offset, u32 file_idx, u8 pattern);
+static bool loopbackSendFileData(const LoopbackOptions *opts, u32 file_idx, u8 *buf);
+
+int main(int argc, char *argv[])
+{
+    LoopbackOptions opts = { LOOPBACK_DEFAULT_FILE_SIZE, 1, USB_TRANSFER_BUFFER_SIZE, false, false, LoopbackDataPattern_Random };
+    UsbFileBatchEntry *entries = NULL;
+    char **filenames = NULL;
+    u8 *buf = NULL;
+    int ret = EXIT_FAILURE;
+
+    static const struct option long_opts[] = {
+        { "size",           required_argument,  NULL, 's' },
+        { "count",          required_argument,  NULL, 'n' },
+        { "batch",          no_argument,        NULL, 'b' },
+        { "chunk-size",     required_argument,  NULL, 'c' },
+        { "in-place",       no_argument,        NULL, 'i' },
+        { "pattern",        required_argument,  NULL, 'p' },
+        { "packet-size",    required_argument,  NULL, 'm' },
+        { "corrupt-urb",    required_argument,  NULL, 'x' },
+        { "help",           no_argument,        NULL, 'h' },
+        { NULL,             0,                  NULL, 0 }
+    };
+
+    int opt = 0;
+
+    while((opt = getopt_long(argc, argv, "s:n:bc:ip:m:x:h", long_opts, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 's':
+                opts.file_size = strtoull(optarg, NULL, 0);
+                break;
+            case 'n':
+                opts.file_count = (u32)strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                opts.batch = true;
+                break;
+            case 'c':
+                opts.chunk_size = strtoull(optarg, NULL, 0);
+                break;
+            case 'i':
+                opts.in_place = true;
+                break;
+            case 'p':
+                if (!strcmp(optarg, "random"))
+                {
+                    opts.pattern = LoopbackDataPattern_Random;
+                } else
+                if (!strcmp(optarg, "text"))
+                {
+                    opts.pattern = LoopbackDataPattern_Text;
+                } else
+                if (!strcmp(optarg, "zeros"))
+                {
+                    opts.pattern = LoopbackDataPattern_Zeros;
+                } else {
+                    loopbackPrintUsage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+
+                break;
+            case 'm':
+                usbSocketSetPacketSize((u32)strtoul(optarg, NULL, 0));
+                break;
+            case 'x':
+                usbSocketSetCorruptUrb((u32)strtoul(optarg, NULL, 0));
+                break;
+            default:
+                loopbackPrintUsage(argv[0]);
+                return (opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (optind != (argc - 1) || !opts.file_count || !opts.chunk_size || opts.chunk_size > USB_TRANSFER_BUFFER_SIZE || (opts.batch && opts.in_place))
+    {
+        loopbackPrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    usbSocketSetPath(argv[optind]);
+
+    /* Allocate data buffer. */
+    buf = usbAllocatePageAlignedBuffer(USB_TRANSFER_BUFFER_SIZE);
+    entries = calloc(opts.file_count, sizeof(UsbFileBatchEntry));
+    filenames = calloc(opts.file_count, sizeof(char*));
+    if (!buf || !entries || !filenames)
+    {
+        LOG_MSG_ERROR("Failed to allocate memory!");
+        goto end;
+    }
+
+    for(u32 i = 0; i < opts.file_count; i++)
+    {
+        if (asprintf(&(filenames[i]), "loopback_%u.bin", i) < 0)
+        {
+            LOG_MSG_ERROR("Failed to generate filename #%u!", i);
+            goto end;
+        }
+
+        entries[i].filename = filenames[i];
+        entries[i].file_size = opts.file_size;
+    }
+
+    if (!usbInitialize())
+    {
+        LOG_MSG_ERROR("Failed to initialize USB interface!");
+        goto end;
+    }
+
+    if (!loopbackWaitForSession()) goto end;
+
+    u64 start = armGetSystemTick(), total_size = (opts.file_size * opts.file_count);
+
+    if (opts.batch && !usbSendFileBatchProperties(entries, opts.file_count))
+    {
+        LOG_MSG_ERROR("Failed to send file batch properties!");
+        goto end;
+    }
+
+    for(u32 i = 0; i < opts.file_count; i++)
+    {
+        if (!opts.batch && !usbSendFileProperties(entries[i].file_size, entries[i].filename))
+        {
+            LOG_MSG_ERROR("Failed to send file properties for \"%s\"!", entries[i].filename);
+            goto end;
+        }
+
+        if (!loopbackSendFileData(&opts, i, buf)) goto end;
+    }
+
+    u64 elapsed = (armGetSystemTick() - start);
+    double seconds = ((double)elapsed / 1000000000.0);
+
+    printf("Sent %u file(s), 0x%lX bytes in %.3f seconds (%.2f MiB/s).\n", opts.file_count, total_size, seconds, seconds > 0.0 ? (((double)total_size / (1024.0 * 1024.0)) / seconds) : 0.0);
+
+    ret = EXIT_SUCCESS;
+
+end:
+    usbExit();
+
+    if (filenames)
+    {
+        for(u32 i = 0; i < opts.file_count; i++) free(filenames[i]);
+        free(filenames);
+    }
+
+    if (entries) free(entries);
+
+    if (buf) free(buf);
+
+    return ret;
+}
+
+static void loopbackPrintUsage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [options] <socket path>\n\n" \
+                    "Options:\n" \
+                    "  -s, --size <bytes>          Size of each file. Defaults to 0x%X.\n" \
+                    "  -n, --count <num>           Number of files to send. Defaults to 1.\n" \
+                    "  -b, --batch                 Send all files using a single file batch command.\n" \
+                    "  -c, --chunk-size <bytes>    Data chunk size passed to usbSendFileData(). Defaults to (and can't exceed) 0x%X.\n" \
+                    "  -i, --in-place              Use usbGetFileDataBuffer() / usbCommitFileDataBuffer() instead of usbSendFileData().\n" \
+                    "  -p, --pattern <name>        File data pattern: random (default), text or zeros.\n" \
+                    "  -m, --packet-size <bytes>   Endpoint max packet size. Must match --loopback-packet-size from the host script. Defaults to 0x200.\n" \
+                    "  -x, --corrupt-urb <num>     Flip a bit from the provided input endpoint URB (1-based, command URBs included).\n", \
+                    argv0, LOOPBACK_DEFAULT_FILE_SIZE, USB_TRANSFER_BUFFER_SIZE);
+}
+
+static bool loopbackWaitForSession(void)
+{
+    u64 deadline = (armGetSystemTick() + (LOOPBACK_SESSION_TIMEOUT * (u64)1000000000));
+
+    while(!usbIsReady())
+    {
+        if (armGetSystemTick() >= deadline)
+        {
+            LOG_MSG_ERROR("Timed out waiting for a USB session!");
+            return false;
+        }
+
+        usleep(10000);
+    }
+
+    return true;
+}
+
+static void loopbackFillBuffer(u8 *buf, u64 size, u64 offset, u32 file_idx, u8 pattern)
+{
+    static const char text[] = "The quick brown fox jumps over the lazy dog. ";
+
+    switch(pattern)
+    {
+        case LoopbackDataPattern_Random:
+            /* splitmix64 over the file index and absolute word index. Each byte is picked from its word using its absolute position, */
+            /* so data doesn't depend on the chunk size, even if chunks aren't aligned to a word boundary. */
+            for(u64 i = 0; i < size; i++)
+            {
+                u64 pos = (offset + i), val = ((((u64)file_idx << 48) ^ (pos / sizeof(u64))) + 0x9E3779B97F4A7C15ULL);
+                val = ((val ^ (val >> 30)) * 0xBF58476D1CE4E5B9ULL);
+                val = ((val ^ (val >> 27)) * 0x94D049BB133111EBULL);
+                val ^= (val >> 31);
+                buf[i] = (u8)(val >> ((pos % sizeof(u64)) * 8));
+            }
+
+            break;
+        case LoopbackDataPattern_Text:
+            for(u64 i = 0; i < size; i++) buf[i] = (u8)text[(offset + i) % (sizeof(text) - 1)];
+            break;
+        default:
+            memset(buf, 0, size);
+            break;
+    }
+}
+
+static bool loopbackSendFileData(const LoopbackOptions *opts, u32 file_idx, u8 *buf)
+{
+    for(u64 offset = 0; offset < opts->file_size;)
+    {
+        u64 chunk_size = MIN(opts->chunk_size, opts->file_size - offset);
+
+        if (opts->in_place)
+        {
+            u64 buf_size = 0;
+            u8 *data_buf = usbGetFileDataBuffer(&buf_size);
+            if (!data_buf)
+            {
+                LOG_MSG_ERROR("Failed to get file data buffer! (file #%u, offset 0x%lX).", file_idx, offset);
+                return false;
+            }
+
+            chunk_size = MIN(chunk_size, buf_size);
+            loopbackFillBuffer(data_buf, chunk_size, offset, file_idx, opts->pattern);
+
+            if (!usbCommitFileDataBuffer(data_buf, chunk_size))
+            {
+                LOG_MSG_ERROR("Failed to commit file data buffer! (file #%u, offset 0x%lX).", file_idx, offset);
+                return false;
+            }
+        } else {
+            loopbackFillBuffer(buf, chunk_size, offset, file_idx, opts->pattern);
+
+            if (!usbSendFileData(buf, chunk_size))
+            {
+                LOG_MSG_ERROR("Failed to send file data! (file #%u, offset 0x%lX).", file_idx, offset);
+                return false;
+            }
+        }
+
+        offset += chunk_size;
+    }
+
+    return true;
+}
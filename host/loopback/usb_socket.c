@@ -0,0 +1,540 @@
+/*
+ * usb_socket.c
+ *
+ * Copyright (c) 2020-2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "nxdt_utils.h"
+#include "usb_transport.h"
+#include "usb_socket.h"
+
+/* USB transport backed by the Unix domain socket the host script listens on when it's started with `--loopback <path>`. */
+/* Each URB posted to the input endpoint is sent as a single length-prefixed message, and each message sent by the host script completes a single URB posted to the output endpoint. */
+
+#define USB_SOCKET_MSG_HEADER_SIZE  sizeof(u32)
+#define USB_SOCKET_MAX_URB_COUNT    16
+#define USB_SOCKET_POLL_TIMEOUT     100                         /* 100 milliseconds. Used to check for cancellation requests while waiting on the socket. */
+#define USB_SOCKET_CONNECT_ATTEMPTS 100                         /* 10 seconds. */
+
+#define USB_SOCKET_URB_STATUS_DONE      3
+#define USB_SOCKET_URB_STATUS_CANCELLED 4
+
+/* Type definitions. */
+
+typedef struct {
+    void *buf;
+    u32 size;
+    u32 id;
+} UsbSocketUrb;
+
+typedef struct {
+    UsbDsEndpoint endpoint;                         ///< Must be the first member.
+    bool initialized, is_input;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    UsbSocketUrb urbs[USB_SOCKET_MAX_URB_COUNT];    ///< Posted URBs, processed in order by the endpoint thread.
+    u32 urb_idx, urb_count, next_urb_id;
+    UsbDsReportData report_data;                    ///< Reports from the last completed URBs, oldest first.
+    bool cancel, zlt, exit;
+    u8 *pending;                                    ///< Output endpoint only. Message data left over from the last URB.
+    u32 pending_offset, pending_size;
+    Thread thread;
+} UsbSocketEndpoint;
+
+/* Global variables. */
+
+static char g_usbSocketPath[sizeof(((struct sockaddr_un*)NULL)->sun_path)] = {0};
+static u32 g_usbSocketPacketSize = 0x200, g_usbSocketCorruptUrb = 0, g_usbSocketPostedInputUrbCount = 0;
+
+static int g_usbSocketFd = -1;
+static UsbSocketEndpoint g_usbSocketEndpointIn = {0}, g_usbSocketEndpointOut = {0};
+
+static Event g_usbSocketStateChangeEvent = {0};
+static atomic_bool g_usbSocketConnected = false;
+
+/* Function prototypes. */
+
+static bool usbSocketInitialize(UsbDsEndpoint **out_endpoint_in, UsbDsEndpoint **out_endpoint_out);
+static void usbSocketExit(void);
+static Event *usbSocketGetStateChangeEvent(void);
+static Result usbSocketGetState(UsbState *out);
+static Result usbSocketPostBufferAsync(UsbDsEndpoint *endpoint, void *buffer, size_t size, u32 *out_urb_id);
+static Result usbSocketGetReportData(UsbDsEndpoint *endpoint, UsbDsReportData *out);
+static Result usbSocketCancel(UsbDsEndpoint *endpoint);
+static Result usbSocketSetZlt(UsbDsEndpoint *endpoint, bool zlt);
+
+static bool usbSocketConnect(void);
+static void usbSocketDisconnect(void);
+
+static bool usbSocketInitializeEndpoint(UsbSocketEndpoint *ep, bool is_input);
+static void usbSocketCloseEndpoint(UsbSocketEndpoint *ep);
+static void usbSocketEndpointThreadFunc(void *arg);
+
+static bool usbSocketWaitForFd(UsbSocketEndpoint *ep, short events, bool cancellable);
+static bool usbSocketSendData(UsbSocketEndpoint *ep, const void *data, size_t size, bool cancellable);
+static bool usbSocketReceiveData(UsbSocketEndpoint *ep, void *data, size_t size, bool cancellable);
+
+static bool usbSocketWriteUrb(UsbSocketEndpoint *ep, const UsbSocketUrb *urb, u32 *out_transferred_size);
+static bool usbSocketReadUrb(UsbSocketEndpoint *ep, const UsbSocketUrb *urb, u32 *out_transferred_size);
+
+static const UsbTransport g_usbSocketTransport = {
+    .initialize = &usbSocketInitialize,
+    .exit = &usbSocketExit,
+    .get_state_change_event = &usbSocketGetStateChangeEvent,
+    .get_state = &usbSocketGetState,
+    .post_buffer_async = &usbSocketPostBufferAsync,
+    .get_report_data = &usbSocketGetReportData,
+    .cancel = &usbSocketCancel,
+    .set_zlt = &usbSocketSetZlt
+};
+
+const UsbTransport *usbGetTransport(void)
+{
+    return &g_usbSocketTransport;
+}
+
+void usbSocketSetPath(const char *path)
+{
+    snprintf(g_usbSocketPath, sizeof(g_usbSocketPath), "%s", path);
+}
+
+void usbSocketSetPacketSize(u32 packet_size)
+{
+    g_usbSocketPacketSize = packet_size;
+}
+
+void usbSocketSetCorruptUrb(u32 urb_num)
+{
+    g_usbSocketCorruptUrb = urb_num;
+}
+
+static bool usbSocketInitialize(UsbDsEndpoint **out_endpoint_in, UsbDsEndpoint **out_endpoint_out)
+{
+    if (!out_endpoint_in || !out_endpoint_out || !*g_usbSocketPath)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    bool ret = false;
+
+    eventCreate(&g_usbSocketStateChangeEvent, true);
+
+    if (!usbSocketConnect()) goto end;
+
+    if (!usbSocketInitializeEndpoint(&g_usbSocketEndpointIn, true) || !usbSocketInitializeEndpoint(&g_usbSocketEndpointOut, false)) goto end;
+
+    *out_endpoint_in = &(g_usbSocketEndpointIn.endpoint);
+    *out_endpoint_out = &(g_usbSocketEndpointOut.endpoint);
+
+    /* Let usb.c know we're "configured". */
+    eventFire(&g_usbSocketStateChangeEvent);
+
+    ret = true;
+
+end:
+    if (!ret) usbSocketExit();
+
+    return ret;
+}
+
+static void usbSocketExit(void)
+{
+    /* Shutting down the socket makes both endpoint threads bail out of any blocking operations. */
+    usbSocketDisconnect();
+
+    usbSocketCloseEndpoint(&g_usbSocketEndpointOut);
+    usbSocketCloseEndpoint(&g_usbSocketEndpointIn);
+
+    if (g_usbSocketFd >= 0)
+    {
+        close(g_usbSocketFd);
+        g_usbSocketFd = -1;
+    }
+}
+
+static Event *usbSocketGetStateChangeEvent(void)
+{
+    return &g_usbSocketStateChangeEvent;
+}
+
+static Result usbSocketGetState(UsbState *out)
+{
+    *out = (atomic_load(&g_usbSocketConnected) ? UsbState_Configured : UsbState_Detached);
+    return 0;
+}
+
+static Result usbSocketPostBufferAsync(UsbDsEndpoint *endpoint, void *buffer, size_t size, u32 *out_urb_id)
+{
+    UsbSocketEndpoint *ep = (UsbSocketEndpoint*)endpoint;
+    Result rc = 0;
+
+    pthread_mutex_lock(&(ep->lock));
+
+    if (ep->urb_count >= USB_SOCKET_MAX_URB_COUNT)
+    {
+        rc = MAKERESULT(Module_Kernel, KernelError_Cancelled);
+    } else {
+        UsbSocketUrb *urb = &(ep->urbs[(ep->urb_idx + ep->urb_count) % USB_SOCKET_MAX_URB_COUNT]);
+
+        urb->buf = buffer;
+        urb->size = (u32)size;
+        urb->id = ++ep->next_urb_id;
+
+        ep->urb_count++;
+        *out_urb_id = urb->id;
+
+        pthread_cond_broadcast(&(ep->cond));
+    }
+
+    pthread_mutex_unlock(&(ep->lock));
+
+    return rc;
+}
+
+static Result usbSocketGetReportData(UsbDsEndpoint *endpoint, UsbDsReportData *out)
+{
+    UsbSocketEndpoint *ep = (UsbSocketEndpoint*)endpoint;
+
+    pthread_mutex_lock(&(ep->lock));
+    memcpy(out, &(ep->report_data), sizeof(UsbDsReportData));
+    pthread_mutex_unlock(&(ep->lock));
+
+    return 0;
+}
+
+static Result usbSocketCancel(UsbDsEndpoint *endpoint)
+{
+    UsbSocketEndpoint *ep = (UsbSocketEndpoint*)endpoint;
+
+    /* Wait until the endpoint thread has flushed all posted URBs. */
+    pthread_mutex_lock(&(ep->lock));
+
+    ep->cancel = true;
+    pthread_cond_broadcast(&(ep->cond));
+
+    while(ep->urb_count && !ep->exit) pthread_cond_wait(&(ep->cond), &(ep->lock));
+
+    ep->cancel = false;
+
+    pthread_mutex_unlock(&(ep->lock));
+
+    eventFire(&(ep->endpoint.CompletionEvent));
+
+    return 0;
+}
+
+static Result usbSocketSetZlt(UsbDsEndpoint *endpoint, bool zlt)
+{
+    UsbSocketEndpoint *ep = (UsbSocketEndpoint*)endpoint;
+
+    pthread_mutex_lock(&(ep->lock));
+    ep->zlt = zlt;
+    pthread_mutex_unlock(&(ep->lock));
+
+    return 0;
+}
+
+static bool usbSocketConnect(void)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", g_usbSocketPath);
+
+    /* Give the host script some time to start listening. */
+    for(u32 i = 0; i < USB_SOCKET_CONNECT_ATTEMPTS; i++)
+    {
+        g_usbSocketFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (g_usbSocketFd < 0)
+        {
+            LOG_MSG_ERROR("socket failed! (%d).", errno);
+            return false;
+        }
+
+        if (connect(g_usbSocketFd, (struct sockaddr*)&addr, sizeof(addr)) == 0)
+        {
+            atomic_store(&g_usbSocketConnected, true);
+            return true;
+        }
+
+        close(g_usbSocketFd);
+        g_usbSocketFd = -1;
+
+        usleep(USB_SOCKET_POLL_TIMEOUT * 1000);
+    }
+
+    LOG_MSG_ERROR("Unable to connect to \"%s\"! (%d).", g_usbSocketPath, errno);
+
+    return false;
+}
+
+static void usbSocketDisconnect(void)
+{
+    /* Emulates a USB cable being unplugged. */
+    if (!atomic_exchange(&g_usbSocketConnected, false)) return;
+
+    shutdown(g_usbSocketFd, SHUT_RDWR);
+    eventFire(&g_usbSocketStateChangeEvent);
+}
+
+static bool usbSocketInitializeEndpoint(UsbSocketEndpoint *ep, bool is_input)
+{
+    memset(ep, 0, sizeof(UsbSocketEndpoint));
+
+    ep->initialized = true;
+    ep->is_input = is_input;
+    pthread_mutex_init(&(ep->lock), NULL);
+    pthread_cond_init(&(ep->cond), NULL);
+    eventCreate(&(ep->endpoint.CompletionEvent), false);
+
+    if (!utilsCreateThread(&(ep->thread), usbSocketEndpointThreadFunc, ep, 0))
+    {
+        LOG_MSG_ERROR("Failed to create %s endpoint thread!", is_input ? "input" : "output");
+        ep->exit = true;
+        return false;
+    }
+
+    return true;
+}
+
+static void usbSocketCloseEndpoint(UsbSocketEndpoint *ep)
+{
+    if (!ep->initialized) return;
+
+    pthread_mutex_lock(&(ep->lock));
+    bool running = !ep->exit;
+    ep->exit = true;
+    pthread_cond_broadcast(&(ep->cond));
+    pthread_mutex_unlock(&(ep->lock));
+
+    if (running) utilsJoinThread(&(ep->thread));
+
+    if (ep->pending) free(ep->pending);
+
+    pthread_cond_destroy(&(ep->cond));
+    pthread_mutex_destroy(&(ep->lock));
+
+    memset(ep, 0, sizeof(UsbSocketEndpoint));
+}
+
+static void usbSocketEndpointThreadFunc(void *arg)
+{
+    UsbSocketEndpoint *ep = (UsbSocketEndpoint*)arg;
+
+    while(true)
+    {
+        pthread_mutex_lock(&(ep->lock));
+
+        while(!ep->urb_count && !ep->exit) pthread_cond_wait(&(ep->cond), &(ep->lock));
+
+        if (ep->exit)
+        {
+            pthread_mutex_unlock(&(ep->lock));
+            break;
+        }
+
+        UsbSocketUrb urb = ep->urbs[ep->urb_idx];
+        bool cancel = ep->cancel;
+
+        pthread_mutex_unlock(&(ep->lock));
+
+        /* Process URB. */
+        u32 transferred_size = 0;
+        bool success = (!cancel && atomic_load(&g_usbSocketConnected));
+        if (success) success = (ep->is_input ? usbSocketWriteUrb(ep, &urb, &transferred_size) : usbSocketReadUrb(ep, &urb, &transferred_size));
+
+        pthread_mutex_lock(&(ep->lock));
+
+        /* Update report data. The oldest entry is dropped if it's full. */
+        UsbDsReportData *report_data = &(ep->report_data);
+        if (report_data->report_count >= MAX_ELEMENTS(report_data->report))
+        {
+            memmove(&(report_data->report[0]), &(report_data->report[1]), sizeof(report_data->report) - sizeof(report_data->report[0]));
+            report_data->report_count--;
+        }
+
+        UsbDsReportEntry *entry = &(report_data->report[report_data->report_count++]);
+        entry->id = urb.id;
+        entry->requestedSize = urb.size;
+        entry->transferredSize = transferred_size;
+        entry->urb_status = (success ? USB_SOCKET_URB_STATUS_DONE : USB_SOCKET_URB_STATUS_CANCELLED);
+
+        ep->urb_idx = ((ep->urb_idx + 1) % USB_SOCKET_MAX_URB_COUNT);
+        ep->urb_count--;
+
+        pthread_cond_broadcast(&(ep->cond));
+        pthread_mutex_unlock(&(ep->lock));
+
+        eventFire(&(ep->endpoint.CompletionEvent));
+    }
+
+    threadExit();
+}
+
+static bool usbSocketWaitForFd(UsbSocketEndpoint *ep, short events, bool cancellable)
+{
+    struct pollfd pfd = { .fd = g_usbSocketFd, .events = events };
+
+    while(true)
+    {
+        pthread_mutex_lock(&(ep->lock));
+        bool cancel = ((cancellable && ep->cancel) || ep->exit);
+        pthread_mutex_unlock(&(ep->lock));
+
+        if (cancel || !atomic_load(&g_usbSocketConnected)) return false;
+
+        int ret = poll(&pfd, 1, USB_SOCKET_POLL_TIMEOUT);
+        if (ret > 0) return true;
+
+        if (ret < 0 && errno != EINTR)
+        {
+            LOG_MSG_ERROR("poll failed! (%d).", errno);
+            return false;
+        }
+    }
+}
+
+static bool usbSocketSendData(UsbSocketEndpoint *ep, const void *data, size_t size, bool cancellable)
+{
+    const u8 *data_u8 = (const u8*)data;
+
+    while(size)
+    {
+        if (!usbSocketWaitForFd(ep, POLLOUT, cancellable)) return false;
+
+        ssize_t ret = send(g_usbSocketFd, data_u8, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno == EAGAIN || errno == EINTR) continue;
+            usbSocketDisconnect();
+            return false;
+        }
+
+        data_u8 += ret;
+        size -= (size_t)ret;
+    }
+
+    return true;
+}
+
+static bool usbSocketReceiveData(UsbSocketEndpoint *ep, void *data, size_t size, bool cancellable)
+{
+    u8 *data_u8 = (u8*)data;
+
+    while(size)
+    {
+        if (!usbSocketWaitForFd(ep, POLLIN, cancellable)) return false;
+
+        ssize_t ret = recv(g_usbSocketFd, data_u8, size, MSG_DONTWAIT);
+        if (ret <= 0)
+        {
+            if (ret < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+
+            /* The host script closed the connection. */
+            usbSocketDisconnect();
+            return false;
+        }
+
+        data_u8 += ret;
+        size -= (size_t)ret;
+    }
+
+    return true;
+}
+
+static bool usbSocketWriteUrb(UsbSocketEndpoint *ep, const UsbSocketUrb *urb, u32 *out_transferred_size)
+{
+    u32 msg_size = urb->size;
+    const u8 *data = (const u8*)urb->buf;
+
+    /* Optionally flip a bit from a specific URB, which lets us exercise integrity block retransmissions. */
+    /* The URB buffer itself is left untouched, so the retransmitted data is valid. */
+    bool corrupt = (g_usbSocketCorruptUrb && ++g_usbSocketPostedInputUrbCount == g_usbSocketCorruptUrb && msg_size);
+    u8 corrupt_byte = (corrupt ? (data[0] ^ 0x01) : 0);
+
+    /* Cancellation requests are only honored until the message header has been sent, in order to keep the stream framing intact. */
+    if (!usbSocketSendData(ep, &msg_size, USB_SOCKET_MSG_HEADER_SIZE, true)) return false;
+
+    if (corrupt)
+    {
+        LOG_MSG_INFO("Corrupting input endpoint URB #%u.", g_usbSocketCorruptUrb);
+        if (!usbSocketSendData(ep, &corrupt_byte, 1, false) || !usbSocketSendData(ep, data + 1, msg_size - 1, false)) return false;
+    } else {
+        if (!usbSocketSendData(ep, data, msg_size, false)) return false;
+    }
+
+    /* Issue a ZLT packet if needed. */
+    pthread_mutex_lock(&(ep->lock));
+    bool zlt = (ep->zlt && IS_ALIGNED(msg_size, g_usbSocketPacketSize));
+    pthread_mutex_unlock(&(ep->lock));
+
+    if (zlt)
+    {
+        u32 zlt_size = 0;
+        if (!usbSocketSendData(ep, &zlt_size, USB_SOCKET_MSG_HEADER_SIZE, false)) return false;
+    }
+
+    *out_transferred_size = urb->size;
+
+    return true;
+}
+
+static bool usbSocketReadUrb(UsbSocketEndpoint *ep, const UsbSocketUrb *urb, u32 *out_transferred_size)
+{
+    /* Receive a new message if there's no leftover data from the last one. */
+    if (ep->pending_offset >= ep->pending_size)
+    {
+        u32 msg_size = 0;
+
+        if (!usbSocketReceiveData(ep, &msg_size, USB_SOCKET_MSG_HEADER_SIZE, true)) return false;
+
+        if (msg_size > ep->pending_size || !ep->pending)
+        {
+            u8 *tmp = realloc(ep->pending, MAX(msg_size, 1));
+            if (!tmp)
+            {
+                LOG_MSG_ERROR("Failed to allocate 0x%X bytes long message buffer!", msg_size);
+                return false;
+            }
+
+            ep->pending = tmp;
+        }
+
+        ep->pending_offset = 0;
+        ep->pending_size = msg_size;
+
+        /* Don't let a cancellation request leave us in the middle of a message. */
+        if (msg_size && !usbSocketReceiveData(ep, ep->pending, msg_size, false))
+        {
+            ep->pending_size = 0;
+            return false;
+        }
+    }
+
+    /* Messages larger than the URB are split, just like a bulk transfer would. */
+    u32 transferred_size = MIN(urb->size, ep->pending_size - ep->pending_offset);
+    memcpy(urb->buf, ep->pending + ep->pending_offset, transferred_size);
+    ep->pending_offset += transferred_size;
+
+    *out_transferred_size = transferred_size;
+
+    return true;
+}
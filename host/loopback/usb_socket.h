@@ -0,0 +1,44 @@
+/*
+ * usb_socket.h
+ *
+ * Copyright (c) 2020-2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __USB_SOCKET_H__
+#define __USB_SOCKET_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Sets the Unix domain socket path the host script is listening on. Must be called before usbInitialize().
+void usbSocketSetPath(const char *path);
+
+/// Sets the endpoint max packet size used to decide when ZLT packets are issued. Must match the value used by the host script.
+void usbSocketSetPacketSize(u32 packet_size);
+
+/// Flips a bit from the data sent by the provided input endpoint URB (1-based). Zero disables this.
+void usbSocketSetCorruptUrb(u32 urb_num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USB_SOCKET_H__ */
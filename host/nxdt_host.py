@@ -23,6 +23,7 @@
 
 # This script depends on PyUSB and tqdm.
 # Optionally, comtypes may also be installed under Windows to provide taskbar progress functionality.
+# Optionally, lz4 may also be installed to enable compressed file data transfers.
 
 # Use `pip -r requirements.txt` under Linux or MacOS to install these dependencies.
 # Windows users may just double-click `windows_install_deps.py` to achieve the same result.
@@ -32,6 +33,9 @@
 # Under MacOS, use `brew install libusb` to install libusb via Homebrew.
 # Under Linux, you should be good to go from the start. If not, just use the package manager from your distro to install libusb.
 
+# The USB transport can be replaced with a loopback transport (`--loopback` option), which listens on a Unix domain socket instead of talking to a console.
+# This is meant for local testing and benchmarking of the ABI, using the native client from the `loopback` directory to emulate the console side.
+
 from __future__ import annotations
 
 import sys
@@ -44,6 +48,9 @@ import queue
 import shutil
 import time
 import struct
+import socket
+import hashlib
+import zlib
 import usb.core
 import usb.util
 import warnings
@@ -57,9 +64,15 @@ from tqdm import tqdm
 
 from argparse import ArgumentParser
 
-from io import BufferedWriter
+from io import BufferedWriter, BufferedRandom
 from typing import List, Tuple, Any, Callable, Optional
 
+try:
+    import lz4.block
+    LZ4_AVAILABLE = True
+except ImportError:
+    LZ4_AVAILABLE = False
+
 # Scaling factors.
 WINDOWS_SCALING_FACTOR = 96.0
 SCALE = 1.0
@@ -96,7 +109,7 @@ USB_MAGIC_WORD = b'NXDT'
 
 # Supported USB ABI version.
 USB_ABI_VERSION_MAJOR = 1
-USB_ABI_VERSION_MINOR = 1
+USB_ABI_VERSION_MINOR = 3
 
 # USB command header size.
 USB_CMD_HEADER_SIZE = 0x10
@@ -107,14 +120,66 @@ USB_CMD_SEND_FILE_PROPERTIES = 1
 USB_CMD_CANCEL_FILE_TRANSFER = 2
 USB_CMD_SEND_NSP_HEADER      = 3
 USB_CMD_END_SESSION          = 4
+USB_CMD_SEND_FILE_BATCH      = 5
+USB_CMD_RESUME_FILE_TRANSFER = 6
 
 # USB command block sizes.
 USB_CMD_BLOCK_SIZE_START_SESSION        = 0x10
 USB_CMD_BLOCK_SIZE_SEND_FILE_PROPERTIES = 0x320
+USB_CMD_BLOCK_SIZE_SEND_FILE_BATCH      = 0x10  # Minimum size. Followed by the file batch manifest.
+USB_CMD_BLOCK_SIZE_RESUME_FILE_TRANSFER = 0x10
+
+# File batch manifest entry header size. Followed by the filename.
+USB_FILE_BATCH_ENTRY_HEADER_SIZE = 0x10
+
+# USB session capability flags.
+USB_CAPABILITY_LZ4_COMPRESSION = 0x01
+USB_CAPABILITY_FILE_RESUME     = 0x02
+USB_CAPABILITY_CHUNK_CHECKSUM  = 0x04
+USB_CAPABILITY_TRANSFER_TUNING = 0x08
+
+# Capabilities supported by this script. Integrity block checksums are opt-in (see --checksum), since they add a host round trip to every URB.
+USB_SUPPORTED_CAPABILITIES = ((USB_CAPABILITY_LZ4_COMPRESSION if LZ4_AVAILABLE else 0) | USB_CAPABILITY_FILE_RESUME | USB_CAPABILITY_TRANSFER_TUNING)
+
+# Compressed frame magic word and header size.
+USB_FRAME_MAGIC_WORD  = b'NXDC'
+USB_FRAME_HEADER_SIZE = 0x10
+
+# Compressed frame read size. Must be bigger than the largest frame nxdumptool can send (0x100010 bytes), and aligned to all endpoint max packet sizes.
+# Each frame is sent as a single USB transfer with Zero-Length Termination, so we always get exactly one frame per read.
+USB_FRAME_READ_SIZE = 0x200000
+
+# Integrity block trailer magic word and size, as well as the max number of times nxdumptool sends each integrity block.
+USB_CHECKSUM_TRAILER_MAGIC_WORD = b'NXDK'
+USB_CHECKSUM_TRAILER_SIZE       = 0x10
+USB_CHECKSUM_MAX_ATTEMPTS       = 4
+
+# Integrity block read size. Each block is a single URB sent with Zero-Length Termination, so we always get exactly one block per read.
+USB_CHECKSUM_BLOCK_READ_SIZE = 0x800000
 
 # Max filename length (file properties).
 USB_FILE_PROPERTIES_MAX_NAME_LENGTH = 0x300
 
+# File properties flags and their offset within the SendFileProperties command block.
+USB_FILE_PROPERTIES_FLAGS_OFFSET   = 0x311
+USB_FILE_PROPERTIES_FLAG_RESUMABLE = 0x01
+
+# File resume info block size, and max size for the tail block covered by its checksum.
+USB_FILE_RESUME_INFO_SIZE = 0x30
+USB_FILE_RESUME_TAIL_SIZE = 0x100000
+
+# USB transfer queue limits. nxdumptool splits its 8 MiB transfer buffer into up to 8 URBs, which must be at least 256 KiB long (2 MiB if LZ4 compression is enabled).
+USB_TRANSFER_BUFFER_SIZE     = 0x800000
+USB_TRANSFER_MAX_QUEUE_DEPTH = 8
+USB_TRANSFER_MIN_URB_SIZE    = 0x40000
+
+# Loopback transport message header size. Each message holds a single USB transfer, prefixed by its length as a 32-bit little endian integer.
+# Zero-length messages represent Zero-Length Termination (ZLT) packets.
+USB_LOOPBACK_MSG_HEADER_SIZE = 0x4
+
+# Default endpoint max packet size used by the loopback transport (USB 2.0).
+USB_LOOPBACK_MAX_PACKET_SIZE = 0x200
+
 # USB status codes.
 USB_STATUS_SUCCESS                 = 0
 USB_STATUS_INVALID_MAGIC_WORD      = 4
@@ -122,6 +187,7 @@ USB_STATUS_UNSUPPORTED_CMD         = 5
 USB_STATUS_UNSUPPORTED_ABI_VERSION = 6
 USB_STATUS_MALFORMED_CMD           = 7
 USB_STATUS_HOST_IO_ERROR           = 8
+USB_STATUS_CHECKSUM_MISMATCH       = 9
 
 # Script title.
 SCRIPT_TITLE = f'{USB_DEV_PRODUCT} host script v{APP_VERSION}'
@@ -329,12 +395,21 @@ g_usbEpIn: Any = None
 g_usbEpOut: Any = None
 g_usbEpMaxPacketSize: int = 0
 
+g_usbLoopbackPath: str = ''
+g_usbLoopbackMaxPacketSize: int = USB_LOOPBACK_MAX_PACKET_SIZE
+g_usbLoopback: Optional[UsbLoopbackTransport] = None
+
 g_nxdtVersionMajor: int = 0
 g_nxdtVersionMinor: int = 0
 g_nxdtVersionMicro: int = 0
 g_nxdtAbiVersionMajor: int = 0
 g_nxdtAbiVersionMinor: int = 0
 g_nxdtGitCommit: str = ''
+g_usbCapabilities: int = 0
+g_usbQueueDepth: int = 0
+g_usbUrbSize: int = 0
+g_usbChecksumEnabled: bool = False
+g_usbChecksumBlockIndex: int = 0
 
 g_nspTransferMode: bool = False
 g_nspSize: int = 0
@@ -343,6 +418,68 @@ g_nspRemainingSize: int = 0
 g_nspFile: Optional[BufferedWriter] = None
 g_nspFilePath: str = ''
 
+# Emulates USB bulk transfer semantics on top of a stream socket. Used in place of the USB endpoints if the loopback transport is enabled.
+# Just like with USB, a read is completed as soon as the requested size is reached, or after receiving a short packet or a ZLT packet.
+# Transfers that are bigger than the remaining read size are split, and their leftover data is returned by the next read.
+class UsbLoopbackTransport:
+    def __init__(self, sock: socket.socket, max_packet_size: int):
+        self.sock = sock
+        self.max_packet_size = max_packet_size
+        self.pending = b''
+        self.pending_short = False
+
+    def _recv(self, size: int) -> bytes:
+        buf = bytearray(size)
+        view = memoryview(buf)
+        pos = 0
+
+        while pos < size:
+            rd = self.sock.recv_into(view[pos:], size - pos)
+            if not rd:
+                raise ConnectionError('Loopback client disconnected.')
+            pos += rd
+
+        return bytes(buf)
+
+    def read(self, size: int, timeout: int = -1) -> bytes:
+        self.sock.settimeout(None if (timeout < 0) else (timeout / 1000))
+
+        data = bytearray()
+
+        while len(data) < size:
+            if self.pending:
+                (transfer, short) = (self.pending, self.pending_short)
+                self.pending = b''
+            else:
+                (transfer_size,) = struct.unpack('<I', self._recv(USB_LOOPBACK_MSG_HEADER_SIZE))
+
+                # ZLT packet.
+                if not transfer_size:
+                    break
+
+                transfer = self._recv(transfer_size)
+                short = bool(transfer_size % self.max_packet_size)
+
+            remaining = (size - len(data))
+            if len(transfer) > remaining:
+                (self.pending, self.pending_short) = (transfer[remaining:], short)
+                (transfer, short) = (transfer[:remaining], False)
+
+            data += transfer
+
+            if short:
+                break
+
+        return bytes(data)
+
+    def write(self, data: bytes, timeout: int = -1) -> int:
+        self.sock.settimeout(None if (timeout < 0) else (timeout / 1000))
+        self.sock.sendall(struct.pack('<I', len(data)) + data)
+        return len(data)
+
+    def close(self) -> None:
+        self.sock.close()
+
 # Reference: https://beenje.github.io/blog/posts/logging-to-a-tkinter-scrolledtext-widget.
 class LogQueueHandler(logging.Handler):
     def __init__(self, log_queue: queue.Queue):
@@ -578,6 +715,32 @@ def utilsResetNspInfo() -> None:
     g_nspFile = None
     g_nspFilePath = ''
 
+def utilsGetFileResumeInfo(file: BufferedRandom, file_size: int) -> Tuple[int, int, bytes]:
+    # Get the amount of data we already hold from a previous transfer attempt.
+    held_size = os.fstat(file.fileno()).st_size
+
+    # Partial files are resumed at a USB_TRANSFER_BLOCK_SIZE boundary. Bigger files can't possibly be related to this transfer.
+    if held_size == file_size:
+        resume_offset = file_size
+    elif held_size < file_size:
+        resume_offset = (held_size - (held_size % USB_TRANSFER_BLOCK_SIZE))
+    else:
+        resume_offset = 0
+
+    # Calculate the checksum for the tail block, which nxdumptool verifies against its own data source.
+    tail_size = min(resume_offset, USB_FILE_RESUME_TAIL_SIZE)
+    tail_hash = (b'\0' * 0x20)
+
+    if tail_size:
+        file.seek(resume_offset - tail_size)
+        tail = file.read(tail_size)
+        if len(tail) == tail_size:
+            tail_hash = hashlib.sha256(tail).digest()
+        else:
+            resume_offset = tail_size = 0
+
+    return (resume_offset, tail_size, tail_hash)
+
 def utilsGetSizeUnitAndDivisor(size: int) -> Tuple[str, int]:
     size_suffixes = [ 'B', 'KiB', 'MiB', 'GiB' ]
     size_suffixes_count = len(size_suffixes)
@@ -663,6 +826,49 @@ def usbGetDeviceEndpoints() -> bool:
 
     return True
 
+def usbWaitForLoopbackClient() -> bool:
+    global g_usbLoopback, g_usbEpMaxPacketSize
+
+    #assert g_logger is not None
+    #assert g_stopEvent is not None
+
+    # Remove stale sockets from previous runs.
+    if os.path.exists(g_usbLoopbackPath):
+        os.remove(g_usbLoopbackPath)
+
+    server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    server.bind(g_usbLoopbackPath)
+    server.listen(1)
+    server.settimeout(0.1)
+
+    g_logger.info(f'Waiting for a loopback client on "{g_usbLoopbackPath}".')
+
+    conn = None
+
+    while conn is None:
+        # Check if the user decided to stop the server.
+        if not g_cliMode and g_stopEvent.is_set():
+            g_stopEvent.clear()
+            break
+
+        try:
+            (conn, addr) = server.accept()
+        except socket.timeout:
+            continue
+
+    server.close()
+    os.remove(g_usbLoopbackPath)
+
+    if conn is None:
+        return False
+
+    g_usbLoopback = UsbLoopbackTransport(conn, g_usbLoopbackMaxPacketSize)
+    g_usbEpMaxPacketSize = g_usbLoopbackMaxPacketSize
+
+    g_logger.debug(f'Loopback client connected. Max packet size: 0x{g_usbEpMaxPacketSize:X}.\n')
+
+    return True
+
 def usbRead(size: int, timeout: int = -1) -> bytes:
     #assert g_logger is not None
 
@@ -670,8 +876,11 @@ def usbRead(size: int, timeout: int = -1) -> bytes:
 
     try:
         # Convert read data to a bytes object for easier handling.
-        rd = bytes(g_usbEpIn.read(size, timeout))
-    except usb.core.USBError:
+        if g_usbLoopback is not None:
+            rd = g_usbLoopback.read(size, timeout)
+        else:
+            rd = bytes(g_usbEpIn.read(size, timeout))
+    except (usb.core.USBError, OSError):
         if not g_cliMode:
             utilsLogException(traceback.format_exc())
         g_logger.error('\nUSB timeout triggered or console disconnected.')
@@ -684,8 +893,11 @@ def usbWrite(data: bytes, timeout: int = -1) -> int:
     wr = 0
 
     try:
-        wr = g_usbEpOut.write(data, timeout)
-    except usb.core.USBError:
+        if g_usbLoopback is not None:
+            wr = g_usbLoopback.write(data, timeout)
+        else:
+            wr = g_usbEpOut.write(data, timeout)
+    except (usb.core.USBError, OSError):
         if not g_cliMode:
             utilsLogException(traceback.format_exc())
         g_logger.error('\nUSB timeout triggered or console disconnected.')
@@ -693,11 +905,133 @@ def usbWrite(data: bytes, timeout: int = -1) -> int:
     return wr
 
 def usbSendStatus(code: int) -> bool:
-    status = struct.pack('<4sIH6p', USB_MAGIC_WORD, code, g_usbEpMaxPacketSize, b'')
+    # The requested USB transfer queue configuration is only read by nxdumptool from the StartSession status response. Zeroes request auto-tuning.
+    status = struct.pack('<4sIHBBI', USB_MAGIC_WORD, code, g_usbEpMaxPacketSize, g_usbCapabilities, g_usbQueueDepth, g_usbUrbSize)
     return bool(usbWrite(status, USB_TRANSFER_TIMEOUT) == len(status))
 
+def usbReadFileData(size: int) -> bytes:
+    #assert g_logger is not None
+
+    # Uncompressed file data streams are read as-is.
+    if not (g_usbCapabilities & USB_CAPABILITY_LZ4_COMPRESSION):
+        return usbRead(size, USB_TRANSFER_TIMEOUT)
+
+    # Compressed file data streams are sent as a sequence of frames.
+    frame = usbRead(USB_FRAME_READ_SIZE, USB_TRANSFER_TIMEOUT)
+
+    # Let the caller take care of errors and CancelFileTransfer commands.
+    if len(frame) <= USB_FRAME_HEADER_SIZE:
+        return frame
+
+    return usbDecodeFrame(frame)
+
+def usbDecodeFrame(frame: bytes) -> bytes:
+    #assert g_logger is not None
+
+    (magic, raw_size, payload_size) = struct.unpack_from('<4sII', frame, 0)
+    if (magic != USB_FRAME_MAGIC_WORD) or (payload_size != (len(frame) - USB_FRAME_HEADER_SIZE)) or (payload_size > raw_size):
+        g_logger.error('Received malformed compressed frame!')
+        return b''
+
+    payload = frame[USB_FRAME_HEADER_SIZE:]
+
+    # Raw data is stored as-is if it couldn't be compressed.
+    if payload_size == raw_size:
+        return payload
+
+    try:
+        data = lz4.block.decompress(payload, uncompressed_size=raw_size)
+    except lz4.block.LZ4BlockError:
+        data = b''
+
+    if len(data) != raw_size:
+        g_logger.error(f'Failed to decompress 0x{payload_size:X}-byte long compressed frame!')
+        return b''
+
+    return data
+
+def usbReadChecksumBlock() -> bytes:
+    #assert g_logger is not None
+
+    global g_usbChecksumBlockIndex
+
+    attempt = 0
+
+    while attempt < USB_CHECKSUM_MAX_ATTEMPTS:
+        # Each integrity block is a single URB, and ZLT is enabled throughout checksummed streams.
+        block = usbRead(USB_CHECKSUM_BLOCK_READ_SIZE, USB_TRANSFER_TIMEOUT)
+        if not block:
+            return b''
+
+        # Let the caller take care of CancelFileTransfer commands.
+        if (len(block) == USB_CMD_HEADER_SIZE) and (block[:4] == USB_MAGIC_WORD):
+            return block
+
+        # Read integrity block trailer. It's sent as its own URB.
+        trailer = usbRead(USB_CHECKSUM_TRAILER_SIZE, USB_TRANSFER_TIMEOUT)
+        if (not trailer) or (len(trailer) != USB_CHECKSUM_TRAILER_SIZE):
+            g_logger.error(f'Failed to read 0x{USB_CHECKSUM_TRAILER_SIZE:X}-byte long integrity block trailer!')
+            return b''
+
+        # A corrupted trailer can't be trusted, so it's handled just like a checksum mismatch for the block we're expecting.
+        (magic, crc, block_size, block_idx) = struct.unpack_from('<4sIII', trailer, 0)
+        if (magic != USB_CHECKSUM_TRAILER_MAGIC_WORD) or (block_size != len(block)):
+            attempt += 1
+            g_logger.warning(f'Received malformed trailer for integrity block #{g_usbChecksumBlockIndex}! (attempt {attempt}/{USB_CHECKSUM_MAX_ATTEMPTS}).')
+            usbSendStatus(USB_STATUS_CHECKSUM_MISMATCH)
+            continue
+
+        # nxdumptool keeps multiple blocks in flight. Blocks received after a corrupted one are dropped, since all of them are sent again.
+        if block_idx != g_usbChecksumBlockIndex:
+            usbSendStatus(USB_STATUS_CHECKSUM_MISMATCH)
+            continue
+
+        if zlib.crc32(block) == crc:
+            usbSendStatus(USB_STATUS_SUCCESS)
+            g_usbChecksumBlockIndex += 1
+
+            # Under compressed streams, each integrity block holds a whole frame.
+            return (usbDecodeFrame(block) if (g_usbCapabilities & USB_CAPABILITY_LZ4_COMPRESSION) else block)
+
+        attempt += 1
+        g_logger.warning(f'Integrity block #{block_idx} checksum mismatch! (0x{block_size:X} bytes, attempt {attempt}/{USB_CHECKSUM_MAX_ATTEMPTS}).')
+        usbSendStatus(USB_STATUS_CHECKSUM_MISMATCH)
+
+    return b''
+
+def usbReadFileResumeCommand() -> Tuple[int, int] | None:
+    #assert g_logger is not None
+
+    # Read command header.
+    cmd_header = usbRead(USB_CMD_HEADER_SIZE, USB_TRANSFER_TIMEOUT)
+    if (not cmd_header) or (len(cmd_header) != USB_CMD_HEADER_SIZE):
+        g_logger.error(f'Failed to read 0x{USB_CMD_HEADER_SIZE:X}-byte long command header!')
+        return None
+
+    (magic, cmd_id, cmd_block_size) = struct.unpack_from('<4sII', cmd_header, 0)
+    if magic != USB_MAGIC_WORD:
+        g_logger.error('Received command header with invalid magic word!')
+        return None
+
+    # CancelFileTransfer has no command block. ResumeFileTransfer blocks are never aligned to the endpoint max packet size, so no ZLT packet is involved.
+    if cmd_id == USB_CMD_CANCEL_FILE_TRANSFER:
+        return (cmd_id, 0)
+
+    if (cmd_id != USB_CMD_RESUME_FILE_TRANSFER) or (cmd_block_size != USB_CMD_BLOCK_SIZE_RESUME_FILE_TRANSFER):
+        g_logger.error(f'Expected ResumeFileTransfer ({USB_CMD_RESUME_FILE_TRANSFER:02X}) command, got command ID {cmd_id:02X}!')
+        return None
+
+    cmd_block = usbRead(cmd_block_size, USB_TRANSFER_TIMEOUT)
+    if (not cmd_block) or (len(cmd_block) != cmd_block_size):
+        g_logger.error(f'Failed to read 0x{cmd_block_size:X}-byte long command block for command ID {cmd_id:02X}!')
+        return None
+
+    (offset,) = struct.unpack_from('<Q', cmd_block, 0)
+
+    return (cmd_id, offset)
+
 def usbHandleStartSession(cmd_block: bytes) -> int:
-    global g_nxdtVersionMajor, g_nxdtVersionMinor, g_nxdtVersionMicro, g_nxdtAbiVersionMajor, g_nxdtAbiVersionMinor, g_nxdtGitCommit
+    global g_nxdtVersionMajor, g_nxdtVersionMinor, g_nxdtVersionMicro, g_nxdtAbiVersionMajor, g_nxdtAbiVersionMinor, g_nxdtGitCommit, g_usbCapabilities
 
     #assert g_logger is not None
 
@@ -707,7 +1041,7 @@ def usbHandleStartSession(cmd_block: bytes) -> int:
     g_logger.debug(f'Received StartSession ({USB_CMD_START_SESSION:02X}) command.')
 
     # Parse command block.
-    (g_nxdtVersionMajor, g_nxdtVersionMinor, g_nxdtVersionMicro, abi_version, git_commit) = struct.unpack_from('<BBBB8s', cmd_block, 0)
+    (g_nxdtVersionMajor, g_nxdtVersionMinor, g_nxdtVersionMicro, abi_version, git_commit, capabilities) = struct.unpack_from('<BBBB8sB', cmd_block, 0)
     g_nxdtGitCommit = git_commit.decode('utf-8').strip('\x00')
 
     # Unpack ABI version.
@@ -722,11 +1056,25 @@ def usbHandleStartSession(cmd_block: bytes) -> int:
         g_logger.error('Unsupported ABI version!')
         return USB_STATUS_UNSUPPORTED_ABI_VERSION
 
+    # Enable capabilities supported by both sides. These are sent back to nxdumptool within the status response.
+    g_usbCapabilities = (capabilities & (USB_SUPPORTED_CAPABILITIES | (USB_CAPABILITY_CHUNK_CHECKSUM if g_usbChecksumEnabled else 0)))
+    if g_usbCapabilities & USB_CAPABILITY_LZ4_COMPRESSION:
+        g_logger.debug('LZ4 compression enabled for file data transfers.')
+    if g_usbCapabilities & USB_CAPABILITY_FILE_RESUME:
+        g_logger.debug('Resumable file transfers enabled.')
+    if g_usbCapabilities & USB_CAPABILITY_CHUNK_CHECKSUM:
+        g_logger.debug('Integrity block checksums enabled for file data transfers.')
+    if g_usbCapabilities & USB_CAPABILITY_TRANSFER_TUNING:
+        if g_usbQueueDepth:
+            g_logger.debug(f'Requesting USB transfer queue configuration: {g_usbQueueDepth} URB(s), 0x{g_usbUrbSize:X} bytes each.')
+        else:
+            g_logger.debug('Requesting USB transfer queue auto-tuning.')
+
     # Return status code.
     return USB_STATUS_SUCCESS
 
 def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
-    global g_nspTransferMode, g_nspSize, g_nspHeaderSize, g_nspRemainingSize, g_nspFile, g_nspFilePath, g_outputDir, g_tkRoot, g_progressBarWindow
+    global g_nspTransferMode, g_nspSize, g_nspHeaderSize, g_nspRemainingSize, g_nspFile, g_nspFilePath, g_outputDir, g_tkRoot, g_progressBarWindow, g_usbChecksumBlockIndex
 
     #assert g_logger is not None
     #assert g_progressBarWindow is not None
@@ -739,6 +1087,8 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
     # Parse command block.
     (file_size, filename_length, nsp_header_size, raw_filename) = struct.unpack_from(f'<QII{USB_FILE_PROPERTIES_MAX_NAME_LENGTH}s', cmd_block, 0)
     filename = raw_filename.decode('utf-8').strip('\x00')
+    (flags,) = struct.unpack_from('<B', cmd_block, USB_FILE_PROPERTIES_FLAGS_OFFSET)
+    resumable = bool(flags & USB_FILE_PROPERTIES_FLAG_RESUMABLE)
 
     # Print info.
     dbg_str = f'File size: 0x{file_size:X} | Filename length: 0x{filename_length:X}'
@@ -764,6 +1114,10 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
         g_logger.error('Invalid filename length!\n')
         return USB_STATUS_MALFORMED_CMD
 
+    if resumable and ((not (g_usbCapabilities & USB_CAPABILITY_FILE_RESUME)) or g_nspTransferMode or nsp_header_size or (not file_size)):
+        g_logger.error('Invalid resumable file transfer request!\n')
+        return USB_STATUS_MALFORMED_CMD
+
     # Enable NSP transfer mode (if needed).
     if (not g_nspTransferMode) and file_size and nsp_header_size:
         g_nspTransferMode = True
@@ -798,8 +1152,8 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
             g_logger.error('Not enough free space available in output volume!\n')
             return USB_STATUS_HOST_IO_ERROR
 
-        # Get file object.
-        file = open(fullpath, "wb")
+        # Get file object. Partial files from previous resumable transfers are kept around until we know where to resume from.
+        file = open(fullpath, "r+b" if (resumable and os.path.isfile(fullpath)) else "wb")
 
         if g_nspTransferMode:
             # Update NSP file object.
@@ -828,10 +1182,69 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
     # Send status response before entering the data transfer stage.
     usbSendStatus(USB_STATUS_SUCCESS)
 
+    offset = 0
+
+    if resumable:
+        # Report how much data we already hold from a previous transfer attempt.
+        (resume_offset, tail_size, tail_hash) = utilsGetFileResumeInfo(file, file_size)
+
+        resume_info = struct.pack('<QQ32s', resume_offset, tail_size, tail_hash)
+        if usbWrite(resume_info, USB_TRANSFER_TIMEOUT) != USB_FILE_RESUME_INFO_SIZE:
+            g_logger.error('Failed to send file resume info!')
+            file.close()
+            return None
+
+        if resume_offset:
+            g_logger.debug(f'Partial file found. Resume offset: 0x{resume_offset:X}.')
+
+            # Wait until nxdumptool verifies the tail block and tells us where to resume from.
+            resume_cmd = usbReadFileResumeCommand()
+            if resume_cmd is None:
+                file.close()
+                return None
+
+            (cmd_id, offset) = resume_cmd
+
+            if cmd_id == USB_CMD_CANCEL_FILE_TRANSFER:
+                file.close()
+                os.remove(fullpath)
+
+                g_logger.debug(f'Received CancelFileTransfer ({USB_CMD_CANCEL_FILE_TRANSFER:02X}) command.')
+                g_logger.warning('Transfer cancelled.')
+
+                # Let the command handler take care of sending the status response for us.
+                return USB_STATUS_SUCCESS
+
+            g_logger.debug(f'Received ResumeFileTransfer ({USB_CMD_RESUME_FILE_TRANSFER:02X}) command. Offset: 0x{offset:X}.')
+
+            if (offset != 0) and (offset != resume_offset):
+                g_logger.error('Invalid resume offset!\n')
+                file.close()
+                return USB_STATUS_MALFORMED_CMD
+
+        # Drop everything past the resume offset.
+        file.truncate(offset)
+        file.seek(offset)
+
+        if offset:
+            g_logger.info(f'Resuming transfer from offset 0x{offset:X}.')
+
+            # Nothing else to do if we already hold the whole file.
+            # The command handler takes care of sending the status response for the ResumeFileTransfer command.
+            if offset == file_size:
+                file.close()
+                g_logger.debug('File transfer already completed!\n')
+                return USB_STATUS_SUCCESS
+        elif resume_offset:
+            g_logger.warning('Partial file data doesn\'t match. Restarting transfer.')
+
+        # Send status response for the ResumeFileTransfer command before entering the data transfer stage.
+        if resume_offset:
+            usbSendStatus(USB_STATUS_SUCCESS)
+
     # Start data transfer stage.
     g_logger.debug(f'Data transfer started. Saving {file_type_str} to: "{fullpath}".')
 
-    offset = 0
     blksize = USB_TRANSFER_BLOCK_SIZE
 
     # Check if we should use the progress bar window.
@@ -849,8 +1262,8 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
 
         if (not g_nspTransferMode) or g_nspRemainingSize == (g_nspSize - g_nspHeaderSize):
             if not g_nspTransferMode:
-                # Set current progress to zero and the maximum value to the provided file size.
-                pbar_n = 0
+                # Set current progress to the resume offset and the maximum value to the provided file size.
+                pbar_n = offset
                 pbar_file_size = file_size
             else:
                 # Set current progress to the NSP header size and the maximum value to the provided NSP size.
@@ -866,16 +1279,18 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
             # Set current prefix (holds the filename for the current NSP file entry).
             g_progressBarWindow.set_prefix(prefix)
 
-    def cancelTransfer():
+    def cancelTransfer(remove_file: bool = True):
         # Cancel file transfer.
         file.close()
-        os.remove(fullpath)
+        if remove_file:
+            os.remove(fullpath)
         utilsResetNspInfo()
         if use_pbar:
             g_progressBarWindow.end()
 
-    # Start transfer process.
+    # Start transfer process. Integrity block indexes start over with each file data stream.
     start_time = time.time()
+    g_usbChecksumBlockIndex = 0
 
     while offset < file_size:
         # Update block size (if needed).
@@ -887,13 +1302,16 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
         if ((offset + blksize) >= file_size) and utilsIsValueAlignedToEndpointPacketSize(blksize):
             rd_size += 1
 
-        # Read current chunk.
-        chunk = usbRead(rd_size, USB_TRANSFER_TIMEOUT)
+        # Read current chunk. Under integrity block checksums, each chunk holds a whole verified block.
+        if g_usbCapabilities & USB_CAPABILITY_CHUNK_CHECKSUM:
+            chunk = usbReadChecksumBlock()
+        else:
+            chunk = usbReadFileData(rd_size)
         if not chunk:
             g_logger.error(f'Failed to read 0x{rd_size:X}-byte long data chunk!')
 
-            # Cancel file transfer.
-            cancelTransfer()
+            # Cancel file transfer. Partial data from resumable transfers is kept around for the next attempt.
+            cancelTransfer(not resumable)
 
             # Returning None will make the command handler exit right away.
             return None
@@ -976,24 +1394,236 @@ def usbHandleSendNspHeader(cmd_block: bytes) -> int:
 
     return USB_STATUS_SUCCESS
 
+def usbHandleSendFileBatch(cmd_block: bytes) -> int | None:
+    global g_outputDir, g_progressBarWindow, g_usbChecksumBlockIndex
+
+    #assert g_logger is not None
+    #assert g_progressBarWindow is not None
+
+    if g_cliMode:
+        print()
+
+    g_logger.debug(f'Received SendFileBatch ({USB_CMD_SEND_FILE_BATCH:02X}) command.')
+
+    if g_nspTransferMode:
+        g_logger.error('Received file batch during NSP transfer mode!\n')
+        return USB_STATUS_MALFORMED_CMD
+
+    # Parse command block header.
+    (file_count, total_size) = struct.unpack_from('<I4xQ', cmd_block, 0)
+    g_logger.debug(f'File count: {file_count} | Total size: 0x{total_size:X}.')
+
+    # Parse file batch manifest.
+    entries: List[Tuple[str, int]] = []
+    cmd_block_size = len(cmd_block)
+    offset = USB_CMD_BLOCK_SIZE_SEND_FILE_BATCH
+
+    for idx in range(file_count):
+        if (offset + USB_FILE_BATCH_ENTRY_HEADER_SIZE) > cmd_block_size:
+            g_logger.error(f'File batch manifest entry #{idx} exceeds command block boundaries!\n')
+            return USB_STATUS_MALFORMED_CMD
+
+        (file_size, filename_length) = struct.unpack_from('<QI4x', cmd_block, offset)
+        offset += USB_FILE_BATCH_ENTRY_HEADER_SIZE
+
+        if (not filename_length) or (filename_length > USB_FILE_PROPERTIES_MAX_NAME_LENGTH) or ((offset + filename_length) > cmd_block_size):
+            g_logger.error(f'Invalid filename length for file batch manifest entry #{idx}!\n')
+            return USB_STATUS_MALFORMED_CMD
+
+        filename = cmd_block[offset:offset+filename_length].decode('utf-8')
+        offset += filename_length
+
+        entries.append((os.path.abspath(g_outputDir + os.path.sep + filename), file_size))
+
+    if (not file_count) or (offset != cmd_block_size) or (sum(entry[1] for entry in entries) != total_size):
+        g_logger.error('Malformed file batch manifest!\n')
+        return USB_STATUS_MALFORMED_CMD
+
+    g_logger.info(f'Receiving file batch: {file_count} file(s), 0x{total_size:X} byte(s).')
+
+    # Create full directory trees and make sure no output filepath points to an existing directory.
+    for (fullpath, file_size) in entries:
+        os.makedirs(os.path.dirname(fullpath), exist_ok=True)
+
+        if os.path.exists(fullpath) and (not os.path.isfile(fullpath)):
+            g_logger.error(f'Output filepath points to an existing directory! ("{fullpath}").\n')
+            return USB_STATUS_HOST_IO_ERROR
+
+    # Make sure we have enough free space.
+    (total_space, used_space, free_space) = shutil.disk_usage(g_outputDir)
+    if free_space <= total_size:
+        g_logger.error('Not enough free space available in output volume!\n')
+        return USB_STATUS_HOST_IO_ERROR
+
+    # Check if we're only dealing with empty files.
+    if not total_size:
+        for (fullpath, file_size) in entries:
+            open(fullpath, 'wb').close()
+
+        # Let the command handler take care of sending the status response for us.
+        return USB_STATUS_SUCCESS
+
+    # Send status response before entering the data transfer stage.
+    usbSendStatus(USB_STATUS_SUCCESS)
+
+    # Start data transfer stage.
+    # File data from all batch entries is received as a single concatenated stream, which is split here.
+    g_logger.debug('File batch transfer started.')
+
+    file = None
+    file_idx = 0
+    file_remaining = 0
+
+    def openNextFile():
+        nonlocal file, file_idx, file_remaining
+
+        # Empty files are created right away.
+        while (file is None) and (file_idx < file_count):
+            (fullpath, file_size) = entries[file_idx]
+            g_logger.debug(f'Saving file batch entry #{file_idx} to: "{fullpath}".')
+
+            file = open(fullpath, 'wb')
+            file_remaining = file_size
+
+            if not file_remaining:
+                file.close()
+                file = None
+                file_idx += 1
+
+    def writeChunk(chunk: bytes):
+        nonlocal file, file_idx, file_remaining
+
+        pos = 0
+        chunk_size = len(chunk)
+
+        while pos < chunk_size:
+            openNextFile()
+            #assert file is not None
+
+            size = min(file_remaining, chunk_size - pos)
+            file.write(chunk[pos:pos+size])
+
+            pos += size
+            file_remaining -= size
+
+            if not file_remaining:
+                file.close()
+                file = None
+                file_idx += 1
+
+    offset = 0
+    blksize = USB_TRANSFER_BLOCK_SIZE
+
+    # Check if we should use the progress bar window.
+    use_pbar = (total_size > USB_TRANSFER_THRESHOLD)
+    if use_pbar:
+        if g_cliMode:
+            # We're not using dynamic tqdm prefixes under CLI mode.
+            prefix = ''
+        else:
+            prefix = f'Current file batch: {file_count} file(s).\n'
+            prefix += 'Use your console to cancel the file transfer if you wish to do so.'
+
+        # Get progress bar unit and unit divider. These will be used to display and calculate size values using a specific size unit (B, KiB, MiB, GiB).
+        (unit, unit_divider) = utilsGetSizeUnitAndDivisor(total_size)
+
+        # Display progress bar window.
+        g_progressBarWindow.start(total_size, 0, unit_divider, prefix, unit)
+
+    def cancelTransfer():
+        # Cancel file transfer. Only the file that was being written is removed.
+        if file is not None:
+            file.close()
+            os.remove(entries[file_idx][0])
+        if use_pbar:
+            g_progressBarWindow.end()
+
+    # Start transfer process. Integrity block indexes start over with each file data stream.
+    start_time = time.time()
+    g_usbChecksumBlockIndex = 0
+
+    while offset < total_size:
+        # Update block size (if needed).
+        diff = (total_size - offset)
+        if blksize > diff: blksize = diff
+
+        # Set block size and handle Zero-Length Termination packet (if needed).
+        rd_size = blksize
+        if ((offset + blksize) >= total_size) and utilsIsValueAlignedToEndpointPacketSize(blksize):
+            rd_size += 1
+
+        # Read current chunk. Under integrity block checksums, each chunk holds a whole verified block.
+        if g_usbCapabilities & USB_CAPABILITY_CHUNK_CHECKSUM:
+            chunk = usbReadChecksumBlock()
+        else:
+            chunk = usbReadFileData(rd_size)
+        if not chunk:
+            g_logger.error(f'Failed to read 0x{rd_size:X}-byte long data chunk!')
+
+            # Cancel file transfer.
+            cancelTransfer()
+
+            # Returning None will make the command handler exit right away.
+            return None
+
+        chunk_size = len(chunk)
+
+        # Check if we're dealing with a CancelFileTransfer command.
+        if chunk_size == USB_CMD_HEADER_SIZE:
+            (magic, cmd_id, cmd_block_size) = struct.unpack_from('<4sII', chunk, 0)
+            if (magic == USB_MAGIC_WORD) and (cmd_id == USB_CMD_CANCEL_FILE_TRANSFER):
+                # Cancel file transfer.
+                cancelTransfer()
+
+                g_logger.debug(f'Received CancelFileTransfer ({USB_CMD_CANCEL_FILE_TRANSFER:02X}) command.')
+                g_logger.warning('Transfer cancelled.')
+
+                # Let the command handler take care of sending the status response for us.
+                return USB_STATUS_SUCCESS
+
+        # Write current chunk.
+        writeChunk(chunk)
+
+        # Update current offset.
+        offset = (offset + chunk_size)
+
+        # Update progress bar window (if needed).
+        if use_pbar:
+            g_progressBarWindow.update(chunk_size)
+
+    # Create any trailing empty files.
+    openNextFile()
+
+    elapsed_time = round(time.time() - start_time)
+    g_logger.debug(f'File batch transfer successfully completed in {tqdm.format_interval(elapsed_time)}!\n')
+
+    # Hide progress bar window (if needed).
+    if use_pbar:
+        g_progressBarWindow.end()
+
+    return USB_STATUS_SUCCESS
+
 def usbHandleEndSession(cmd_block: bytes) -> int:
     #assert g_logger is not None
     g_logger.debug(f'Received EndSession ({USB_CMD_END_SESSION:02X}) command.')
     return USB_STATUS_SUCCESS
 
 def usbCommandHandler() -> None:
+    global g_usbCapabilities, g_usbLoopback
+
     #assert g_logger is not None
 
-    # CancelFileTransfer is handled in usbHandleSendFileProperties().
+    # CancelFileTransfer is handled in usbHandleSendFileProperties() and usbHandleSendFileBatch().
     cmd_dict = {
         USB_CMD_START_SESSION:        usbHandleStartSession,
         USB_CMD_SEND_FILE_PROPERTIES: usbHandleSendFileProperties,
         USB_CMD_SEND_NSP_HEADER:      usbHandleSendNspHeader,
-        USB_CMD_END_SESSION:          usbHandleEndSession
+        USB_CMD_END_SESSION:          usbHandleEndSession,
+        USB_CMD_SEND_FILE_BATCH:      usbHandleSendFileBatch
     }
 
-    # Get device endpoints.
-    if not usbGetDeviceEndpoints():
+    # Get device endpoints, or wait for a loopback client.
+    if not (usbWaitForLoopbackClient() if g_usbLoopbackPath else usbGetDeviceEndpoints()):
         if not g_cliMode:
             # Update UI.
             uiToggleElements(True)
@@ -1009,6 +1639,9 @@ def usbCommandHandler() -> None:
     # Reset NSP info.
     utilsResetNspInfo()
 
+    # Reset session capabilities.
+    g_usbCapabilities = 0
+
     while True:
         # Read command header.
         cmd_header = usbRead(USB_CMD_HEADER_SIZE)
@@ -1050,7 +1683,8 @@ def usbCommandHandler() -> None:
         # Verify command block size.
         if (cmd_id == USB_CMD_START_SESSION and cmd_block_size != USB_CMD_BLOCK_SIZE_START_SESSION) or \
            (cmd_id == USB_CMD_SEND_FILE_PROPERTIES and cmd_block_size != USB_CMD_BLOCK_SIZE_SEND_FILE_PROPERTIES) or \
-           (cmd_id == USB_CMD_SEND_NSP_HEADER and not cmd_block_size):
+           (cmd_id == USB_CMD_SEND_NSP_HEADER and not cmd_block_size) or \
+           (cmd_id == USB_CMD_SEND_FILE_BATCH and cmd_block_size < USB_CMD_BLOCK_SIZE_SEND_FILE_BATCH):
             g_logger.error(f'Invalid command block size for command ID {cmd_id:02X}! (0x{cmd_block_size:X}).\n')
             usbSendStatus(USB_STATUS_MALFORMED_CMD)
             continue
@@ -1063,6 +1697,11 @@ def usbCommandHandler() -> None:
 
     g_logger.info('\nStopping server.')
 
+    # Close loopback connection (if needed).
+    if g_usbLoopback is not None:
+        g_usbLoopback.close()
+        g_usbLoopback = None
+
     if not g_cliMode:
         # Update UI.
         uiToggleElements(True)
@@ -1305,7 +1944,7 @@ def cliInitialize() -> None:
     usbCommandHandler()
 
 def main() -> int:
-    global g_cliMode, g_outputDir, g_osType, g_osVersion, g_isWindows, g_isWindowsVista, g_isWindows7, g_logger
+    global g_cliMode, g_outputDir, g_osType, g_osVersion, g_isWindows, g_isWindowsVista, g_isWindows7, g_logger, g_usbLoopbackPath, g_usbLoopbackMaxPacketSize, g_usbQueueDepth, g_usbUrbSize, g_usbChecksumEnabled
 
     # Disable warnings.
     warnings.filterwarnings("ignore")
@@ -1315,11 +1954,35 @@ def main() -> int:
     parser.add_argument('-c', '--cli', required=False, action='store_true', default=False, help='Start the script in CLI mode.')
     parser.add_argument('-o', '--outdir', required=False, type=str, metavar='DIR', help='Path to output directory. Defaults to "' + DEFAULT_DIR + '".')
     parser.add_argument('-v', '--verbose', required=False, action='store_true', default=False, help='Enable verbose output.')
+    parser.add_argument('-l', '--loopback', required=False, type=str, metavar='PATH', help='Listen for a loopback client on the provided Unix domain socket path instead of using USB. Meant for local testing.')
+    parser.add_argument('-q', '--queue-depth', required=False, type=int, metavar='COUNT', help=f'Number of in-flight URBs used by {USB_DEV_PRODUCT}. Must be used alongside --urb-size. If omitted, {USB_DEV_PRODUCT} auto-tunes the USB transfer queue at the start of each session.')
+    parser.add_argument('-u', '--urb-size', required=False, type=int, metavar='KIB', help=f'Size of each URB used by {USB_DEV_PRODUCT}, in KiB. Must be used alongside --queue-depth.')
+    parser.add_argument('-k', '--checksum', required=False, action='store_true', default=False, help=f'Ask {USB_DEV_PRODUCT} to send a CRC32 checksum after each URB, and to retransmit corrupted data. Slows down transfers.')
+    parser.add_argument('--loopback-packet-size', required=False, type=int, choices=[0x40, 0x200, 0x400], default=USB_LOOPBACK_MAX_PACKET_SIZE, help='Endpoint max packet size emulated by the loopback transport. Defaults to %(default)d.')
     args = parser.parse_args()
 
     # Update global flags.
     g_cliMode = args.cli
     g_outputDir = utilsGetPath(args.outdir, DEFAULT_DIR, False, True)
+    g_usbLoopbackPath = (os.path.abspath(args.loopback) if args.loopback else '')
+    g_usbLoopbackMaxPacketSize = args.loopback_packet_size
+    g_usbChecksumEnabled = args.checksum
+
+    if g_usbLoopbackPath and (not hasattr(socket, 'AF_UNIX')):
+        eprint('Loopback transport is not supported on this platform.')
+        return 1
+
+    # Validate the requested USB transfer queue configuration. nxdumptool will fall back to its defaults if the URB size is too small for compressed frames.
+    if (args.queue_depth is None) != (args.urb_size is None):
+        parser.error('--queue-depth and --urb-size must be used together.')
+
+    if args.queue_depth is not None:
+        g_usbQueueDepth = args.queue_depth
+        g_usbUrbSize = (args.urb_size * 1024)
+
+        if (g_usbQueueDepth <= 0) or (g_usbQueueDepth > USB_TRANSFER_MAX_QUEUE_DEPTH) or (g_usbUrbSize < USB_TRANSFER_MIN_URB_SIZE) or (g_usbUrbSize % 0x1000) or \
+           ((g_usbQueueDepth * g_usbUrbSize) > USB_TRANSFER_BUFFER_SIZE):
+            parser.error(f'Invalid USB transfer queue configuration! Up to {USB_TRANSFER_MAX_QUEUE_DEPTH} URBs are supported, each one at least {USB_TRANSFER_MIN_URB_SIZE // 1024} KiB long and 4 KiB aligned, and {USB_TRANSFER_BUFFER_SIZE // 1024} KiB in total.')
 
     # Get OS information.
     g_osType = platform.system()
@@ -0,0 +1,65 @@
+/*
+ * dat.h
+ *
+ * Copyright (c) 2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __DAT_H__
+#define __DAT_H__
+
+#include "digest.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    DatMatchType_None   = 0,    ///< No DAT entry matches the provided data.
+    DatMatchType_Crc32  = 1,    ///< Matched using a CRC32 checksum (and size, if available). Weakest match type.
+    DatMatchType_Sha1   = 2,    ///< Matched using a SHA-1 checksum and size.
+    DatMatchType_Sha256 = 3     ///< Matched using a SHA-256 checksum and size.
+} DatMatchType;
+
+/// Initializes the DAT interface.
+/// DAT files are parsed by a background thread, so this function doesn't block. Both the NSWDB XML (NSWDB_XML_PATH) and all Logiqx DAT files stored in DAT_PATH are loaded.
+bool datInitialize(void);
+
+/// Closes the DAT interface.
+void datExit(void);
+
+/// Returns true if the background thread is still loading DAT files. Doesn't block.
+bool datIsLoading(void);
+
+/// Returns the number of loaded DAT entries. Waits until the background thread is done loading DAT files.
+u32 datGetEntryCount(void);
+
+/// Looks up a DAT entry using the provided data size and digests. 'digest_mask' must hold a bitmask with the digest types set within 'digest_result' (DigestTypeMask).
+/// Every digest available in both the DAT entry and the provided result must match. Waits until the background thread is done loading DAT files.
+/// If a match is found and 'out_name' is provided, the DAT entry name is copied into it.
+u8 datLookupEntry(u64 size, const DigestResult *digest_result, u8 digest_mask, char *out_name, size_t out_name_size);
+
+/// Returns a string representation of the provided DatMatchType value. Returns NULL if the provided value is invalid.
+const char *datGetMatchTypeName(u8 match_type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DAT_H__ */
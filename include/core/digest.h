@@ -0,0 +1,141 @@
+/*
+ * digest.h
+ *
+ * Copyright (c) 2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __DIGEST_H__
+#define __DIGEST_H__
+
+#include <mbedtls/md5.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MD5_HASH_SIZE   0x10
+
+typedef enum {
+    DigestType_Crc32  = 0,
+    DigestType_Md5    = 1,
+    DigestType_Sha1   = 2,
+    DigestType_Sha256 = 3,
+    DigestType_Count  = 4   ///< Total values supported by this enum.
+} DigestType;
+
+typedef enum {
+    DigestTypeMask_None   = 0,
+    DigestTypeMask_Crc32  = BIT(DigestType_Crc32),
+    DigestTypeMask_Md5    = BIT(DigestType_Md5),
+    DigestTypeMask_Sha1   = BIT(DigestType_Sha1),
+    DigestTypeMask_Sha256 = BIT(DigestType_Sha256),
+    DigestTypeMask_All    = (DigestTypeMask_Crc32 | DigestTypeMask_Md5 | DigestTypeMask_Sha1 | DigestTypeMask_Sha256)
+} DigestTypeMask;
+
+/// Only the digests requested while initializing the engine hold valid data.
+typedef struct {
+    u32 crc32;
+    u8 md5[MD5_HASH_SIZE];
+    u8 sha1[SHA1_HASH_SIZE];
+    u8 sha256[SHA256_HASH_SIZE];
+} DigestResult;
+
+struct _DigestEngine;
+
+typedef struct {
+    struct _DigestEngine *engine;
+    u8 type;                                    ///< DigestType.
+    Thread thread;
+    bool thread_started;
+    u64 processed_seq;                          ///< Sequence number of the last data block processed by this hasher.
+    u64 busy_time;                              ///< Nanoseconds spent hashing data.
+    union {
+        u32 crc32;
+        mbedtls_md5_context md5_ctx;
+        Sha1Context sha1_ctx;
+        Sha256Context sha256_ctx;
+    };
+} DigestHasher;
+
+/// Fans out each submitted data block to a hasher thread per requested digest, so all of them are calculated with a single pass over the input data.
+/// Only a single data block is processed at a time, and it's guaranteed to no longer be in use by the time the next one is submitted.
+typedef struct _DigestEngine {
+    DigestHasher hashers[DigestType_Count];
+    u8 type_mask;                               ///< DigestTypeMask.
+    Mutex mutex;
+    CondVar submit_cond;                        ///< Signaled whenever a new data block is submitted.
+    CondVar done_cond;                          ///< Signaled whenever all hashers are done with the current data block.
+    const void *data;                           ///< Data block being processed by the hashers.
+    u64 data_size;
+    u64 block_seq;                              ///< Incremented each time a data block is submitted.
+    u32 pending;                                ///< Number of hashers still working on the current data block.
+    u64 total_size;                             ///< Amount of data submitted since the last (re)initialization.
+    bool exit;
+} DigestEngine;
+
+/// Snapshot of the running hash states from a digest engine. Used to resume interrupted dumps without hashing previously processed data again.
+/// Its layout depends on the hash context structs from libnx and mbedtls, so it must only be restored by the same build that saved it.
+typedef struct {
+    u8 type_mask;                               ///< DigestTypeMask.
+    u8 reserved[7];
+    u64 total_size;                             ///< Amount of data processed by the hashers.
+    u32 crc32;
+    mbedtls_md5_context md5_ctx;
+    Sha1Context sha1_ctx;
+    Sha256Context sha256_ctx;
+} DigestEngineState;
+
+/// Initializes a digest engine and starts a hasher thread for each digest type set in 'type_mask'.
+/// 'cpu_ids' may point to an array with DigestType_Count CPU core IDs (one per digest type) to be passed to utilsCreateThread(). If NULL, default values are used.
+bool digestEngineInitialize(DigestEngine *engine, u8 type_mask, const int *cpu_ids);
+
+/// Submits a data block to all hashers. Waits until the previous data block has been processed, which means its buffer can be safely reused by the caller afterwards.
+void digestEngineUpdate(DigestEngine *engine, const void *data, u64 data_size);
+
+/// Waits until all hashers are done with the last submitted data block.
+void digestEngineWaitForIdle(DigestEngine *engine);
+
+/// Waits until all hashers are idle, then stores the requested digests into the provided output. Hash contexts are reset afterwards, so the engine can be reused.
+bool digestEngineFinalize(DigestEngine *engine, DigestResult *out);
+
+/// Waits until all hashers are idle, then stores their running hash states into the provided output.
+bool digestEngineExportState(DigestEngine *engine, DigestEngineState *out);
+
+/// Restores running hash states previously stored by digestEngineExportState(). The engine must have been initialized using the same digest types.
+/// Must be called before submitting any data, or right after calling digestEngineFinalize().
+bool digestEngineImportState(DigestEngine *engine, const DigestEngineState *state);
+
+/// Stops all hasher threads and frees a digest engine.
+void digestEngineFree(DigestEngine *engine);
+
+/// Returns a string representation of the provided digest type. Returns NULL if the provided value is invalid.
+const char *digestGetTypeName(u8 type);
+
+/// Returns the size of the provided digest type. Returns zero if the provided value is invalid.
+u32 digestGetTypeSize(u8 type);
+
+/// Generates an uppercase hex string representation of a digest from the provided result. Returns false if the provided digest type is invalid.
+bool digestGenerateString(const DigestResult *result, u8 type, char *dst, size_t dst_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DIGEST_H__ */
@@ -0,0 +1,146 @@
+/*
+ * dump_pipeline.h
+ *
+ * Copyright (c) 2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __DUMP_PIPELINE_H__
+#define __DUMP_PIPELINE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DUMP_PIPELINE_MAX_STAGE_COUNT   6
+#define DUMP_PIPELINE_MAX_BUFFER_COUNT  8
+
+typedef enum {
+    DumpPipelineStageType_Read     = 0,     ///< Source stage. Must be the first one. Fills buffers with 'input_size' bytes from 'offset'.
+    DumpPipelineStageType_Process  = 1,     ///< Decrypts / patches buffer data in place.
+    DumpPipelineStageType_Hash     = 2,     ///< Only inspects buffer data.
+    DumpPipelineStageType_Compress = 3,     ///< May replace buffer data with a different representation, as long as it fits within the buffer capacity.
+    DumpPipelineStageType_Write    = 4,     ///< Sink stage. Must be the last one. Writes 'data_size' bytes from the buffer.
+    DumpPipelineStageType_Count    = 5      ///< Total values supported by this enum.
+} DumpPipelineStageType;
+
+typedef struct {
+    u8 *data;                                                       ///< Page-aligned. Owned by the pipeline.
+    u64 capacity;                                                   ///< Buffer size.
+    u64 data_size;                                                  ///< Amount of valid data. Set to 'input_size' before calling the read stage.
+    u64 offset;                                                     ///< Input stream offset for this data block.
+    u64 input_size;                                                 ///< Amount of input stream data held by this block. Used for progress accounting.
+    u64 index;                                                      ///< Data block index, relative to the pipeline start offset.
+} DumpPipelineBuffer;
+
+/// Processes a single data block. Returning false aborts the whole pipeline.
+/// Blocks are always passed to each stage in input stream order.
+typedef bool (*DumpPipelineStageFunction)(DumpPipelineBuffer *buf, void *userdata);
+
+typedef struct {
+    u8 type;                                                        ///< DumpPipelineStageType.
+    const char *name;                                               ///< Used for logging purposes. May be NULL.
+    DumpPipelineStageFunction func;
+    void *userdata;                                                 ///< Passed to 'func'.
+    int cpu_id;                                                     ///< CPU core for the stage thread. Passed to utilsCreateThread().
+} DumpPipelineStage;
+
+typedef struct {
+    u64 busy_time;                                                  ///< Nanoseconds spent inside the stage function.
+    u64 wait_time;                                                  ///< Nanoseconds spent waiting for the previous stage (or for a free buffer, if this is the read stage).
+    u64 block_count;                                                ///< Number of processed data blocks.
+} DumpPipelineStageStats;
+
+typedef struct {
+    DumpPipelineBuffer *entries[DUMP_PIPELINE_MAX_BUFFER_COUNT];
+    u32 head;
+    u32 count;
+    CondVar cond;                                                   ///< Signaled whenever a buffer is pushed to this queue.
+} DumpPipelineQueue;
+
+struct _DumpPipeline;
+
+typedef struct {
+    struct _DumpPipeline *pipeline;
+    u32 idx;
+    Thread thread;
+    bool thread_started;
+    DumpPipelineStageStats stats;
+} DumpPipelineStageContext;
+
+typedef struct _DumpPipeline {
+    DumpPipelineStage stages[DUMP_PIPELINE_MAX_STAGE_COUNT];
+    DumpPipelineStageContext stage_ctx[DUMP_PIPELINE_MAX_STAGE_COUNT];
+    u32 stage_count;
+
+    DumpPipelineBuffer buffers[DUMP_PIPELINE_MAX_BUFFER_COUNT];
+    u32 buffer_count;
+
+    /// Input queue for each stage. The read stage takes buffers from the first queue (free buffer pool), and the write stage gives them back to it.
+    DumpPipelineQueue queues[DUMP_PIPELINE_MAX_STAGE_COUNT];
+
+    Mutex mutex;
+    u64 block_size;                                                 ///< Maximum amount of input data held by each buffer.
+    u64 start_offset;                                               ///< Input stream offset the pipeline starts at. Used to resume dumps.
+    u64 total_size;                                                 ///< Input stream size.
+    u64 block_count;                                                ///< Number of data blocks between 'start_offset' and 'total_size'.
+    u64 processed_size;                                             ///< Amount of input data (including 'start_offset') that has already gone through the write stage.
+    bool started;
+    bool finished;
+    bool error;
+    u32 error_stage;                                                ///< Only valid if 'error' is set.
+    bool cancelled;
+} DumpPipeline;
+
+/// Initializes a dump pipeline with the provided stages, which are copied into the context.
+/// The first stage must be a DumpPipelineStageType_Read stage, and the last one must be a DumpPipelineStageType_Write stage.
+/// 'buffer_capacity' may be greater than 'block_size' if a stage needs room to grow the data from a block (e.g. compression). If zero, 'block_size' is used.
+bool dumpPipelineInitialize(DumpPipeline *pipeline, const DumpPipelineStage *stages, u32 stage_count, u64 total_size, u64 start_offset, u64 block_size, u64 buffer_capacity, \
+                            u32 buffer_count);
+
+/// Starts a stage thread for each pipeline stage. Completes right away if there's no data left to process.
+bool dumpPipelineStart(DumpPipeline *pipeline);
+
+/// Returns true if the pipeline has been started and it's still processing data.
+bool dumpPipelineIsRunning(DumpPipeline *pipeline);
+
+/// Returns the amount of input data that has already gone through the write stage. Includes the start offset.
+u64 dumpPipelineGetProcessedSize(DumpPipeline *pipeline);
+
+/// Returns true if a stage function has failed. Safe to call while the pipeline is running.
+bool dumpPipelineHasFailed(DumpPipeline *pipeline);
+
+/// Makes every stage thread bail out as soon as possible.
+void dumpPipelineCancel(DumpPipeline *pipeline);
+
+/// Waits for all stage threads to exit. Returns true if all data was processed without errors.
+/// A cancellation request that comes in after the last block has been written doesn't make this fail, since the output is already complete by then.
+bool dumpPipelineWait(DumpPipeline *pipeline);
+
+/// Frees a dump pipeline. Waits for all stage threads to exit beforehand, if needed.
+void dumpPipelineFree(DumpPipeline *pipeline);
+
+/// Logs per-stage timing information.
+void dumpPipelineLogStats(DumpPipeline *pipeline);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DUMP_PIPELINE_H__ */
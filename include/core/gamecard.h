@@ -270,6 +270,31 @@ typedef struct {
 
 NXDT_ASSERT(LotusAsicFirmwareBlob, 0x7800);
 
+#define GAMECARD_STREAM_MAX_BUFFER_COUNT    4
+
+/// Used to perform sequential gamecard storage reads in a background thread, while the caller processes previously read blocks.
+/// Use gamecardStreamInitialize() to initialize it, and gamecardStreamFree() once you're done with it.
+typedef struct {
+    u64 offset;                                                 ///< Offset for the next block to be read by the stream thread (relative to the start of the gamecard image).
+    u64 end_offset;                                             ///< End offset for the stream (relative to the start of the gamecard image).
+    u64 block_size;                                             ///< Must be a multiple of GAMECARD_PAGE_SIZE.
+    u32 buffer_count;                                           ///< Must be at least 2 and no greater than GAMECARD_STREAM_MAX_BUFFER_COUNT.
+    u8 *buffers[GAMECARD_STREAM_MAX_BUFFER_COUNT];              ///< Page-aligned block buffers.
+    u64 buffer_data_sizes[GAMECARD_STREAM_MAX_BUFFER_COUNT];    ///< Set to zero if the block buffer is available.
+    u32 read_idx;                                               ///< Block buffer to be used by the stream thread for the next read.
+    u32 consume_idx;                                            ///< Block buffer to be returned to the caller by the next gamecardStreamGetNextBlock() call.
+    u32 release_idx;                                            ///< Block buffer to be released by the next gamecardStreamReleaseBlock() call.
+    u32 ready_count;                                            ///< Blocks read by the stream thread that haven't been retrieved by the caller yet.
+    u32 acquired_count;                                         ///< Blocks retrieved by the caller that haven't been released yet.
+    bool read_error;                                            ///< Set by the stream thread if a read error occurs.
+    bool finished;                                              ///< Set by the stream thread once it exits.
+    bool cancelled;                                             ///< Set by gamecardStreamFree() to stop the stream thread.
+    Thread thread;
+    bool thread_started;
+    Mutex mutex;
+    CondVar ready_condvar, free_condvar;
+} GameCardStreamContext;
+
 /// Initializes data needed to access raw gamecard storage areas.
 /// Also spans a background thread to automatically detect gamecard status changes and to cache data from the inserted gamecard.
 bool gamecardInitialize(void);
@@ -302,6 +327,23 @@ bool gamecardGetLotusAsicFirmwareBlob(LotusAsicFirmwareBlob *out_lafw_blob, u64
 /// 'offset' + 'read_size' must not exceed the value returned by gamecardGetTotalSize().
 bool gamecardReadStorage(void *out, u64 read_size, u64 offset);
 
+/// Initializes a GameCardStreamContext and starts a background thread that reads gamecard storage data in 'block_size' chunks, starting at 'offset'.
+/// Up to 'buffer_count' blocks are read ahead of time, so gamecard I/O overlaps with whatever the caller does with previously read blocks.
+/// 'block_size' must be aligned to GAMECARD_PAGE_SIZE. If 'offset' isn't aligned, the first block is shortened to make all subsequent reads aligned.
+/// 'offset' + 'size' must not exceed the value returned by gamecardGetTotalSize().
+bool gamecardStreamInitialize(GameCardStreamContext *out, u64 offset, u64 size, u64 block_size, u32 buffer_count);
+
+/// Waits until the next block from the provided GameCardStreamContext is available, then saves its pointer and size to the provided variables.
+/// Block buffers remain valid until they're released with gamecardStreamReleaseBlock(). Blocks must be released in the same order they were retrieved.
+/// Returns false if a read error occurred or if there are no blocks left.
+bool gamecardStreamGetNextBlock(GameCardStreamContext *ctx, void **out_buf, u64 *out_size);
+
+/// Releases the oldest block retrieved with gamecardStreamGetNextBlock(), letting the stream thread reuse its buffer.
+void gamecardStreamReleaseBlock(GameCardStreamContext *ctx);
+
+/// Stops the stream thread from the provided GameCardStreamContext and frees all of its block buffers.
+void gamecardStreamFree(GameCardStreamContext *ctx);
+
 /// Fills the provided GameCardHeader pointer.
 /// This area can also be read using gamecardReadStorage(), starting at offset 0.
 bool gamecardGetHeader(GameCardHeader *out);
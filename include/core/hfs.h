@@ -71,6 +71,16 @@ typedef struct {
     u8 *header;         ///< HashFileSystemHeader + (HashFileSystemEntry * entry_count) + Name Table.
 } HashFileSystemContext;
 
+/// Used to verify the hash target region from a Hash FS entry while its data is being read.
+/// Data must be fed sequentially using hfsUpdateEntryHashContext(), but it doesn't need to be limited to the hash target region.
+typedef struct {
+    u64 hash_target_offset;         ///< Hash target region offset (relative to the start of the Hash FS entry).
+    u32 hash_target_size;           ///< Hash target region size.
+    u8 hash[SHA256_HASH_SIZE];      ///< Expected SHA-256 checksum for the hash target region.
+    u64 hashed_size;                ///< Hash target region bytes processed so far.
+    Sha256Context sha256_ctx;
+} HashFileSystemEntryHashContext;
+
 /// Reads raw partition data using a Hash FS context.
 /// Input offset must be relative to the start of the Hash FS.
 bool hfsReadPartitionData(HashFileSystemContext *ctx, void *out, u64 read_size, u64 offset);
@@ -86,6 +96,18 @@ bool hfsGetTotalDataSize(HashFileSystemContext *ctx, u64 *out_size);
 /// Retrieves a Hash FS entry index by its name.
 bool hfsGetEntryIndexByName(HashFileSystemContext *ctx, const char *name, u32 *out_idx);
 
+/// Initializes a HashFileSystemEntryHashContext using the hash target region information from the provided Hash FS entry.
+bool hfsInitializeEntryHashContext(HashFileSystemEntryHashContext *out, HashFileSystemEntry *fs_entry);
+
+/// Updates the provided HashFileSystemEntryHashContext using a block of data read from its Hash FS entry.
+/// Input offset must be relative to the start of the Hash FS entry. Data outside of the hash target region is ignored.
+void hfsUpdateEntryHashContext(HashFileSystemEntryHashContext *ctx, const void *data, u64 data_size, u64 offset);
+
+/// Finalizes the provided HashFileSystemEntryHashContext and compares the calculated checksum against the expected one.
+/// Returns false if the hash target region hasn't been fully processed yet, or if the checksums don't match.
+/// This function must only be called once per context.
+bool hfsVerifyEntryHashContext(HashFileSystemEntryHashContext *ctx);
+
 /// Takes a HashFileSystemPartitionType value. Returns a pointer to a string that represents the partition name that matches the provided Hash FS partition type.
 /// Returns NULL if the provided value is out of range.
 const char *hfsGetPartitionNameString(u8 hfs_partition_type);
@@ -146,6 +168,11 @@ NX_INLINE HashFileSystemEntry *hfsGetEntryByName(HashFileSystemContext *ctx, con
     return hfsGetEntryByIndex(ctx, idx);
 }
 
+NX_INLINE bool hfsIsEntryHashContextComplete(HashFileSystemEntryHashContext *ctx)
+{
+    return (ctx && ctx->hash_target_size && ctx->hashed_size >= ctx->hash_target_size);
+}
+
 #ifdef __cplusplus
 }
 #endif
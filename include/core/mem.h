@@ -45,6 +45,24 @@ typedef struct {
     u64 data_size;
 } MemoryLocation;
 
+#define MEM_SCAN_MAX_RECORD_SIZE    0x10000
+
+/// Used by memScanProgramMemory() to validate a pattern match. 'record' points to the full record, which starts 'pattern_offset' bytes before the match.
+/// Must return true if this is the record that's being looked for. Keep in mind this is called while the target program is being debugged, so no FS I/O
+/// (including logging) must take place here if the target program is the FS sysmodule.
+typedef bool (*MemoryScanValidateFunction)(const void *record, u64 record_size, void *userdata);
+
+typedef struct {
+    const void *pattern;
+    u32 pattern_size;
+    u32 pattern_offset;                     ///< Pattern offset within the record.
+    u32 record_size;                        ///< Must be at least 'pattern_offset + pattern_size' and no greater than MEM_SCAN_MAX_RECORD_SIZE.
+    MemoryScanValidateFunction validate;    ///< Optional. If NULL, the first record that holds the pattern is used.
+    void *userdata;                         ///< Passed to 'validate'.
+    bool found;                             ///< Set by memScanProgramMemory().
+    u64 address;                            ///< Program memory address for the first record byte. Set by memScanProgramMemory().
+} MemoryScanPattern;
+
 /// Retrieves memory segment (.text, .rodata, .data) data from a running program.
 /// These are memory pages with read permission (Perm_R) enabled, with type MemType_CodeStatic or MemType_CodeMutable and no MemoryAttribute flag set.
 bool memRetrieveProgramMemorySegment(MemoryLocation *location);
@@ -54,6 +72,14 @@ bool memRetrieveProgramMemorySegment(MemoryLocation *location);
 /// MemType_Unmapped, MemType_Io, MemType_ThreadLocal and MemType_Reserved memory pages are excluded if FS program memory is being retrieved, in order to avoid hangs.
 bool memRetrieveFullProgramMemory(MemoryLocation *location);
 
+/// Looks for multiple patterns in a single pass over the memory from a running program, without keeping a full copy of it in memory.
+/// Memory pages are read through a fixed-size window, and records are only handed to their validation callbacks once they're fully available.
+/// Memory pages are scanned as a single concatenated stream, so records may straddle pages that aren't contiguous in program memory (just like with a full memory dump).
+/// If 'mask' is set to MemoryProgramSegmentType_None, the same memory pages used by memRetrieveFullProgramMemory() are scanned. Otherwise, only the
+/// program memory segments from 'mask' are scanned, just like memRetrieveProgramMemorySegment() does.
+/// Returns false if an error occurs. The 'found' flag from each MemoryScanPattern element must be checked by the caller.
+bool memScanProgramMemory(u64 program_id, u8 mask, MemoryScanPattern *patterns, u32 pattern_count);
+
 /// Frees a populated MemoryLocation element.
 NX_INLINE void memFreeMemoryLocation(MemoryLocation *location)
 {
@@ -469,6 +469,14 @@ struct _NcaContext {
     u32 content_type_ctx_data_idx;                      ///< Start index for the data generated by the content type context. Used while creating NSPs.
 };
 
+/// Statistics from the sequential read-ahead layer used by ncaReadContentFile().
+typedef struct {
+    u64 read_count;         ///< Total ncaReadContentFile() calls.
+    u64 requested_size;     ///< Total data size requested by ncaReadContentFile() callers.
+    u64 hit_size;           ///< Data served straight from prefetch buffers.
+    u64 prefetched_size;    ///< Data read ahead of time, beyond what callers requested.
+} NcaPrefetchStats;
+
 typedef struct {
     bool written;   ///< Set to true if this patch has already been written.
     u64 offset;     ///< New data offset (relative to the start of the NCA content file).
@@ -490,10 +498,16 @@ typedef struct {
 } NcaHierarchicalIntegrityPatch;
 
 /// Functions to control the internal heap buffer used by NCA FS section crypto operations.
-/// Must be called at startup.
+/// Must be called at startup. ncaFreeCryptoBuffer() also frees the buffers used by the content file prefetcher.
 bool ncaAllocateCryptoBuffer(void);
 void ncaFreeCryptoBuffer(void);
 
+/// Retrieves statistics from the sequential read-ahead layer used by ncaReadContentFile().
+void ncaGetPrefetchStats(NcaPrefetchStats *out);
+
+/// Resets prefetcher statistics.
+void ncaResetPrefetchStats(void);
+
 /// Initializes a NCA context.
 /// If 'storage_id' == NcmStorageId_GameCard, the 'hfs_partition_type' argument must be a valid HashFileSystemPartitionType value.
 /// If the NCA holds a populated Rights ID field, ticket data will need to be retrieved.
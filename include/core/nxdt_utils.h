@@ -132,6 +132,11 @@ void utilsGenerateHexString(char *dst, size_t dst_size, const void *src, size_t
 /// Returns false if there's an error validating input arguments.
 bool utilsParseHexString(void *dst, size_t dst_size, const char *src, size_t src_size);
 
+/// Combines two CRC32 checksums calculated with crc32Calculate() / crc32CalculateWithSeed() into the checksum of the concatenated data.
+/// 'crc2' must have been calculated over 'len2' bytes using a zero seed. The data itself isn't needed, which makes it possible to
+/// calculate checksums for large repetitive regions (e.g. gamecard padding) without processing every single byte.
+u32 utilsCrc32Combine(u32 crc1, u32 crc2, u64 len2);
+
 /// Formats the provided 'size' value to a human-readable size string and stores it in 'dst'.
 void utilsGenerateFormattedSizeString(double size, char *dst, size_t dst_size);
 
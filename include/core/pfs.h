@@ -67,8 +67,15 @@ typedef struct {
     PartitionFileSystemEntry *entries;  ///< Partition FS entries.
     char *name_table;                   ///< Name table.
     u64 fs_size;                        ///< Partition FS data size. Updated each time a new entry is added.
+    u64 full_header_size;               ///< Full Partition FS header size, including name table padding. Updated each time a new entry is added.
+    u32 entry_capacity;                 ///< Number of Partition FS entries that fit in the currently allocated entry buffer.
+    u32 name_table_capacity;            ///< Currently allocated name table size.
 } PartitionFileSystemFileContext;
 
+/// Used by pfsWriteFileContextHeader() to output full Partition FS header data.
+/// Must return false if an error occurs while writing the provided data block.
+typedef bool (*PartitionFileSystemFileContextHeaderWriteFunction)(const void *data, u64 data_size, void *userdata);
+
 /// Initializes a Partition FS context.
 bool pfsInitializeContext(PartitionFileSystemContext *out, NcaFsSectionContext *nca_fs_ctx);
 
@@ -92,6 +99,10 @@ bool pfsGetTotalDataSize(PartitionFileSystemContext *ctx, u64 *out_size);
 /// Use the pfsWriteEntryPatchToMemoryBuffer() wrapper to write patch data generated by this function.
 bool pfsGenerateEntryPatch(PartitionFileSystemContext *ctx, PartitionFileSystemEntry *fs_entry, const void *data, u64 data_size, u64 data_offset, NcaHierarchicalSha256Patch *out);
 
+/// Preallocates enough memory in an existing PartitionFileSystemFileContext to hold the provided number of Partition FS entries and name table size.
+/// Useful to avoid reallocations in pfsAddEntryInformationToFileContext() if the final entry count is known beforehand.
+bool pfsReserveFileContextEntries(PartitionFileSystemFileContext *ctx, u32 entry_count, u32 name_table_size);
+
 /// Adds a new Partition FS entry to an existing PartitionFileSystemFileContext, using the provided entry name and size.
 /// If 'out_entry_idx' is a valid pointer, the index to the new Partition FS entry will be saved to it.
 bool pfsAddEntryInformationToFileContext(PartitionFileSystemFileContext *ctx, const char *entry_name, u64 entry_size, u32 *out_entry_idx);
@@ -99,6 +110,10 @@ bool pfsAddEntryInformationToFileContext(PartitionFileSystemFileContext *ctx, co
 /// Updates the name from a Partition FS entry in an existing PartitionFileSystemFileContext, using an entry index and the new entry name.
 bool pfsUpdateEntryNameFromFileContext(PartitionFileSystemFileContext *ctx, u32 entry_idx, const char *new_entry_name);
 
+/// Generates a full Partition FS header from an existing PartitionFileSystemFileContext and outputs it using the provided write function.
+/// Header data is passed to the write function in sequential blocks, without using an intermediate buffer.
+bool pfsWriteFileContextHeader(PartitionFileSystemFileContext *ctx, PartitionFileSystemFileContextHeaderWriteFunction write_func, void *userdata);
+
 /// Generates a full Partition FS header from an existing PartitionFileSystemFileContext and writes it to the provided memory buffer.
 bool pfsWriteFileContextHeaderToMemoryBuffer(PartitionFileSystemFileContext *ctx, void *buf, u64 buf_size, u64 *out_header_size);
 
@@ -185,6 +200,11 @@ NX_INLINE u32 pfsGetEntryCountFromFileContext(PartitionFileSystemFileContext *ct
     return (ctx ? ctx->header.entry_count : 0);
 }
 
+NX_INLINE u64 pfsGetFileContextFullHeaderSize(PartitionFileSystemFileContext *ctx)
+{
+    return (ctx ? ctx->full_header_size : 0);
+}
+
 NX_INLINE PartitionFileSystemEntry *pfsGetEntryByIndexFromFileContext(PartitionFileSystemFileContext *ctx, u32 idx)
 {
     if (idx >= pfsGetEntryCountFromFileContext(ctx)) return NULL;
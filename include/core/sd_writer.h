@@ -0,0 +1,112 @@
+/*
+ * sd_writer.h
+ *
+ * Copyright (c) 2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __SD_WRITER_H__
+#define __SD_WRITER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SD_WRITER_BUFFER_SIZE       0x100000    /* 1 MiB. Smaller writes are coalesced into a staging buffer of this size. */
+#define SD_WRITER_BUFFER_ALIGNMENT  0x1000
+
+#define SD_WRITER_PART_SIZE         0xFFFF0000  /* Horizon OS splits ConcatenationFile data into parts of this size. */
+#define SD_WRITER_MAX_LANE_COUNT    4
+
+/// Writes an output file to the SD card straight through the FS sysmodule, bypassing newlib's stdio buffering and the fsdev devoptab.
+/// Output files are created with their final size, so all clusters are allocated up front instead of growing the FAT chain while data is being written.
+/// Writes are sequential, starting at offset zero. Not thread-safe.
+typedef struct {
+    FsFile file;
+    u64 size;                   ///< Output file size.
+    u64 offset;                 ///< File offset for the data held by the staging buffer (i.e. amount of data already passed to the FS sysmodule).
+    u8 *buf;                    ///< Page-aligned staging buffer. Holds 'buf_size' bytes of data that haven't been written yet.
+    u64 buf_size;
+    u64 flush_interval;         ///< Amount of data written between explicit FS flushes. Zero disables periodic flushes.
+    u64 unflushed_size;         ///< Amount of data written since the last FS flush.
+} SdWriter;
+
+/// Writes disjoint regions ("lanes") of a single output file concurrently. Each lane is backed by its own SdWriter, and therefore by its own FsFile handle.
+/// Lane boundaries are aligned to ConcatenationFile part boundaries, so every lane fills its own set of parts and requests from different lanes never touch the same part.
+/// Data within each lane must be written sequentially. Each lane may be used by a different thread, but a single lane must never be used by more than one thread at once.
+typedef struct {
+    SdWriter lanes[SD_WRITER_MAX_LANE_COUNT];
+    u64 lane_offsets[SD_WRITER_MAX_LANE_COUNT]; ///< Output file offset for the start of each lane.
+    u64 lane_sizes[SD_WRITER_MAX_LANE_COUNT];
+    u32 lane_count;
+} SdSplitWriter;
+
+/// Creates an output file at the provided SD card path with the provided size, replacing any existing file or ConcatenationFile, and opens it for writing.
+/// A ConcatenationFile is created if the file size exceeds FAT32_FILESIZE_LIMIT. The path may include the SD card devoptab device name prefix.
+/// 'flush_interval' sets the amount of data written between FS flushes. If zero, data is only flushed by sdWriterFlush() and sdWriterClose().
+bool sdWriterCreate(SdWriter *writer, const char *path, u64 size, u64 flush_interval);
+
+/// Opens an existing output file at the provided SD card path for writing (e.g. to resume an interrupted dump). Its size is adjusted to match the provided one, if needed.
+/// The write position is set to zero. Use sdWriterSeek() to change it.
+bool sdWriterOpen(SdWriter *writer, const char *path, u64 size, u64 flush_interval);
+
+/// Writes data at the current write position and advances it. Writes past the output file size are rejected.
+/// Large blocks are passed to the FS sysmodule right away, while smaller ones are staged until the buffer is full.
+bool sdWriterWrite(SdWriter *writer, const void *data, u64 size);
+
+/// Writes staged data and moves the write position to the provided offset.
+bool sdWriterSeek(SdWriter *writer, u64 offset);
+
+/// Writes staged data, then reads data back from the output file. The write position isn't modified.
+bool sdWriterRead(SdWriter *writer, void *out, u64 size, u64 offset);
+
+/// Writes staged data and flushes the output file, guaranteeing everything written so far has made it to the SD card.
+bool sdWriterFlush(SdWriter *writer);
+
+/// Flushes and closes the output file. Safe to use on writers that were never opened.
+bool sdWriterClose(SdWriter *writer);
+
+/// Creates an output file just like sdWriterCreate(), then splits it into up to 'lane_count' lanes. Must be closed with sdSplitWriterClose().
+/// The actual lane count may be lower than the requested one, since a ConcatenationFile part is never split across lanes. A single lane is used for files that fit in a single part.
+/// Falls back to a single lane if FS refuses to open additional write handles to the output file.
+bool sdSplitWriterCreate(SdSplitWriter *writer, const char *path, u64 size, u32 lane_count, u64 flush_interval);
+
+/// Writes data at the current write position for the provided lane and advances it. Writes past the end of the lane are rejected.
+bool sdSplitWriterWrite(SdSplitWriter *writer, u32 lane_idx, const void *data, u64 size);
+
+/// Flushes and closes all lanes. Safe to use on writers that were never opened.
+bool sdSplitWriterClose(SdSplitWriter *writer);
+
+/// Returns true if the provided writer holds an open output file.
+NX_INLINE bool sdWriterIsOpen(SdWriter *writer)
+{
+    return (writer && serviceIsActive(&(writer->file.s)));
+}
+
+/// Returns the current write position.
+NX_INLINE u64 sdWriterGetPosition(SdWriter *writer)
+{
+    return (writer ? (writer->offset + writer->buf_size) : 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_WRITER_H__ */
@@ -42,6 +42,19 @@ typedef enum {
     UsbHostSpeed_Count      = 4     ///< Total values supported by this enum.
 } UsbHostSpeed;
 
+/// Used to describe a file entry from a file batch. See usbSendFileBatchProperties().
+typedef struct {
+    const char *filename;   ///< Output path, relative to the host output directory.
+    u64 file_size;          ///< File size. May be zero.
+} UsbFileBatchEntry;
+
+/// Resume information reported by the host device. See usbSendResumableFileProperties().
+typedef struct {
+    u64 offset;                         ///< Amount of file data already held by the host device. Zero if there's nothing to resume.
+    u64 tail_size;                      ///< Size of the file data block right before 'offset' covered by 'tail_hash'. Never exceeds 1 MiB.
+    u8 tail_hash[SHA256_HASH_SIZE];     ///< SHA-256 checksum of the file data block at ['offset' - 'tail_size', 'offset').
+} UsbFileResumeInfo;
+
 /// Initializes the USB interface, input and output endpoints and allocates an internal transfer buffer.
 bool usbInitialize(void);
 
@@ -61,18 +74,53 @@ u8 usbIsReady(void);
 /// Under NSP transfer mode, this function must be called right before transferring data from each NSP file entry to the host device, which should in turn write it all to the same output file.
 bool usbSendFileProperties(u64 file_size, const char *filename);
 
+/// Same as usbSendFileProperties(), but the host device is asked to keep the output file around if the transfer is interrupted, and to report how much data it already holds from a previous attempt.
+/// If 'out_resume_info->offset' is non-zero, the caller must read 'out_resume_info->tail_size' bytes right before that offset from its data source, verify them against 'out_resume_info->tail_hash',
+/// and then call usbResumeFileTransfer() using either the reported offset (if the checksum matches) or zero (which restarts the transfer). No file data can be sent until that happens.
+/// The reported offset is either a multiple of USB_TRANSFER_BUFFER_SIZE or equal to 'file_size', in which case there's no data left to transfer after resuming.
+/// If the host device doesn't support resumable transfers, 'out_resume_info->offset' is always zero and the transfer proceeds just like with usbSendFileProperties().
+/// Can't be used under NSP transfer mode.
+bool usbSendResumableFileProperties(u64 file_size, const char *filename, UsbFileResumeInfo *out_resume_info);
+
+/// Lets the host device know where the file transfer started by usbSendResumableFileProperties() must resume from. See usbSendResumableFileProperties() for details.
+/// The host device truncates the output file to 'offset'. File data must then be sent starting at 'offset'.
+bool usbResumeFileTransfer(u64 offset);
+
 /// Sends NSP properties to the host device and enables NSP transfer mode. If needed, it must be called before usbSendFileData().
 /// Both 'nsp_size' and 'nsp_header_size' must be greater than zero. 'nsp_size' must also be greater than 'nsp_header_size'.
 /// Calling this function after NSP transfer mode has already been enabled will result in an error.
 /// The host device should immediately write 'nsp_header_size' padding at the start of the output file and start listening for further usbSendFileProperties() calls, or a usbSendNspHeader() call.
 bool usbSendNspProperties(u64 nsp_size, const char *filename, u32 nsp_header_size);
 
-/// Performs a file data transfer. Must be continuously called after usbSendFileProperties() / usbSendNspProperties() until all file data has been transferred.
+/// Sends the properties from multiple files to the host device using a single command, which greatly reduces the per-file overhead when dealing with lots of small files.
+/// Data from all batch entries must then be transferred as a single concatenated stream using usbSendFileData(), in the same order used for 'entries'. The host device only replies once after all data has been received.
+/// usbGetFileDataBuffer() can't be used with file batches. Calling this function before finishing an ongoing file data transfer or under NSP transfer mode will result in an error.
+/// The full command block must fit within USB_TRANSFER_BUFFER_SIZE, which can hold at least 10,000 entries with maximum-length filenames.
+bool usbSendFileBatchProperties(const UsbFileBatchEntry *entries, u32 entry_count);
+
+/// Performs a file data transfer. Must be continuously called after usbSendFileProperties() / usbSendResumableFileProperties() / usbSendNspProperties() / usbSendFileBatchProperties() until all file data has been transferred.
 /// Data chunk size must not exceed USB_TRANSFER_BUFFER_SIZE.
+/// Data is copied and queued as multiple in-flight USB transfers, so this function may return before the host device receives it. Transfer errors may be reported by a later call.
+/// The caller is free to reuse its buffer as soon as this function returns. All queued data is guaranteed to have reached the host device after sending the last chunk.
+/// If the host device supports it, data is transparently LZ4-compressed on multiple CPU cores. Compression is disabled for the rest of the current file if it isn't reducing the data size.
+/// If the host device asks for it, each queued USB transfer is also followed by a CRC32 checksum. Transfers that fail verification on the host device are transparently retransmitted.
 /// If the last file data chunk is aligned to the endpoint max packet size, the host device should expect a Zero Length Termination (ZLT) packet.
 /// Calling this function if there's no remaining data to transfer will result in an error.
 bool usbSendFileData(void *data, u64 data_size);
 
+/// Returns a pointer to a page-aligned buffer owned by the USB interface, which can be used to read the next file data chunk in place, avoiding an additional memory copy.
+/// The buffer size is saved to 'out_size'. Multiple buffers may be acquired at once, up to the number of in-flight USB transfers supported by the USB interface.
+/// The buffer size may change from one call to another while the USB transfer queue configuration is being auto-tuned, so it must always be checked.
+/// Each acquired buffer must be passed to usbCommitFileDataBuffer() in the same order it was acquired. usbSendFileData() can't be used while any buffer is outstanding.
+/// If integrity block checksums are in use, fewer buffers may be acquired at once, since each in-flight transfer also needs a checksum trailer.
+/// Returns NULL if there's no remaining data to transfer or if all buffers are already in use.
+void *usbGetFileDataBuffer(u64 *out_size);
+
+/// Performs a file data transfer using a buffer previously returned by usbGetFileDataBuffer(). 'data_size' must not exceed the buffer size.
+/// Behaves just like usbSendFileData(). If the provided data is the last file data chunk, no other buffers may be outstanding.
+/// The buffer must not be accessed after calling this function.
+bool usbCommitFileDataBuffer(void *buf, u64 data_size);
+
 /// Used to gracefully cancel an ongoing file transfer. The current USB session is kept alive.
 void usbCancelFileTransfer(void);
 
@@ -0,0 +1,55 @@
+/*
+ * usb_transport.h
+ *
+ * Copyright (c) 2020-2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __USB_TRANSPORT_H__
+#define __USB_TRANSPORT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USB_FS_EP_MAX_PACKET_SIZE   0x40    /* 64 bytes. */
+#define USB_HS_EP_MAX_PACKET_SIZE   0x200   /* 512 bytes. */
+#define USB_SS_EP_MAX_PACKET_SIZE   0x400   /* 1024 bytes. */
+
+/// Endpoint operations used by the USB interface.
+/// The console build uses usb:ds (see usb_ds_transport.c). The host loopback harness provides a socket-backed implementation, which lets usb.c run natively against the host script.
+typedef struct {
+    bool (*initialize)(UsbDsEndpoint **out_endpoint_in, UsbDsEndpoint **out_endpoint_out);     ///< Sets up the USB device interface and returns its bulk IN/OUT endpoints.
+    void (*exit)(void);                                                                         ///< Closes the USB device interface.
+    Event *(*get_state_change_event)(void);                                                     ///< Returns the USB state change event.
+    Result (*get_state)(UsbState *out);                                                         ///< Retrieves the current USB state.
+    Result (*post_buffer_async)(UsbDsEndpoint *endpoint, void *buffer, size_t size, u32 *out_urb_id);
+    Result (*get_report_data)(UsbDsEndpoint *endpoint, UsbDsReportData *out);
+    Result (*cancel)(UsbDsEndpoint *endpoint);
+    Result (*set_zlt)(UsbDsEndpoint *endpoint, bool zlt);
+} UsbTransport;
+
+/// Returns a pointer to the USB transport used by usb.c.
+const UsbTransport *usbGetTransport(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USB_TRANSPORT_H__ */
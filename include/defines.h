@@ -123,6 +123,8 @@
 #define NSWDB_XML_NAME                  "NSWreleases.xml"
 #define NSWDB_XML_PATH                  APP_BASE_PATH NSWDB_XML_NAME
 
+#define DAT_PATH                        APP_BASE_PATH "DAT/"                                                                    /* User-supplied Logiqx DAT files (e.g. No-Intro) used for offline dump verification. */
+
 #define BOREALIS_URL                    "https://github.com/natinusala/borealis"
 #define LIBUSBHSFS_URL                  "https://github.com/DarkMatterCore/libusbhsfs"
 #define FATFS_URL                       "http://elm-chan.org/fsw/ff/00index_e.html"
@@ -26,6 +26,8 @@
 #include "title.h"
 #include "pfs.h"
 #include "romfs.h"
+#include "dump_pipeline.h"
+#include "sd_writer.h"
 
 #define RESET   "\033[0m"
 #define BLACK   "\033[30m"      /* Black */
@@ -45,32 +47,49 @@
 #define BOLDCYAN    "\033[1m\033[36m"      /* Bold Cyan */
 #define BOLDWHITE   "\033[1m\033[37m"      /* Bold White */
 
-#define BLOCK_SIZE  USB_TRANSFER_BUFFER_SIZE
+/* The read stage decrypts NCA data straight into free pipeline buffers, while the hash and write stages drain filled ones. */
+#define BLOCK_SIZE      0x400000    /* 4 MiB. */
+#define BUFFER_COUNT    4
+
+/* Outputs are preallocated and written straight through the FS sysmodule. Data is flushed every once in a while, so a crash doesn't leave a huge amount of it in flight. */
+#define FLUSH_INTERVAL  0x4000000   /* 64 MiB. */
+
+/* The manifest describes the dumped outputs, so they can be skipped on later runs if the installed program NCA hasn't changed. */
+#define MANIFEST_MAGIC      0x464D444F  /* "ODMF". */
+#define MANIFEST_VERSION    2
+
+/* Outputs are verified on later runs by hashing a few evenly spaced blocks from them (including the first and last ones), instead of reading them back in full. */
+#define SAMPLE_SIZE     0x10000     /* 64 KiB. */
+#define SAMPLE_COUNT    16
 
 bool g_borealisInitialized = false;
 
 static PadState g_padState = {0};
 
-static Mutex g_fileMutex = 0;
-static CondVar g_readCondvar = 0, g_writeCondvar = 0;
-
 typedef struct
 {
-    FILE *fd;
-    NcaFsSectionContext* section_ctx;
+    SdWriter writer;
+    NcaFsSectionContext *section_ctx;
+    u64 section_offset;                         ///< Output data offset within the NCA FS section.
+    Sha256Context sha256_ctx;                   ///< Output data hash. Only updated by the hash stage.
+} DumpStageData;
 
-    void *data;
-    size_t data_size;
-    size_t data_written;
-
-    size_t total_offset;
-    size_t total_size;
+typedef struct
+{
+    u8 section_hash[SHA256_HASH_SIZE];          ///< NCA FS section header hash the output was dumped from. Zeroed if the output isn't valid.
+    u64 size;                                   ///< Output size.
+    u8 hash[SHA256_HASH_SIZE];                  ///< Output SHA-256 checksum.
+    u8 sample_hash[SHA256_HASH_SIZE];           ///< SHA-256 checksum calculated over SAMPLE_COUNT blocks from the output. See get_output_sample_hash().
+} DowngradeManifestEntry;
 
-    bool read_error;
-    bool write_error;
-    bool transfer_cancelled;
-    bool mode;
-} ThreadSharedData;
+typedef struct
+{
+    u32 magic;                                  ///< MANIFEST_MAGIC.
+    u32 version;                                ///< MANIFEST_VERSION.
+    NcmContentId content_id;                    ///< Source program NCA content ID.
+    DowngradeManifestEntry romfs;
+    DowngradeManifestEntry exefs;
+} DowngradeManifest;
 
 static void utilsScanPads(void)
 {
@@ -113,6 +132,7 @@ static const char sdmc_prefix[] = "sdmc:";
 static const size_t sdmc_prefix_length = sizeof(sdmc_prefix) - 1;
 static const char romfs_path[] = "sdmc:/atmosphere/contents/0100000000010000/romfs.bin";
 static const char exefs_path[] = "sdmc:/atmosphere/contents/0100000000010000/exefs.nsp";
+static const char manifest_path[] = "sdmc:/atmosphere/contents/0100000000010000/odyssey_downgrade.manifest";
 static const char patch_path[] = "sdmc:/atmosphere/exefs_patches/odyssey_100_downgrade/3CA12DFAAF9C82DA064D1698DF79CDA1.ips";
 
 static const u8 patch_data[] = {
@@ -123,123 +143,265 @@ static const u8 patch_data[] = {
 
 static const size_t patch_data_size = sizeof(patch_data);
 
-static void read_thread_func(void *arg)
+static bool manifest_load(DowngradeManifest *manifest)
+{
+    FILE *fd = fopen(manifest_path, "rb");
+    if (!fd) return false;
+
+    bool success = (fread(manifest, 1, sizeof(DowngradeManifest), fd) == sizeof(DowngradeManifest) && manifest->magic == MANIFEST_MAGIC && \
+                    manifest->version == MANIFEST_VERSION);
+
+    fclose(fd);
+
+    return success;
+}
+
+static bool manifest_save(const DowngradeManifest *manifest)
+{
+    FILE *fd = fopen(manifest_path, "wb");
+    if (!fd) return false;
+
+    bool success = (fwrite(manifest, 1, sizeof(DowngradeManifest), fd) == sizeof(DowngradeManifest));
+
+    fclose(fd);
+
+    if (!success) remove(manifest_path);
+
+    return success;
+}
+
+static bool get_output_file_size(const char *path, s64 *out_size)
 {
-    ThreadSharedData *shared_data = (ThreadSharedData*)arg;
-    if (!shared_data || !shared_data->data || !shared_data->total_size || (!shared_data->section_ctx))
+    FsFileSystem *fs = utilsGetSdCardFileSystemObject();
+    FsFile f = {0};
+
+    /* Use the native FS interface, since romfs.bin may be a concatenation file. */
+    if (R_FAILED(fsFsOpenFile(fs, path + sdmc_prefix_length, FsOpenMode_Read, &f))) return false;
+
+    bool success = R_SUCCEEDED(fsFileGetSize(&f, out_size));
+
+    fsFileClose(&f);
+
+    return success;
+}
+
+/* Hashes SAMPLE_COUNT evenly spaced blocks from an output file on the SD card. This only reads about 1 MiB, regardless of the output size. */
+/* It catches truncated outputs and outputs that were only partially written before a crash, which is all we need to decide if a dump can be skipped. */
+static bool get_output_sample_hash(const char *path, u64 size, u8 *out_hash)
+{
+    FsFileSystem *fs = utilsGetSdCardFileSystemObject();
+    FsFile f = {0};
+    Sha256Context sha256_ctx = {0};
+    u64 sample_size = MIN(SAMPLE_SIZE, size), bytes_read = 0;
+    bool success = false;
+
+    u8 *buf = malloc(SAMPLE_SIZE);
+    if (!buf) return false;
+
+    if (R_FAILED(fsFsOpenFile(fs, path + sdmc_prefix_length, FsOpenMode_Read, &f))) goto end;
+
+    sha256ContextCreate(&sha256_ctx);
+
+    for(u32 i = 0; i < SAMPLE_COUNT; i++)
     {
-        shared_data->read_error = true;
-        goto end;
+        u64 offset = (((size - sample_size) * i) / (SAMPLE_COUNT - 1));
+        if (R_FAILED(fsFileRead(&f, (s64)offset, buf, sample_size, FsReadOption_None, &bytes_read)) || bytes_read != sample_size) goto end;
+        sha256ContextUpdate(&sha256_ctx, buf, sample_size);
     }
 
-    u8 *buf = malloc(BLOCK_SIZE);
-    if (!buf)
+    sha256ContextGetHash(&sha256_ctx, out_hash);
+    success = true;
+
+end:
+    if (serviceIsActive(&(f.s))) fsFileClose(&f);
+
+    free(buf);
+
+    return success;
+}
+
+/* Checks if an output recorded in the manifest was dumped from the provided NCA FS section and is still intact on the SD card. */
+static bool manifest_check_output(const DowngradeManifestEntry *entry, const u8 *section_hash, u64 size, const char *path, const char *name)
+{
+    s64 file_size = 0;
+    u8 hash[SHA256_HASH_SIZE] = {0};
+
+    if (entry->size != size || memcmp(entry->section_hash, section_hash, SHA256_HASH_SIZE) || !get_output_file_size(path, &file_size) || (u64)file_size != size) return false;
+
+    if (!get_output_sample_hash(path, size, hash) || memcmp(hash, entry->sample_hash, SHA256_HASH_SIZE))
     {
-        shared_data->read_error = true;
-        goto end;
+        consolePrint("%s failed verification, dumping it again\n", name);
+        return false;
     }
 
-    /* Open file. */
-    const char* path = shared_data->mode ? exefs_path : romfs_path;
-    shared_data->read_error = ((shared_data->fd = fopen(path, "wb")) == NULL);
-    if (shared_data->read_error)
+    return true;
+}
+
+static bool read_stage_func(DumpPipelineBuffer *buf, void *userdata)
+{
+    DumpStageData *stage_data = (DumpStageData*)userdata;
+    return ncaReadFsSection(stage_data->section_ctx, buf->data, buf->data_size, stage_data->section_offset + buf->offset);
+}
+
+static bool hash_stage_func(DumpPipelineBuffer *buf, void *userdata)
+{
+    DumpStageData *stage_data = (DumpStageData*)userdata;
+    sha256ContextUpdate(&(stage_data->sha256_ctx), buf->data, buf->data_size);
+    return true;
+}
+
+static bool write_stage_func(DumpPipelineBuffer *buf, void *userdata)
+{
+    DumpStageData *stage_data = (DumpStageData*)userdata;
+    return sdWriterWrite(&(stage_data->writer), buf->data, buf->data_size);
+}
+
+static bool dump_section(DowngradeManifest *manifest, DowngradeManifestEntry *manifest_entry, const char *path, NcaFsSectionContext *section_ctx, const u8 *section_hash, \
+                         u64 offset, u64 size)
+{
+    DumpStageData stage_data = { .section_ctx = section_ctx, .section_offset = offset };
+    DumpPipeline pipeline = {0};
+    bool success = false;
+
+    DumpPipelineStage stages[] = {
+        { .type = DumpPipelineStageType_Read,  .name = "read",  .func = read_stage_func,  .userdata = &stage_data, .cpu_id = 1 },
+        { .type = DumpPipelineStageType_Hash,  .name = "hash",  .func = hash_stage_func,  .userdata = &stage_data, .cpu_id = 2 },
+        { .type = DumpPipelineStageType_Write, .name = "write", .func = write_stage_func, .userdata = &stage_data, .cpu_id = 2 }
+    };
+
+    /* Invalidate the manifest entry for the output we're about to overwrite, in case the dump gets interrupted. */
+    memset(manifest_entry, 0, sizeof(DowngradeManifestEntry));
+    manifest_save(manifest);
+
+    sha256ContextCreate(&(stage_data.sha256_ctx));
+
+    /* Replaces any existing output. A ConcatenationFile is created if the output doesn't fit in a single FAT32 file. */
+    consolePrint("creating file...");
+
+    if (!sdWriterCreate(&(stage_data.writer), path, size, FLUSH_INTERVAL))
     {
-        condvarWakeAll(&g_writeCondvar);
-        goto cleanup;
+        consolePrint("failed to create output file\n");
+        return false;
     }
 
-    for(u64 offset = 0, blksize = BLOCK_SIZE; offset < shared_data->total_size; offset += blksize)
+    consolePrint("done\n");
+
+    consolePrint("starting pipeline\n");
+
+    if (!dumpPipelineInitialize(&pipeline, stages, MAX_ELEMENTS(stages), size, 0, BLOCK_SIZE, 0, BUFFER_COUNT) || !dumpPipelineStart(&pipeline))
     {
-        if ((shared_data->total_size - offset) < blksize) blksize = (shared_data->total_size - offset);
+        consolePrint("dump pipeline start failed\n");
+        goto end;
+    }
 
-        /* Check if the transfer has been cancelled by the user. */
-        if (shared_data->transfer_cancelled)
-        {
-            condvarWakeAll(&g_writeCondvar);
-            break;
-        }
+    u8 prev_time = 0;
+    u64 prev_size = 0;
+    u8 percent = 0;
 
-        /* Read current file data chunk. */
-        shared_data->read_error = !ncaReadFsSection(shared_data->section_ctx, buf, blksize, offset + shared_data->total_offset);
-        if (shared_data->read_error)
-        {
-            condvarWakeAll(&g_writeCondvar);
-            break;
-        }
+    time_t btn_cancel_start_tmr = 0, btn_cancel_end_tmr = 0;
+    bool btn_cancel_cur_state = false, btn_cancel_prev_state = false;
+
+    utilsSetLongRunningProcessState(true);
+
+    consolePrint("hold b to cancel\n\n");
+
+    time_t start = time(NULL);
+
+    while(dumpPipelineIsRunning(&pipeline))
+    {
+        /* Don't hog a CPU core the pipeline stages could be using. */
+        utilsAppletLoopDelay();
 
-        /* Wait until the previous file data chunk has been written. */
-        mutexLock(&g_fileMutex);
+        struct tm ts = {0};
+        time_t now = time(NULL);
+        localtime_r(&now, &ts);
 
-        if (shared_data->data_size && !shared_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
+        size_t cur_size = dumpPipelineGetProcessedSize(&pipeline);
 
-        if (shared_data->write_error)
+        utilsScanPads();
+        btn_cancel_cur_state = (utilsGetButtonsHeld() & HidNpadButton_B);
+
+        if (btn_cancel_cur_state && btn_cancel_cur_state != btn_cancel_prev_state)
         {
-            mutexUnlock(&g_fileMutex);
-            break;
+            btn_cancel_start_tmr = now;
+        } else
+        if (btn_cancel_cur_state && btn_cancel_cur_state == btn_cancel_prev_state)
+        {
+            btn_cancel_end_tmr = now;
+            if ((btn_cancel_end_tmr - btn_cancel_start_tmr) >= 3)
+            {
+                dumpPipelineCancel(&pipeline);
+                break;
+            }
+        } else {
+            btn_cancel_start_tmr = btn_cancel_end_tmr = 0;
         }
 
-        /* Copy current file data chunk to the shared buffer. */
-        memcpy(shared_data->data, buf, blksize);
-        shared_data->data_size = blksize;
+        btn_cancel_prev_state = btn_cancel_cur_state;
+
+        if (prev_time == ts.tm_sec || prev_size == cur_size) continue;
 
-        /* Wake up the write thread to continue writing data. */
-        mutexUnlock(&g_fileMutex);
-        condvarWakeAll(&g_writeCondvar);
-    }
+        percent = (u8)((cur_size * 100) / size);
 
-    /* Wait until the previous file data chunk has been written. */
-    mutexLock(&g_fileMutex);
-    if (shared_data->data_size && !shared_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
-    mutexUnlock(&g_fileMutex);
+        prev_time = ts.tm_sec;
+        prev_size = cur_size;
 
-    if ((shared_data->read_error || shared_data->write_error || shared_data->transfer_cancelled) && *path) remove(path);
+        printf("%lu / %lu (%u%%) | Time elapsed: %lu\n", cur_size, size, percent, (now - start));
+        consoleUpdate(NULL);
+    }
 
-cleanup:
-    free(buf);
+    consolePrint("\nwaiting for pipeline to finish\n");
+    success = dumpPipelineWait(&pipeline);
 
-end:
-    threadExit();
-}
+    utilsSetLongRunningProcessState(false);
 
-static void write_thread_func(void *arg)
-{
-    ThreadSharedData *shared_data = (ThreadSharedData*)arg;
-    if (!shared_data || !shared_data->data)
+    if (!success)
     {
-        shared_data->write_error = true;
+        consolePrint(dumpPipelineHasFailed(&pipeline) ? "i/o error\n" : "process cancelled\n");
         goto end;
     }
 
-    while(shared_data->data_written < shared_data->total_size)
+    consolePrint("process completed in %lu seconds\n", time(NULL) - start);
+
+    for(u32 i = 0; i < pipeline.stage_count; i++)
     {
-        /* Wait until the current file data chunk has been read */
-        mutexLock(&g_fileMutex);
+        DumpPipelineStageStats *stats = &(pipeline.stage_ctx[i].stats);
+        consolePrint("%s: %lu ms busy | %lu ms waiting\n", pipeline.stages[i].name, stats->busy_time / 1000000, stats->wait_time / 1000000);
+    }
 
-        if (!shared_data->data_size && !shared_data->read_error) condvarWait(&g_writeCondvar, &g_fileMutex);
+    /* The last data block may still be sitting in the staging buffer. Make sure it reaches the SD card before recording the output. */
+    if (!sdWriterFlush(&(stage_data.writer)))
+    {
+        consolePrint("failed to flush output file\n");
+        success = false;
+        goto end;
+    }
 
-        if (shared_data->read_error || shared_data->transfer_cancelled || !shared_data->fd)
-        {
-            mutexUnlock(&g_fileMutex);
-            break;
-        }
+    /* Sample the output as stored on the SD card, so later runs can verify it. */
+    sdWriterClose(&(stage_data.writer));
 
-        /* Write current file data chunk */
-        shared_data->write_error = (fwrite(shared_data->data, 1, shared_data->data_size, shared_data->fd) != shared_data->data_size);
-        if (!shared_data->write_error)
-        {
-            shared_data->data_written += shared_data->data_size;
-            shared_data->data_size = 0;
-        }
+    if (!get_output_sample_hash(path, size, manifest_entry->sample_hash))
+    {
+        consolePrint("failed to read back output file\n");
+        success = false;
+        goto end;
+    }
 
-        /* Wake up the read thread to continue reading data */
-        mutexUnlock(&g_fileMutex);
-        condvarWakeAll(&g_readCondvar);
+    /* Record the dumped output. */
+    memcpy(manifest_entry->section_hash, section_hash, SHA256_HASH_SIZE);
+    manifest_entry->size = size;
+    sha256ContextGetHash(&(stage_data.sha256_ctx), manifest_entry->hash);
 
-        if (shared_data->write_error) break;
-    }
+    if (!manifest_save(manifest)) consolePrint("failed to write manifest\n");
 
 end:
-    threadExit();
+    dumpPipelineFree(&pipeline);
+
+    sdWriterClose(&(stage_data.writer));
+
+    if (!success) utilsRemoveConcatenationFile(path);
+
+    return success;
 }
 
 u8 get_program_id_offset(TitleInfo *info, u32 program_count)
@@ -257,12 +419,10 @@ void do_add_downgrade() {
     TitleApplicationMetadata **app_metadata = NULL;
     TitleUserApplicationData user_app_data = {0};
 
-    u8 *buf = NULL;
-
     NcaContext *base_nca_ctx = NULL;
 
-    ThreadSharedData shared_data = {0};
-    Thread read_thread = {0}, write_thread = {0};
+    DowngradeManifest manifest = {0};
+    bool dump_romfs = true, dump_exefs = true;
 
     app_metadata = titleGetApplicationMetadataEntries(false, &app_count);
     if (!app_metadata || !app_count)
@@ -273,15 +433,6 @@ void do_add_downgrade() {
 
     consolePrint("app metadata succeeded\n");
 
-    buf = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
-    if (!buf)
-    {
-        consolePrint("buf failed\n");
-        goto cleanup;
-    }
-
-    consolePrint("buf succeeded\n");
-
     base_nca_ctx = calloc(1, sizeof(NcaContext));
     if (!base_nca_ctx)
     {
@@ -357,124 +508,33 @@ void do_add_downgrade() {
     }
     consolePrint("exefs initialize ctx succeeded\n");
 
-    shared_data.section_ctx = &(base_nca_ctx->fs_ctx[1]);
-    shared_data.total_offset = romfs_ctx.offset;
-    shared_data.total_size = romfs_ctx.size;
-    shared_data.mode = false;
-
-    shared_data.data = buf;
-    shared_data.data_size = 0;
-    shared_data.data_written = 0;
+    const u8 *romfs_section_hash = base_nca_ctx->header.fs_header_hash[1].hash;
+    const u8 *exefs_section_hash = base_nca_ctx->header.fs_header_hash[0].hash;
 
-    consolePrint("creating file...");
-
-    if(!utilsCreateConcatenationFileWithSize(romfs_path, romfs_ctx.size))
+    /* Only dump the outputs that don't match the installed program NCA. */
+    if (manifest_load(&manifest) && !memcmp(&(manifest.content_id), &(base_nca_ctx->content_id), sizeof(NcmContentId)))
     {
-        consolePrint("create concatenation file failed\n");
-        goto cleanup;
+        dump_romfs = !manifest_check_output(&(manifest.romfs), romfs_section_hash, romfs_ctx.size, romfs_path, "romfs.bin");
+        dump_exefs = !manifest_check_output(&(manifest.exefs), exefs_section_hash, exefs_ctx.size, exefs_path, "exefs.nsp");
+    } else {
+        memset(&manifest, 0, sizeof(DowngradeManifest));
+        manifest.magic = MANIFEST_MAGIC;
+        manifest.version = MANIFEST_VERSION;
+        memcpy(&(manifest.content_id), &(base_nca_ctx->content_id), sizeof(NcmContentId));
     }
 
-    consolePrint("done\n");
+    if (!dump_romfs) consolePrint("romfs.bin is up to date, skipping\n");
+    if (!dump_exefs) consolePrint("exefs.nsp is up to date, skipping\n");
 
-dump_start:
-    consolePrint("creating threads\n");
-    utilsCreateThread(&read_thread, read_thread_func, &shared_data, 2);
-    utilsCreateThread(&write_thread, write_thread_func, &shared_data, 2);
-
-    u8 prev_time = 0;
-    u64 prev_size = 0;
-    u8 percent = 0;
-
-    time_t btn_cancel_start_tmr = 0, btn_cancel_end_tmr = 0;
-    bool btn_cancel_cur_state = false, btn_cancel_prev_state = false;
-
-    utilsSetLongRunningProcessState(true);
-
-    consolePrint("hold b to cancel\n\n");
-
-    time_t start = time(NULL);
-
-    while(shared_data.data_written < shared_data.total_size)
+    if (!dump_romfs && !dump_exefs)
     {
-        if (shared_data.read_error || shared_data.write_error) break;
-
-        struct tm ts = {0};
-        time_t now = time(NULL);
-        localtime_r(&now, &ts);
-
-        size_t size = shared_data.data_written;
-
-        utilsScanPads();
-        btn_cancel_cur_state = (utilsGetButtonsHeld() & HidNpadButton_B);
-
-        if (btn_cancel_cur_state && btn_cancel_cur_state != btn_cancel_prev_state)
-        {
-            btn_cancel_start_tmr = now;
-        } else
-        if (btn_cancel_cur_state && btn_cancel_cur_state == btn_cancel_prev_state)
-        {
-            btn_cancel_end_tmr = now;
-            if ((btn_cancel_end_tmr - btn_cancel_start_tmr) >= 3)
-            {
-                mutexLock(&g_fileMutex);
-                shared_data.transfer_cancelled = true;
-                mutexUnlock(&g_fileMutex);
-                break;
-            }
-        } else {
-            btn_cancel_start_tmr = btn_cancel_end_tmr = 0;
-        }
-
-        btn_cancel_prev_state = btn_cancel_cur_state;
-
-        if (prev_time == ts.tm_sec || prev_size == size) continue;
-
-        percent = (u8)((size * 100) / shared_data.total_size);
-
-        prev_time = ts.tm_sec;
-        prev_size = size;
-
-        printf("%lu / %lu (%u%%) | Time elapsed: %lu\n", size, shared_data.total_size, percent, (now - start));
-        consoleUpdate(NULL);
-    }
-
-    start = (time(NULL) - start);
-
-    consolePrint("\nwaiting for threads to join\n");
-    utilsJoinThread(&read_thread);
-    consolePrint("read_thread done: %lu\n", time(NULL));
-    utilsJoinThread(&write_thread);
-    consolePrint("write_thread done: %lu\n", time(NULL));
-
-    utilsSetLongRunningProcessState(false);
-
-    if (shared_data.read_error || shared_data.write_error)
-    {
-        consolePrint("i/o error\n");
-        goto cleanup;
-    }
-
-    fclose(shared_data.fd);
-
-    if (shared_data.transfer_cancelled)
-    {
-        consolePrint("process cancelled\n");
+        consolePrint("downgrade already up to date\n");
         goto cleanup;
     }
 
-    consolePrint("process completed in %lu seconds\n", start);
+    if (dump_romfs && !dump_section(&manifest, &(manifest.romfs), romfs_path, &(base_nca_ctx->fs_ctx[1]), romfs_section_hash, romfs_ctx.offset, romfs_ctx.size)) goto cleanup;
 
-    if(shared_data.mode == false) {
-        shared_data.section_ctx = &(base_nca_ctx->fs_ctx[0]);
-        shared_data.total_offset = exefs_ctx.offset;
-        shared_data.total_size = exefs_ctx.size;
-        shared_data.mode = true;
-
-        shared_data.data = buf;
-        shared_data.data_size = 0;
-        shared_data.data_written = 0;
-        goto dump_start;
-    }
+    if (dump_exefs && !dump_section(&manifest, &(manifest.exefs), exefs_path, &(base_nca_ctx->fs_ctx[0]), exefs_section_hash, exefs_ctx.offset, exefs_ctx.size)) goto cleanup;
 
     if(user_app_data.app_info->storage_id == NcmStorageId_GameCard)
         consolePrint("if odysey doesn't launch, reinsert your gamecard.\n");
@@ -484,8 +544,6 @@ cleanup:
 
     titleFreeUserApplicationData(&user_app_data);
 
-    if (buf) free(buf);
-
     if (app_metadata) free(app_metadata);
 
     consolePrint("press any button to exit\n");
@@ -496,6 +554,21 @@ void do_add_patch() {
     consoleClear();
     FsFileSystem* fs = utilsGetSdCardFileSystemObject();
 
+    /* Don't rewrite the patch if the one on the SD card is already identical. */
+    FILE *fd = fopen(patch_path, "rb");
+    if (fd)
+    {
+        u8 cur_patch_data[sizeof(patch_data) + 1] = {0};
+        bool identical = (fread(cur_patch_data, 1, sizeof(cur_patch_data), fd) == patch_data_size && !memcmp(cur_patch_data, patch_data, patch_data_size));
+        fclose(fd);
+
+        if (identical)
+        {
+            consolePrint("patch already up to date\n");
+            goto end;
+        }
+    }
+
     /* May error if file already exists, this is ok. */
     int r = fsFsCreateFile(fs, patch_path + sdmc_prefix_length, patch_data_size, 0);
     if(R_FAILED(r) && r != R_PATH_EXISTS) {
@@ -510,7 +583,9 @@ void do_add_patch() {
         goto end;
     }
 
-    r = fsFileWrite(&f, 0, patch_data, patch_data_size, FsWriteOption_Flush);
+    /* Truncate stale patch files. */
+    r = fsFileSetSize(&f, patch_data_size);
+    if(R_SUCCEEDED(r)) r = fsFileWrite(&f, 0, patch_data, patch_data_size, FsWriteOption_Flush);
     if(R_FAILED(r)) {
         consolePrint("failed to write patch (%x)\n", r);
         fsFileClose(&f);
@@ -539,6 +614,12 @@ void do_remove_downgrade() {
         goto end;
     }
 
+    r = fsFsDeleteFile(fs, manifest_path + sdmc_prefix_length);
+    if(R_FAILED(r) && r != R_PATH_DOESNT_EXIST) {
+        consolePrint("failed to delete manifest (%x)\n", r);
+        goto end;
+    }
+
     consolePrint("done\n");
 end:
     consolePrint("press any button to exit\n");
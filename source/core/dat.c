@@ -0,0 +1,547 @@
+/*
+ * dat.c
+ *
+ * Copyright (c) 2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <libxml/xmlreader.h>
+
+#include "nxdt_utils.h"
+#include "dat.h"
+
+#define DAT_ENTRY_ALLOC_COUNT       0x400
+#define DAT_NAME_TABLE_ALLOC_SIZE   0x10000
+
+#define DAT_ROM_ELEMENT             "rom"       /* Logiqx DAT files (e.g. No-Intro). */
+#define DAT_RELEASE_ELEMENT         "release"   /* NSWDB XML. */
+
+/* Network access is disabled. XML_PARSE_DTDLOAD and XML_PARSE_NOENT are left unset, so the external DTD referenced by Logiqx DAT files is never loaded */
+/* and entity references aren't substituted. */
+#define DAT_XML_PARSE_OPTIONS       (XML_PARSE_NONET | XML_PARSE_NOBLANKS | XML_PARSE_COMPACT)
+
+/* Type definitions. */
+
+typedef struct {
+    u64 size;                       ///< Set to zero if unknown.
+    u32 crc32;
+    u8 sha1[SHA1_HASH_SIZE];
+    u8 sha256[SHA256_HASH_SIZE];
+    u8 digest_mask;                 ///< DigestTypeMask. Digests available for this entry.
+    u32 name_offset;                ///< Offset to the entry name within the name table.
+} DatEntry;
+
+/// Open addressing hash table with linear probing. Digests are uniformly distributed, so their first 32 bits are used as-is to pick a slot.
+typedef struct {
+    u32 *slots;                     ///< Each slot holds a DAT entry index + 1. Zero is used for empty slots.
+    u32 mask;                       ///< Slot count minus one. The slot count is always a power of two.
+} DatHashTable;
+
+/* Global variables. */
+
+static Mutex g_datMutex = 0, g_datLoaderMutex = 0;
+static bool g_datInterfaceInit = false, g_datLoaderThreadCreated = false, g_datLoaderExit = false, g_datLoaderRunning = false;
+
+static Thread g_datLoaderThread = {0};
+
+/// Only modified by the loader thread until it's joined.
+static DatEntry *g_datEntries = NULL;
+static u32 g_datEntryCount = 0, g_datEntryCapacity = 0;
+
+static char *g_datNameTable = NULL;
+static u32 g_datNameTableSize = 0, g_datNameTableCapacity = 0;
+
+static DatHashTable g_datHashTables[DigestType_Count] = {0};    ///< MD5 digests aren't indexed.
+
+static const char *g_datMatchTypeNames[] = {
+    [DatMatchType_None]   = "none",
+    [DatMatchType_Crc32]  = "crc32",
+    [DatMatchType_Sha1]   = "sha1",
+    [DatMatchType_Sha256] = "sha256"
+};
+
+/* Function prototypes. */
+
+static void datLoaderThreadFunc(void *arg);
+static bool datIsLoaderExitRequested(void);
+static void datWaitForLoaderThread(void);
+
+static void datParseFile(const char *path);
+static void datXmlReaderErrorFunc(void *arg, const char *msg, xmlParserSeverities severity, xmlTextReaderLocatorPtr locator);
+static void datParseRomElement(xmlTextReaderPtr reader);
+static void datParseReleaseElement(xmlTextReaderPtr reader);
+
+static bool datGetXmlAttribute(xmlTextReaderPtr reader, const char *attr_name, char *out, size_t out_size);
+static bool datGetXmlElementText(xmlNodePtr node, const char *child_name, char *out, size_t out_size);
+static bool datParseCrc32String(const char *str, u32 *out);
+
+static bool datAddEntry(const char *name, u64 size, u32 crc32, const u8 *sha1, const u8 *sha256, u8 digest_mask);
+
+static void datBuildHashTables(void);
+static bool datEntryMatches(const DatEntry *entry, u64 size, const DigestResult *digest_result, u8 digest_mask);
+static void datFreeEntries(void);
+
+NX_INLINE u32 datGetDigestKey(u8 digest_type, u32 crc32, const u8 *sha1, const u8 *sha256);
+
+bool datInitialize(void)
+{
+    bool ret = false;
+
+    SCOPED_LOCK(&g_datMutex)
+    {
+        ret = g_datInterfaceInit;
+        if (ret) break;
+
+        SCOPED_LOCK(&g_datLoaderMutex)
+        {
+            g_datLoaderExit = false;
+            g_datLoaderRunning = true;
+        }
+
+        /* Parse DAT files in the background, so we don't block the UI startup. */
+        if (!(g_datLoaderThreadCreated = utilsCreateThread(&g_datLoaderThread, datLoaderThreadFunc, NULL, 1)))
+        {
+            LOG_MSG_ERROR("Failed to create DAT loader thread!");
+            SCOPED_LOCK(&g_datLoaderMutex) g_datLoaderRunning = false;
+            break;
+        }
+
+        /* Update flags. */
+        ret = g_datInterfaceInit = true;
+    }
+
+    return ret;
+}
+
+void datExit(void)
+{
+    SCOPED_LOCK(&g_datMutex)
+    {
+        /* Stop the loader thread as soon as possible. */
+        SCOPED_LOCK(&g_datLoaderMutex) g_datLoaderExit = true;
+        datWaitForLoaderThread();
+
+        datFreeEntries();
+
+        g_datInterfaceInit = false;
+    }
+}
+
+bool datIsLoading(void)
+{
+    bool ret = false;
+    SCOPED_LOCK(&g_datLoaderMutex) ret = g_datLoaderRunning;
+    return ret;
+}
+
+u32 datGetEntryCount(void)
+{
+    u32 ret = 0;
+
+    SCOPED_LOCK(&g_datMutex)
+    {
+        if (!g_datInterfaceInit) break;
+        datWaitForLoaderThread();
+        ret = g_datEntryCount;
+    }
+
+    return ret;
+}
+
+u8 datLookupEntry(u64 size, const DigestResult *digest_result, u8 digest_mask, char *out_name, size_t out_name_size)
+{
+    u8 ret = DatMatchType_None;
+
+    if (!size || !digest_result || !(digest_mask & (DigestTypeMask_Crc32 | DigestTypeMask_Sha1 | DigestTypeMask_Sha256)))
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return ret;
+    }
+
+    SCOPED_LOCK(&g_datMutex)
+    {
+        if (!g_datInterfaceInit) break;
+
+        datWaitForLoaderThread();
+        if (!g_datEntryCount) break;
+
+        /* Try the strongest digest first. */
+        const u8 digest_types[] = { DigestType_Sha256, DigestType_Sha1, DigestType_Crc32 };
+        const u8 match_types[] = { DatMatchType_Sha256, DatMatchType_Sha1, DatMatchType_Crc32 };
+
+        for(u32 i = 0; i < MAX_ELEMENTS(digest_types) && ret == DatMatchType_None; i++)
+        {
+            u8 digest_type = digest_types[i];
+            DatHashTable *table = &(g_datHashTables[digest_type]);
+
+            if (!(digest_mask & BIT(digest_type)) || !table->slots) continue;
+
+            u32 key = datGetDigestKey(digest_type, digest_result->crc32, digest_result->sha1, digest_result->sha256);
+
+            for(u32 slot = (key & table->mask); table->slots[slot]; slot = ((slot + 1) & table->mask))
+            {
+                DatEntry *entry = &(g_datEntries[table->slots[slot] - 1]);
+                if (!datEntryMatches(entry, size, digest_result, digest_mask)) continue;
+
+                if (out_name && out_name_size) snprintf(out_name, out_name_size, "%s", g_datNameTable + entry->name_offset);
+                ret = match_types[i];
+                break;
+            }
+        }
+    }
+
+    return ret;
+}
+
+const char *datGetMatchTypeName(u8 match_type)
+{
+    return (match_type < MAX_ELEMENTS(g_datMatchTypeNames) ? g_datMatchTypeNames[match_type] : NULL);
+}
+
+static void datLoaderThreadFunc(void *arg)
+{
+    (void)arg;
+
+    DIR *dir = NULL;
+    struct dirent *entry = NULL;
+    char path[FS_MAX_PATH] = {0};
+    const char *ext = NULL;
+
+    /* Load the NSWDB XML, if available. */
+    datParseFile(DEVOPTAB_SDMC_DEVICE NSWDB_XML_PATH);
+
+    /* Load user-supplied Logiqx DAT files. */
+    if ((dir = opendir(DEVOPTAB_SDMC_DEVICE DAT_PATH)))
+    {
+        while((entry = readdir(dir)) && !datIsLoaderExitRequested())
+        {
+            if (entry->d_type == DT_DIR || !(ext = strrchr(entry->d_name, '.')) || (strcasecmp(ext, ".dat") != 0 && strcasecmp(ext, ".xml") != 0)) continue;
+
+            snprintf(path, MAX_ELEMENTS(path), DEVOPTAB_SDMC_DEVICE DAT_PATH "%s", entry->d_name);
+            datParseFile(path);
+        }
+
+        closedir(dir);
+    }
+
+    if (datIsLoaderExitRequested())
+    {
+        datFreeEntries();
+    } else {
+        datBuildHashTables();
+        LOG_MSG_INFO("Loaded %u DAT entries.", g_datEntryCount);
+    }
+
+    SCOPED_LOCK(&g_datLoaderMutex) g_datLoaderRunning = false;
+
+    threadExit();
+}
+
+static bool datIsLoaderExitRequested(void)
+{
+    bool ret = false;
+    SCOPED_LOCK(&g_datLoaderMutex) ret = g_datLoaderExit;
+    return ret;
+}
+
+static void datWaitForLoaderThread(void)
+{
+    /* The loader thread doesn't use g_datMutex, so it's safe to wait for it while holding it. */
+    if (!g_datLoaderThreadCreated) return;
+    utilsJoinThread(&g_datLoaderThread);
+    g_datLoaderThreadCreated = false;
+}
+
+static void datParseFile(const char *path)
+{
+    FILE *fp = NULL;
+    xmlTextReaderPtr reader = NULL;
+    int ret = 0;
+    u32 entry_count = g_datEntryCount;
+
+    /* DAT files are optional. */
+    if (!(fp = fopen(path, "rb"))) return;
+
+    /* Use a streaming reader, so memory usage doesn't depend on the DAT size and elements of any size are handled. Only one element is expanded at a time. */
+    if (!(reader = xmlReaderForFd(fileno(fp), path, NULL, DAT_XML_PARSE_OPTIONS)))
+    {
+        LOG_MSG_ERROR("Failed to create XML reader for \"%s\"!", path);
+        goto end;
+    }
+
+    xmlTextReaderSetErrorHandler(reader, datXmlReaderErrorFunc, (void*)path);
+
+    while(!datIsLoaderExitRequested() && (ret = xmlTextReaderRead(reader)) == 1)
+    {
+        if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT) continue;
+
+        const xmlChar *name = xmlTextReaderConstLocalName(reader);
+
+        if (xmlStrEqual(name, BAD_CAST DAT_ROM_ELEMENT))
+        {
+            datParseRomElement(reader);
+        } else
+        if (xmlStrEqual(name, BAD_CAST DAT_RELEASE_ELEMENT))
+        {
+            datParseReleaseElement(reader);
+        }
+    }
+
+    /* Entries parsed before an error are kept. */
+    if (ret < 0) LOG_MSG_ERROR("Failed to parse \"%s\"! Stopped at line %d.", path, xmlTextReaderGetParserLineNumber(reader));
+
+    LOG_MSG_INFO("Loaded %u entries from \"%s\".", g_datEntryCount - entry_count, path);
+
+end:
+    if (reader) xmlFreeTextReader(reader);
+
+    fclose(fp);
+}
+
+static void datXmlReaderErrorFunc(void *arg, const char *msg, xmlParserSeverities severity, xmlTextReaderLocatorPtr locator)
+{
+    const char *path = (const char*)arg;
+    int line = xmlTextReaderLocatorLineNumber(locator);
+
+    if (severity == XML_PARSER_SEVERITY_ERROR || severity == XML_PARSER_SEVERITY_VALIDITY_ERROR)
+    {
+        LOG_MSG_ERROR("\"%s\", line %d: %s", path, line, msg);
+    } else {
+        LOG_MSG_WARNING("\"%s\", line %d: %s", path, line, msg);
+    }
+}
+
+static void datParseRomElement(xmlTextReaderPtr reader)
+{
+    char name[0x200] = {0}, value[0x80] = {0};
+    u64 size = 0;
+    u32 crc32 = 0;
+    u8 sha1[SHA1_HASH_SIZE] = {0}, sha256[SHA256_HASH_SIZE] = {0}, digest_mask = 0;
+
+    if (!datGetXmlAttribute(reader, "name", name, sizeof(name))) return;
+
+    if (datGetXmlAttribute(reader, "size", value, sizeof(value))) size = strtoull(value, NULL, 10);
+
+    if (datGetXmlAttribute(reader, "crc", value, sizeof(value)) && datParseCrc32String(value, &crc32)) digest_mask |= DigestTypeMask_Crc32;
+
+    if (datGetXmlAttribute(reader, "sha1", value, sizeof(value)) && strlen(value) == (SHA1_HASH_SIZE * 2) && \
+        utilsParseHexString(sha1, sizeof(sha1), value, 0)) digest_mask |= DigestTypeMask_Sha1;
+
+    if (datGetXmlAttribute(reader, "sha256", value, sizeof(value)) && strlen(value) == (SHA256_HASH_SIZE * 2) && \
+        utilsParseHexString(sha256, sizeof(sha256), value, 0)) digest_mask |= DigestTypeMask_Sha256;
+
+    datAddEntry(name, size, crc32, sha1, sha256, digest_mask);
+}
+
+static void datParseReleaseElement(xmlTextReaderPtr reader)
+{
+    char name[0x200] = {0}, value[0x20] = {0};
+    u32 crc32 = 0;
+
+    /* Only the current release element is loaded into memory. Its subtree is freed by the reader once it moves past it. */
+    xmlNodePtr node = xmlTextReaderExpand(reader);
+    if (!node) return;
+
+    /* NSWDB releases only provide a CRC32 checksum for the full XCI image. Its size isn't stored in bytes. */
+    if (!datGetXmlElementText(node, "imgcrc", value, sizeof(value)) || !datParseCrc32String(value, &crc32)) return;
+
+    if (!datGetXmlElementText(node, "releasename", name, sizeof(name)) && !datGetXmlElementText(node, "name", name, sizeof(name))) return;
+
+    datAddEntry(name, 0, crc32, NULL, NULL, DigestTypeMask_Crc32);
+}
+
+static bool datGetXmlAttribute(xmlTextReaderPtr reader, const char *attr_name, char *out, size_t out_size)
+{
+    /* Entities are already unescaped by the reader. */
+    xmlChar *value = xmlTextReaderGetAttribute(reader, BAD_CAST attr_name);
+    if (!value) return false;
+
+    snprintf(out, out_size, "%s", (const char*)value);
+    xmlFree(value);
+
+    return true;
+}
+
+static bool datGetXmlElementText(xmlNodePtr node, const char *child_name, char *out, size_t out_size)
+{
+    for(xmlNodePtr child = node->children; child; child = child->next)
+    {
+        if (child->type != XML_ELEMENT_NODE || !xmlStrEqual(child->name, BAD_CAST child_name)) continue;
+
+        xmlChar *value = xmlNodeGetContent(child);
+        if (!value) return false;
+
+        snprintf(out, out_size, "%s", (const char*)value);
+        xmlFree(value);
+
+        return (*out != '\0');
+    }
+
+    return false;
+}
+
+static bool datParseCrc32String(const char *str, u32 *out)
+{
+    char *end = NULL;
+
+    if (strlen(str) != 8) return false;
+
+    *out = (u32)strtoul(str, &end, 16);
+
+    return (end && !*end);
+}
+
+static bool datAddEntry(const char *name, u64 size, u32 crc32, const u8 *sha1, const u8 *sha256, u8 digest_mask)
+{
+    if (!digest_mask || !*name) return false;
+
+    u32 name_size = (u32)(strlen(name) + 1);
+
+    /* Reallocate buffers, if needed. */
+    if (g_datEntryCount >= g_datEntryCapacity)
+    {
+        DatEntry *tmp_entries = realloc(g_datEntries, (g_datEntryCapacity + DAT_ENTRY_ALLOC_COUNT) * sizeof(DatEntry));
+        if (!tmp_entries)
+        {
+            LOG_MSG_ERROR("Failed to reallocate DAT entries buffer!");
+            return false;
+        }
+
+        g_datEntries = tmp_entries;
+        g_datEntryCapacity += DAT_ENTRY_ALLOC_COUNT;
+    }
+
+    if ((g_datNameTableSize + name_size) > g_datNameTableCapacity)
+    {
+        u32 capacity = (g_datNameTableCapacity + MAX(name_size, DAT_NAME_TABLE_ALLOC_SIZE));
+
+        char *tmp_name_table = realloc(g_datNameTable, capacity);
+        if (!tmp_name_table)
+        {
+            LOG_MSG_ERROR("Failed to reallocate DAT name table!");
+            return false;
+        }
+
+        g_datNameTable = tmp_name_table;
+        g_datNameTableCapacity = capacity;
+    }
+
+    DatEntry *entry = &(g_datEntries[g_datEntryCount++]);
+    memset(entry, 0, sizeof(DatEntry));
+
+    entry->size = size;
+    entry->crc32 = crc32;
+    if (digest_mask & DigestTypeMask_Sha1) memcpy(entry->sha1, sha1, sizeof(entry->sha1));
+    if (digest_mask & DigestTypeMask_Sha256) memcpy(entry->sha256, sha256, sizeof(entry->sha256));
+    entry->digest_mask = digest_mask;
+    entry->name_offset = g_datNameTableSize;
+
+    memcpy(g_datNameTable + g_datNameTableSize, name, name_size);
+    g_datNameTableSize += name_size;
+
+    return true;
+}
+
+static void datBuildHashTables(void)
+{
+    const u8 digest_types[] = { DigestType_Crc32, DigestType_Sha1, DigestType_Sha256 };
+
+    for(u32 i = 0; i < MAX_ELEMENTS(digest_types); i++)
+    {
+        u8 digest_type = digest_types[i];
+        DatHashTable *table = &(g_datHashTables[digest_type]);
+        u32 count = 0, slot_count = 1;
+
+        for(u32 j = 0; j < g_datEntryCount; j++)
+        {
+            if (g_datEntries[j].digest_mask & BIT(digest_type)) count++;
+        }
+
+        if (!count) continue;
+
+        /* Keep the load factor at or below 50%. */
+        while(slot_count < (count * 2)) slot_count <<= 1;
+
+        if (!(table->slots = calloc(slot_count, sizeof(u32))))
+        {
+            LOG_MSG_ERROR("Failed to allocate %s DAT hash table!", digestGetTypeName(digest_type));
+            continue;
+        }
+
+        table->mask = (slot_count - 1);
+
+        for(u32 j = 0; j < g_datEntryCount; j++)
+        {
+            DatEntry *entry = &(g_datEntries[j]);
+            if (!(entry->digest_mask & BIT(digest_type))) continue;
+
+            u32 slot = (datGetDigestKey(digest_type, entry->crc32, entry->sha1, entry->sha256) & table->mask);
+            while(table->slots[slot]) slot = ((slot + 1) & table->mask);
+
+            table->slots[slot] = (j + 1);
+        }
+    }
+}
+
+static bool datEntryMatches(const DatEntry *entry, u64 size, const DigestResult *digest_result, u8 digest_mask)
+{
+    u8 common_mask = (entry->digest_mask & digest_mask);
+
+    if ((entry->size && entry->size != size) || !common_mask) return false;
+
+    if ((common_mask & DigestTypeMask_Crc32) && entry->crc32 != digest_result->crc32) return false;
+
+    if ((common_mask & DigestTypeMask_Sha1) && memcmp(entry->sha1, digest_result->sha1, sizeof(entry->sha1)) != 0) return false;
+
+    if ((common_mask & DigestTypeMask_Sha256) && memcmp(entry->sha256, digest_result->sha256, sizeof(entry->sha256)) != 0) return false;
+
+    return true;
+}
+
+static void datFreeEntries(void)
+{
+    for(u32 i = 0; i < DigestType_Count; i++)
+    {
+        if (g_datHashTables[i].slots) free(g_datHashTables[i].slots);
+    }
+
+    memset(g_datHashTables, 0, sizeof(g_datHashTables));
+
+    if (g_datEntries) free(g_datEntries);
+    g_datEntries = NULL;
+    g_datEntryCount = g_datEntryCapacity = 0;
+
+    if (g_datNameTable) free(g_datNameTable);
+    g_datNameTable = NULL;
+    g_datNameTableSize = g_datNameTableCapacity = 0;
+}
+
+NX_INLINE u32 datGetDigestKey(u8 digest_type, u32 crc32, const u8 *sha1, const u8 *sha256)
+{
+    u32 key = crc32;
+
+    if (digest_type == DigestType_Sha1)
+    {
+        memcpy(&key, sha1, sizeof(u32));
+    } else
+    if (digest_type == DigestType_Sha256)
+    {
+        memcpy(&key, sha256, sizeof(u32));
+    }
+
+    return key;
+}
@@ -0,0 +1,442 @@
+/*
+ * digest.c
+ *
+ * Copyright (c) 2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "nxdt_utils.h"
+#include "digest.h"
+
+/* Global variables. */
+
+static const char *g_digestTypeNames[DigestType_Count] = {
+    [DigestType_Crc32]  = "crc32",
+    [DigestType_Md5]    = "md5",
+    [DigestType_Sha1]   = "sha1",
+    [DigestType_Sha256] = "sha256"
+};
+
+static const u32 g_digestTypeSizes[DigestType_Count] = {
+    [DigestType_Crc32]  = sizeof(u32),
+    [DigestType_Md5]    = MD5_HASH_SIZE,
+    [DigestType_Sha1]   = SHA1_HASH_SIZE,
+    [DigestType_Sha256] = SHA256_HASH_SIZE
+};
+
+/// MD5 is the only digest without hardware acceleration, so it gets a core of its own by default. CRC32 shares a core with the gamecard stream thread.
+static const int g_digestEngineDefaultCpuIds[DigestType_Count] = {
+    [DigestType_Crc32]  = 1,
+    [DigestType_Md5]    = 0,
+    [DigestType_Sha1]   = 2,
+    [DigestType_Sha256] = 2
+};
+
+/* Function prototypes. */
+
+static void digestHasherCreateContext(DigestHasher *hasher);
+static void digestHasherUpdateContext(DigestHasher *hasher, const void *data, u64 data_size);
+static void digestHasherGetDigest(DigestHasher *hasher, DigestResult *out);
+static void digestHasherFreeContext(DigestHasher *hasher);
+static void digestHasherExportContext(DigestHasher *hasher, DigestEngineState *out);
+static void digestHasherImportContext(DigestHasher *hasher, const DigestEngineState *state);
+
+static void digestHasherThreadFunc(void *arg);
+
+bool digestEngineInitialize(DigestEngine *engine, u8 type_mask, const int *cpu_ids)
+{
+    if (!engine || !(type_mask & DigestTypeMask_All) || (type_mask & ~DigestTypeMask_All))
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    bool success = false;
+
+    if (!cpu_ids) cpu_ids = g_digestEngineDefaultCpuIds;
+
+    /* This also initializes the mutex and both condvars. */
+    memset(engine, 0, sizeof(DigestEngine));
+    engine->type_mask = type_mask;
+
+    for(u8 i = 0; i < DigestType_Count; i++)
+    {
+        if (!(type_mask & BIT(i))) continue;
+
+        DigestHasher *hasher = &(engine->hashers[i]);
+        hasher->engine = engine;
+        hasher->type = i;
+
+        digestHasherCreateContext(hasher);
+
+        hasher->thread_started = utilsCreateThread(&(hasher->thread), digestHasherThreadFunc, hasher, cpu_ids[i]);
+        if (!hasher->thread_started)
+        {
+            LOG_MSG_ERROR("Failed to create %s hasher thread!", g_digestTypeNames[i]);
+            goto end;
+        }
+    }
+
+    success = true;
+
+end:
+    if (!success) digestEngineFree(engine);
+
+    return success;
+}
+
+void digestEngineUpdate(DigestEngine *engine, const void *data, u64 data_size)
+{
+    if (!engine || !engine->type_mask || !data || !data_size) return;
+
+    mutexLock(&(engine->mutex));
+
+    /* Wait until the previous data block has been processed by all hashers. */
+    while(engine->pending) condvarWait(&(engine->done_cond), &(engine->mutex));
+
+    engine->data = data;
+    engine->data_size = data_size;
+    engine->block_seq++;
+    engine->total_size += data_size;
+
+    for(u8 i = 0; i < DigestType_Count; i++)
+    {
+        if (engine->hashers[i].thread_started) engine->pending++;
+    }
+
+    mutexUnlock(&(engine->mutex));
+    condvarWakeAll(&(engine->submit_cond));
+}
+
+void digestEngineWaitForIdle(DigestEngine *engine)
+{
+    if (!engine || !engine->type_mask) return;
+
+    mutexLock(&(engine->mutex));
+    while(engine->pending) condvarWait(&(engine->done_cond), &(engine->mutex));
+    mutexUnlock(&(engine->mutex));
+}
+
+bool digestEngineFinalize(DigestEngine *engine, DigestResult *out)
+{
+    if (!engine || !engine->type_mask || !out)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    digestEngineWaitForIdle(engine);
+
+    memset(out, 0, sizeof(DigestResult));
+
+    SCOPED_LOCK(&(engine->mutex))
+    {
+        for(u8 i = 0; i < DigestType_Count; i++)
+        {
+            DigestHasher *hasher = &(engine->hashers[i]);
+            if (!hasher->thread_started) continue;
+
+            digestHasherGetDigest(hasher, out);
+
+            /* Get the hasher ready for the next data stream. */
+            digestHasherFreeContext(hasher);
+            digestHasherCreateContext(hasher);
+        }
+
+        engine->total_size = 0;
+    }
+
+    return true;
+}
+
+bool digestEngineExportState(DigestEngine *engine, DigestEngineState *out)
+{
+    if (!engine || !engine->type_mask || !out)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    digestEngineWaitForIdle(engine);
+
+    memset(out, 0, sizeof(DigestEngineState));
+
+    SCOPED_LOCK(&(engine->mutex))
+    {
+        out->type_mask = engine->type_mask;
+        out->total_size = engine->total_size;
+
+        for(u8 i = 0; i < DigestType_Count; i++)
+        {
+            DigestHasher *hasher = &(engine->hashers[i]);
+            if (hasher->thread_started) digestHasherExportContext(hasher, out);
+        }
+    }
+
+    return true;
+}
+
+bool digestEngineImportState(DigestEngine *engine, const DigestEngineState *state)
+{
+    if (!engine || !engine->type_mask || !state || state->type_mask != engine->type_mask)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    digestEngineWaitForIdle(engine);
+
+    SCOPED_LOCK(&(engine->mutex))
+    {
+        for(u8 i = 0; i < DigestType_Count; i++)
+        {
+            DigestHasher *hasher = &(engine->hashers[i]);
+            if (!hasher->thread_started) continue;
+
+            digestHasherFreeContext(hasher);
+            digestHasherImportContext(hasher, state);
+        }
+
+        engine->total_size = state->total_size;
+    }
+
+    return true;
+}
+
+void digestEngineFree(DigestEngine *engine)
+{
+    if (!engine) return;
+
+    /* Make sure no data block is being processed before stopping the hasher threads. */
+    digestEngineWaitForIdle(engine);
+
+    mutexLock(&(engine->mutex));
+    engine->exit = true;
+    mutexUnlock(&(engine->mutex));
+    condvarWakeAll(&(engine->submit_cond));
+
+    for(u8 i = 0; i < DigestType_Count; i++)
+    {
+        DigestHasher *hasher = &(engine->hashers[i]);
+        if (!hasher->engine) continue;
+
+        if (hasher->thread_started) utilsJoinThread(&(hasher->thread));
+
+        digestHasherFreeContext(hasher);
+    }
+
+    memset(engine, 0, sizeof(DigestEngine));
+}
+
+const char *digestGetTypeName(u8 type)
+{
+    return (type < DigestType_Count ? g_digestTypeNames[type] : NULL);
+}
+
+u32 digestGetTypeSize(u8 type)
+{
+    return (type < DigestType_Count ? g_digestTypeSizes[type] : 0);
+}
+
+bool digestGenerateString(const DigestResult *result, u8 type, char *dst, size_t dst_size)
+{
+    if (!result || type >= DigestType_Count || !dst || dst_size < ((g_digestTypeSizes[type] * 2) + 1))
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    switch(type)
+    {
+        case DigestType_Crc32:
+            snprintf(dst, dst_size, "%08X", result->crc32);
+            break;
+        case DigestType_Md5:
+            utilsGenerateHexString(dst, dst_size, result->md5, sizeof(result->md5), true);
+            break;
+        case DigestType_Sha1:
+            utilsGenerateHexString(dst, dst_size, result->sha1, sizeof(result->sha1), true);
+            break;
+        case DigestType_Sha256:
+            utilsGenerateHexString(dst, dst_size, result->sha256, sizeof(result->sha256), true);
+            break;
+        default:
+            break;
+    }
+
+    return true;
+}
+
+static void digestHasherCreateContext(DigestHasher *hasher)
+{
+    switch(hasher->type)
+    {
+        case DigestType_Crc32:
+            hasher->crc32 = 0;
+            break;
+        case DigestType_Md5:
+            mbedtls_md5_init(&(hasher->md5_ctx));
+            mbedtls_md5_starts_ret(&(hasher->md5_ctx));
+            break;
+        case DigestType_Sha1:
+            sha1ContextCreate(&(hasher->sha1_ctx));
+            break;
+        case DigestType_Sha256:
+            sha256ContextCreate(&(hasher->sha256_ctx));
+            break;
+        default:
+            break;
+    }
+}
+
+static void digestHasherUpdateContext(DigestHasher *hasher, const void *data, u64 data_size)
+{
+    switch(hasher->type)
+    {
+        case DigestType_Crc32:
+            hasher->crc32 = crc32CalculateWithSeed(hasher->crc32, data, data_size);
+            break;
+        case DigestType_Md5:
+            mbedtls_md5_update_ret(&(hasher->md5_ctx), (const u8*)data, data_size);
+            break;
+        case DigestType_Sha1:
+            sha1ContextUpdate(&(hasher->sha1_ctx), data, data_size);
+            break;
+        case DigestType_Sha256:
+            sha256ContextUpdate(&(hasher->sha256_ctx), data, data_size);
+            break;
+        default:
+            break;
+    }
+}
+
+static void digestHasherGetDigest(DigestHasher *hasher, DigestResult *out)
+{
+    switch(hasher->type)
+    {
+        case DigestType_Crc32:
+            out->crc32 = hasher->crc32;
+            break;
+        case DigestType_Md5:
+            mbedtls_md5_finish_ret(&(hasher->md5_ctx), out->md5);
+            break;
+        case DigestType_Sha1:
+            sha1ContextGetHash(&(hasher->sha1_ctx), out->sha1);
+            break;
+        case DigestType_Sha256:
+            sha256ContextGetHash(&(hasher->sha256_ctx), out->sha256);
+            break;
+        default:
+            break;
+    }
+}
+
+static void digestHasherFreeContext(DigestHasher *hasher)
+{
+    if (hasher->type == DigestType_Md5) mbedtls_md5_free(&(hasher->md5_ctx));
+}
+
+static void digestHasherExportContext(DigestHasher *hasher, DigestEngineState *out)
+{
+    switch(hasher->type)
+    {
+        case DigestType_Crc32:
+            out->crc32 = hasher->crc32;
+            break;
+        case DigestType_Md5:
+            memcpy(&(out->md5_ctx), &(hasher->md5_ctx), sizeof(mbedtls_md5_context));
+            break;
+        case DigestType_Sha1:
+            memcpy(&(out->sha1_ctx), &(hasher->sha1_ctx), sizeof(Sha1Context));
+            break;
+        case DigestType_Sha256:
+            memcpy(&(out->sha256_ctx), &(hasher->sha256_ctx), sizeof(Sha256Context));
+            break;
+        default:
+            break;
+    }
+}
+
+static void digestHasherImportContext(DigestHasher *hasher, const DigestEngineState *state)
+{
+    switch(hasher->type)
+    {
+        case DigestType_Crc32:
+            hasher->crc32 = state->crc32;
+            break;
+        case DigestType_Md5:
+            memcpy(&(hasher->md5_ctx), &(state->md5_ctx), sizeof(mbedtls_md5_context));
+            break;
+        case DigestType_Sha1:
+            memcpy(&(hasher->sha1_ctx), &(state->sha1_ctx), sizeof(Sha1Context));
+            break;
+        case DigestType_Sha256:
+            memcpy(&(hasher->sha256_ctx), &(state->sha256_ctx), sizeof(Sha256Context));
+            break;
+        default:
+            break;
+    }
+}
+
+static void digestHasherThreadFunc(void *arg)
+{
+    DigestHasher *hasher = (DigestHasher*)arg;
+    DigestEngine *engine = hasher->engine;
+
+    const void *data = NULL;
+    u64 data_size = 0, start_tick = 0;
+
+    while(true)
+    {
+        /* Wait until a new data block has been submitted. */
+        mutexLock(&(engine->mutex));
+        while(hasher->processed_seq == engine->block_seq && !engine->exit) condvarWait(&(engine->submit_cond), &(engine->mutex));
+
+        if (hasher->processed_seq == engine->block_seq)
+        {
+            mutexUnlock(&(engine->mutex));
+            break;
+        }
+
+        data = engine->data;
+        data_size = engine->data_size;
+
+        mutexUnlock(&(engine->mutex));
+
+        start_tick = armGetSystemTick();
+        digestHasherUpdateContext(hasher, data, data_size);
+        hasher->busy_time += armTicksToNs(armGetSystemTick() - start_tick);
+
+        /* Let the submitter know we're done with this data block once all hashers have processed it. */
+        mutexLock(&(engine->mutex));
+
+        hasher->processed_seq++;
+
+        bool done = (--engine->pending == 0);
+        if (done)
+        {
+            engine->data = NULL;
+            engine->data_size = 0;
+        }
+
+        mutexUnlock(&(engine->mutex));
+
+        if (done) condvarWakeAll(&(engine->done_cond));
+    }
+
+    threadExit();
+}
@@ -0,0 +1,343 @@
+/*
+ * dump_pipeline.c
+ *
+ * Copyright (c) 2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "nxdt_utils.h"
+#include "dump_pipeline.h"
+
+#define DUMP_PIPELINE_BUFFER_ALIGNMENT  0x1000
+
+/* Global variables. */
+
+static const char *g_dumpPipelineStageTypeNames[DumpPipelineStageType_Count] = {
+    [DumpPipelineStageType_Read]     = "read",
+    [DumpPipelineStageType_Process]  = "process",
+    [DumpPipelineStageType_Hash]     = "hash",
+    [DumpPipelineStageType_Compress] = "compress",
+    [DumpPipelineStageType_Write]    = "write"
+};
+
+/* Function prototypes. */
+
+static void dumpPipelineStageThreadFunc(void *arg);
+
+static void dumpPipelineWakeAll(DumpPipeline *pipeline);
+
+NX_INLINE void dumpPipelineQueuePush(DumpPipelineQueue *queue, DumpPipelineBuffer *buf);
+NX_INLINE DumpPipelineBuffer *dumpPipelineQueuePop(DumpPipelineQueue *queue);
+
+bool dumpPipelineInitialize(DumpPipeline *pipeline, const DumpPipelineStage *stages, u32 stage_count, u64 total_size, u64 start_offset, u64 block_size, u64 buffer_capacity, \
+                            u32 buffer_count)
+{
+    if (!pipeline || !stages || stage_count < 2 || stage_count > DUMP_PIPELINE_MAX_STAGE_COUNT || start_offset > total_size || !block_size || \
+        (buffer_capacity && buffer_capacity < block_size) || !buffer_count || buffer_count > DUMP_PIPELINE_MAX_BUFFER_COUNT)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    /* Validate stages. */
+    for(u32 i = 0; i < stage_count; i++)
+    {
+        const DumpPipelineStage *stage = &(stages[i]);
+        u8 expected_type = (i == 0 ? DumpPipelineStageType_Read : (i == (stage_count - 1) ? DumpPipelineStageType_Write : DumpPipelineStageType_Count));
+
+        if (!stage->func || stage->type >= DumpPipelineStageType_Count || (expected_type != DumpPipelineStageType_Count && stage->type != expected_type) || \
+            (expected_type == DumpPipelineStageType_Count && (stage->type == DumpPipelineStageType_Read || stage->type == DumpPipelineStageType_Write)))
+        {
+            LOG_MSG_ERROR("Invalid stage #%u!", i);
+            return false;
+        }
+    }
+
+    bool success = false;
+
+    /* This also initializes the mutex and all condvars. */
+    memset(pipeline, 0, sizeof(DumpPipeline));
+
+    memcpy(pipeline->stages, stages, stage_count * sizeof(DumpPipelineStage));
+    pipeline->stage_count = stage_count;
+
+    for(u32 i = 0; i < stage_count; i++)
+    {
+        pipeline->stage_ctx[i].pipeline = pipeline;
+        pipeline->stage_ctx[i].idx = i;
+    }
+
+    pipeline->block_size = block_size;
+    pipeline->start_offset = pipeline->processed_size = start_offset;
+    pipeline->total_size = total_size;
+    pipeline->block_count = ((total_size - start_offset) + (block_size - 1)) / block_size;
+
+    /* Allocate buffers and place them into the free buffer pool. */
+    if (!buffer_capacity) buffer_capacity = block_size;
+
+    for(u32 i = 0; i < buffer_count; i++)
+    {
+        DumpPipelineBuffer *buf = &(pipeline->buffers[i]);
+
+        buf->data = memalign(DUMP_PIPELINE_BUFFER_ALIGNMENT, buffer_capacity);
+        if (!buf->data)
+        {
+            LOG_MSG_ERROR("Failed to allocate 0x%lX bytes long buffer #%u!", buffer_capacity, i);
+            goto end;
+        }
+
+        buf->capacity = buffer_capacity;
+        pipeline->buffer_count++;
+
+        dumpPipelineQueuePush(&(pipeline->queues[0]), buf);
+    }
+
+    success = true;
+
+end:
+    if (!success) dumpPipelineFree(pipeline);
+
+    return success;
+}
+
+bool dumpPipelineStart(DumpPipeline *pipeline)
+{
+    if (!pipeline || !pipeline->buffer_count || pipeline->started)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    pipeline->started = true;
+
+    /* Nothing left to do if we're resuming from the end of the input stream. */
+    if (!pipeline->block_count)
+    {
+        pipeline->finished = true;
+        return true;
+    }
+
+    for(u32 i = 0; i < pipeline->stage_count; i++)
+    {
+        DumpPipelineStageContext *stage_ctx = &(pipeline->stage_ctx[i]);
+
+        stage_ctx->thread_started = utilsCreateThread(&(stage_ctx->thread), dumpPipelineStageThreadFunc, stage_ctx, pipeline->stages[i].cpu_id);
+        if (!stage_ctx->thread_started)
+        {
+            LOG_MSG_ERROR("Failed to create thread for stage #%u!", i);
+            dumpPipelineCancel(pipeline);
+            dumpPipelineWait(pipeline);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool dumpPipelineIsRunning(DumpPipeline *pipeline)
+{
+    bool ret = false;
+
+    SCOPED_LOCK(&(pipeline->mutex)) ret = (pipeline->started && !pipeline->finished && !pipeline->error && !pipeline->cancelled);
+
+    return ret;
+}
+
+u64 dumpPipelineGetProcessedSize(DumpPipeline *pipeline)
+{
+    u64 ret = 0;
+
+    SCOPED_LOCK(&(pipeline->mutex)) ret = pipeline->processed_size;
+
+    return ret;
+}
+
+bool dumpPipelineHasFailed(DumpPipeline *pipeline)
+{
+    bool ret = false;
+
+    SCOPED_LOCK(&(pipeline->mutex)) ret = pipeline->error;
+
+    return ret;
+}
+
+void dumpPipelineCancel(DumpPipeline *pipeline)
+{
+    SCOPED_LOCK(&(pipeline->mutex))
+    {
+        pipeline->cancelled = true;
+        dumpPipelineWakeAll(pipeline);
+    }
+}
+
+bool dumpPipelineWait(DumpPipeline *pipeline)
+{
+    if (!pipeline) return false;
+
+    for(u32 i = 0; i < pipeline->stage_count; i++)
+    {
+        DumpPipelineStageContext *stage_ctx = &(pipeline->stage_ctx[i]);
+        if (!stage_ctx->thread_started) continue;
+
+        utilsJoinThread(&(stage_ctx->thread));
+        stage_ctx->thread_started = false;
+    }
+
+    /* A cancellation request that comes in after the last block has been written doesn't invalidate the output. */
+    return (pipeline->finished && !pipeline->error);
+}
+
+void dumpPipelineFree(DumpPipeline *pipeline)
+{
+    if (!pipeline) return;
+
+    if (pipeline->started && !pipeline->finished) dumpPipelineCancel(pipeline);
+    dumpPipelineWait(pipeline);
+
+    for(u32 i = 0; i < pipeline->buffer_count; i++)
+    {
+        if (pipeline->buffers[i].data) free(pipeline->buffers[i].data);
+    }
+
+    memset(pipeline, 0, sizeof(DumpPipeline));
+}
+
+void dumpPipelineLogStats(DumpPipeline *pipeline)
+{
+    if (!pipeline) return;
+
+    for(u32 i = 0; i < pipeline->stage_count; i++)
+    {
+        DumpPipelineStage *stage = &(pipeline->stages[i]);
+        DumpPipelineStageStats *stats = &(pipeline->stage_ctx[i].stats);
+
+        LOG_MSG_INFO("Stage #%u (%s, \"%s\"): %lu block(s), %lu ms busy, %lu ms waiting.", i, g_dumpPipelineStageTypeNames[stage->type], stage->name ? stage->name : "unnamed", \
+                     stats->block_count, stats->busy_time / 1000000, stats->wait_time / 1000000);
+    }
+
+    if (pipeline->error) LOG_MSG_INFO("Pipeline aborted by stage #%u.", pipeline->error_stage);
+}
+
+static void dumpPipelineStageThreadFunc(void *arg)
+{
+    DumpPipelineStageContext *stage_ctx = (DumpPipelineStageContext*)arg;
+    DumpPipeline *pipeline = stage_ctx->pipeline;
+    u32 idx = stage_ctx->idx;
+
+    DumpPipelineStage *stage = &(pipeline->stages[idx]);
+    DumpPipelineQueue *in_queue = &(pipeline->queues[idx]);
+    DumpPipelineQueue *out_queue = &(pipeline->queues[(idx + 1) % pipeline->stage_count]);
+
+    bool is_read_stage = (idx == 0), is_write_stage = (idx == (pipeline->stage_count - 1));
+
+    /* Every stage handles each data block exactly once, in input stream order. */
+    for(u64 i = 0; i < pipeline->block_count; i++)
+    {
+        DumpPipelineBuffer *buf = NULL;
+        u64 tick = 0;
+        bool success = false;
+
+        /* Wait until a buffer is available. */
+        mutexLock(&(pipeline->mutex));
+
+        tick = armGetSystemTick();
+        while(!in_queue->count && !pipeline->error && !pipeline->cancelled) condvarWait(&(in_queue->cond), &(pipeline->mutex));
+        stage_ctx->stats.wait_time += armTicksToNs(armGetSystemTick() - tick);
+
+        if (pipeline->error || pipeline->cancelled)
+        {
+            mutexUnlock(&(pipeline->mutex));
+            break;
+        }
+
+        buf = dumpPipelineQueuePop(in_queue);
+
+        mutexUnlock(&(pipeline->mutex));
+
+        if (is_read_stage)
+        {
+            buf->index = i;
+            buf->offset = (pipeline->start_offset + (i * pipeline->block_size));
+            buf->input_size = buf->data_size = MIN(pipeline->block_size, pipeline->total_size - buf->offset);
+        }
+
+        /* Process data block. Other stages keep working on other buffers in the meantime. */
+        tick = armGetSystemTick();
+        success = stage->func(buf, stage->userdata);
+        stage_ctx->stats.busy_time += armTicksToNs(armGetSystemTick() - tick);
+
+        if (success && buf->data_size > buf->capacity)
+        {
+            LOG_MSG_ERROR("Stage #%u overflowed buffer #%lu! (0x%lX > 0x%lX).", idx, buf->index, buf->data_size, buf->capacity);
+            success = false;
+        }
+
+        mutexLock(&(pipeline->mutex));
+
+        if (!success)
+        {
+            LOG_MSG_ERROR("Stage #%u (\"%s\") failed to process block #%lu (offset 0x%lX)!", idx, stage->name ? stage->name : "unnamed", buf->index, buf->offset);
+
+            /* Make the rest of the stages bail out. */
+            if (!pipeline->error)
+            {
+                pipeline->error = true;
+                pipeline->error_stage = idx;
+            }
+
+            dumpPipelineWakeAll(pipeline);
+            mutexUnlock(&(pipeline->mutex));
+            break;
+        }
+
+        stage_ctx->stats.block_count++;
+
+        if (is_write_stage)
+        {
+            pipeline->processed_size = (buf->offset + buf->input_size);
+            pipeline->finished = ((i + 1) == pipeline->block_count);
+        }
+
+        /* Hand the buffer over to the next stage. The write stage gives it back to the free buffer pool. */
+        dumpPipelineQueuePush(out_queue, buf);
+
+        mutexUnlock(&(pipeline->mutex));
+        condvarWakeAll(&(out_queue->cond));
+    }
+
+    threadExit();
+}
+
+static void dumpPipelineWakeAll(DumpPipeline *pipeline)
+{
+    for(u32 i = 0; i < pipeline->stage_count; i++) condvarWakeAll(&(pipeline->queues[i].cond));
+}
+
+NX_INLINE void dumpPipelineQueuePush(DumpPipelineQueue *queue, DumpPipelineBuffer *buf)
+{
+    /* Queues can hold every pipeline buffer at once, so this can never overflow. */
+    queue->entries[(queue->head + queue->count) % DUMP_PIPELINE_MAX_BUFFER_COUNT] = buf;
+    queue->count++;
+}
+
+NX_INLINE DumpPipelineBuffer *dumpPipelineQueuePop(DumpPipelineQueue *queue)
+{
+    DumpPipelineBuffer *buf = queue->entries[queue->head];
+    queue->head = ((queue->head + 1) % DUMP_PIPELINE_MAX_BUFFER_COUNT);
+    queue->count--;
+    return buf;
+}
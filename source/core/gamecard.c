@@ -37,6 +37,13 @@
 
 #define LAFW_MAGIC                              0x4C414657              /* "LAFW". */
 
+#define GAMECARD_STREAM_BUFFER_ALIGNMENT        0x1000                  /* Page-aligned buffers can be directly used in USB transfers. */
+
+#define GAMECARD_HFS_CACHE_PATH                 DEVOPTAB_SDMC_DEVICE APP_BASE_PATH "Cache/Gamecard/"
+#define GAMECARD_HFS_CACHE_MAGIC                0x47434843              /* "GCHC". */
+#define GAMECARD_HFS_CACHE_VERSION              1
+#define GAMECARD_HFS_CACHE_MAX_SIZE             0x100000                /* 1 MiB. Real caches are just a few KiB long. */
+
 /* Type definitions. */
 
 typedef enum {
@@ -54,6 +61,25 @@ typedef enum {
     GameCardCapacity_32GiB = BITL(35)
 } GameCardCapacity;
 
+/// Persistent Hash FS layout cache. Stored on the SD card, one file per gamecard package ID.
+/// Followed by 'entry_count' GameCardHfsCacheEntry elements, each one followed by its full Hash FS header.
+typedef struct {
+    u32 magic;                              ///< "GCHC".
+    u32 version;                            ///< GAMECARD_HFS_CACHE_VERSION.
+    u8 header_hash[SHA256_HASH_SIZE];       ///< SHA-256 checksum calculated over the full GameCardHeader. Used to validate the cache on insertion.
+    u32 entry_count;
+    u8 reserved[0x4];
+} GameCardHfsCacheHeader;
+
+NXDT_ASSERT(GameCardHfsCacheHeader, 0x30);
+
+typedef struct {
+    u64 offset;                             ///< Hash FS partition offset (relative to the start of gamecard image).
+    u64 header_size;                        ///< Full Hash FS header size.
+} GameCardHfsCacheEntry;
+
+NXDT_ASSERT(GameCardHfsCacheEntry, 0x10);
+
 /* Global variables. */
 
 static Mutex g_gameCardMutex = 0;
@@ -86,12 +112,8 @@ static u64 g_gameCardCapacity = 0;
 static u32 g_gameCardHfsCount = 0;
 static HashFileSystemContext **g_gameCardHfsCtx = NULL;
 
-static MemoryLocation g_fsProgramMemory = {
-    .program_id = FS_SYSMODULE_TID,
-    .mask = 0,
-    .data = NULL,
-    .data_size = 0
-};
+static u8 *g_gameCardHfsCache = NULL;
+static u64 g_gameCardHfsCacheSize = 0;
 
 static const char *g_gameCardHosVersionStrings[GameCardFwVersion_Count] = {
     [GameCardFwVersion_ForDev]       = "1.0.0",
@@ -117,6 +139,7 @@ static const char *g_lafwDeviceTypeStrings[LotusAsicDeviceType_Count] = {
 /* Function prototypes. */
 
 static bool gamecardReadLotusAsicFirmwareBlob(void);
+static bool gamecardValidateLotusAsicFirmwareBlob(const void *record, u64 record_size, void *userdata);
 
 static bool gamecardCreateDetectionThread(void);
 static void gamecardDestroyDetectionThread(void);
@@ -132,6 +155,7 @@ static bool gamecardReadHeader(void);
 static bool _gamecardGetDecryptedCardInfoArea(void);
 
 static bool gamecardReadSecurityInformation(GameCardSecurityInformation *out);
+static bool gamecardValidateSecurityInformation(const void *record, u64 record_size, void *userdata);
 
 static bool gamecardGetHandleAndStorage(u32 partition);
 NX_INLINE void gamecardCloseHandle(void);
@@ -141,9 +165,19 @@ static bool gamecardReadStorageArea(void *out, u64 read_size, u64 offset);
 static void gamecardCloseStorageArea(void);
 
 static bool gamecardGetStorageAreasSizes(void);
+
+static void gamecardStreamThreadFunc(void *arg);
 NX_INLINE u64 gamecardGetCapacityFromRomSizeValue(u8 rom_size);
 
+static bool gamecardInitializeHashFileSystemContexts(void);
+static void gamecardFreeHashFileSystemContexts(void);
 static HashFileSystemContext *gamecardInitializeHashFileSystemContext(const char *name, u64 offset, u64 size, u8 *hash, u64 hash_target_offset, u32 hash_target_size);
+
+static void gamecardGenerateHashFileSystemCachePath(char *out, size_t out_size);
+static void gamecardLoadHashFileSystemCache(void);
+static void gamecardSaveHashFileSystemCache(void);
+static const u8 *gamecardGetCachedHashFileSystemHeader(u64 offset, u64 *out_header_size);
+static void gamecardFreeHashFileSystemCache(void);
 static HashFileSystemContext *_gamecardGetHashFileSystemContext(u8 hfs_partition_type);
 
 bool gamecardInitialize(void)
@@ -341,6 +375,115 @@ bool gamecardReadStorage(void *out, u64 read_size, u64 offset)
     return ret;
 }
 
+bool gamecardStreamInitialize(GameCardStreamContext *out, u64 offset, u64 size, u64 block_size, u32 buffer_count)
+{
+    if (!out || !size || !block_size || !IS_ALIGNED(block_size, GAMECARD_PAGE_SIZE) || buffer_count < 2 || buffer_count > GAMECARD_STREAM_MAX_BUFFER_COUNT)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    bool success = false;
+
+    memset(out, 0, sizeof(GameCardStreamContext));
+
+    out->offset = offset;
+    out->end_offset = (offset + size);
+    out->block_size = block_size;
+    out->buffer_count = buffer_count;
+
+    /* Allocate block buffers. */
+    for(u32 i = 0; i < buffer_count; i++)
+    {
+        if (!(out->buffers[i] = memalign(GAMECARD_STREAM_BUFFER_ALIGNMENT, block_size)))
+        {
+            LOG_MSG_ERROR("Failed to allocate memory for gamecard stream block buffer #%u!", i);
+            goto end;
+        }
+    }
+
+    /* Create stream thread. */
+    if (!(out->thread_started = utilsCreateThread(&(out->thread), gamecardStreamThreadFunc, out, 1)))
+    {
+        LOG_MSG_ERROR("Failed to create gamecard stream thread!");
+        goto end;
+    }
+
+    success = true;
+
+end:
+    if (!success) gamecardStreamFree(out);
+
+    return success;
+}
+
+bool gamecardStreamGetNextBlock(GameCardStreamContext *ctx, void **out_buf, u64 *out_size)
+{
+    if (!ctx || !ctx->thread_started || !out_buf || !out_size)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    bool ret = false;
+
+    SCOPED_LOCK(&(ctx->mutex))
+    {
+        /* Wait until the stream thread is done reading the next block. */
+        while(!ctx->ready_count && !ctx->read_error && !ctx->finished) condvarWait(&(ctx->ready_condvar), &(ctx->mutex));
+
+        /* Blocks that have already been read are returned even if a read error occurred afterwards. */
+        if (!ctx->ready_count) break;
+
+        *out_buf = ctx->buffers[ctx->consume_idx];
+        *out_size = ctx->buffer_data_sizes[ctx->consume_idx];
+
+        ctx->consume_idx = ((ctx->consume_idx + 1) % ctx->buffer_count);
+        ctx->ready_count--;
+        ctx->acquired_count++;
+
+        ret = true;
+    }
+
+    return ret;
+}
+
+void gamecardStreamReleaseBlock(GameCardStreamContext *ctx)
+{
+    if (!ctx || !ctx->thread_started) return;
+
+    SCOPED_LOCK(&(ctx->mutex))
+    {
+        if (!ctx->acquired_count) break;
+
+        ctx->buffer_data_sizes[ctx->release_idx] = 0;
+        ctx->release_idx = ((ctx->release_idx + 1) % ctx->buffer_count);
+        ctx->acquired_count--;
+    }
+
+    condvarWakeAll(&(ctx->free_condvar));
+}
+
+void gamecardStreamFree(GameCardStreamContext *ctx)
+{
+    if (!ctx) return;
+
+    if (ctx->thread_started)
+    {
+        /* Stop the stream thread. */
+        SCOPED_LOCK(&(ctx->mutex)) ctx->cancelled = true;
+        condvarWakeAll(&(ctx->free_condvar));
+        utilsJoinThread(&(ctx->thread));
+    }
+
+    for(u32 i = 0; i < ctx->buffer_count; i++)
+    {
+        if (ctx->buffers[i]) free(ctx->buffers[i]);
+    }
+
+    memset(ctx, 0, sizeof(GameCardStreamContext));
+}
+
 bool gamecardGetHeader(GameCardHeader *out)
 {
     bool ret = false;
@@ -569,7 +712,17 @@ const char *gamecardGetLafwDeviceTypeString(u64 device_type)
 static bool gamecardReadLotusAsicFirmwareBlob(void)
 {
     u64 fw_version = 0;
-    bool ret = false, found = false, dev_unit = utilsIsDevelopmentUnit();
+    bool ret = false, dev_unit = utilsIsDevelopmentUnit();
+    u32 lafw_magic = __builtin_bswap32(LAFW_MAGIC);
+
+    MemoryScanPattern lafw_pattern = {
+        .pattern = &lafw_magic,
+        .pattern_size = sizeof(lafw_magic),
+        .pattern_offset = offsetof(LotusAsicFirmwareBlob, magic),
+        .record_size = sizeof(LotusAsicFirmwareBlob),
+        .validate = gamecardValidateLotusAsicFirmwareBlob,
+        .userdata = NULL
+    };
 
     /* Allocate memory for the LAFW blob. */
     g_lafwBlob = calloc(1, sizeof(LotusAsicFirmwareBlob));
@@ -579,41 +732,24 @@ static bool gamecardReadLotusAsicFirmwareBlob(void)
         goto end;
     }
 
-    /* Temporarily set the segment mask to .data. */
-    g_fsProgramMemory.mask = MemoryProgramSegmentType_Data;
+    lafw_pattern.userdata = g_lafwBlob;
 
-    /* Retrieve FS .data segment memory dump. */
-    if (!memRetrieveProgramMemorySegment(&g_fsProgramMemory))
+    /* Look for the LAFW ReadFw blob in the FS .data segment. */
+    /* The segment is streamed through a small window instead of being fully dumped. */
+    if (!memScanProgramMemory(FS_SYSMODULE_TID, MemoryProgramSegmentType_Data, &lafw_pattern, 1))
     {
-        LOG_MSG_ERROR("Failed to retrieve FS .data segment dump!");
+        LOG_MSG_ERROR("Failed to scan FS .data segment!");
         goto end;
     }
 
-    /* Look for the LAFW ReadFw blob in the FS .data segment memory dump. */
-    for(u64 offset = 0; offset < g_fsProgramMemory.data_size; offset++)
-    {
-        if ((g_fsProgramMemory.data_size - offset) < sizeof(LotusAsicFirmwareBlob)) break;
-
-        LotusAsicFirmwareBlob *lafw_blob = (LotusAsicFirmwareBlob*)(g_fsProgramMemory.data + offset);
-        u32 magic = __builtin_bswap32(lafw_blob->magic), fw_type = lafw_blob->fw_type;
-
-        if (magic == LAFW_MAGIC && ((!dev_unit && fw_type == LotusAsicFirmwareType_ReadFw) || (dev_unit && fw_type == LotusAsicFirmwareType_ReadDevFw)))
-        {
-            /* Jackpot. */
-            memcpy(g_lafwBlob, lafw_blob, sizeof(LotusAsicFirmwareBlob));
-            fw_version = lafw_blob->fw_version;
-            found = true;
-            break;
-        }
-    }
-
-    if (!found)
+    if (!lafw_pattern.found)
     {
         LOG_MSG_ERROR("Unable to locate Lotus %s blob in FS .data segment!", dev_unit ? "ReadDevFw" : "ReadFw");
         goto end;
     }
 
     /* Convert LAFW version bitmask to an integer. */
+    fw_version = g_lafwBlob->fw_version;
     g_lafwVersion = 0;
 
     while(fw_version)
@@ -628,11 +764,24 @@ static bool gamecardReadLotusAsicFirmwareBlob(void)
     ret = true;
 
 end:
-    memFreeMemoryLocation(&g_fsProgramMemory);
+    return ret;
+}
 
-    g_fsProgramMemory.mask = MemoryProgramSegmentType_None;
+static bool gamecardValidateLotusAsicFirmwareBlob(const void *record, u64 record_size, void *userdata)
+{
+    (void)record_size;
 
-    return ret;
+    /* Don't log anything here -- FS is being debugged. */
+    const LotusAsicFirmwareBlob *lafw_blob = (const LotusAsicFirmwareBlob*)record;
+    bool dev_unit = utilsIsDevelopmentUnit();
+    u32 fw_type = lafw_blob->fw_type;
+
+    if ((!dev_unit && fw_type != LotusAsicFirmwareType_ReadFw) || (dev_unit && fw_type != LotusAsicFirmwareType_ReadDevFw)) return false;
+
+    /* Jackpot. */
+    memcpy(userdata, lafw_blob, sizeof(LotusAsicFirmwareBlob));
+
+    return true;
 }
 
 static bool gamecardCreateDetectionThread(void)
@@ -721,10 +870,6 @@ static void gamecardLoadInfo(void)
 {
     if (g_gameCardStatus == GameCardStatus_InsertedAndInfoLoaded) return;
 
-    HashFileSystemContext *root_hfs_ctx = NULL;
-    u32 root_hfs_entry_count = 0, root_hfs_name_table_size = 0;
-    char *root_hfs_name_table = NULL;
-
     /* Set initial gamecard status. */
     g_gameCardStatus = GameCardStatus_InsertedAndInfoNotLoaded;
 
@@ -767,60 +912,33 @@ static void gamecardLoadInfo(void)
         g_gameCardSecureAreaSize = (g_gameCardCapacity - (g_gameCardNormalAreaSize + GAMECARD_UNUSED_AREA_SIZE(g_gameCardCapacity)));
     }
 
-    /* Initialize Hash FS context for the root partition. */
-    root_hfs_ctx = gamecardInitializeHashFileSystemContext(NULL, g_gameCardHeader.partition_fs_header_address, 0, g_gameCardHeader.partition_fs_header_hash, 0, g_gameCardHeader.partition_fs_header_size);
-    if (!root_hfs_ctx) goto end;
+    /* Load cached Hash FS headers for this gamecard, if available. */
+    gamecardLoadHashFileSystemCache();
 
-    /* Calculate total Hash FS partition count. */
-    root_hfs_entry_count = hfsGetEntryCount(root_hfs_ctx);
-    g_gameCardHfsCount = (root_hfs_entry_count + 1);
-
-    /* Allocate Hash FS context pointer array. */
-    g_gameCardHfsCtx = calloc(g_gameCardHfsCount, sizeof(HashFileSystemContext*));
-    if (!g_gameCardHfsCtx)
+    /* Initialize Hash FS contexts for all partitions. */
+    if (!gamecardInitializeHashFileSystemContexts())
     {
-        LOG_MSG_ERROR("Unable to allocate Hash FS context pointer array! (%u).", g_gameCardHfsCount);
-        goto end;
-    }
+        /* Don't trust the cached data if anything went wrong. Let's try again reading everything straight from the gamecard. */
+        if (!g_gameCardHfsCache) goto end;
 
-    /* Set root partition context as the first pointer. */
-    g_gameCardHfsCtx[0] = root_hfs_ctx;
+        LOG_MSG_WARNING("Failed to initialize Hash FS contexts using cached data! Retrying without cache.");
 
-    /* Get root partition name table. */
-    root_hfs_name_table_size = ((HashFileSystemHeader*)root_hfs_ctx->header)->name_table_size;
-    root_hfs_name_table = hfsGetNameTable(root_hfs_ctx);
+        gamecardFreeHashFileSystemContexts();
+        gamecardFreeHashFileSystemCache();
 
-    /* Initialize Hash FS contexts for the child partitions. */
-    for(u32 i = 0; i < root_hfs_entry_count; i++)
-    {
-        HashFileSystemEntry *hfs_entry = hfsGetEntryByIndex(root_hfs_ctx, i);
-        char *hfs_entry_name = (root_hfs_name_table + hfs_entry->name_offset);
-        u64 hfs_entry_offset = (root_hfs_ctx->offset + root_hfs_ctx->header_size + hfs_entry->offset);
-
-        if (hfs_entry->name_offset >= root_hfs_name_table_size || !*hfs_entry_name)
-        {
-            LOG_MSG_ERROR("Invalid name for root Hash FS partition entry #%u!", i);
-            goto end;
-        }
-
-        g_gameCardHfsCtx[i + 1] = gamecardInitializeHashFileSystemContext(hfs_entry_name, hfs_entry_offset, hfs_entry->size, hfs_entry->hash, hfs_entry->hash_target_offset, hfs_entry->hash_target_size);
-        if (!g_gameCardHfsCtx[i + 1]) goto end;
+        if (!gamecardInitializeHashFileSystemContexts()) goto end;
     }
 
+    /* Save Hash FS headers to our cache if we had to read them from the gamecard. */
+    if (!g_gameCardHfsCache) gamecardSaveHashFileSystemCache();
+
     /* Update gamecard status. */
     g_gameCardStatus = GameCardStatus_InsertedAndInfoLoaded;
 
 end:
-    if (g_gameCardStatus != GameCardStatus_InsertedAndInfoLoaded)
-    {
-        if (!g_gameCardHfsCtx && root_hfs_ctx)
-        {
-            hfsFreeContext(root_hfs_ctx);
-            free(root_hfs_ctx);
-        }
+    gamecardFreeHashFileSystemCache();
 
-        gamecardFreeInfo(false);
-    }
+    if (g_gameCardStatus != GameCardStatus_InsertedAndInfoLoaded) gamecardFreeInfo(false);
 }
 
 static void gamecardFreeInfo(bool clear_status)
@@ -833,23 +951,7 @@ static void gamecardFreeInfo(bool clear_status)
 
     g_gameCardCapacity = 0;
 
-    if (g_gameCardHfsCtx)
-    {
-        for(u32 i = 0; i < g_gameCardHfsCount; i++)
-        {
-            HashFileSystemContext *cur_hfs_ctx = g_gameCardHfsCtx[i];
-            if (cur_hfs_ctx)
-            {
-                hfsFreeContext(cur_hfs_ctx);
-                free(cur_hfs_ctx);
-            }
-        }
-
-        free(g_gameCardHfsCtx);
-        g_gameCardHfsCtx = NULL;
-    }
-
-    g_gameCardHfsCount = 0;
+    gamecardFreeHashFileSystemContexts();
 
     gamecardCloseStorageArea();
 
@@ -932,43 +1034,48 @@ static bool gamecardReadSecurityInformation(GameCardSecurityInformation *out)
         return false;
     }
 
-    bool found = false;
-    u8 tmp_hash[SHA256_HASH_SIZE] = {0};
+    /* The initial data block is stored at the end of the security information area. We'll look for it using the package ID from the gamecard header. */
+    MemoryScanPattern sec_info_pattern = {
+        .pattern = &(g_gameCardHeader.package_id),
+        .pattern_size = sizeof(g_gameCardHeader.package_id),
+        .pattern_offset = (sizeof(GameCardSecurityInformation) - sizeof(GameCardInitialData)),
+        .record_size = sizeof(GameCardSecurityInformation),
+        .validate = gamecardValidateSecurityInformation,
+        .userdata = out
+    };
 
-    /* Retrieve full FS program memory dump. */
-    if (!memRetrieveFullProgramMemory(&g_fsProgramMemory))
+    /* Scan full FS program memory. */
+    if (!memScanProgramMemory(FS_SYSMODULE_TID, MemoryProgramSegmentType_None, &sec_info_pattern, 1))
     {
-        LOG_MSG_ERROR("Failed to retrieve full FS program memory dump!");
+        LOG_MSG_ERROR("Failed to scan FS program memory!");
         return false;
     }
 
-    /* Look for the initial data block in the FS memory dump using the package ID and the initial data hash from the gamecard header. */
-    for(u64 offset = 0; offset < g_fsProgramMemory.data_size; offset++)
-    {
-        if ((g_fsProgramMemory.data_size - offset) < sizeof(GameCardInitialData)) break;
+    if (!sec_info_pattern.found) return false;
 
-        if (memcmp(g_fsProgramMemory.data + offset, &(g_gameCardHeader.package_id), sizeof(g_gameCardHeader.package_id)) != 0) continue;
+    /* Clear out the current ASIC session hash. */
+    /* It's not actually part of the gamecard data, and this changes every time a gamecard (re)insertion takes place. */
+    memset(out->specific_data.asic_session_hash, 0xFF, sizeof(out->specific_data.asic_session_hash));
 
-        sha256CalculateHash(tmp_hash, g_fsProgramMemory.data + offset, sizeof(GameCardInitialData));
+    return true;
+}
 
-        if (!memcmp(tmp_hash, g_gameCardHeader.initial_data_hash, SHA256_HASH_SIZE))
-        {
-            /* Jackpot. */
-            memcpy(out, g_fsProgramMemory.data + offset + sizeof(GameCardInitialData) - sizeof(GameCardSecurityInformation), sizeof(GameCardSecurityInformation));
+static bool gamecardValidateSecurityInformation(const void *record, u64 record_size, void *userdata)
+{
+    (void)record_size;
 
-            /* Clear out the current ASIC session hash. */
-            /* It's not actually part of the gamecard data, and this changes every time a gamecard (re)insertion takes place. */
-            memset(out->specific_data.asic_session_hash, 0xFF, sizeof(out->specific_data.asic_session_hash));
+    /* Don't log anything here -- FS is being debugged. */
+    const GameCardSecurityInformation *sec_info = (const GameCardSecurityInformation*)record;
+    u8 tmp_hash[SHA256_HASH_SIZE] = {0};
 
-            found = true;
-            break;
-        }
-    }
+    /* Validate the initial data block using the initial data hash from the gamecard header. */
+    sha256CalculateHash(tmp_hash, &(sec_info->initial_data), sizeof(GameCardInitialData));
+    if (memcmp(tmp_hash, g_gameCardHeader.initial_data_hash, SHA256_HASH_SIZE) != 0) return false;
 
-    /* Free FS memory dump. */
-    memFreeMemoryLocation(&g_fsProgramMemory);
+    /* Jackpot. */
+    memcpy(userdata, sec_info, sizeof(GameCardSecurityInformation));
 
-    return found;
+    return true;
 }
 
 static bool gamecardGetHandleAndStorage(u32 partition)
@@ -1060,71 +1167,112 @@ static bool gamecardReadStorageArea(void *out, u64 read_size, u64 offset)
 
     Result rc = 0;
     u8 *out_u8 = (u8*)out;
-    u8 area = (offset < g_gameCardNormalAreaSize ? GameCardStorageArea_Normal : GameCardStorageArea_Secure);
-    bool success = false;
+    u8 area = GameCardStorageArea_None;
+    u64 area_read_size = 0, base_offset = 0, chunk_size = 0;
+    u64 block_start_offset = 0, block_size = 0, data_start_offset = 0;
 
-    /* Handle reads that span both the normal and secure gamecard storage areas. */
-    if (area == GameCardStorageArea_Normal && (offset + read_size) > g_gameCardNormalAreaSize)
+    /* Process the read request in chunks. Reads that span both the normal and secure gamecard storage areas are split at the area boundary. */
+    while(read_size)
     {
-        /* Calculate normal storage area size difference. */
-        u64 diff_size = (g_gameCardNormalAreaSize - offset);
+        area = (offset < g_gameCardNormalAreaSize ? GameCardStorageArea_Normal : GameCardStorageArea_Secure);
+        area_read_size = (area == GameCardStorageArea_Normal ? MIN(read_size, g_gameCardNormalAreaSize - offset) : read_size);
 
-        /* Read normal storage area data. */
-        if (!gamecardReadStorageArea(out_u8, diff_size, offset)) goto end;
+        /* Open a storage area if needed. */
+        /* If the right storage area has already been opened, this will return true. */
+        if (!gamecardOpenStorageArea(area))
+        {
+            LOG_MSG_ERROR("Failed to open %s storage area!", GAMECARD_STORAGE_AREA_NAME(area));
+            return false;
+        }
 
-        /* Adjust variables to read right from the start of the secure storage area. */
-        read_size -= diff_size;
-        offset = g_gameCardNormalAreaSize;
-        out_u8 += diff_size;
-        area = GameCardStorageArea_Secure;
-    }
+        /* Calculate proper storage area offset. */
+        base_offset = (area == GameCardStorageArea_Normal ? offset : (offset - g_gameCardNormalAreaSize));
 
-    /* Open a storage area if needed. */
-    /* If the right storage area has already been opened, this will return true. */
-    if (!gamecardOpenStorageArea(area))
-    {
-        LOG_MSG_ERROR("Failed to open %s storage area!", GAMECARD_STORAGE_AREA_NAME(area));
-        goto end;
+        if (IS_ALIGNED(base_offset, GAMECARD_PAGE_SIZE) && area_read_size >= GAMECARD_PAGE_SIZE)
+        {
+            /* Read as many full pages as possible straight into the output buffer. */
+            chunk_size = ALIGN_DOWN(area_read_size, GAMECARD_PAGE_SIZE);
+
+            rc = fsStorageRead(&g_gameCardStorage, base_offset, out_u8, chunk_size);
+            if (R_FAILED(rc))
+            {
+                LOG_MSG_ERROR("fsStorageRead failed to read 0x%lX bytes at offset 0x%lX from %s storage area! (0x%X) (aligned).", chunk_size, base_offset, GAMECARD_STORAGE_AREA_NAME(area), rc);
+                return false;
+            }
+        } else {
+            /* Use our read buffer to handle unaligned data. */
+            /* If the unaligned block is bigger than our read buffer, the next chunk will be aligned to a GAMECARD_PAGE_SIZE boundary. */
+            block_start_offset = ALIGN_DOWN(base_offset, GAMECARD_PAGE_SIZE);
+            block_size = MIN(ALIGN_UP(base_offset + area_read_size, GAMECARD_PAGE_SIZE) - block_start_offset, GAMECARD_READ_BUFFER_SIZE);
+            data_start_offset = (base_offset - block_start_offset);
+            chunk_size = MIN(area_read_size, block_size - data_start_offset);
+
+            rc = fsStorageRead(&g_gameCardStorage, block_start_offset, g_gameCardReadBuf, block_size);
+            if (R_FAILED(rc))
+            {
+                LOG_MSG_ERROR("fsStorageRead failed to read 0x%lX bytes at offset 0x%lX from %s storage area! (0x%X) (unaligned).", block_size, block_start_offset, GAMECARD_STORAGE_AREA_NAME(area), rc);
+                return false;
+            }
+
+            memcpy(out_u8, g_gameCardReadBuf + data_start_offset, chunk_size);
+        }
+
+        out_u8 += chunk_size;
+        offset += chunk_size;
+        read_size -= chunk_size;
     }
 
-    /* Calculate proper storage area offset. */
-    u64 base_offset = (area == GameCardStorageArea_Normal ? offset : (offset - g_gameCardNormalAreaSize));
+    return true;
+}
+
+static void gamecardStreamThreadFunc(void *arg)
+{
+    GameCardStreamContext *ctx = (GameCardStreamContext*)arg;
+    u32 idx = 0;
+    u64 read_size = 0;
+    bool success = false;
 
-    if (!(base_offset % GAMECARD_PAGE_SIZE) && !(read_size % GAMECARD_PAGE_SIZE))
+    while(ctx->offset < ctx->end_offset)
     {
-        /* Optimization for reads that are already aligned to a GAMECARD_PAGE_SIZE boundary. */
-        rc = fsStorageRead(&g_gameCardStorage, base_offset, out_u8, read_size);
-        if (R_FAILED(rc))
+        /* Wait until a block buffer is available. */
+        SCOPED_LOCK(&(ctx->mutex))
         {
-            LOG_MSG_ERROR("fsStorageRead failed to read 0x%lX bytes at offset 0x%lX from %s storage area! (0x%X) (aligned).", read_size, base_offset, GAMECARD_STORAGE_AREA_NAME(area), rc);
-            goto end;
+            while((ctx->ready_count + ctx->acquired_count) >= ctx->buffer_count && !ctx->cancelled) condvarWait(&(ctx->free_condvar), &(ctx->mutex));
+            idx = ctx->read_idx;
+            success = !ctx->cancelled;
         }
 
-        success = true;
-    } else {
-        /* Fix offset and/or size to avoid unaligned reads. */
-        u64 block_start_offset = ALIGN_DOWN(base_offset, GAMECARD_PAGE_SIZE);
-        u64 block_end_offset = ALIGN_UP(base_offset + read_size, GAMECARD_PAGE_SIZE);
-        u64 block_size = (block_end_offset - block_start_offset);
+        if (!success) break;
 
-        u64 data_start_offset = (base_offset - block_start_offset);
-        u64 chunk_size = (block_size > GAMECARD_READ_BUFFER_SIZE ? GAMECARD_READ_BUFFER_SIZE : block_size);
-        u64 out_chunk_size = (block_size > GAMECARD_READ_BUFFER_SIZE ? (GAMECARD_READ_BUFFER_SIZE - data_start_offset) : read_size);
+        /* Read next block. This doesn't lock our mutex, so the caller is free to process previously read blocks in the meantime. */
+        /* The block size is adjusted to keep all reads aligned to GAMECARD_PAGE_SIZE boundaries. */
+        read_size = MIN(ctx->block_size - (ctx->offset % GAMECARD_PAGE_SIZE), ctx->end_offset - ctx->offset);
+        success = gamecardReadStorage(ctx->buffers[idx], read_size, ctx->offset);
 
-        rc = fsStorageRead(&g_gameCardStorage, block_start_offset, g_gameCardReadBuf, chunk_size);
-        if (R_FAILED(rc))
+        SCOPED_LOCK(&(ctx->mutex))
         {
-            LOG_MSG_ERROR("fsStorageRead failed to read 0x%lX bytes at offset 0x%lX from %s storage area! (0x%X) (unaligned).", chunk_size, block_start_offset, GAMECARD_STORAGE_AREA_NAME(area), rc);
-            goto end;
+            if (!success)
+            {
+                LOG_MSG_ERROR("Failed to read 0x%lX-byte long gamecard block at offset 0x%lX!", read_size, ctx->offset);
+                ctx->read_error = true;
+                break;
+            }
+
+            ctx->buffer_data_sizes[idx] = read_size;
+            ctx->read_idx = ((idx + 1) % ctx->buffer_count);
+            ctx->ready_count++;
+            ctx->offset += read_size;
         }
 
-        memcpy(out_u8, g_gameCardReadBuf + data_start_offset, out_chunk_size);
+        condvarWakeAll(&(ctx->ready_condvar));
 
-        success = (block_size > GAMECARD_READ_BUFFER_SIZE ? gamecardReadStorageArea(out_u8 + out_chunk_size, read_size - out_chunk_size, offset + out_chunk_size) : true);
+        if (!success) break;
     }
 
-end:
-    return success;
+    SCOPED_LOCK(&(ctx->mutex)) ctx->finished = true;
+    condvarWakeAll(&(ctx->ready_condvar));
+
+    threadExit();
 }
 
 static void gamecardCloseStorageArea(void)
@@ -1210,6 +1358,92 @@ NX_INLINE u64 gamecardGetCapacityFromRomSizeValue(u8 rom_size)
     return capacity;
 }
 
+static bool gamecardInitializeHashFileSystemContexts(void)
+{
+    HashFileSystemContext *root_hfs_ctx = NULL;
+    u32 root_hfs_entry_count = 0, root_hfs_name_table_size = 0;
+    char *root_hfs_name_table = NULL;
+    bool success = false;
+
+    /* Initialize Hash FS context for the root partition. */
+    root_hfs_ctx = gamecardInitializeHashFileSystemContext(NULL, g_gameCardHeader.partition_fs_header_address, 0, g_gameCardHeader.partition_fs_header_hash, 0, g_gameCardHeader.partition_fs_header_size);
+    if (!root_hfs_ctx) goto end;
+
+    /* Calculate total Hash FS partition count. */
+    root_hfs_entry_count = hfsGetEntryCount(root_hfs_ctx);
+    g_gameCardHfsCount = (root_hfs_entry_count + 1);
+
+    /* Allocate Hash FS context pointer array. */
+    g_gameCardHfsCtx = calloc(g_gameCardHfsCount, sizeof(HashFileSystemContext*));
+    if (!g_gameCardHfsCtx)
+    {
+        LOG_MSG_ERROR("Unable to allocate Hash FS context pointer array! (%u).", g_gameCardHfsCount);
+        goto end;
+    }
+
+    /* Set root partition context as the first pointer. */
+    g_gameCardHfsCtx[0] = root_hfs_ctx;
+
+    /* Get root partition name table. */
+    root_hfs_name_table_size = ((HashFileSystemHeader*)root_hfs_ctx->header)->name_table_size;
+    root_hfs_name_table = hfsGetNameTable(root_hfs_ctx);
+
+    /* Initialize Hash FS contexts for the child partitions. */
+    for(u32 i = 0; i < root_hfs_entry_count; i++)
+    {
+        HashFileSystemEntry *hfs_entry = hfsGetEntryByIndex(root_hfs_ctx, i);
+        char *hfs_entry_name = (root_hfs_name_table + hfs_entry->name_offset);
+        u64 hfs_entry_offset = (root_hfs_ctx->offset + root_hfs_ctx->header_size + hfs_entry->offset);
+
+        if (hfs_entry->name_offset >= root_hfs_name_table_size || !*hfs_entry_name)
+        {
+            LOG_MSG_ERROR("Invalid name for root Hash FS partition entry #%u!", i);
+            goto end;
+        }
+
+        g_gameCardHfsCtx[i + 1] = gamecardInitializeHashFileSystemContext(hfs_entry_name, hfs_entry_offset, hfs_entry->size, hfs_entry->hash, hfs_entry->hash_target_offset, hfs_entry->hash_target_size);
+        if (!g_gameCardHfsCtx[i + 1]) goto end;
+    }
+
+    /* Update flag. */
+    success = true;
+
+end:
+    if (!success)
+    {
+        if (!g_gameCardHfsCtx && root_hfs_ctx)
+        {
+            hfsFreeContext(root_hfs_ctx);
+            free(root_hfs_ctx);
+        }
+
+        gamecardFreeHashFileSystemContexts();
+    }
+
+    return success;
+}
+
+static void gamecardFreeHashFileSystemContexts(void)
+{
+    if (g_gameCardHfsCtx)
+    {
+        for(u32 i = 0; i < g_gameCardHfsCount; i++)
+        {
+            HashFileSystemContext *cur_hfs_ctx = g_gameCardHfsCtx[i];
+            if (cur_hfs_ctx)
+            {
+                hfsFreeContext(cur_hfs_ctx);
+                free(cur_hfs_ctx);
+            }
+        }
+
+        free(g_gameCardHfsCtx);
+        g_gameCardHfsCtx = NULL;
+    }
+
+    g_gameCardHfsCount = 0;
+}
+
 static HashFileSystemContext *gamecardInitializeHashFileSystemContext(const char *name, u64 offset, u64 size, u8 *hash, u64 hash_target_offset, u32 hash_target_size)
 {
     u32 i = 0, magic = 0;
@@ -1217,6 +1451,9 @@ static HashFileSystemContext *gamecardInitializeHashFileSystemContext(const char
     HashFileSystemHeader hfs_header = {0};
     u8 hfs_header_hash[SHA256_HASH_SIZE] = {0};
 
+    const u8 *cached_header = NULL;
+    u64 cached_header_size = 0;
+
     bool success = false, dump_fs_header = false;
 
     if ((name && !*name) || offset < (GAMECARD_CERTIFICATE_OFFSET + sizeof(FsGameCardCertificate)) || !IS_ALIGNED(offset, GAMECARD_PAGE_SIZE) || \
@@ -1257,7 +1494,14 @@ static HashFileSystemContext *gamecardInitializeHashFileSystemContext(const char
 
     hfs_ctx->type = i;
 
+    /* Check if the full Hash FS header is available in our cache. */
+    cached_header = gamecardGetCachedHashFileSystemHeader(offset, &cached_header_size);
+
     /* Read partial Hash FS header. */
+    if (cached_header)
+    {
+        memcpy(&hfs_header, cached_header, sizeof(HashFileSystemHeader));
+    } else
     if (!gamecardReadStorageArea(&hfs_header, sizeof(HashFileSystemHeader), offset))
     {
         LOG_MSG_ERROR("Failed to read partial Hash FS header! (\"%s\", offset 0x%lX).", hfs_ctx->name, offset);
@@ -1294,6 +1538,16 @@ static HashFileSystemContext *gamecardInitializeHashFileSystemContext(const char
     }
 
     /* Read full Hash FS header. */
+    if (cached_header && cached_header_size != hfs_ctx->header_size)
+    {
+        LOG_MSG_ERROR("Cached Hash FS header size mismatch! (\"%s\", offset 0x%lX).", hfs_ctx->name, offset);
+        goto end;
+    }
+
+    if (cached_header)
+    {
+        memcpy(hfs_ctx->header, cached_header, hfs_ctx->header_size);
+    } else
     if (!gamecardReadStorageArea(hfs_ctx->header, hfs_ctx->header_size, offset))
     {
         LOG_MSG_ERROR("Failed to read full Hash FS header! (\"%s\", offset 0x%lX).", hfs_ctx->name, offset);
@@ -1343,6 +1597,205 @@ end:
     return hfs_ctx;
 }
 
+static void gamecardGenerateHashFileSystemCachePath(char *out, size_t out_size)
+{
+    snprintf(out, out_size, GAMECARD_HFS_CACHE_PATH "%016lX.bin", g_gameCardHeader.package_id);
+}
+
+static void gamecardLoadHashFileSystemCache(void)
+{
+    char path[FS_MAX_PATH] = {0};
+    FILE *fp = NULL;
+    long file_size = 0;
+
+    GameCardHfsCacheHeader *cache_header = NULL;
+    GameCardHfsCacheEntry *cache_entry = NULL;
+    u8 header_hash[SHA256_HASH_SIZE] = {0};
+    u64 cur_offset = sizeof(GameCardHfsCacheHeader);
+
+    bool success = false, cache_available = false;
+
+    gamecardFreeHashFileSystemCache();
+
+    gamecardGenerateHashFileSystemCachePath(path, sizeof(path));
+
+    /* Open cache file. It's perfectly fine if it doesn't exist -- we just haven't seen this gamecard before. */
+    fp = fopen(path, "rb");
+    if (!fp) goto end;
+
+    cache_available = true;
+
+    fseek(fp, 0, SEEK_END);
+    file_size = ftell(fp);
+    rewind(fp);
+
+    if (file_size <= (long)sizeof(GameCardHfsCacheHeader) || file_size > GAMECARD_HFS_CACHE_MAX_SIZE)
+    {
+        LOG_MSG_ERROR("Invalid Hash FS cache size for \"%s\"! (0x%lX).", path, file_size);
+        goto end;
+    }
+
+    /* Read cache file. */
+    g_gameCardHfsCacheSize = (u64)file_size;
+
+    g_gameCardHfsCache = malloc(g_gameCardHfsCacheSize);
+    if (!g_gameCardHfsCache)
+    {
+        LOG_MSG_ERROR("Failed to allocate 0x%lX bytes for the Hash FS cache!", g_gameCardHfsCacheSize);
+        goto end;
+    }
+
+    if (fread(g_gameCardHfsCache, 1, g_gameCardHfsCacheSize, fp) != g_gameCardHfsCacheSize)
+    {
+        LOG_MSG_ERROR("Failed to read Hash FS cache from \"%s\"!", path);
+        goto end;
+    }
+
+    /* Validate cache header. The cache is only valid for the exact same gamecard header. */
+    cache_header = (GameCardHfsCacheHeader*)g_gameCardHfsCache;
+    sha256CalculateHash(header_hash, &g_gameCardHeader, sizeof(GameCardHeader));
+
+    if (__builtin_bswap32(cache_header->magic) != GAMECARD_HFS_CACHE_MAGIC || cache_header->version != GAMECARD_HFS_CACHE_VERSION || !cache_header->entry_count || \
+        memcmp(cache_header->header_hash, header_hash, SHA256_HASH_SIZE) != 0)
+    {
+        LOG_MSG_DEBUG("Hash FS cache from \"%s\" doesn't match the inserted gamecard. Discarding it.", path);
+        goto end;
+    }
+
+    /* Validate cache entries. */
+    for(u32 i = 0; i < cache_header->entry_count; i++)
+    {
+        if ((g_gameCardHfsCacheSize - cur_offset) < sizeof(GameCardHfsCacheEntry)) break;
+
+        cache_entry = (GameCardHfsCacheEntry*)(g_gameCardHfsCache + cur_offset);
+        cur_offset += sizeof(GameCardHfsCacheEntry);
+
+        if (cache_entry->header_size < sizeof(HashFileSystemHeader) || cache_entry->header_size > (g_gameCardHfsCacheSize - cur_offset)) break;
+
+        cur_offset += cache_entry->header_size;
+    }
+
+    if (cur_offset != g_gameCardHfsCacheSize)
+    {
+        LOG_MSG_ERROR("Hash FS cache from \"%s\" is corrupted!", path);
+        goto end;
+    }
+
+    LOG_MSG_DEBUG("Loaded Hash FS cache from \"%s\" (%u entries).", path, cache_header->entry_count);
+
+    /* Update flag. */
+    success = true;
+
+end:
+    if (fp) fclose(fp);
+
+    if (!success)
+    {
+        gamecardFreeHashFileSystemCache();
+
+        /* Remove unusable cache files, so they get regenerated. */
+        if (cache_available) remove(path);
+    }
+}
+
+static void gamecardSaveHashFileSystemCache(void)
+{
+    char path[FS_MAX_PATH] = {0};
+    FILE *fp = NULL;
+
+    GameCardHfsCacheHeader cache_header = {0};
+    GameCardHfsCacheEntry cache_entry = {0};
+    HashFileSystemContext *hfs_ctx = NULL;
+
+    bool success = false;
+
+    if (!g_gameCardHfsCtx || !g_gameCardHfsCount) return;
+
+    /* Fill cache header. */
+    cache_header.magic = __builtin_bswap32(GAMECARD_HFS_CACHE_MAGIC);
+    cache_header.version = GAMECARD_HFS_CACHE_VERSION;
+    sha256CalculateHash(cache_header.header_hash, &g_gameCardHeader, sizeof(GameCardHeader));
+    cache_header.entry_count = g_gameCardHfsCount;
+
+    gamecardGenerateHashFileSystemCachePath(path, sizeof(path));
+    utilsCreateDirectoryTree(path, false);
+
+    fp = fopen(path, "wb");
+    if (!fp)
+    {
+        LOG_MSG_ERROR("Failed to open \"%s\" for writing!", path);
+        goto end;
+    }
+
+    if (fwrite(&cache_header, 1, sizeof(GameCardHfsCacheHeader), fp) != sizeof(GameCardHfsCacheHeader)) goto end;
+
+    /* Write Hash FS headers. */
+    for(u32 i = 0; i < g_gameCardHfsCount; i++)
+    {
+        hfs_ctx = g_gameCardHfsCtx[i];
+
+        cache_entry.offset = hfs_ctx->offset;
+        cache_entry.header_size = hfs_ctx->header_size;
+
+        if (fwrite(&cache_entry, 1, sizeof(GameCardHfsCacheEntry), fp) != sizeof(GameCardHfsCacheEntry) || \
+            fwrite(hfs_ctx->header, 1, hfs_ctx->header_size, fp) != hfs_ctx->header_size) goto end;
+    }
+
+    /* Update flag. */
+    success = true;
+
+end:
+    if (fp)
+    {
+        fclose(fp);
+
+        if (!success)
+        {
+            LOG_MSG_ERROR("Failed to write Hash FS cache to \"%s\"!", path);
+            remove(path);
+        }
+
+        utilsCommitSdCardFileSystemChanges();
+    }
+}
+
+static const u8 *gamecardGetCachedHashFileSystemHeader(u64 offset, u64 *out_header_size)
+{
+    if (!g_gameCardHfsCache) return NULL;
+
+    GameCardHfsCacheHeader *cache_header = (GameCardHfsCacheHeader*)g_gameCardHfsCache;
+    GameCardHfsCacheEntry *cache_entry = NULL;
+    u64 cur_offset = sizeof(GameCardHfsCacheHeader);
+
+    /* Entries have already been validated by gamecardLoadHashFileSystemCache(). */
+    for(u32 i = 0; i < cache_header->entry_count; i++)
+    {
+        cache_entry = (GameCardHfsCacheEntry*)(g_gameCardHfsCache + cur_offset);
+        cur_offset += sizeof(GameCardHfsCacheEntry);
+
+        if (cache_entry->offset == offset)
+        {
+            *out_header_size = cache_entry->header_size;
+            return (g_gameCardHfsCache + cur_offset);
+        }
+
+        cur_offset += cache_entry->header_size;
+    }
+
+    return NULL;
+}
+
+static void gamecardFreeHashFileSystemCache(void)
+{
+    if (g_gameCardHfsCache)
+    {
+        free(g_gameCardHfsCache);
+        g_gameCardHfsCache = NULL;
+    }
+
+    g_gameCardHfsCacheSize = 0;
+}
+
 static HashFileSystemContext *_gamecardGetHashFileSystemContext(u8 hfs_partition_type)
 {
     HashFileSystemContext *hfs_ctx = NULL;
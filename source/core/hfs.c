@@ -145,6 +145,53 @@ end:
     return ret;
 }
 
+bool hfsInitializeEntryHashContext(HashFileSystemEntryHashContext *out, HashFileSystemEntry *fs_entry)
+{
+    if (!out || !fs_entry || !fs_entry->hash_target_size || (fs_entry->hash_target_offset + fs_entry->hash_target_size) > fs_entry->size)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    memset(out, 0, sizeof(HashFileSystemEntryHashContext));
+
+    out->hash_target_offset = fs_entry->hash_target_offset;
+    out->hash_target_size = fs_entry->hash_target_size;
+    memcpy(out->hash, fs_entry->hash, sizeof(fs_entry->hash));
+
+    sha256ContextCreate(&(out->sha256_ctx));
+
+    return true;
+}
+
+void hfsUpdateEntryHashContext(HashFileSystemEntryHashContext *ctx, const void *data, u64 data_size, u64 offset)
+{
+    if (!ctx || !ctx->hash_target_size || !data || !data_size || hfsIsEntryHashContextComplete(ctx)) return;
+
+    u64 cur_offset = (ctx->hash_target_offset + ctx->hashed_size);
+    u64 end_offset = (ctx->hash_target_offset + ctx->hash_target_size);
+    u64 hash_size = 0;
+
+    /* Skip blocks that don't contain the next chunk of the hash target region. */
+    if (offset > cur_offset || (offset + data_size) <= cur_offset) return;
+
+    hash_size = (MIN(offset + data_size, end_offset) - cur_offset);
+
+    sha256ContextUpdate(&(ctx->sha256_ctx), (const u8*)data + (cur_offset - offset), hash_size);
+    ctx->hashed_size += hash_size;
+}
+
+bool hfsVerifyEntryHashContext(HashFileSystemEntryHashContext *ctx)
+{
+    u8 hash[SHA256_HASH_SIZE] = {0};
+
+    if (!hfsIsEntryHashContextComplete(ctx)) return false;
+
+    sha256ContextGetHash(&(ctx->sha256_ctx), hash);
+
+    return !memcmp(hash, ctx->hash, SHA256_HASH_SIZE);
+}
+
 const char *hfsGetPartitionNameString(u8 hfs_partition_type)
 {
     return ((hfs_partition_type > HashFileSystemPartitionType_None && hfs_partition_type < HashFileSystemPartitionType_Count) ? \
@@ -23,6 +23,7 @@
 #include "nxdt_utils.h"
 #include "mem.h"
 
+/* Only usable while memTraverseProgramMemory() is running. The log buffer is flushed and freed before it returns, so LOG_MSG_*() must be used afterwards. */
 #define MEMLOG_DEBUG(fmt, ...)              LOG_MSG_BUF_DEBUG(&g_memLogBuf, &g_memLogBufSize, fmt, ##__VA_ARGS__)
 #define MEMLOG_ERROR(fmt, ...)              LOG_MSG_BUF_ERROR(&g_memLogBuf, &g_memLogBufSize, fmt, ##__VA_ARGS__)
 
@@ -32,6 +33,31 @@
 
 #define MEM_INVALID_FS_PAGE_TYPE(x)         ((x) == MemType_Unmapped || (x) == MemType_Io || (x) == MemType_ThreadLocal || (x) == MemType_Reserved)
 
+#define MEM_SCAN_WINDOW_SIZE                0x40000                 /* Memory pages are streamed through a window of this size while scanning program memory. */
+#define MEM_SCAN_MAX_PAGE_RUNS              ((MEM_SCAN_MAX_RECORD_SIZE / 0x1000) + 2)   /* Carried over data may span this many 4 KiB memory pages, plus the one being read. */
+
+/* Type definitions. */
+
+typedef bool (*MemoryPageCallback)(Handle debug_handle, const MemoryInfo *mem_info, void *userdata);
+
+typedef struct {
+    u64 offset;                         ///< Scanned data stream offset for the first byte in this run.
+    u64 addr;                           ///< Program memory address for the first byte in this run.
+} MemoryScanPageRun;
+
+typedef struct {
+    MemoryScanPattern *patterns;
+    u32 pattern_count;
+    u32 remaining_count;                ///< Patterns that haven't been found yet.
+    u64 *next_record_offsets;           ///< Lowest record stream offset that still needs to be checked for each pattern.
+    u8 *buf;
+    u64 buf_offset;                     ///< Scanned data stream offset for the first byte in the window buffer. Memory pages are concatenated into a single stream.
+    u64 buf_size;                       ///< Amount of valid data in the window buffer.
+    u64 carry_size;                     ///< Amount of data kept at the start of the window buffer between reads, so records can straddle window and page boundaries.
+    MemoryScanPageRun page_runs[MEM_SCAN_MAX_PAGE_RUNS];    ///< Contiguous program memory runs that are still covered by the window buffer. Used to translate stream offsets into addresses.
+    u32 page_run_count;
+} MemoryScanState;
+
 /* Global variables. */
 
 static Mutex g_memMutex = 0;
@@ -45,6 +71,15 @@ static size_t g_memLogBufSize = 0;
 /* Function prototypes. */
 
 static bool memRetrieveProgramMemory(MemoryLocation *location, bool is_segment);
+static bool memRetrieveProgramMemoryPage(Handle debug_handle, const MemoryInfo *mem_info, void *userdata);
+
+static bool memScanProgramMemoryPage(Handle debug_handle, const MemoryInfo *mem_info, void *userdata);
+static bool memScanAddPageRun(MemoryScanState *state, u64 addr);
+static u64 memScanGetRecordAddress(MemoryScanState *state, u64 record_offset);
+static void memScanWindowBuffer(MemoryScanState *state);
+static const u8 *memFindPattern(const u8 *data, u64 data_size, const u8 *pattern, u32 pattern_size);
+
+static bool memTraverseProgramMemory(u64 program_id, u8 mask, bool is_segment, MemoryPageCallback callback, void *userdata);
 static bool memRetrieveDebugHandleFromProgramById(Handle *out, u64 program_id);
 
 bool memRetrieveProgramMemorySegment(MemoryLocation *location)
@@ -73,7 +108,254 @@ bool memRetrieveFullProgramMemory(MemoryLocation *location)
     return ret;
 }
 
+bool memScanProgramMemory(u64 program_id, u8 mask, MemoryScanPattern *patterns, u32 pattern_count)
+{
+    if (!program_id || mask >= MemoryProgramSegmentType_Limit || !patterns || !pattern_count)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    MemoryScanState state = {0};
+    u64 max_record_size = 0;
+    bool ret = false;
+
+    for(u32 i = 0; i < pattern_count; i++)
+    {
+        MemoryScanPattern *cur_pattern = &(patterns[i]);
+
+        if (!cur_pattern->pattern || !cur_pattern->pattern_size || cur_pattern->record_size < ((u64)cur_pattern->pattern_offset + cur_pattern->pattern_size) || \
+            cur_pattern->record_size > MEM_SCAN_MAX_RECORD_SIZE)
+        {
+            LOG_MSG_ERROR("Invalid parameters for pattern #%u!", i);
+            return false;
+        }
+
+        cur_pattern->found = false;
+        cur_pattern->address = 0;
+
+        if (cur_pattern->record_size > max_record_size) max_record_size = cur_pattern->record_size;
+    }
+
+    /* Allocate memory for our scan state. */
+    state.patterns = patterns;
+    state.pattern_count = state.remaining_count = pattern_count;
+    state.carry_size = (max_record_size - 1);
+
+    state.next_record_offsets = calloc(pattern_count, sizeof(u64));
+    state.buf = malloc(MEM_SCAN_WINDOW_SIZE + state.carry_size);
+
+    if (!state.next_record_offsets || !state.buf)
+    {
+        LOG_MSG_ERROR("Failed to allocate memory for program memory scan state!");
+        goto end;
+    }
+
+    /* Scan program memory. */
+    SCOPED_LOCK(&g_memMutex) ret = memTraverseProgramMemory(program_id, mask, mask != MemoryProgramSegmentType_None, memScanProgramMemoryPage, &state);
+
+end:
+    if (state.buf) free(state.buf);
+
+    if (state.next_record_offsets) free(state.next_record_offsets);
+
+    return ret;
+}
+
 static bool memRetrieveProgramMemory(MemoryLocation *location, bool is_segment)
+{
+    bool success = false;
+
+    /* Clear output MemoryLocation element. */
+    memFreeMemoryLocation(location);
+
+    /* Retrieve program memory. */
+    success = memTraverseProgramMemory(location->program_id, location->mask, is_segment, memRetrieveProgramMemoryPage, location);
+    if (success && (!location->data || !location->data_size))
+    {
+        LOG_MSG_ERROR("Unable to locate readable program memory pages for %016lX that match the required criteria!", location->program_id);
+        success = false;
+    }
+
+    if (!success) memFreeMemoryLocation(location);
+
+    return success;
+}
+
+static bool memRetrieveProgramMemoryPage(Handle debug_handle, const MemoryInfo *mem_info, void *userdata)
+{
+    Result rc = 0;
+    MemoryLocation *location = (MemoryLocation*)userdata;
+    u8 *tmp = NULL;
+
+    /* Reallocate data buffer. */
+    tmp = realloc(location->data, location->data_size + mem_info->size);
+    if (!tmp)
+    {
+        MEMLOG_ERROR("Failed to resize segment data buffer to 0x%lX bytes for program %016lX!", location->data_size + mem_info->size, location->program_id);
+        return false;
+    }
+
+    location->data = tmp;
+    tmp = NULL;
+
+    /* Read memory page. */
+    rc = svcReadDebugProcessMemory(location->data + location->data_size, debug_handle, mem_info->addr, mem_info->size);
+    if (R_FAILED(rc))
+    {
+        MEMLOG_ERROR("svcReadDebugProcessMemory failed for program %016lX! (0x%X).", location->program_id, rc);
+        return false;
+    }
+
+    /* Increase data buffer size. */
+    location->data_size += mem_info->size;
+
+    return true;
+}
+
+static bool memScanProgramMemoryPage(Handle debug_handle, const MemoryInfo *mem_info, void *userdata)
+{
+    Result rc = 0;
+    MemoryScanState *state = (MemoryScanState*)userdata;
+    u64 addr = mem_info->addr, end_addr = (mem_info->addr + mem_info->size), drop_size = 0, chunk_size = 0;
+
+    /* Memory pages are scanned as a single concatenated stream, just like the data retrieved by memRetrieveFullProgramMemory() / memRetrieveProgramMemorySegment(). */
+    /* Leftover data from the previous memory page is kept even if it isn't contiguous with the current one, so records straddling both pages can still be found. */
+    if (!memScanAddPageRun(state, addr)) return false;
+
+    while(addr < end_addr && state->remaining_count)
+    {
+        /* Only keep the tail of the previous window, which may hold the beginning of a record that hasn't been checked yet. */
+        if (state->buf_size > state->carry_size)
+        {
+            drop_size = (state->buf_size - state->carry_size);
+            memmove(state->buf, state->buf + drop_size, state->carry_size);
+            state->buf_offset += drop_size;
+            state->buf_size = state->carry_size;
+        }
+
+        /* Read next window. */
+        chunk_size = MIN(MEM_SCAN_WINDOW_SIZE, end_addr - addr);
+
+        rc = svcReadDebugProcessMemory(state->buf + state->buf_size, debug_handle, addr, chunk_size);
+        if (R_FAILED(rc))
+        {
+            MEMLOG_ERROR("svcReadDebugProcessMemory failed to read 0x%lX bytes at address 0x%lX! (0x%X).", chunk_size, addr, rc);
+            return false;
+        }
+
+        state->buf_size += chunk_size;
+        addr += chunk_size;
+
+        /* Look for our patterns. */
+        memScanWindowBuffer(state);
+    }
+
+    return true;
+}
+
+static bool memScanAddPageRun(MemoryScanState *state, u64 addr)
+{
+    u64 stream_offset = (state->buf_offset + state->buf_size);
+    u64 keep_offset = (stream_offset > state->carry_size ? (stream_offset - state->carry_size) : 0);
+    MemoryScanPageRun *last_run = (state->page_run_count ? &(state->page_runs[state->page_run_count - 1]) : NULL);
+    u32 drop_count = 0;
+
+    /* Nothing to do if this memory page is contiguous with the previous one. */
+    if (last_run && addr == (last_run->addr + (stream_offset - last_run->offset))) return true;
+
+    /* Drop runs that only cover data that won't be carried over anymore. The run holding the first carried over byte is kept. */
+    while((drop_count + 1) < state->page_run_count && state->page_runs[drop_count + 1].offset <= keep_offset) drop_count++;
+
+    if (drop_count)
+    {
+        state->page_run_count -= drop_count;
+        memmove(state->page_runs, state->page_runs + drop_count, state->page_run_count * sizeof(MemoryScanPageRun));
+    }
+
+    if (state->page_run_count >= MEM_SCAN_MAX_PAGE_RUNS)
+    {
+        MEMLOG_ERROR("Too many non-contiguous memory pages within the scan window! (address 0x%lX).", addr);
+        return false;
+    }
+
+    state->page_runs[state->page_run_count].offset = stream_offset;
+    state->page_runs[state->page_run_count++].addr = addr;
+
+    return true;
+}
+
+static u64 memScanGetRecordAddress(MemoryScanState *state, u64 record_offset)
+{
+    MemoryScanPageRun *run = &(state->page_runs[0]);
+
+    for(u32 i = 1; i < state->page_run_count && state->page_runs[i].offset <= record_offset; i++) run = &(state->page_runs[i]);
+
+    return (run->addr + (record_offset - run->offset));
+}
+
+static void memScanWindowBuffer(MemoryScanState *state)
+{
+    MemoryScanPattern *cur_pattern = NULL;
+    u64 record_offset = 0, last_record_offset = 0;
+    const u8 *match = NULL;
+
+    for(u32 i = 0; i < state->pattern_count && state->remaining_count; i++)
+    {
+        cur_pattern = &(state->patterns[i]);
+        if (cur_pattern->found || state->buf_size < cur_pattern->record_size) continue;
+
+        /* Records must be fully available in the window buffer before they can be validated. Anything past this point is checked after the next read. */
+        record_offset = MAX(state->next_record_offsets[i], state->buf_offset);
+        last_record_offset = (state->buf_offset + state->buf_size - cur_pattern->record_size);
+
+        while(record_offset <= last_record_offset)
+        {
+            /* Look for the next pattern match. */
+            match = memFindPattern(state->buf + (record_offset - state->buf_offset) + cur_pattern->pattern_offset, (last_record_offset - record_offset) + cur_pattern->pattern_size, \
+                                   (const u8*)cur_pattern->pattern, cur_pattern->pattern_size);
+            if (!match)
+            {
+                record_offset = (last_record_offset + 1);
+                break;
+            }
+
+            /* Validate record. */
+            record_offset = (state->buf_offset + (u64)(match - state->buf) - cur_pattern->pattern_offset);
+
+            if (!cur_pattern->validate || cur_pattern->validate(match - cur_pattern->pattern_offset, cur_pattern->record_size, cur_pattern->userdata))
+            {
+                /* Jackpot. */
+                cur_pattern->found = true;
+                cur_pattern->address = memScanGetRecordAddress(state, record_offset);
+                state->remaining_count--;
+                break;
+            }
+
+            record_offset++;
+        }
+
+        state->next_record_offsets[i] = record_offset;
+    }
+}
+
+static const u8 *memFindPattern(const u8 *data, u64 data_size, const u8 *pattern, u32 pattern_size)
+{
+    const u8 *cur = data, *end = (data + data_size);
+
+    if (data_size < pattern_size) return NULL;
+
+    /* memchr() is word-at-a-time optimized, so let it skip over everything that doesn't match the first pattern byte. */
+    while((cur = memchr(cur, pattern[0], (size_t)(end - cur - pattern_size + 1))) != NULL)
+    {
+        if (!memcmp(cur + 1, pattern + 1, pattern_size - 1)) return cur;
+        cur++;
+    }
+
+    return NULL;
+}
+
+static bool memTraverseProgramMemory(u64 program_id, u8 mask, bool is_segment, MemoryPageCallback callback, void *userdata)
 {
     Result rc = 0;
     Handle debug_handle = INVALID_HANDLE;
@@ -83,7 +365,6 @@ static bool memRetrieveProgramMemory(MemoryLocation *location, bool is_segment)
     u32 page_info = 0;
     u64 addr = 0, last_text_addr = 0;
     u8 segment = MemoryProgramSegmentType_Text, mem_type = 0;
-    u8 *tmp = NULL;
 
     bool success = true;
 
@@ -98,9 +379,6 @@ static bool memRetrieveProgramMemory(MemoryLocation *location, bool is_segment)
         return false;
     }
 
-    /* Clear output MemoryLocation element. */
-    memFreeMemoryLocation(location);
-
 #if LOG_LEVEL < LOG_LEVEL_NONE
     /* LOG_*() macros will be useless if the target program is the FS sysmodule. */
     /* This is because any FS I/O operation *will* lock up the console while FS itself is being debugged. */
@@ -111,13 +389,14 @@ static bool memRetrieveProgramMemory(MemoryLocation *location, bool is_segment)
 #endif
 
     /* Retrieve debug handle by program ID. */
-    if (!memRetrieveDebugHandleFromProgramById(&debug_handle, location->program_id))
+    if (!memRetrieveDebugHandleFromProgramById(&debug_handle, program_id))
     {
-        MEMLOG_ERROR("Unable to retrieve debug handle for program %016lX!", location->program_id);
+        MEMLOG_ERROR("Unable to retrieve debug handle for program %016lX!", program_id);
+        success = false;
         goto end;
     }
 
-    if (is_segment && location->program_id == FS_SYSMODULE_TID)
+    if (is_segment && program_id == FS_SYSMODULE_TID)
     {
         /* Locate the "real" FS .text segment, since Atmosphère emuMMC has two. */
         /* We'll only look for it if we haven't previously retrieved it, though. */
@@ -128,7 +407,7 @@ static bool memRetrieveProgramMemory(MemoryLocation *location, bool is_segment)
                 rc = svcQueryDebugProcessMemory(&mem_info, &page_info, debug_handle, addr);
                 if (R_FAILED(rc))
                 {
-                    MEMLOG_ERROR("svcQueryDebugProcessMemory failed for program %016lX! (0x%X).", location->program_id, rc);
+                    MEMLOG_ERROR("svcQueryDebugProcessMemory failed for program %016lX! (0x%X).", program_id, rc);
                     success = false;
                     goto end;
                 }
@@ -148,7 +427,7 @@ static bool memRetrieveProgramMemory(MemoryLocation *location, bool is_segment)
                              "- perm: 0x%X\r\n" \
                              "- ipc_refcount: 0x%X\r\n" \
                              "- device_refcount: 0x%X", \
-                             location->program_id, page_info, debug_handle, mem_info.addr, mem_info.size, mem_info.type, mem_info.attr, mem_info.perm, \
+                             program_id, page_info, debug_handle, mem_info.addr, mem_info.size, mem_info.type, mem_info.attr, mem_info.perm, \
                              mem_info.ipc_refcount, mem_info.device_refcount);
 #endif
 
@@ -169,7 +448,7 @@ static bool memRetrieveProgramMemory(MemoryLocation *location, bool is_segment)
         rc = svcQueryDebugProcessMemory(&mem_info, &page_info, debug_handle, addr);
         if (R_FAILED(rc))
         {
-            MEMLOG_ERROR("svcQueryDebugProcessMemory failed for program %016lX! (0x%X).", location->program_id, rc);
+            MEMLOG_ERROR("svcQueryDebugProcessMemory failed for program %016lX! (0x%X).", program_id, rc);
             success = false;
             break;
         }
@@ -179,8 +458,8 @@ static bool memRetrieveProgramMemory(MemoryLocation *location, bool is_segment)
 
         /* Filter out unwanted memory pages. */
         if (mem_info.attr || !(mem_info.perm & Perm_R) || \
-            (is_segment && (MEM_INVALID_SEGMENT_PAGE_TYPE(mem_type) || !(((segment <<= 1) >> 1) & location->mask))) || \
-            (!is_segment && location->program_id == FS_SYSMODULE_TID && MEM_INVALID_FS_PAGE_TYPE(mem_type))) continue;
+            (is_segment && (MEM_INVALID_SEGMENT_PAGE_TYPE(mem_type) || !(((segment <<= 1) >> 1) & mask))) || \
+            (!is_segment && program_id == FS_SYSMODULE_TID && MEM_INVALID_FS_PAGE_TYPE(mem_type))) continue;
 
 #if LOG_LEVEL == LOG_LEVEL_DEBUG
         MEMLOG_DEBUG("svcQueryDebugProcessMemory info (program %016lX, page 0x%X, debug handle 0x%X):\r\n" \
@@ -191,33 +470,16 @@ static bool memRetrieveProgramMemory(MemoryLocation *location, bool is_segment)
                      "- perm: 0x%X\r\n" \
                      "- ipc_refcount: 0x%X\r\n" \
                      "- device_refcount: 0x%X", \
-                     location->program_id, page_info, debug_handle, mem_info.addr, mem_info.size, mem_info.type, mem_info.attr, mem_info.perm, \
+                     program_id, page_info, debug_handle, mem_info.addr, mem_info.size, mem_info.type, mem_info.attr, mem_info.perm, \
                      mem_info.ipc_refcount, mem_info.device_refcount);
 #endif
 
-        /* Reallocate data buffer. */
-        tmp = realloc(location->data, location->data_size + mem_info.size);
-        if (!tmp)
-        {
-            MEMLOG_ERROR("Failed to resize segment data buffer to 0x%lX bytes for program %016lX!", location->data_size + mem_info.size, location->program_id);
-            success = false;
-            break;
-        }
-
-        location->data = tmp;
-        tmp = NULL;
-
-        /* Read memory page. */
-        rc = svcReadDebugProcessMemory(location->data + location->data_size, debug_handle, mem_info.addr, mem_info.size);
-        if (R_FAILED(rc))
+        /* Process memory page. */
+        if (!callback(debug_handle, &mem_info, userdata))
         {
-            MEMLOG_ERROR("svcReadDebugProcessMemory failed for program %016lX! (0x%X).", location->program_id, rc);
             success = false;
             break;
         }
-
-        /* Increase data buffer size. */
-        location->data_size += mem_info.size;
     } while(addr != 0 && segment < MemoryProgramSegmentType_Limit);
 
 end:
@@ -227,17 +489,7 @@ end:
 #if LOG_LEVEL < LOG_LEVEL_NONE
     /* Unlock logfile mutex. */
     logControlMutex(false);
-#endif
 
-    if (success && (!location->data || !location->data_size))
-    {
-        MEMLOG_ERROR("Unable to locate readable program memory pages for %016lX that match the required criteria!", location->program_id);
-        success = false;
-    }
-
-    if (!success) memFreeMemoryLocation(location);
-
-#if LOG_LEVEL < LOG_LEVEL_NONE
     /* Write log buffer data. This will do nothing if the log buffer length is zero. */
     logWriteStringToLogFile(g_memLogBuf);
 
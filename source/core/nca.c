@@ -27,13 +27,41 @@
 #include "gamecard.h"
 #include "title.h"
 
-#define NCA_CRYPTO_BUFFER_SIZE  0x800000    /* 8 MiB. */
+#define NCA_CRYPTO_BUFFER_SIZE          0x800000    /* 8 MiB. */
+
+#define NCA_PREFETCH_SLOT_COUNT         4
+#define NCA_PREFETCH_MIN_WINDOW_SIZE    0x10000     /* 64 KiB. */
+#define NCA_PREFETCH_MAX_WINDOW_SIZE    0x200000    /* 2 MiB. */
+
+/* Type definitions. */
+
+/// Read-ahead state for a single NCA content file reader.
+typedef struct {
+    bool valid;
+    bool in_flight;                 ///< Set to true while the prefetch buffer is being filled outside of the prefetch lock.
+    const NcaContext *reader;       ///< NCA context that owns this slot. Each reader gets its own read-ahead window.
+    u8 storage_id;                  ///< NcmStorageId.
+    NcmContentId content_id;
+    u64 gamecard_offset;            ///< Only used if storage_id == NcmStorageId_GameCard.
+    u64 next_offset;                ///< Expected offset for the next read if the content file is being sequentially accessed.
+    u64 window_size;                ///< Current read-ahead window size. Set to zero if the last access wasn't sequential.
+    u8 *buf;                        ///< Dynamically allocated. NCA_PREFETCH_MAX_WINDOW_SIZE bytes long.
+    u64 buf_offset;                 ///< Content file offset for the prefetched data.
+    u64 buf_size;                   ///< Prefetched data size.
+    u64 last_use;                   ///< Used to evict the least recently used slot.
+} NcaPrefetchSlot;
 
 /* Global variables. */
 
 static u8 *g_ncaCryptoBuffer = NULL;
 static Mutex g_ncaCryptoBufferMutex = 0;
 
+static NcaPrefetchSlot g_ncaPrefetchSlots[NCA_PREFETCH_SLOT_COUNT] = {0};
+static NcaPrefetchStats g_ncaPrefetchStats = {0};
+static u64 g_ncaPrefetchUseCounter = 0;
+static Mutex g_ncaPrefetchMutex = 0;
+static CondVar g_ncaPrefetchCondvar = 0;
+
 /// Used to verify the NCA header main signature.
 static const u8 g_ncaHeaderMainSignaturePublicExponent[3] = { 0x01, 0x00, 0x01 };
 
@@ -152,6 +180,11 @@ static bool ncaWritePatchToMemoryBuffer(NcaContext *ctx, const void *patch, u64
 
 static void *ncaGenerateEncryptedFsSectionBlock(NcaFsSectionContext *ctx, const void *data, u64 data_size, u64 data_offset, u64 *out_block_size, u64 *out_block_offset);
 
+static bool ncaReadPrefetchedContentFileData(NcaContext *ctx, u8 **out, u64 *read_size, u64 *offset, NcaPrefetchSlot **out_fill_slot, u64 *out_fetch_size);
+static void ncaFinishPrefetchSlotFill(NcaPrefetchSlot *slot, bool success, u64 fetch_size, u64 read_size);
+static NcaPrefetchSlot *ncaGetPrefetchSlot(NcaContext *ctx);
+static bool _ncaReadContentFile(NcaContext *ctx, void *out, u64 read_size, u64 offset);
+
 bool ncaAllocateCryptoBuffer(void)
 {
     bool ret = false;
@@ -173,6 +206,29 @@ void ncaFreeCryptoBuffer(void)
         free(g_ncaCryptoBuffer);
         g_ncaCryptoBuffer = NULL;
     }
+
+    SCOPED_LOCK(&g_ncaPrefetchMutex)
+    {
+        for(u32 i = 0; i < NCA_PREFETCH_SLOT_COUNT; i++)
+        {
+            /* Don't pull the buffer out from under a reader that's still filling it. */
+            while(g_ncaPrefetchSlots[i].in_flight) condvarWait(&g_ncaPrefetchCondvar, &g_ncaPrefetchMutex);
+            if (g_ncaPrefetchSlots[i].buf) free(g_ncaPrefetchSlots[i].buf);
+        }
+
+        memset(g_ncaPrefetchSlots, 0, sizeof(g_ncaPrefetchSlots));
+    }
+}
+
+void ncaGetPrefetchStats(NcaPrefetchStats *out)
+{
+    if (!out) return;
+    SCOPED_LOCK(&g_ncaPrefetchMutex) memcpy(out, &g_ncaPrefetchStats, sizeof(NcaPrefetchStats));
+}
+
+void ncaResetPrefetchStats(void)
+{
+    SCOPED_LOCK(&g_ncaPrefetchMutex) memset(&g_ncaPrefetchStats, 0, sizeof(NcaPrefetchStats));
 }
 
 bool ncaInitializeContext(NcaContext *out, u8 storage_id, u8 hfs_partition_type, const NcmContentMetaKey *meta_key, const NcmContentInfo *content_info, Ticket *tik)
@@ -276,23 +332,28 @@ bool ncaReadContentFile(NcaContext *ctx, void *out, u64 read_size, u64 offset)
         return false;
     }
 
-    Result rc = 0;
+    u8 *out_u8 = (u8*)out;
+    NcaPrefetchSlot *fill_slot = NULL;
+    u64 fetch_size = 0;
     bool ret = false;
 
-    if (ctx->storage_id != NcmStorageId_GameCard)
+    /* Serve as much data as possible from the prefetch layer. This only copies cached data and claims slots, so the lock is never held across a backend read. */
+    SCOPED_LOCK(&g_ncaPrefetchMutex) ret = ncaReadPrefetchedContentFileData(ctx, &out_u8, &read_size, &offset, &fill_slot, &fetch_size);
+
+    if (ret && fill_slot)
     {
-        /* Retrieve NCA data normally. */
-        /* This strips NAX0 crypto from SD card NCAs (not used on eMMC NCAs). */
-        rc = ncmContentStorageReadContentIdFile(ctx->ncm_storage, out, read_size, &(ctx->content_id), offset);
-        ret = R_SUCCEEDED(rc);
-        if (!ret) LOG_MSG_ERROR("Failed to read 0x%lX bytes block at offset 0x%lX from NCA \"%s\"! (ncm) (0x%X).", read_size, offset, ctx->content_id_str, rc);
-    } else {
-        /* Retrieve NCA data using raw gamecard reads. */
-        /* Fixes NCA read issues with gamecards under HOS < 4.0.0 when using ncmContentStorageReadContentIdFile(). */
-        ret = gamecardReadStorage(out, read_size, ctx->gamecard_offset + offset);
-        if (!ret) LOG_MSG_ERROR("Failed to read 0x%lX bytes block at offset 0x%lX from NCA \"%s\"! (gamecard).", read_size, offset, ctx->content_id_str);
+        /* Fill the claimed slot. It's marked as in-flight, so nobody else touches its buffer until we publish it. */
+        ret = _ncaReadContentFile(ctx, fill_slot->buf, fetch_size, offset);
+        if (ret) memcpy(out_u8, fill_slot->buf, read_size);
+
+        SCOPED_LOCK(&g_ncaPrefetchMutex) ncaFinishPrefetchSlotFill(fill_slot, ret, fetch_size, read_size);
+
+        if (ret) read_size = 0;
     }
 
+    /* Whatever's left (random accesses, large reads) goes straight to the backend. */
+    if (ret && read_size) ret = _ncaReadContentFile(ctx, out_u8, read_size, offset);
+
     return ret;
 }
 
@@ -1811,3 +1872,141 @@ end:
 
     return out;
 }
+
+static bool ncaReadPrefetchedContentFileData(NcaContext *ctx, u8 **out, u64 *read_size, u64 *offset, NcaPrefetchSlot **out_fill_slot, u64 *out_fetch_size)
+{
+    NcaPrefetchSlot *slot = NULL;
+    u64 buf_end_offset = 0, chunk_size = 0;
+    bool sequential = false;
+
+    g_ncaPrefetchStats.read_count++;
+    g_ncaPrefetchStats.requested_size += *read_size;
+
+    /* Wait until this reader's slot is no longer being filled by another thread using the same context. */
+    while((slot = ncaGetPrefetchSlot(ctx)) && slot->in_flight) condvarWait(&g_ncaPrefetchCondvar, &g_ncaPrefetchMutex);
+
+    /* No slot available (all of them are being filled). Let the caller perform a regular read. */
+    if (!slot) return true;
+
+    buf_end_offset = (slot->buf_offset + slot->buf_size);
+
+    if (slot->buf_size && *offset >= slot->buf_offset && *offset < buf_end_offset)
+    {
+        /* Serve as much data as possible from the prefetch buffer. */
+        chunk_size = MIN(*read_size, buf_end_offset - *offset);
+        memcpy(*out, slot->buf + (*offset - slot->buf_offset), chunk_size);
+
+        g_ncaPrefetchStats.hit_size += chunk_size;
+
+        *out += chunk_size;
+        *offset += chunk_size;
+        *read_size -= chunk_size;
+
+        sequential = true;
+    } else {
+        /* Grow the read-ahead window if this read picks up right where the previous one left off. Reset it otherwise. */
+        sequential = (slot->valid && *offset == slot->next_offset);
+        slot->window_size = (sequential ? MIN(MAX(slot->window_size * 2, NCA_PREFETCH_MIN_WINDOW_SIZE), NCA_PREFETCH_MAX_WINDOW_SIZE) : 0);
+    }
+
+    slot->valid = true;
+    slot->next_offset = (*offset + *read_size);
+
+    /* Random accesses and reads that are at least as big as the read-ahead window are left to the caller. */
+    if (!*read_size || !sequential || !slot->window_size || *read_size >= slot->window_size) return true;
+
+    /* Allocate prefetch buffer, if needed. Let the caller perform a regular read if we can't. */
+    if (!slot->buf && !(slot->buf = malloc(NCA_PREFETCH_MAX_WINDOW_SIZE))) return true;
+
+    /* Claim the slot. The caller fills it without holding the prefetch lock. */
+    slot->in_flight = true;
+    slot->buf_offset = *offset;
+    slot->buf_size = 0;
+
+    *out_fill_slot = slot;
+    *out_fetch_size = MIN(slot->window_size, ctx->content_size - *offset);
+
+    return true;
+}
+
+static void ncaFinishPrefetchSlotFill(NcaPrefetchSlot *slot, bool success, u64 fetch_size, u64 read_size)
+{
+    if (success)
+    {
+        slot->buf_size = fetch_size;
+        g_ncaPrefetchStats.prefetched_size += (fetch_size - read_size);
+    } else {
+        /* Drop the read-ahead state. The next access starts over with a regular read. */
+        slot->valid = false;
+        slot->next_offset = slot->window_size = 0;
+        slot->buf_offset = slot->buf_size = 0;
+    }
+
+    slot->in_flight = false;
+    condvarWakeAll(&g_ncaPrefetchCondvar);
+}
+
+static NcaPrefetchSlot *ncaGetPrefetchSlot(NcaContext *ctx)
+{
+    NcaPrefetchSlot *slot = NULL, *lru_slot = NULL;
+    u64 gamecard_offset = (ctx->storage_id == NcmStorageId_GameCard ? ctx->gamecard_offset : 0);
+
+    for(u32 i = 0; i < NCA_PREFETCH_SLOT_COUNT; i++)
+    {
+        NcaPrefetchSlot *cur_slot = &(g_ncaPrefetchSlots[i]);
+
+        /* Slots are keyed by reader context as well as by content, so two threads reading the same content at different offsets don't thrash each other's window. */
+        /* The content checks catch a freed context whose memory got reused for a different NCA. */
+        if (cur_slot->valid && cur_slot->reader == ctx && cur_slot->storage_id == ctx->storage_id && cur_slot->gamecard_offset == gamecard_offset && \
+            !memcmp(&(cur_slot->content_id), &(ctx->content_id), sizeof(NcmContentId)))
+        {
+            slot = cur_slot;
+            break;
+        }
+
+        /* Slots being filled can't be evicted. */
+        if (cur_slot->in_flight) continue;
+
+        if (!lru_slot || !cur_slot->valid || (lru_slot->valid && cur_slot->last_use < lru_slot->last_use)) lru_slot = cur_slot;
+    }
+
+    if (!slot && lru_slot)
+    {
+        /* Evict least recently used slot. Its buffer is kept around for reuse. */
+        slot = lru_slot;
+
+        slot->valid = false;
+        slot->reader = ctx;
+        slot->storage_id = ctx->storage_id;
+        memcpy(&(slot->content_id), &(ctx->content_id), sizeof(NcmContentId));
+        slot->gamecard_offset = gamecard_offset;
+        slot->next_offset = slot->window_size = 0;
+        slot->buf_offset = slot->buf_size = 0;
+    }
+
+    if (slot) slot->last_use = ++g_ncaPrefetchUseCounter;
+
+    return slot;
+}
+
+static bool _ncaReadContentFile(NcaContext *ctx, void *out, u64 read_size, u64 offset)
+{
+    Result rc = 0;
+    bool ret = false;
+
+    if (ctx->storage_id != NcmStorageId_GameCard)
+    {
+        /* Retrieve NCA data normally. */
+        /* This strips NAX0 crypto from SD card NCAs (not used on eMMC NCAs). */
+        rc = ncmContentStorageReadContentIdFile(ctx->ncm_storage, out, read_size, &(ctx->content_id), offset);
+        ret = R_SUCCEEDED(rc);
+        if (!ret) LOG_MSG_ERROR("Failed to read 0x%lX bytes block at offset 0x%lX from NCA \"%s\"! (ncm) (0x%X).", read_size, offset, ctx->content_id_str, rc);
+    } else {
+        /* Retrieve NCA data using raw gamecard reads. */
+        /* Fixes NCA read issues with gamecards under HOS < 4.0.0 when using ncmContentStorageReadContentIdFile(). */
+        ret = gamecardReadStorage(out, read_size, ctx->gamecard_offset + offset);
+        if (!ret) LOG_MSG_ERROR("Failed to read 0x%lX bytes block at offset 0x%lX from NCA \"%s\"! (gamecard).", read_size, offset, ctx->content_id_str);
+    }
+
+    return ret;
+}
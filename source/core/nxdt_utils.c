@@ -30,6 +30,7 @@
 #include "title.h"
 #include "bfttf.h"
 #include "nxdt_bfsar.h"
+#include "dat.h"
 #include "fatfs/ff.h"
 
 /// Reference: https://docs.microsoft.com/en-us/windows/win32/fileio/filesystem-functionality-comparison#limits.
@@ -38,6 +39,8 @@
 #define FS_MAX_FILENAME_LENGTH      255
 #define SDMC_MAX_FILENAME_LENGTH    128 /* Arbitrarily set, I'm tired of FS sysmodule shenanigans. */
 
+#define CRC32_POLYNOMIAL            0xEDB88320  /* Reversed CRC-32 polynomial, as used by crc32Calculate(). */
+
 /* Type definitions. */
 
 typedef struct {
@@ -115,6 +118,9 @@ static size_t utilsGetUtf8StringLimit(const char *str, size_t str_size, size_t b
 
 static char utilsConvertHexDigitToBinary(char c);
 
+static u32 utilsGf2MatrixTimes(const u32 *mat, u32 vec);
+static void utilsGf2MatrixSquare(u32 *square, const u32 *mat);
+
 bool utilsInitializeResources(const int program_argc, const char **program_argv)
 {
     Result rc = 0;
@@ -239,6 +245,10 @@ bool utilsInitializeResources(const int program_argc, const char **program_argv)
         /* Initialize configuration interface. */
         if (!configInitialize()) break;
 
+        /* Initialize DAT interface. */
+        /* DAT files are loaded in the background, and they're not required for the application to work. */
+        if (!datInitialize()) LOG_MSG_ERROR("Failed to initialize DAT interface!");
+
         /* Setup an applet hook to change the hardware clocks after a system mode change (docked <-> undocked). */
         appletHook(&g_systemOverclockCookie, utilsOverclockSystemAppletHook, NULL);
 
@@ -295,6 +305,9 @@ void utilsCloseResources(void)
         /* Unset our overclock applet hook. */
         appletUnhook(&g_systemOverclockCookie);
 
+        /* Deinitialize DAT interface. */
+        datExit();
+
         /* Close configuration interface. */
         configExit();
 
@@ -679,6 +692,42 @@ bool utilsParseHexString(void *dst, size_t dst_size, const char *src, size_t src
     return success;
 }
 
+u32 utilsCrc32Combine(u32 crc1, u32 crc2, u64 len2)
+{
+    /* Based on crc32_combine() from zlib. */
+    /* Appending 'len2' zero bytes to the first block is equivalent to multiplying its CRC by x^(8 * len2) modulo the CRC polynomial. */
+    /* This is done in O(log(len2)) steps by repeatedly squaring a GF(2) matrix that represents the zero-byte CRC operator. */
+    u32 even[32] = {0}, odd[32] = {0}, row = 1;
+
+    if (!len2) return crc1;
+
+    /* Put operator for one zero bit in odd. */
+    odd[0] = CRC32_POLYNOMIAL;
+    for(u32 i = 1; i < 32; i++)
+    {
+        odd[i] = row;
+        row <<= 1;
+    }
+
+    /* Put operator for two zero bits in even, then four zero bits in odd. */
+    utilsGf2MatrixSquare(even, odd);
+    utilsGf2MatrixSquare(odd, even);
+
+    /* Apply len2 zeros to crc1. The first squaring puts the operator for one zero byte (eight zero bits) in even. */
+    do {
+        utilsGf2MatrixSquare(even, odd);
+        if (len2 & 1) crc1 = utilsGf2MatrixTimes(even, crc1);
+        len2 >>= 1;
+        if (!len2) break;
+
+        utilsGf2MatrixSquare(odd, even);
+        if (len2 & 1) crc1 = utilsGf2MatrixTimes(odd, crc1);
+        len2 >>= 1;
+    } while(len2);
+
+    return (crc1 ^ crc2);
+}
+
 void utilsGenerateFormattedSizeString(double size, char *dst, size_t dst_size)
 {
     if (!dst || dst_size < 2) return;
@@ -1351,3 +1400,22 @@ static char utilsConvertHexDigitToBinary(char c)
     if ('0' <= c && c <= '9') return (c - '0');
     return 'z';
 }
+
+static u32 utilsGf2MatrixTimes(const u32 *mat, u32 vec)
+{
+    u32 sum = 0;
+
+    while(vec)
+    {
+        if (vec & 1) sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+
+    return sum;
+}
+
+static void utilsGf2MatrixSquare(u32 *square, const u32 *mat)
+{
+    for(u32 i = 0; i < 32; i++) square[i] = utilsGf2MatrixTimes(mat, mat[i]);
+}
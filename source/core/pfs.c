@@ -25,6 +25,23 @@
 
 #define PFS_FULL_HEADER_ALIGNMENT   0x20
 
+#define PFS_FILE_CONTEXT_MIN_ENTRY_CAPACITY         0x10
+#define PFS_FILE_CONTEXT_MIN_NAME_TABLE_CAPACITY    0x400
+
+/* Type definitions. */
+
+typedef struct {
+    u8 *buf;
+    u64 buf_size;
+    u64 buf_offset;
+} PartitionFileSystemMemoryBufferWriteData;
+
+/* Function prototypes. */
+
+static bool pfsGrowFileContextBuffers(PartitionFileSystemFileContext *ctx, u32 entry_count, u32 name_table_size);
+static u64 pfsCalculateFullHeaderSize(PartitionFileSystemHeader *header);
+static bool pfsWriteFileContextHeaderDataToMemoryBuffer(const void *data, u64 data_size, void *userdata);
+
 bool pfsInitializeContext(PartitionFileSystemContext *out, NcaFsSectionContext *nca_fs_ctx)
 {
     u32 magic = 0;
@@ -244,6 +261,17 @@ bool pfsGenerateEntryPatch(PartitionFileSystemContext *ctx, PartitionFileSystemE
     return true;
 }
 
+bool pfsReserveFileContextEntries(PartitionFileSystemFileContext *ctx, u32 entry_count, u32 name_table_size)
+{
+    if (!ctx || !entry_count || !name_table_size)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    return pfsGrowFileContextBuffers(ctx, entry_count, name_table_size);
+}
+
 bool pfsAddEntryInformationToFileContext(PartitionFileSystemFileContext *ctx, const char *entry_name, u64 entry_size, u32 *out_entry_idx)
 {
     if (!ctx || !entry_name || !*entry_name)
@@ -254,22 +282,21 @@ bool pfsAddEntryInformationToFileContext(PartitionFileSystemFileContext *ctx, co
 
     PartitionFileSystemHeader *header = &(ctx->header);
 
-    PartitionFileSystemEntry *tmp_pfs_entries = NULL, *cur_pfs_entry = NULL, *prev_pfs_entry = NULL;
-    u64 tmp_pfs_entries_size = ((header->entry_count + 1) * sizeof(PartitionFileSystemEntry));
+    PartitionFileSystemEntry *cur_pfs_entry = NULL, *prev_pfs_entry = NULL;
 
-    char *tmp_name_table = NULL;
-    u32 tmp_name_table_size = (header->name_table_size + strlen(entry_name) + 1);
+    u32 entry_count = (header->entry_count + 1);
+    u32 name_table_size = (header->name_table_size + strlen(entry_name) + 1);
 
-    /* Reallocate Partition FS entries. */
-    if (!(tmp_pfs_entries = realloc(ctx->entries, tmp_pfs_entries_size)))
+    /* Grow Partition FS entry buffer and name table, if needed. */
+    /* Capacities are doubled to keep reallocations to a minimum. */
+    if ((entry_count > ctx->entry_capacity || name_table_size > ctx->name_table_capacity) && \
+        !pfsGrowFileContextBuffers(ctx, MAX(entry_count, MAX(ctx->entry_capacity * 2, PFS_FILE_CONTEXT_MIN_ENTRY_CAPACITY)), \
+                                   MAX(name_table_size, MAX(ctx->name_table_capacity * 2, PFS_FILE_CONTEXT_MIN_NAME_TABLE_CAPACITY))))
     {
-        LOG_MSG_ERROR("Failed to reallocate Partition FS entries!");
+        LOG_MSG_ERROR("Failed to grow Partition FS file context buffers!");
         return false;
     }
 
-    ctx->entries = tmp_pfs_entries;
-    tmp_pfs_entries = NULL;
-
     /* Update Partition FS entry information. */
     cur_pfs_entry = &(ctx->entries[header->entry_count]);
     prev_pfs_entry = (header->entry_count ? &(ctx->entries[header->entry_count - 1]) : NULL);
@@ -280,27 +307,21 @@ bool pfsAddEntryInformationToFileContext(PartitionFileSystemFileContext *ctx, co
     cur_pfs_entry->size = entry_size;
     cur_pfs_entry->name_offset = header->name_table_size;
 
-    /* Reallocate Partition FS name table. */
-    if (!(tmp_name_table = realloc(ctx->name_table, tmp_name_table_size)))
-    {
-        LOG_MSG_ERROR("Failed to reallocate Partition FS name table!");
-        return false;
-    }
-
-    ctx->name_table = tmp_name_table;
-    tmp_name_table = NULL;
-
     /* Update Partition FS name table. */
     sprintf(ctx->name_table + header->name_table_size, "%s", entry_name);
-    header->name_table_size = tmp_name_table_size;
+    header->name_table_size = name_table_size;
 
     /* Update output entry index. */
     if (out_entry_idx) *out_entry_idx = header->entry_count;
 
     /* Update Partition FS entry count, name table size and data size. */
-    header->entry_count++;
+    header->entry_count = entry_count;
     ctx->fs_size += entry_size;
 
+    /* Update full header size. */
+    /* Entry names can't grow after being added, so this is the only place where it needs to be calculated. */
+    ctx->full_header_size = pfsCalculateFullHeaderSize(header);
+
     return true;
 }
 
@@ -329,52 +350,112 @@ bool pfsUpdateEntryNameFromFileContext(PartitionFileSystemFileContext *ctx, u32
     return true;
 }
 
-bool pfsWriteFileContextHeaderToMemoryBuffer(PartitionFileSystemFileContext *ctx, void *buf, u64 buf_size, u64 *out_header_size)
+bool pfsWriteFileContextHeader(PartitionFileSystemFileContext *ctx, PartitionFileSystemFileContextHeaderWriteFunction write_func, void *userdata)
 {
-    if (!ctx || !ctx->header.entry_count || !ctx->header.name_table_size || !ctx->entries || !ctx->name_table || !buf || !out_header_size)
+    if (!ctx || !ctx->header.entry_count || !ctx->header.name_table_size || !ctx->entries || !ctx->name_table || !ctx->full_header_size || !write_func)
     {
         LOG_MSG_ERROR("Invalid parameters!");
         return false;
     }
 
-    PartitionFileSystemHeader *header = &(ctx->header);
-    u8 *buf_u8 = (u8*)buf;
-    u64 header_size = 0, full_header_size = 0, block_offset = 0, block_size = 0;
-    u32 padding_size = 0;
+    static const u8 padding[PFS_FULL_HEADER_ALIGNMENT] = {0};
+
+    PartitionFileSystemHeader header = ctx->header;
+    u64 entries_size = (header.entry_count * sizeof(PartitionFileSystemEntry));
+    u32 padding_size = (u32)(ctx->full_header_size - (sizeof(PartitionFileSystemHeader) + entries_size + header.name_table_size));
 
-    /* Calculate header size. */
-    header_size = (sizeof(PartitionFileSystemHeader) + (header->entry_count * sizeof(PartitionFileSystemEntry)) + header->name_table_size);
+    /* The padding is stored as part of the name table. */
+    header.name_table_size += padding_size;
+
+    /* Write full header. */
+    if (!write_func(&header, sizeof(PartitionFileSystemHeader), userdata) || !write_func(ctx->entries, entries_size, userdata) || \
+        !write_func(ctx->name_table, ctx->header.name_table_size, userdata) || !write_func(padding, padding_size, userdata))
+    {
+        LOG_MSG_ERROR("Failed to write full Partition FS header!");
+        return false;
+    }
 
-    /* Calculate full header size and padding size. */
-    full_header_size = (IS_ALIGNED(header_size, PFS_FULL_HEADER_ALIGNMENT) ? ALIGN_UP(header_size + 1, PFS_FULL_HEADER_ALIGNMENT) : ALIGN_UP(header_size, PFS_FULL_HEADER_ALIGNMENT));
-    padding_size = (u32)(full_header_size - header_size);
+    return true;
+}
+
+bool pfsWriteFileContextHeaderToMemoryBuffer(PartitionFileSystemFileContext *ctx, void *buf, u64 buf_size, u64 *out_header_size)
+{
+    if (!ctx || !buf || !out_header_size)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    PartitionFileSystemMemoryBufferWriteData write_data = { .buf = (u8*)buf, .buf_size = buf_size, .buf_offset = 0 };
 
     /* Check buffer size. */
-    if (buf_size < full_header_size)
+    if (buf_size < ctx->full_header_size)
     {
-        LOG_MSG_ERROR("Not enough space available in input buffer to write full Partition FS header! (got 0x%lX, need 0x%lX).", buf_size, full_header_size);
+        LOG_MSG_ERROR("Not enough space available in input buffer to write full Partition FS header! (got 0x%lX, need 0x%lX).", buf_size, ctx->full_header_size);
         return false;
     }
 
     /* Write full header. */
-    header->name_table_size += padding_size;
-    block_size = sizeof(PartitionFileSystemHeader);
-    memcpy(buf_u8 + block_offset, header, block_size);
-    block_offset += block_size;
-    header->name_table_size -= padding_size;
+    if (!pfsWriteFileContextHeader(ctx, pfsWriteFileContextHeaderDataToMemoryBuffer, &write_data)) return false;
+
+    /* Update output header size. */
+    *out_header_size = write_data.buf_offset;
+
+    return true;
+}
 
-    block_size = (header->entry_count * sizeof(PartitionFileSystemEntry));
-    memcpy(buf_u8 + block_offset, ctx->entries, block_size);
-    block_offset += block_size;
+static bool pfsGrowFileContextBuffers(PartitionFileSystemFileContext *ctx, u32 entry_count, u32 name_table_size)
+{
+    PartitionFileSystemEntry *tmp_pfs_entries = NULL;
+    char *tmp_name_table = NULL;
 
-    block_size = header->name_table_size;
-    memcpy(buf_u8 + block_offset, ctx->name_table, block_size);
-    block_offset += block_size;
+    /* Reallocate Partition FS entries. */
+    if (entry_count > ctx->entry_capacity)
+    {
+        if (!(tmp_pfs_entries = realloc(ctx->entries, entry_count * sizeof(PartitionFileSystemEntry))))
+        {
+            LOG_MSG_ERROR("Failed to reallocate Partition FS entries!");
+            return false;
+        }
 
-    memset(buf_u8 + block_offset, 0, padding_size);
+        ctx->entries = tmp_pfs_entries;
+        ctx->entry_capacity = entry_count;
+        tmp_pfs_entries = NULL;
+    }
 
-    /* Update output header size. */
-    *out_header_size = full_header_size;
+    /* Reallocate Partition FS name table. */
+    if (name_table_size > ctx->name_table_capacity)
+    {
+        if (!(tmp_name_table = realloc(ctx->name_table, name_table_size)))
+        {
+            LOG_MSG_ERROR("Failed to reallocate Partition FS name table!");
+            return false;
+        }
+
+        ctx->name_table = tmp_name_table;
+        ctx->name_table_capacity = name_table_size;
+        tmp_name_table = NULL;
+    }
+
+    return true;
+}
+
+static u64 pfsCalculateFullHeaderSize(PartitionFileSystemHeader *header)
+{
+    u64 header_size = (sizeof(PartitionFileSystemHeader) + (header->entry_count * sizeof(PartitionFileSystemEntry)) + header->name_table_size);
+
+    /* At least one padding byte is always added. */
+    return (IS_ALIGNED(header_size, PFS_FULL_HEADER_ALIGNMENT) ? ALIGN_UP(header_size + 1, PFS_FULL_HEADER_ALIGNMENT) : ALIGN_UP(header_size, PFS_FULL_HEADER_ALIGNMENT));
+}
+
+static bool pfsWriteFileContextHeaderDataToMemoryBuffer(const void *data, u64 data_size, void *userdata)
+{
+    PartitionFileSystemMemoryBufferWriteData *write_data = (PartitionFileSystemMemoryBufferWriteData*)userdata;
+
+    if ((write_data->buf_offset + data_size) > write_data->buf_size) return false;
+
+    memcpy(write_data->buf + write_data->buf_offset, data, data_size);
+    write_data->buf_offset += data_size;
 
     return true;
 }
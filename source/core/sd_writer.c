@@ -0,0 +1,360 @@
+/*
+ * sd_writer.c
+ *
+ * Copyright (c) 2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "nxdt_utils.h"
+#include "sd_writer.h"
+
+/* Function prototypes. */
+
+static const char *sdWriterGetFileSystemPath(const char *path);
+static bool sdWriterOpenFile(SdWriter *writer, FsFileSystem *sdmc_fs, const char *fs_path, u64 size, u64 flush_interval);
+
+static bool sdWriterWriteFile(SdWriter *writer, const void *data, u64 size);
+static bool sdWriterWriteBuffer(SdWriter *writer);
+
+bool sdWriterCreate(SdWriter *writer, const char *path, u64 size, u64 flush_interval)
+{
+    FsFileSystem *sdmc_fs = utilsGetSdCardFileSystemObject();
+    const char *fs_path = NULL;
+    Result rc = 0;
+
+    if (!writer || !sdmc_fs || !(fs_path = sdWriterGetFileSystemPath(path)) || !size)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    memset(writer, 0, sizeof(SdWriter));
+
+    /* Create the output file with its final size. The FS sysmodule allocates all clusters right away, which avoids fragmentation and FAT updates while writing. */
+    if (size > FAT32_FILESIZE_LIMIT)
+    {
+        if (!utilsCreateConcatenationFileWithSize(path, size)) return false;
+    } else {
+        /* Safety measure: remove any existant file/directory at the destination path. */
+        utilsRemoveConcatenationFile(path);
+
+        rc = fsFsCreateFile(sdmc_fs, fs_path, (s64)size, 0);
+        if (R_FAILED(rc))
+        {
+            LOG_MSG_ERROR("fsFsCreateFile failed for \"%s\"! (0x%X).", path, rc);
+            return false;
+        }
+    }
+
+    if (!sdWriterOpenFile(writer, sdmc_fs, fs_path, size, flush_interval))
+    {
+        utilsRemoveConcatenationFile(path);
+        return false;
+    }
+
+    return true;
+}
+
+bool sdWriterOpen(SdWriter *writer, const char *path, u64 size, u64 flush_interval)
+{
+    FsFileSystem *sdmc_fs = utilsGetSdCardFileSystemObject();
+    const char *fs_path = NULL;
+
+    if (!writer || !sdmc_fs || !(fs_path = sdWriterGetFileSystemPath(path)) || !size)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    memset(writer, 0, sizeof(SdWriter));
+
+    return sdWriterOpenFile(writer, sdmc_fs, fs_path, size, flush_interval);
+}
+
+bool sdWriterWrite(SdWriter *writer, const void *data, u64 size)
+{
+    if (!sdWriterIsOpen(writer) || (size && !data) || (sdWriterGetPosition(writer) + size) > writer->size)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    const u8 *data_u8 = (const u8*)data;
+    u64 copy_size = 0;
+
+    /* Large blocks skip the staging buffer, so we don't copy them around for no reason. */
+    if (size >= SD_WRITER_BUFFER_SIZE) return (sdWriterWriteBuffer(writer) && sdWriterWriteFile(writer, data, size));
+
+    while(size)
+    {
+        copy_size = MIN(size, SD_WRITER_BUFFER_SIZE - writer->buf_size);
+        memcpy(writer->buf + writer->buf_size, data_u8, copy_size);
+
+        writer->buf_size += copy_size;
+        data_u8 += copy_size;
+        size -= copy_size;
+
+        if (writer->buf_size == SD_WRITER_BUFFER_SIZE && !sdWriterWriteBuffer(writer)) return false;
+    }
+
+    return true;
+}
+
+bool sdWriterSeek(SdWriter *writer, u64 offset)
+{
+    if (!sdWriterIsOpen(writer) || offset > writer->size)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    if (!sdWriterWriteBuffer(writer)) return false;
+
+    writer->offset = offset;
+
+    return true;
+}
+
+bool sdWriterRead(SdWriter *writer, void *out, u64 size, u64 offset)
+{
+    if (!sdWriterIsOpen(writer) || !out || !size || (offset + size) > writer->size)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    u64 bytes_read = 0;
+    Result rc = 0;
+
+    if (!sdWriterWriteBuffer(writer)) return false;
+
+    rc = fsFileRead(&(writer->file), (s64)offset, out, size, FsReadOption_None, &bytes_read);
+    if (R_FAILED(rc) || bytes_read != size)
+    {
+        LOG_MSG_ERROR("fsFileRead failed! (0x%X, 0x%lX / 0x%lX bytes read at 0x%lX).", rc, bytes_read, size, offset);
+        return false;
+    }
+
+    return true;
+}
+
+bool sdWriterFlush(SdWriter *writer)
+{
+    if (!sdWriterIsOpen(writer))
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    if (!sdWriterWriteBuffer(writer)) return false;
+
+    Result rc = fsFileFlush(&(writer->file));
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("fsFileFlush failed! (0x%X).", rc);
+        return false;
+    }
+
+    writer->unflushed_size = 0;
+
+    return true;
+}
+
+bool sdWriterClose(SdWriter *writer)
+{
+    if (!writer) return false;
+
+    bool success = true;
+
+    if (sdWriterIsOpen(writer))
+    {
+        success = sdWriterFlush(writer);
+        fsFileClose(&(writer->file));
+    }
+
+    if (writer->buf) free(writer->buf);
+
+    memset(writer, 0, sizeof(SdWriter));
+
+    return success;
+}
+
+bool sdSplitWriterCreate(SdSplitWriter *writer, const char *path, u64 size, u32 lane_count, u64 flush_interval)
+{
+    if (!writer || !size || !lane_count || lane_count > SD_WRITER_MAX_LANE_COUNT)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    memset(writer, 0, sizeof(SdSplitWriter));
+
+    /* Hand out whole ConcatenationFile parts to each lane. */
+    u64 part_count = ((size + SD_WRITER_PART_SIZE - 1) / SD_WRITER_PART_SIZE);
+    if (lane_count > part_count) lane_count = (u32)part_count;
+
+    u64 lane_part_count = ((part_count + lane_count - 1) / lane_count);
+    lane_count = (u32)((part_count + lane_part_count - 1) / lane_part_count);
+
+    /* The first lane takes care of creating the output file. Every other lane opens its own handle to it. */
+    if (!sdWriterCreate(&(writer->lanes[0]), path, size, flush_interval)) return false;
+
+    for(u32 i = 0; i < lane_count; i++)
+    {
+        SdWriter *lane = &(writer->lanes[i]);
+
+        writer->lane_offsets[i] = (i * lane_part_count * SD_WRITER_PART_SIZE);
+        writer->lane_sizes[i] = MIN(size - writer->lane_offsets[i], lane_part_count * SD_WRITER_PART_SIZE);
+        writer->lane_count++;
+
+        /* Holding multiple write handles to the same file hasn't been verified against every FS sysmodule version, and FS may refuse to open another one (e.g. TargetLocked). */
+        /* If that happens, we just fall back to a single lane that covers the whole file. */
+        if (i > 0 && (!sdWriterOpen(lane, path, size, flush_interval) || !sdWriterSeek(lane, writer->lane_offsets[i])))
+        {
+            LOG_MSG_WARNING("Failed to open lane #%u for \"%s\"! Falling back to a single lane.", i, path);
+
+            for(u32 j = 1; j <= i; j++) sdWriterClose(&(writer->lanes[j]));
+
+            writer->lane_offsets[0] = 0;
+            writer->lane_sizes[0] = size;
+            writer->lane_count = 1;
+
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool sdSplitWriterWrite(SdSplitWriter *writer, u32 lane_idx, const void *data, u64 size)
+{
+    if (!writer || lane_idx >= writer->lane_count || (sdWriterGetPosition(&(writer->lanes[lane_idx])) + size) > (writer->lane_offsets[lane_idx] + writer->lane_sizes[lane_idx]))
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    return sdWriterWrite(&(writer->lanes[lane_idx]), data, size);
+}
+
+bool sdSplitWriterClose(SdSplitWriter *writer)
+{
+    if (!writer) return false;
+
+    bool success = true;
+
+    for(u32 i = 0; i < SD_WRITER_MAX_LANE_COUNT; i++)
+    {
+        if (!sdWriterClose(&(writer->lanes[i]))) success = false;
+    }
+
+    memset(writer, 0, sizeof(SdSplitWriter));
+
+    return success;
+}
+
+static const char *sdWriterGetFileSystemPath(const char *path)
+{
+    if (!path || !*path) return NULL;
+
+    /* Strip the devoptab device name prefix, since we're talking to the FS sysmodule directly. */
+    if (!strncmp(path, DEVOPTAB_SDMC_DEVICE, strlen(DEVOPTAB_SDMC_DEVICE))) path += strlen(DEVOPTAB_SDMC_DEVICE);
+
+    return (*path == '/' ? path : NULL);
+}
+
+static bool sdWriterOpenFile(SdWriter *writer, FsFileSystem *sdmc_fs, const char *fs_path, u64 size, u64 flush_interval)
+{
+    s64 file_size = 0;
+    Result rc = 0;
+    bool success = false;
+
+    /* Allocate staging buffer. */
+    if (!(writer->buf = memalign(SD_WRITER_BUFFER_ALIGNMENT, SD_WRITER_BUFFER_SIZE)))
+    {
+        LOG_MSG_ERROR("Failed to allocate memory for the staging buffer!");
+        goto end;
+    }
+
+    /* Open file. Read access is needed to verify previously written data. */
+    rc = fsFsOpenFile(sdmc_fs, fs_path, FsOpenMode_Read | FsOpenMode_Write, &(writer->file));
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("fsFsOpenFile failed for \"%s\"! (0x%X).", fs_path, rc);
+        goto end;
+    }
+
+    /* Preallocate the whole file if it doesn't have the right size. */
+    rc = fsFileGetSize(&(writer->file), &file_size);
+    if (R_SUCCEEDED(rc) && (u64)file_size != size) rc = fsFileSetSize(&(writer->file), (s64)size);
+
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("Failed to set size for \"%s\"! (0x%X).", fs_path, rc);
+        goto end;
+    }
+
+    writer->size = size;
+    writer->flush_interval = flush_interval;
+
+    success = true;
+
+end:
+    if (!success) sdWriterClose(writer);
+
+    return success;
+}
+
+static bool sdWriterWriteFile(SdWriter *writer, const void *data, u64 size)
+{
+    if (!size) return true;
+
+    Result rc = fsFileWrite(&(writer->file), (s64)writer->offset, data, size, FsWriteOption_None);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("fsFileWrite failed! (0x%X, 0x%lX bytes at 0x%lX).", rc, size, writer->offset);
+        return false;
+    }
+
+    writer->offset += size;
+    writer->unflushed_size += size;
+
+    /* Flush data if the flush interval has elapsed. */
+    if (writer->flush_interval && writer->unflushed_size >= writer->flush_interval)
+    {
+        rc = fsFileFlush(&(writer->file));
+        if (R_FAILED(rc))
+        {
+            LOG_MSG_ERROR("fsFileFlush failed! (0x%X).", rc);
+            return false;
+        }
+
+        writer->unflushed_size = 0;
+    }
+
+    return true;
+}
+
+static bool sdWriterWriteBuffer(SdWriter *writer)
+{
+    if (!writer->buf_size) return true;
+
+    bool success = sdWriterWriteFile(writer, writer->buf, writer->buf_size);
+    writer->buf_size = 0;
+
+    return success;
+}
@@ -31,6 +31,11 @@
 
 #define NCM_CMT_APP_OFFSET                  0x7A
 
+#define TITLE_GAMECARD_CACHE_PATH           DEVOPTAB_SDMC_DEVICE APP_BASE_PATH "Cache/Gamecard/"
+#define TITLE_GAMECARD_CACHE_MAGIC          0x47435449                              /* "GCTI". */
+#define TITLE_GAMECARD_CACHE_VERSION        1
+#define TITLE_GAMECARD_CACHE_MAX_SIZE       0x100000                                /* 1 MiB. Real caches are just a few KiB long. */
+
 /* Type definitions. */
 
 typedef struct {
@@ -46,6 +51,25 @@ typedef struct {
     u32 title_count;
 } TitleStorage;
 
+/// Persistent gamecard title info cache. Stored on the SD card, one file per gamecard header hash.
+/// Followed by 'title_count' TitleGameCardCacheEntry elements, each one followed by its NcmContentInfo array.
+typedef struct {
+    u32 magic;                      ///< "GCTI".
+    u32 version;                    ///< TITLE_GAMECARD_CACHE_VERSION.
+    u32 title_count;
+    u8 reserved[0x4];
+} TitleGameCardCacheHeader;
+
+NXDT_ASSERT(TitleGameCardCacheHeader, 0x10);
+
+typedef struct {
+    NcmContentMetaKey meta_key;
+    u32 content_count;
+    u8 reserved[0x4];
+} TitleGameCardCacheEntry;
+
+NXDT_ASSERT(TitleGameCardCacheEntry, 0x18);
+
 /* Global variables. */
 
 static Mutex g_titleMutex = 0;
@@ -558,6 +582,10 @@ static bool titleGenerateTitleInfoEntriesForTitleStorage(TitleStorage *title_sto
 static bool titleGetMetaKeysFromContentDatabase(NcmContentMetaDatabase *ncm_db, NcmContentMetaKey **out_meta_keys, u32 *out_meta_key_count);
 static bool titleGetContentInfosForMetaKey(NcmContentMetaDatabase *ncm_db, const NcmContentMetaKey *meta_key, NcmContentInfo **out_content_infos, u32 *out_content_count);
 
+static bool titleGenerateGameCardCachePath(char *out, size_t out_size);
+static u8 *titleLoadGameCardCache(u32 *out_title_count);
+static void titleSaveGameCardCache(TitleStorage *title_storage);
+
 static void titleUpdateTitleInfoLinkedLists(void);
 
 static bool titleCreateGameCardInfoThread(void);
@@ -1902,10 +1930,17 @@ static bool titleGenerateTitleInfoEntriesForTitleStorage(TitleStorage *title_sto
     u32 total = 0, extra_title_count = 0;
     NcmContentMetaKey *meta_keys = NULL;
 
+    u8 *cache = NULL;
+    u64 cache_offset = sizeof(TitleGameCardCacheHeader);
+
     bool success = false, free_entries = false;
 
+    /* Load gamecard title info from the SD card cache if we have seen this gamecard before. */
+    /* This skips all ncm content meta database queries, which are slow for gamecards. */
+    if (storage_id == NcmStorageId_GameCard) cache = titleLoadGameCardCache(&total);
+
     /* Get content meta keys for this storage. */
-    if (!titleGetMetaKeysFromContentDatabase(ncm_db, &meta_keys, &total)) goto end;
+    if (!cache && !titleGetMetaKeysFromContentDatabase(ncm_db, &meta_keys, &total)) goto end;
 
     /* Check if we're dealing with an empty storage. */
     if (!total)
@@ -1923,7 +1958,18 @@ static bool titleGenerateTitleInfoEntriesForTitleStorage(TitleStorage *title_sto
     for(u32 i = 0; i < total; i++)
     {
         u64 tmp_size = 0;
-        NcmContentMetaKey *cur_meta_key = &(meta_keys[i]);
+        NcmContentMetaKey *cur_meta_key = NULL;
+        TitleGameCardCacheEntry *cache_entry = NULL;
+
+        if (cache)
+        {
+            /* Entries have already been validated by titleLoadGameCardCache(). */
+            cache_entry = (TitleGameCardCacheEntry*)(cache + cache_offset);
+            cache_offset += (sizeof(TitleGameCardCacheEntry) + (cache_entry->content_count * sizeof(NcmContentInfo)));
+            cur_meta_key = &(cache_entry->meta_key);
+        } else {
+            cur_meta_key = &(meta_keys[i]);
+        }
 
         TitleInfo *cur_title_info = title_storage->titles[title_storage->title_count + extra_title_count];
         if (!cur_title_info)
@@ -1941,6 +1987,18 @@ static bool titleGenerateTitleInfoEntriesForTitleStorage(TitleStorage *title_sto
         }
 
         /* Get content infos. */
+        if (cache_entry)
+        {
+            cur_title_info->content_infos = calloc(cache_entry->content_count, sizeof(NcmContentInfo));
+            if (!cur_title_info->content_infos)
+            {
+                LOG_MSG_ERROR("Failed to allocate memory for cached content infos! (title ID %016lX).", cur_meta_key->id);
+                goto end;
+            }
+
+            memcpy(cur_title_info->content_infos, cache_entry + 1, cache_entry->content_count * sizeof(NcmContentInfo));
+            cur_title_info->content_count = cache_entry->content_count;
+        } else
         if (!titleGetContentInfosForMetaKey(ncm_db, cur_meta_key, &(cur_title_info->content_infos), &(cur_title_info->content_count)))
         {
             LOG_MSG_ERROR("Failed to get content infos for title ID %016lX!", cur_meta_key->id);
@@ -1993,10 +2051,15 @@ static bool titleGenerateTitleInfoEntriesForTitleStorage(TitleStorage *title_sto
     /* This will also keep track of orphan titles - titles with no available application metadata. */
     titleUpdateTitleInfoLinkedLists();
 
+    /* Store gamecard title info on the SD card, so we don't have to query ncm the next time this gamecard is inserted. */
+    if (storage_id == NcmStorageId_GameCard && !cache) titleSaveGameCardCache(title_storage);
+
     /* Update flag. */
     success = true;
 
 end:
+    if (cache) free(cache);
+
     if (meta_keys) free(meta_keys);
 
     /* Free previously allocated title info pointers. Ignore return value. */
@@ -2164,6 +2227,194 @@ end:
     return success;
 }
 
+static bool titleGenerateGameCardCachePath(char *out, size_t out_size)
+{
+    GameCardHeader gc_header = {0};
+    u8 header_hash[SHA256_HASH_SIZE] = {0};
+    char header_hash_str[(SHA256_HASH_SIZE * 2) + 1] = {0};
+
+    if (!gamecardGetHeader(&gc_header))
+    {
+        LOG_MSG_ERROR("Failed to retrieve gamecard header!");
+        return false;
+    }
+
+    /* Cache files are keyed by a hash of the full gamecard header, so they're never used with a different gamecard. */
+    sha256CalculateHash(header_hash, &gc_header, sizeof(GameCardHeader));
+    utilsGenerateHexString(header_hash_str, sizeof(header_hash_str), header_hash, sizeof(header_hash), false);
+
+    snprintf(out, out_size, TITLE_GAMECARD_CACHE_PATH "%s.titles", header_hash_str);
+
+    return true;
+}
+
+static u8 *titleLoadGameCardCache(u32 *out_title_count)
+{
+    char path[FS_MAX_PATH] = {0};
+    FILE *fp = NULL;
+    long file_size = 0;
+
+    u8 *cache = NULL;
+    TitleGameCardCacheHeader *cache_header = NULL;
+    TitleGameCardCacheEntry *cache_entry = NULL;
+    u64 cache_size = 0, cur_offset = sizeof(TitleGameCardCacheHeader);
+
+    bool success = false, cache_available = false;
+
+    if (!titleGenerateGameCardCachePath(path, sizeof(path))) return NULL;
+
+    /* Open cache file. It's perfectly fine if it doesn't exist -- we just haven't seen this gamecard before. */
+    fp = fopen(path, "rb");
+    if (!fp) goto end;
+
+    cache_available = true;
+
+    fseek(fp, 0, SEEK_END);
+    file_size = ftell(fp);
+    rewind(fp);
+
+    if (file_size <= (long)sizeof(TitleGameCardCacheHeader) || file_size > TITLE_GAMECARD_CACHE_MAX_SIZE)
+    {
+        LOG_MSG_ERROR("Invalid gamecard title cache size for \"%s\"! (0x%lX).", path, file_size);
+        goto end;
+    }
+
+    /* Read cache file. */
+    cache_size = (u64)file_size;
+
+    cache = malloc(cache_size);
+    if (!cache)
+    {
+        LOG_MSG_ERROR("Failed to allocate 0x%lX bytes for the gamecard title cache!", cache_size);
+        goto end;
+    }
+
+    if (fread(cache, 1, cache_size, fp) != cache_size)
+    {
+        LOG_MSG_ERROR("Failed to read gamecard title cache from \"%s\"!", path);
+        goto end;
+    }
+
+    /* Validate cache header. */
+    cache_header = (TitleGameCardCacheHeader*)cache;
+
+    if (__builtin_bswap32(cache_header->magic) != TITLE_GAMECARD_CACHE_MAGIC || cache_header->version != TITLE_GAMECARD_CACHE_VERSION || !cache_header->title_count)
+    {
+        LOG_MSG_DEBUG("Gamecard title cache from \"%s\" is outdated. Discarding it.", path);
+        goto end;
+    }
+
+    /* Validate cache entries. */
+    for(u32 i = 0; i < cache_header->title_count; i++)
+    {
+        if ((cache_size - cur_offset) < sizeof(TitleGameCardCacheEntry)) break;
+
+        cache_entry = (TitleGameCardCacheEntry*)(cache + cur_offset);
+        cur_offset += sizeof(TitleGameCardCacheEntry);
+
+        if (!cache_entry->content_count || cache_entry->content_count > ((cache_size - cur_offset) / sizeof(NcmContentInfo))) break;
+
+        cur_offset += (cache_entry->content_count * sizeof(NcmContentInfo));
+    }
+
+    if (cur_offset != cache_size)
+    {
+        LOG_MSG_ERROR("Gamecard title cache from \"%s\" is corrupted!", path);
+        goto end;
+    }
+
+    LOG_MSG_DEBUG("Loaded gamecard title cache from \"%s\" (%u entries).", path, cache_header->title_count);
+
+    *out_title_count = cache_header->title_count;
+
+    /* Update flag. */
+    success = true;
+
+end:
+    if (fp) fclose(fp);
+
+    if (!success)
+    {
+        if (cache)
+        {
+            free(cache);
+            cache = NULL;
+        }
+
+        /* Remove unusable cache files, so they get regenerated. */
+        if (cache_available) remove(path);
+    }
+
+    return cache;
+}
+
+static void titleSaveGameCardCache(TitleStorage *title_storage)
+{
+    char path[FS_MAX_PATH] = {0};
+    FILE *fp = NULL;
+
+    TitleGameCardCacheHeader cache_header = {0};
+    TitleGameCardCacheEntry cache_entry = {0};
+    TitleInfo *cur_title_info = NULL;
+
+    bool success = false;
+
+    if (!title_storage->titles || !title_storage->title_count || !titleGenerateGameCardCachePath(path, sizeof(path))) return;
+
+    /* Fill cache header. Title info entries without content infos aren't stored. */
+    cache_header.magic = __builtin_bswap32(TITLE_GAMECARD_CACHE_MAGIC);
+    cache_header.version = TITLE_GAMECARD_CACHE_VERSION;
+
+    for(u32 i = 0; i < title_storage->title_count; i++)
+    {
+        cur_title_info = title_storage->titles[i];
+        if (cur_title_info && cur_title_info->content_infos && cur_title_info->content_count) cache_header.title_count++;
+    }
+
+    if (!cache_header.title_count) return;
+
+    utilsCreateDirectoryTree(path, false);
+
+    fp = fopen(path, "wb");
+    if (!fp)
+    {
+        LOG_MSG_ERROR("Failed to open \"%s\" for writing!", path);
+        goto end;
+    }
+
+    if (fwrite(&cache_header, 1, sizeof(TitleGameCardCacheHeader), fp) != sizeof(TitleGameCardCacheHeader)) goto end;
+
+    /* Write title info entries. */
+    for(u32 i = 0; i < title_storage->title_count; i++)
+    {
+        cur_title_info = title_storage->titles[i];
+        if (!cur_title_info || !cur_title_info->content_infos || !cur_title_info->content_count) continue;
+
+        memcpy(&(cache_entry.meta_key), &(cur_title_info->meta_key), sizeof(NcmContentMetaKey));
+        cache_entry.content_count = cur_title_info->content_count;
+
+        if (fwrite(&cache_entry, 1, sizeof(TitleGameCardCacheEntry), fp) != sizeof(TitleGameCardCacheEntry) || \
+            fwrite(cur_title_info->content_infos, sizeof(NcmContentInfo), cur_title_info->content_count, fp) != cur_title_info->content_count) goto end;
+    }
+
+    /* Update flag. */
+    success = true;
+
+end:
+    if (fp)
+    {
+        fclose(fp);
+
+        if (!success)
+        {
+            LOG_MSG_ERROR("Failed to write gamecard title cache to \"%s\"!", path);
+            remove(path);
+        }
+
+        utilsCommitSdCardFileSystemChanges();
+    }
+}
+
 static void titleUpdateTitleInfoLinkedLists(void)
 {
     /* Free orphan title info entries. */
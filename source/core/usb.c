@@ -24,9 +24,10 @@
 
 #include "nxdt_utils.h"
 #include "usb.h"
+#include "usb_transport.h"
 
 #define USB_ABI_VERSION_MAJOR       1
-#define USB_ABI_VERSION_MINOR       1
+#define USB_ABI_VERSION_MINOR       3
 #define USB_ABI_VERSION             ((USB_ABI_VERSION_MAJOR << 4) | USB_ABI_VERSION_MINOR)
 
 #define USB_CMD_HEADER_MAGIC        0x4E584454                  /* "NXDT". */
@@ -34,25 +35,23 @@
 #define USB_TRANSFER_ALIGNMENT      0x1000                      /* 4 KiB. */
 #define USB_TRANSFER_TIMEOUT        5                           /* 5 seconds. */
 
-#define USB_DEV_VID                 0x057E                      /* VID officially used by Nintendo in usb:ds. */
-#define USB_DEV_PID                 0x3000                      /* PID officially used by Nintendo in usb:ds. */
-#define USB_DEV_BCD_REL             0x0100                      /* Device release number. Always 1.0. */
+#define USB_TRANSFER_MAX_QUEUE_DEPTH    8                       /* Number of entries in UsbDsReportData. */
+#define USB_TRANSFER_MIN_URB_SIZE       0x40000                 /* 256 KiB. */
+#define USB_TRANSFER_TUNING_SAMPLE_SIZE 0x1000000               /* 16 MiB. Amount of file data that must be timed with a saturated queue using each candidate queue configuration while auto-tuning. */
+#define USB_TRANSFER_TUNING_MAX_SAMPLE_SIZE 0x4000000           /* 64 MiB. Candidates are measured with whatever was timed after sending this much data, in case the queue rarely stays saturated. */
 
-#define USB_FS_BCD_REVISION         0x0110                      /* USB 1.1. */
-#define USB_FS_EP0_MAX_PACKET_SIZE  0x40                        /* 64 bytes. */
-#define USB_FS_EP_MAX_PACKET_SIZE   0x40                        /* 64 bytes. */
+#define USB_FRAME_HEADER_MAGIC      0x4E584443                  /* "NXDC". */
+#define USB_COMPRESSION_BLOCK_SIZE  0x100000                    /* 1 MiB. Max raw data size per compressed frame. */
+#define USB_COMPRESSION_PROBE_SIZE  0x1000000                   /* 16 MiB. Compression is disabled for the rest of the stream if it isn't winning after this much data. */
+#define USB_COMPRESSION_THREAD_COUNT    2                       /* Running on cores 0 and 1. */
+#define USB_COMPRESSION_MIN_URB_SIZE    0x200000                /* 2 MiB. Compressed frames must fit within a single URB. */
 
-#define USB_HS_BCD_REVISION         0x0200                      /* USB 2.0. */
-#define USB_HS_EP0_MAX_PACKET_SIZE  0x40                        /* 64 bytes. */
-#define USB_HS_EP_MAX_PACKET_SIZE   0x200                       /* 512 bytes. */
+#define USB_FILE_RESUME_MAX_TAIL_SIZE   0x100000                /* 1 MiB. */
 
-#define USB_SS_BCD_REVISION         0x0300                      /* USB 3.0. */
-#define USB_SS_EP0_MAX_PACKET_SIZE  9                           /* 512 bytes (1 << 9). */
-#define USB_SS_EP_MAX_PACKET_SIZE   0x400                       /* 1024 bytes. */
-
-#define USB_BOS_SIZE                0x16                        /* usb_bos_descriptor + usb_2_0_extension_descriptor + usb_ss_usb_device_capability_descriptor. */
-
-#define USB_LANGID_ENUS             0x0409
+#define USB_CHECKSUM_TRAILER_MAGIC  0x4E58444B                  /* "NXDK". */
+#define USB_CHECKSUM_MAX_ATTEMPTS   4                           /* Integrity blocks are sent up to this many times before giving up. */
+#define USB_CHECKSUM_MAX_QUEUE_DEPTH    (USB_TRANSFER_MAX_QUEUE_DEPTH / 2)  /* Each integrity block takes up two URBs from the input endpoint (data + trailer). */
+#define USB_CHECKSUM_CONTROL_SIZE   (USB_TRANSFER_MAX_QUEUE_DEPTH * 2 * USB_TRANSFER_ALIGNMENT) /* Trailer + status block pages for each URB slot. Placed right after the USB transfer buffer. */
 
 /* Type definitions. */
 
@@ -62,7 +61,9 @@ typedef enum {
     UsbCommandType_CancelFileTransfer = 2,
     UsbCommandType_SendNspHeader      = 3,
     UsbCommandType_EndSession         = 4,
-    UsbCommandType_Count              = 5   ///< Total values supported by this enum.
+    UsbCommandType_SendFileBatch      = 5,
+    UsbCommandType_ResumeFileTransfer = 6,
+    UsbCommandType_Count              = 7   ///< Total values supported by this enum.
 } UsbCommandType;
 
 typedef struct {
@@ -74,13 +75,24 @@ typedef struct {
 
 NXDT_ASSERT(UsbCommandHeader, 0x10);
 
+typedef enum {
+    UsbSessionCapability_None           = 0,
+    UsbSessionCapability_Lz4Compression = BIT(0),   ///< File data streams are sent as a sequence of LZ4-compressed frames. See UsbCompressedFrameHeader.
+    UsbSessionCapability_FileResume     = BIT(1),   ///< Host device keeps partial files from interrupted transfers around and reports them. See usbSendResumableFileProperties().
+    UsbSessionCapability_ChunkChecksum  = BIT(2),   ///< Each file data URB is sent as an integrity block, followed by a UsbChecksumBlockTrailer. Corrupted blocks are retransmitted.
+    UsbSessionCapability_TransferTuning = BIT(3),   ///< Host device picks the USB transfer queue configuration through the StartSession status block, or asks us to auto-tune it.
+    UsbSessionCapability_All            = (UsbSessionCapability_Lz4Compression | UsbSessionCapability_FileResume | UsbSessionCapability_ChunkChecksum | \
+                                           UsbSessionCapability_TransferTuning)
+} UsbSessionCapability;
+
 typedef struct {
     u8 app_ver_major;
     u8 app_ver_minor;
     u8 app_ver_micro;
     u8 abi_version;
     char git_commit[8];
-    u8 reserved[0x4];
+    u8 capabilities;    ///< UsbSessionCapability bitmask. Capabilities supported by us.
+    u8 reserved[0x3];
 } UsbCommandStartSession;
 
 NXDT_ASSERT(UsbCommandStartSession, 0x10);
@@ -90,11 +102,45 @@ typedef struct {
     u32 filename_length;
     u32 nsp_header_size;
     char filename[FS_MAX_PATH];
-    u8 reserved_2[0xF];
+    u8 flags;               ///< UsbFilePropertiesFlags bitmask.
+    u8 reserved_2[0xE];
 } UsbCommandSendFileProperties;
 
 NXDT_ASSERT(UsbCommandSendFileProperties, 0x320);
 
+typedef enum {
+    UsbFilePropertiesFlags_None      = 0,
+    UsbFilePropertiesFlags_Resumable = BIT(0)   ///< The host device must reply with a UsbFileResumeInfo block right after the status block. Requires UsbSessionCapability_FileResume.
+} UsbFilePropertiesFlags;
+
+NXDT_ASSERT(UsbFileResumeInfo, 0x30);
+
+/// Only valid right after a resumable SendFileProperties command for which the host device reported a non-zero resume offset.
+typedef struct {
+    u64 offset;             ///< Must be either zero (restart transfer) or the resume offset reported by the host device.
+    u8 reserved[0x8];
+} UsbCommandResumeFileTransfer;
+
+NXDT_ASSERT(UsbCommandResumeFileTransfer, 0x10);
+
+/// Followed by 'file_count' UsbFileBatchManifestEntry elements.
+typedef struct {
+    u32 file_count;
+    u8 reserved_1[0x4];
+    u64 total_size;         ///< Sum of all file sizes. File data is sent as a single concatenated stream.
+} UsbCommandSendFileBatch;
+
+NXDT_ASSERT(UsbCommandSendFileBatch, 0x10);
+
+/// Followed by 'filename_length' bytes holding a non NULL-terminated UTF-8 filename.
+typedef struct {
+    u64 file_size;
+    u32 filename_length;
+    u8 reserved[0x4];
+} UsbFileBatchManifestEntry;
+
+NXDT_ASSERT(UsbFileBatchManifestEntry, 0x10);
+
 typedef enum {
     ///< Expected response code.
     UsbStatusType_Success               = 0,
@@ -110,95 +156,119 @@ typedef enum {
     UsbStatusType_UnsupportedAbiVersion = 6,
     UsbStatusType_MalformedCommand      = 7,
     UsbStatusType_HostIoError           = 8,
+    UsbStatusType_ChecksumMismatch      = 9,        ///< Only returned for integrity blocks. Requests a retransmission.
 
-    UsbStatusType_Count                 = 9         ///< Total values supported by this enum.
+    UsbStatusType_Count                 = 10        ///< Total values supported by this enum.
 } UsbStatusType;
 
 typedef struct {
     u32 magic;
     u32 status;             ///< UsbStatusType.
     u16 max_packet_size;    ///< USB host endpoint max packet size.
-    u8 reserved[0x6];
+    u8 capabilities;        ///< UsbSessionCapability bitmask. Capabilities enabled by the host device. Only valid in StartSession responses.
+    u8 queue_depth;         ///< Requested USB transfer queue depth. Only valid in StartSession responses, and only if UsbSessionCapability_TransferTuning is enabled.
+    u32 urb_size;           ///< Requested URB size. Same rules as 'queue_depth'. If both are zero, the queue configuration is auto-tuned.
 } UsbStatus;
 
 NXDT_ASSERT(UsbStatus, 0x10);
 
-/// Imported from libusb, with some adjustments.
-enum usb_bos_type {
-    USB_BT_WIRELESS_USB_DEVICE_CAPABILITY = 1,
-    USB_BT_USB_2_0_EXTENSION              = 2,
-    USB_BT_SS_USB_DEVICE_CAPABILITY       = 3,
-    USB_BT_CONTAINER_ID                   = 4
-};
-
-/// Imported from libusb, with some adjustments.
-enum usb_2_0_extension_attributes {
-    USB_BM_LPM_SUPPORT = 2
-};
-
-/// Imported from libusb, with some adjustments.
-enum usb_ss_usb_device_capability_attributes {
-    USB_BM_LTM_SUPPORT = 2
-};
-
-/// Imported from libusb, with some adjustments.
-enum usb_supported_speed {
-    USB_LOW_SPEED_OPERATION   = BIT(0),
-    USB_FULL_SPEED_OPERATION  = BIT(1),
-    USB_HIGH_SPEED_OPERATION  = BIT(2),
-    USB_SUPER_SPEED_OPERATION = BIT(3)
-};
+/// Each compressed frame is sent as a single URB with ZLT enabled, which lets the host device read it on its own.
+/// Followed by 'payload_size' bytes holding a LZ4 block, or raw data if 'payload_size' matches 'raw_size'.
+typedef struct {
+    u32 magic;              ///< USB_FRAME_HEADER_MAGIC.
+    u32 raw_size;
+    u32 payload_size;
+    u8 reserved[0x4];
+} UsbCompressedFrameHeader;
 
-/// Imported from libusb, with some adjustments.
-struct PACKED usb_bos_descriptor {
-    u8 bLength;
-    u8 bDescriptorType; ///< Must match USB_DT_BOS.
-    u16 wTotalLength;   ///< Length of this descriptor and all of its sub descriptors.
-    u8 bNumDeviceCaps;  ///< The number of separate device capability descriptors in the BOS.
-};
+NXDT_ASSERT(UsbCompressedFrameHeader, 0x10);
 
-NXDT_ASSERT(struct usb_bos_descriptor, 0x5);
+/// Sent as its own URB right after each integrity block if UsbSessionCapability_ChunkChecksum is enabled. The host device replies to each one with a status block.
+/// Each integrity block holds the data from a single file data URB (a whole frame under compressed streams). ZLT is enabled throughout the stream, so blocks can be read without knowing their size beforehand.
+/// Multiple integrity blocks may be in flight at once. The host device drops every block it receives after a corrupted one, and nxdumptool sends all of them again.
+typedef struct {
+    u32 magic;              ///< USB_CHECKSUM_TRAILER_MAGIC.
+    u32 crc32;              ///< CRC32 checksum calculated over the block data, as sent through the USB bus.
+    u32 block_size;         ///< Block data size.
+    u32 block_idx;          ///< Block index within the current file data stream.
+} UsbChecksumBlockTrailer;
 
-/// Imported from libusb, with some adjustments.
-struct PACKED usb_2_0_extension_descriptor {
-    u8 bLength;
-    u8 bDescriptorType;     ///< Must match USB_DT_DEVICE_CAPABILITY.
-    u8 bDevCapabilityType;  ///< Must match USB_BT_USB_2_0_EXTENSION.
-    u32 bmAttributes;       ///< usb_2_0_extension_attributes.
-};
+NXDT_ASSERT(UsbChecksumBlockTrailer, 0x10);
 
-NXDT_ASSERT(struct usb_2_0_extension_descriptor, 0x7);
-
-/// Imported from libusb, with some adjustments.
-struct PACKED usb_ss_usb_device_capability_descriptor {
-    u8 bLength;
-    u8 bDescriptorType;         ///< Must match USB_DT_DEVICE_CAPABILITY.
-    u8 bDevCapabilityType;      ///< Must match USB_BT_SS_USB_DEVICE_CAPABILITY.
-    u8 bmAttributes;            ///< usb_ss_usb_device_capability_attributes.
-    u16 wSpeedsSupported;       ///< usb_supported_speed.
-    u8 bFunctionalitySupport;   ///< The lowest speed at which all the functionality that the device supports is available to the user.
-    u8 bU1DevExitLat;           ///< U1 Device Exit Latency.
-    u16 bU2DevExitLat;          ///< U2 Device Exit Latency.
-};
+typedef struct {
+    const u8 *data;         ///< Raw data.
+    u32 raw_size;           ///< Raw data size. Must not exceed USB_COMPRESSION_BLOCK_SIZE.
+    bool compress;          ///< If false, raw data is stored as-is.
+    u8 *frame;              ///< URB slot. Holds a UsbCompressedFrameHeader followed by the payload.
+    u32 frame_size;         ///< Set after processing the job.
+} UsbCompressionJob;
+
+/// USB transfer queue configuration. The USB transfer buffer is split into 'queue_depth' URB slots, each one 'urb_size' bytes long.
+typedef struct {
+    u32 urb_size;
+    u32 queue_depth;
+} UsbTransferQueueConfig;
 
-NXDT_ASSERT(struct usb_ss_usb_device_capability_descriptor, 0xA);
+/// Used to keep track of file data URBs posted to the input endpoint that haven't been reaped yet.
+/// Each slot is backed by a g_usbTransferUrbSize-long region from the USB transfer buffer.
+/// Under integrity block checksums, slots are only released once the host device has verified their data.
+typedef struct {
+    u32 urb_id;             ///< URB ID returned by g_usbTransport->post_buffer_async().
+    u32 size;               ///< URB size.
+    u32 trailer_urb_id;     ///< Only used under integrity block checksums. UsbChecksumBlockTrailer URB posted to the input endpoint.
+    u32 status_urb_id;      ///< Only used under integrity block checksums. UsbStatus URB posted to the output endpoint.
+    u32 attempts;           ///< Only used under integrity block checksums. Number of times this block failed verification.
+    u64 post_tick;          ///< System tick at which the URB was posted. Used while auto-tuning.
+} UsbPendingTransfer;
 
 /* Global variables. */
 
 static Mutex g_usbInterfaceMutex = 0;
-static UsbDsInterface *g_usbInterface = NULL;
+static const UsbTransport *g_usbTransport = NULL;
 static UsbDsEndpoint *g_usbEndpointIn = NULL, *g_usbEndpointOut = NULL;
-static bool g_usbInterfaceInit = false, g_usbHos5xEnabled = false;
+static bool g_usbInterfaceInit = false;
 
 static Event *g_usbStateChangeEvent = NULL;
 static Thread g_usbDetectionThread = {0};
 static UEvent g_usbDetectionThreadExitEvent = {0}, g_usbTimeoutEvent = {0};
-static bool g_usbHostAvailable = false, g_usbSessionStarted = false, g_usbDetectionThreadExitFlag = false, g_nspTransferMode = false;
+static bool g_usbHostAvailable = false, g_usbSessionStarted = false, g_usbDetectionThreadExitFlag = false, g_nspTransferMode = false, g_fileBatchTransferMode = false;
 static atomic_bool g_usbDetectionThreadCreated = false;
 
 static u8 *g_usbTransferBuffer = NULL;
 static u64 g_usbTransferRemainingSize = 0, g_usbTransferWrittenSize = 0;
 static u16 g_usbEndpointMaxPacketSize = 0;
+static u8 g_usbSessionCapabilities = 0;
+static u64 g_usbFileResumeOffset = 0;
+
+static UsbPendingTransfer g_usbPendingTransfers[USB_TRANSFER_MAX_QUEUE_DEPTH] = {0};
+static u32 g_usbPendingTransferIdx = 0, g_usbPendingTransferCount = 0, g_usbAcquiredTransferCount = 0, g_usbStagedTransferSize = 0;
+
+/* Candidate USB transfer queue configurations, sorted by URB size. All of them fit within the USB transfer buffer. */
+static const UsbTransferQueueConfig g_usbTransferQueueConfigs[] = {
+    { 0x80000,  8 },    /* 512 KiB x 8. Default for USB 1.x. */
+    { 0x100000, 8 },    /* 1 MiB x 8. Default for USB 2.0. */
+    { 0x200000, 4 },    /* 2 MiB x 4. Default for USB 3.0. */
+    { 0x400000, 2 }     /* 4 MiB x 2. */
+};
+
+static const u32 g_usbTransferQueueConfigsCount = MAX_ELEMENTS(g_usbTransferQueueConfigs);
+
+static u32 g_usbTransferUrbSize = 0x200000, g_usbTransferQueueDepth = 4;
+
+static bool g_usbTransferTuningActive = false;
+static u32 g_usbTransferTuningIdx = 0, g_usbTransferTuningBestIdx = 0;
+static u64 g_usbTransferTuningBestRate = 0, g_usbTransferTuningSampleSize = 0, g_usbTransferTuningTimedSize = 0, g_usbTransferTuningTimedTicks = 0, g_usbTransferTuningLastTick = 0;
+
+static Mutex g_usbCompressionMutex = 0;
+static CondVar g_usbCompressionJobCondvar = 0, g_usbCompressionDoneCondvar = 0;
+static Thread g_usbCompressionThreads[USB_COMPRESSION_THREAD_COUNT] = {0};
+static u32 g_usbCompressionThreadCount = 0;
+static bool g_usbCompressionThreadExitFlag = false, g_usbCompressionStreamEnabled = false;
+static UsbCompressionJob g_usbCompressionJobs[USB_TRANSFER_MAX_QUEUE_DEPTH] = {0};
+static u32 g_usbCompressionJobCount = 0, g_usbCompressionNextJob = 0, g_usbCompressionDoneCount = 0;
+static u64 g_usbCompressionRawSize = 0, g_usbCompressionPayloadSize = 0;
+
+static u32 g_usbChecksumBlockCount = 0;
 
 /* Function prototypes. */
 
@@ -218,12 +288,9 @@ static void usbLogStatusDetail(u32 status);
 NX_INLINE bool usbAllocateTransferBuffer(void);
 NX_INLINE void usbFreeTransferBuffer(void);
 
-static bool usbInitializeComms(void);
-static bool usbInitializeComms5x(void);
-static bool usbInitializeComms1x(void);
-static void usbCloseComms(void);
-
-static bool _usbSendFileProperties(u64 file_size, const char *filename, u32 nsp_header_size, bool enforce_nsp_mode);
+static bool _usbSendFileProperties(u64 file_size, const char *filename, u32 nsp_header_size, bool enforce_nsp_mode, UsbFileResumeInfo *out_resume_info);
+static bool _usbSendFileData(void *data, u64 data_size, bool in_place);
+static bool usbSendStreamData(u8 *data, u64 data_size, bool in_place, bool first_chunk, bool last_chunk, bool *out_zlt_required);
 
 NX_INLINE bool usbIsHostAvailable(void);
 
@@ -233,6 +300,44 @@ NX_INLINE bool usbRead(void *buf, size_t size);
 NX_INLINE bool usbWrite(void *buf, size_t size);
 static bool usbTransferData(void *buf, size_t size, UsbDsEndpoint *endpoint);
 
+static bool usbQueueTransferData(const void *data, u32 size);
+static bool usbPostTransfer(u32 slot);
+static bool usbWaitForTransfer(UsbDsEndpoint *endpoint, u32 urb_id, u32 size);
+NX_INLINE bool usbIsTransferComplete(UsbDsEndpoint *endpoint, u32 urb_id);
+static bool usbReapTransfer(void);
+static bool usbFlushTransferQueue(void);
+static void usbCancelTransferQueue(void);
+NX_INLINE void usbResetTransferQueue(void);
+NX_INLINE u32 usbGetTransferQueueLimit(void);
+NX_INLINE u8 *usbGetTransferSlotBuffer(u32 pos);
+static bool usbStageTransferData(const u8 *data, u64 size, bool flush, bool *out_zlt_required);
+
+static void usbConfigureTransferQueue(const UsbStatus *status);
+NX_INLINE bool usbIsValidTransferQueueConfig(u32 urb_size, u32 queue_depth);
+NX_INLINE u32 usbGetDefaultTransferQueueConfigIndex(void);
+NX_INLINE u32 usbGetNextTransferQueueConfigIndex(u32 idx);
+static void usbSetTransferQueueConfig(u32 urb_size, u32 queue_depth);
+static bool usbUpdateTransferTuning(void);
+static void usbSampleTransferTuning(const UsbPendingTransfer *pending, bool timed);
+NX_INLINE void usbResetTransferTuningSample(void);
+
+NX_INLINE bool usbIsCompressionEnabled(void);
+NX_INLINE u32 usbGetFileDataBufferOffset(void);
+static bool usbSendCompressedTransferData(const u8 *data, u64 size, bool in_place);
+static void usbProcessCompressionJob(UsbCompressionJob *job);
+static void usbRunCompressionJobs(u32 job_count);
+static bool usbCreateCompressionThreads(void);
+static void usbDestroyCompressionThreads(void);
+static void usbCompressionThreadFunc(void *arg);
+
+NX_INLINE bool usbIsChecksumEnabled(void);
+NX_INLINE u64 usbGetFileDataBufferSize(void);
+NX_INLINE UsbChecksumBlockTrailer *usbGetChecksumBlockTrailer(u32 slot);
+NX_INLINE UsbStatus *usbGetChecksumBlockStatus(u32 slot);
+static bool usbWaitForChecksumBlockReply(u32 slot, u32 *out_status);
+static bool usbReapChecksumBlock(void);
+static bool usbResendChecksumBlocks(void);
+
 bool usbInitialize(void)
 {
     bool ret = false;
@@ -250,14 +355,15 @@ bool usbInitialize(void)
         }
 
         /* Initialize USB comms. */
-        if (!usbInitializeComms())
+        g_usbTransport = usbGetTransport();
+        if (!g_usbTransport->initialize(&g_usbEndpointIn, &g_usbEndpointOut))
         {
             LOG_MSG_ERROR("Failed to initialize USB comms!");
             break;
         }
 
         /* Retrieve USB state change kernel event. */
-        g_usbStateChangeEvent = usbDsGetStateChangeEvent();
+        g_usbStateChangeEvent = g_usbTransport->get_state_change_event();
         if (!g_usbStateChangeEvent)
         {
             LOG_MSG_ERROR("Failed to retrieve USB state change kernel event!");
@@ -297,7 +403,11 @@ void usbExit(void)
         g_usbStateChangeEvent = NULL;
 
         /* Close USB device interface. */
-        usbCloseComms();
+        if (g_usbTransport) g_usbTransport->exit();
+        g_usbEndpointIn = g_usbEndpointOut = NULL;
+
+        /* Destroy compression threads. */
+        usbDestroyCompressionThreads();
 
         /* Free USB transfer buffer. */
         usbFreeTransferBuffer();
@@ -343,113 +453,202 @@ u8 usbIsReady(void)
 bool usbSendFileProperties(u64 file_size, const char *filename)
 {
     bool ret = false;
-    SCOPED_LOCK(&g_usbInterfaceMutex) ret = _usbSendFileProperties(file_size, filename, 0, false);
+    SCOPED_LOCK(&g_usbInterfaceMutex) ret = _usbSendFileProperties(file_size, filename, 0, false, NULL);
     return ret;
 }
 
-bool usbSendNspProperties(u64 nsp_size, const char *filename, u32 nsp_header_size)
+bool usbSendResumableFileProperties(u64 file_size, const char *filename, UsbFileResumeInfo *out_resume_info)
 {
     bool ret = false;
-    SCOPED_LOCK(&g_usbInterfaceMutex) ret = _usbSendFileProperties(nsp_size, filename, nsp_header_size, true);
+
+    SCOPED_LOCK(&g_usbInterfaceMutex)
+    {
+        if (!out_resume_info)
+        {
+            LOG_MSG_ERROR("Invalid parameters!");
+            break;
+        }
+
+        ret = _usbSendFileProperties(file_size, filename, 0, false, out_resume_info);
+    }
+
     return ret;
 }
 
-bool usbSendFileData(void *data, u64 data_size)
+bool usbResumeFileTransfer(u64 offset)
 {
     bool ret = false;
 
     SCOPED_LOCK(&g_usbInterfaceMutex)
     {
-        void *buf = NULL;
-        bool zlt_required = false;
+        UsbCommandResumeFileTransfer *cmd_block = NULL;
 
-        if (!g_usbTransferBuffer || !g_usbInterfaceInit || !g_usbHostAvailable || !g_usbSessionStarted || !g_usbTransferRemainingSize || !data || !data_size || data_size > USB_TRANSFER_BUFFER_SIZE || \
-            data_size > g_usbTransferRemainingSize)
+        if (!g_usbInterfaceInit || !g_usbTransferBuffer || !g_usbHostAvailable || !g_usbSessionStarted || !g_usbFileResumeOffset || (offset && offset != g_usbFileResumeOffset))
         {
             LOG_MSG_ERROR("Invalid parameters!");
-            goto end;
+            break;
         }
 
-        /* Optimization for buffers that already are page aligned. */
-        if (IS_ALIGNED((u64)data, USB_TRANSFER_ALIGNMENT))
-        {
-            buf = data;
-        } else {
-            buf = g_usbTransferBuffer;
-            memcpy(buf, data, data_size);
-        }
+        /* Prepare command data. */
+        usbPrepareCommandHeader(UsbCommandType_ResumeFileTransfer, (u32)sizeof(UsbCommandResumeFileTransfer));
+
+        cmd_block = (UsbCommandResumeFileTransfer*)(g_usbTransferBuffer + sizeof(UsbCommandHeader));
+        memset(cmd_block, 0, sizeof(UsbCommandResumeFileTransfer));
+        cmd_block->offset = offset;
 
-        /* Determine if we'll need to set a Zero Length Termination (ZLT) packet. */
-        /* This is automatically handled by usbDsEndpoint_PostBufferAsync(), depending on the ZLT setting from the input (write) endpoint. */
-        /* First, check if this is the last data chunk for this file. */
-        if ((g_usbTransferRemainingSize - data_size) == 0)
+        /* Send command. The host device truncates the output file to the provided offset before replying. */
+        ret = usbSendCommand();
+        if (ret)
         {
-            /* Enable ZLT if the last chunk size is aligned to the USB endpoint max packet size. */
-            if (IS_ALIGNED(data_size, g_usbEndpointMaxPacketSize))
-            {
-                zlt_required = true;
-                usbSetZltPacket(true);
-                LOG_MSG_DEBUG("ZLT enabled. Last chunk size: 0x%lX bytes.", data_size);
-            }
+            /* The transfer is already complete if the host device holds the whole file. */
+            g_usbTransferRemainingSize -= offset;
+            g_usbChecksumBlockCount = 0;
+            usbResetTransferTuningSample();
         } else {
-            /* Disable ZLT if this is the first of multiple data chunks. */
-            if (!g_usbTransferWrittenSize)
-            {
-                usbSetZltPacket(false);
-                LOG_MSG_DEBUG("ZLT disabled (first chunk).");
-            }
+            g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
         }
 
-        /* Send data chunk. */
-        if (!(ret = usbWrite(buf, data_size)))
+        g_usbFileResumeOffset = 0;
+    }
+
+    return ret;
+}
+
+bool usbSendNspProperties(u64 nsp_size, const char *filename, u32 nsp_header_size)
+{
+    bool ret = false;
+    SCOPED_LOCK(&g_usbInterfaceMutex) ret = _usbSendFileProperties(nsp_size, filename, nsp_header_size, true, NULL);
+    return ret;
+}
+
+bool usbSendFileBatchProperties(const UsbFileBatchEntry *entries, u32 entry_count)
+{
+    bool ret = false;
+
+    SCOPED_LOCK(&g_usbInterfaceMutex)
+    {
+        UsbCommandSendFileBatch *cmd_block = NULL;
+        u8 *manifest = NULL;
+        u64 manifest_size = sizeof(UsbCommandSendFileBatch), total_size = 0;
+
+        if (!g_usbInterfaceInit || !g_usbTransferBuffer || !g_usbHostAvailable || !g_usbSessionStarted || g_usbTransferRemainingSize || g_nspTransferMode || !entries || !entry_count)
         {
-            LOG_MSG_ERROR("Failed to write 0x%lX bytes long file data chunk from offset 0x%lX! (total size: 0x%lX).", data_size, g_usbTransferWrittenSize, \
-                                                                                                                      g_usbTransferRemainingSize + g_usbTransferWrittenSize);
-            goto end;
+            LOG_MSG_ERROR("Invalid parameters!");
+            break;
         }
 
-        g_usbTransferRemainingSize -= data_size;
-        g_usbTransferWrittenSize += data_size;
+        /* Prepare command data. The command block size is updated once the manifest has been generated. */
+        usbPrepareCommandHeader(UsbCommandType_SendFileBatch, 0);
+
+        cmd_block = (UsbCommandSendFileBatch*)(g_usbTransferBuffer + sizeof(UsbCommandHeader));
+        memset(cmd_block, 0, sizeof(UsbCommandSendFileBatch));
+
+        manifest = ((u8*)cmd_block + sizeof(UsbCommandSendFileBatch));
 
-        /* Check if this is the last chunk. */
-        if (!g_usbTransferRemainingSize)
+        /* Generate manifest. */
+        for(u32 i = 0; i < entry_count; i++)
         {
-            /* Check response from host device. */
-            if (!(ret = usbRead(g_usbTransferBuffer, sizeof(UsbStatus))))
+            const UsbFileBatchEntry *entry = &(entries[i]);
+            UsbFileBatchManifestEntry *manifest_entry = (UsbFileBatchManifestEntry*)manifest;
+            size_t filename_length = 0;
+
+            if (!entry->filename || !(filename_length = strlen(entry->filename)) || filename_length >= FS_MAX_PATH || \
+                (sizeof(UsbCommandHeader) + manifest_size + sizeof(UsbFileBatchManifestEntry) + filename_length) > USB_TRANSFER_BUFFER_SIZE)
             {
-                LOG_MSG_ERROR("Failed to read 0x%lX bytes long status block!", sizeof(UsbStatus));
+                LOG_MSG_ERROR("Invalid file batch entry #%u!", i);
                 goto end;
             }
 
-            UsbStatus *cmd_status = (UsbStatus*)g_usbTransferBuffer;
+            manifest_entry->file_size = entry->file_size;
+            manifest_entry->filename_length = (u32)filename_length;
+            memset(manifest_entry->reserved, 0, sizeof(manifest_entry->reserved));
+            memcpy(manifest + sizeof(UsbFileBatchManifestEntry), entry->filename, filename_length);
 
-            if (!(ret = (cmd_status->magic == __builtin_bswap32(USB_CMD_HEADER_MAGIC))))
-            {
-                LOG_MSG_ERROR("Invalid status block magic word! (0x%08X).", __builtin_bswap32(cmd_status->magic));
-                goto end;
-            }
+            manifest += (sizeof(UsbFileBatchManifestEntry) + filename_length);
+            manifest_size += (sizeof(UsbFileBatchManifestEntry) + filename_length);
+            total_size += entry->file_size;
+        }
 
-            ret = (cmd_status->status == UsbStatusType_Success);
-#if LOG_LEVEL <= LOG_LEVEL_ERROR
-            if (!ret) usbLogStatusDetail(cmd_status->status);
-#endif
+        cmd_block->file_count = entry_count;
+        cmd_block->total_size = total_size;
+        ((UsbCommandHeader*)g_usbTransferBuffer)->cmd_block_size = (u32)manifest_size;
+
+        /* Send command. */
+        ret = usbSendCommand();
+        if (ret)
+        {
+            g_usbTransferRemainingSize = total_size;
+            g_usbTransferWrittenSize = 0;
+            g_usbChecksumBlockCount = 0;
+            usbResetTransferTuningSample();
+            g_fileBatchTransferMode = (total_size > 0);
         }
 
 end:
-        /* Disable ZLT if it was previously enabled. */
-        if (zlt_required) usbSetZltPacket(false);
-
-        /* Reset variables in case of errors. */
         if (!ret)
         {
             g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
-            g_nspTransferMode = false;
+            g_fileBatchTransferMode = false;
+        }
+    }
+
+    return ret;
+}
+
+bool usbSendFileData(void *data, u64 data_size)
+{
+    bool ret = false;
+    SCOPED_LOCK(&g_usbInterfaceMutex) ret = _usbSendFileData(data, data_size, false);
+    return ret;
+}
+
+void *usbGetFileDataBuffer(u64 *out_size)
+{
+    void *ret = NULL;
+
+    SCOPED_LOCK(&g_usbInterfaceMutex)
+    {
+        if (!g_usbTransferBuffer || !g_usbInterfaceInit || !g_usbHostAvailable || !g_usbSessionStarted || !g_usbTransferRemainingSize || g_usbFileResumeOffset || g_fileBatchTransferMode || !out_size)
+        {
+            LOG_MSG_ERROR("Invalid parameters!");
+            break;
+        }
+
+        /* Reap the oldest URB if all slots are in use. */
+        if ((g_usbPendingTransferCount + g_usbAcquiredTransferCount) >= usbGetTransferQueueLimit())
+        {
+            if (!g_usbPendingTransferCount)
+            {
+                LOG_MSG_ERROR("All USB file data buffers have already been acquired!");
+                break;
+            }
+
+            if (!usbReapTransfer())
+            {
+                LOG_MSG_ERROR("Failed to reap USB transfer!");
+                g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
+                g_nspTransferMode = g_fileBatchTransferMode = false;
+                break;
+            }
         }
+
+        /* Under compressed streams, the buffer is placed right after the frame header and sent as a stored frame. */
+        ret = (usbGetTransferSlotBuffer(g_usbPendingTransferCount + g_usbAcquiredTransferCount) + usbGetFileDataBufferOffset());
+        g_usbAcquiredTransferCount++;
+
+        *out_size = usbGetFileDataBufferSize();
     }
 
     return ret;
 }
 
+bool usbCommitFileDataBuffer(void *buf, u64 data_size)
+{
+    bool ret = false;
+    SCOPED_LOCK(&g_usbInterfaceMutex) ret = _usbSendFileData(buf, data_size, true);
+    return ret;
+}
+
 void usbCancelFileTransfer(void)
 {
     SCOPED_LOCK(&g_usbInterfaceMutex)
@@ -458,7 +657,11 @@ void usbCancelFileTransfer(void)
 
         /* Reset variables right away. */
         g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
-        g_nspTransferMode = false;
+        g_usbFileResumeOffset = 0;
+        g_nspTransferMode = g_fileBatchTransferMode = false;
+
+        /* ZLT is kept enabled throughout compressed streams. */
+        if (usbIsCompressionEnabled()) usbSetZltPacket(false);
 
         /* Prepare command data. */
         usbPrepareCommandHeader(UsbCommandType_CancelFileTransfer, 0);
@@ -545,6 +748,11 @@ static void usbDetectionThreadFunc(void *arg)
             g_usbSessionStarted = false;
             g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
             g_usbEndpointMaxPacketSize = 0;
+            g_usbSessionCapabilities = 0;
+            g_usbFileResumeOffset = 0;
+
+            /* Any URBs that were still in flight are lost at this point. */
+            usbResetTransferQueue();
 
             /* Start a USB session if we're connected to a host device. */
             /* This will essentially hang this thread and all other threads that call USB-related functions until: */
@@ -576,6 +784,9 @@ static void usbDetectionThreadFunc(void *arg)
         g_usbHostAvailable = g_usbSessionStarted = g_usbDetectionThreadExitFlag = false;
         g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
         g_usbEndpointMaxPacketSize = 0;
+        g_usbSessionCapabilities = 0;
+        g_usbFileResumeOffset = 0;
+        usbResetTransferQueue();
     }
 
     threadExit();
@@ -602,6 +813,7 @@ static bool usbStartSession(void)
     cmd_block->app_ver_micro = VERSION_MICRO;
     cmd_block->abi_version = USB_ABI_VERSION;
     snprintf(cmd_block->git_commit, sizeof(cmd_block->git_commit), "%s", GIT_COMMIT);
+    cmd_block->capabilities = UsbSessionCapability_All;
 
     ret = usbSendCommand();
     if (ret)
@@ -617,6 +829,14 @@ static bool usbStartSession(void)
             /* Reset flags. */
             ret = false;
             g_usbEndpointMaxPacketSize = 0;
+        } else {
+            /* Only keep the capabilities we actually asked for. Old host scripts always reply with zeroes here. */
+            g_usbSessionCapabilities = (((UsbStatus*)g_usbTransferBuffer)->capabilities & UsbSessionCapability_All);
+            if (g_usbSessionCapabilities & UsbSessionCapability_Lz4Compression) LOG_MSG_INFO("LZ4 compression enabled for file data streams.");
+            if (g_usbSessionCapabilities & UsbSessionCapability_FileResume) LOG_MSG_INFO("Resumable file transfers enabled.");
+            if (g_usbSessionCapabilities & UsbSessionCapability_ChunkChecksum) LOG_MSG_INFO("Integrity block checksums enabled for file data streams.");
+
+            usbConfigureTransferQueue((UsbStatus*)g_usbTransferBuffer);
         }
     }
 
@@ -641,7 +861,12 @@ static void usbEndSession(void)
 
 NX_INLINE void usbPrepareCommandHeader(u32 cmd, u32 cmd_block_size)
 {
-    if (cmd > UsbCommandType_EndSession) return;
+    if (cmd >= UsbCommandType_Count) return;
+
+    /* Commands are only ever sent after all file data URBs have been reaped, so anything still queued at this point belongs to an aborted transfer. */
+    /* Drop it before overwriting the USB transfer buffer. */
+    usbCancelTransferQueue();
+
     UsbCommandHeader *cmd_header = (UsbCommandHeader*)g_usbTransferBuffer;
     memset(cmd_header, 0, sizeof(UsbCommandHeader));
     cmd_header->magic = __builtin_bswap32(USB_CMD_HEADER_MAGIC);
@@ -755,6 +980,9 @@ static void usbLogStatusDetail(u32 status)
         case UsbStatusType_HostIoError:
             LOG_MSG_INFO("Host replied with I/O Error status code.");
             break;
+        case UsbStatusType_ChecksumMismatch:
+            LOG_MSG_INFO("Host replied with Checksum Mismatch status code.");
+            break;
         default:
             LOG_MSG_INFO("Unknown status code: 0x%X.", status);
             break;
@@ -765,7 +993,9 @@ static void usbLogStatusDetail(u32 status)
 NX_INLINE bool usbAllocateTransferBuffer(void)
 {
     if (g_usbTransferBuffer) return true;
-    g_usbTransferBuffer = memalign(USB_TRANSFER_ALIGNMENT, USB_TRANSFER_BUFFER_SIZE);
+
+    /* Integrity block trailers and status blocks are kept right after the URB slots, since they're posted as URBs of their own. */
+    g_usbTransferBuffer = memalign(USB_TRANSFER_ALIGNMENT, USB_TRANSFER_BUFFER_SIZE + USB_CHECKSUM_CONTROL_SIZE);
     return (g_usbTransferBuffer != NULL);
 }
 
@@ -776,578 +1006,1072 @@ NX_INLINE void usbFreeTransferBuffer(void)
     g_usbTransferBuffer = NULL;
 }
 
-static bool usbInitializeComms(void)
+static bool _usbSendFileProperties(u64 file_size, const char *filename, u32 nsp_header_size, bool enforce_nsp_mode, UsbFileResumeInfo *out_resume_info)
 {
-    Result rc = 0;
-    bool ret = false, is_5x = hosversionAtLeast(5, 0, 0);
+    bool ret = false, resumable = false;
+    size_t filename_length = 0;
+
+    /* Disallow sending new files if we're not in NSP transfer mode and the remaining transfer size isn't zero. */
+    /* Allow empty files if we're not in NSP transfer mode. */
+    /* Disallow sending new NSPs if we're already in NSP transfer mode. */
+    /* Resumable transfers can't be used under NSP transfer mode. */
+    if (!g_usbInterfaceInit || !g_usbTransferBuffer || !g_usbHostAvailable || !g_usbSessionStarted || (!g_nspTransferMode && g_usbTransferRemainingSize) || g_usbFileResumeOffset || \
+        (out_resume_info && (g_nspTransferMode || enforce_nsp_mode)) || !filename || !(filename_length = strlen(filename)) || filename_length >= FS_MAX_PATH || (!enforce_nsp_mode && nsp_header_size) || \
+        (enforce_nsp_mode && (g_nspTransferMode || !file_size || !nsp_header_size || nsp_header_size >= file_size)))
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    /* Prepare command data. */
+    usbPrepareCommandHeader(UsbCommandType_SendFileProperties, (u32)sizeof(UsbCommandSendFileProperties));
 
-    /* Carry out USB comms initialization steps for this HOS version. */
-    ret = (is_5x ? usbInitializeComms5x() : usbInitializeComms1x());
-    if (!ret) goto end;
+    UsbCommandSendFileProperties *cmd_block = (UsbCommandSendFileProperties*)(g_usbTransferBuffer + sizeof(UsbCommandHeader));
+    memset(cmd_block, 0, sizeof(UsbCommandSendFileProperties));
 
-    /* Enable USB interface. */
-    /* This is always needed regardless of the HOS version. */
-    rc = usbDsInterface_EnableInterface(g_usbInterface);
-    if (R_FAILED(rc))
+    cmd_block->file_size = file_size;
+    cmd_block->filename_length = (u32)filename_length;
+    cmd_block->nsp_header_size = nsp_header_size;
+    snprintf(cmd_block->filename, sizeof(cmd_block->filename), "%s", filename);
+
+    /* Only ask for resume info if the host device supports it. Empty files are always created from scratch. */
+    if (out_resume_info)
     {
-        LOG_MSG_ERROR("usbDsInterface_EnableInterface failed! (0x%X).", rc);
-        goto end;
+        memset(out_resume_info, 0, sizeof(UsbFileResumeInfo));
+        resumable = (file_size && (g_usbSessionCapabilities & UsbSessionCapability_FileResume));
+        if (resumable) cmd_block->flags |= UsbFilePropertiesFlags_Resumable;
     }
 
-    /* Additional step needed under HOS 5.0.0+. */
-    if (is_5x)
+    /* Send command. */
+    ret = usbSendCommand();
+
+    /* Read resume info block, if needed. */
+    if (ret && resumable)
     {
-        rc = usbDsEnable();
-        if (R_FAILED(rc))
+        if (!(ret = usbRead(g_usbTransferBuffer, sizeof(UsbFileResumeInfo))))
         {
-            LOG_MSG_ERROR("usbDsEnable failed! (0x%X).", rc);
-            goto end;
-        }
+            LOG_MSG_ERROR("Failed to read 0x%lX bytes long file resume info block!", sizeof(UsbFileResumeInfo));
+        } else {
+            memcpy(out_resume_info, g_usbTransferBuffer, sizeof(UsbFileResumeInfo));
 
-        g_usbHos5xEnabled = true;
+            /* Partial files are always resumed at a USB_TRANSFER_BUFFER_SIZE boundary, which keeps the ZLT logic from both sides in sync. */
+            ret = (out_resume_info->offset <= file_size && out_resume_info->tail_size <= out_resume_info->offset && out_resume_info->tail_size <= USB_FILE_RESUME_MAX_TAIL_SIZE && \
+                   (out_resume_info->offset == file_size || IS_ALIGNED(out_resume_info->offset, USB_TRANSFER_BUFFER_SIZE)));
+            if (!ret)
+            {
+                LOG_MSG_ERROR("Invalid file resume info received from USB host! (offset 0x%lX, tail size 0x%lX, file size 0x%lX).", out_resume_info->offset, out_resume_info->tail_size, file_size);
+                memset(out_resume_info, 0, sizeof(UsbFileResumeInfo));
+            }
+        }
     }
 
-    ret = true;
+    if (ret)
+    {
+        g_usbTransferRemainingSize = file_size;
+        g_usbTransferWrittenSize = 0;
+        g_usbChecksumBlockCount = 0;
+        usbResetTransferTuningSample();
+        g_fileBatchTransferMode = false;
+        if (!g_nspTransferMode && enforce_nsp_mode) g_nspTransferMode = true;
 
-end:
-    if (!ret) usbCloseComms();
+        /* File data can't be sent until usbResumeFileTransfer() is called. */
+        if (resumable) g_usbFileResumeOffset = out_resume_info->offset;
+    } else {
+        g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
+        g_nspTransferMode = g_fileBatchTransferMode = false;
+    }
 
     return ret;
 }
 
-static bool usbInitializeComms5x(void)
+static bool _usbSendFileData(void *data, u64 data_size, bool in_place)
 {
-    Result rc = 0;
     bool ret = false;
-
-    struct usb_device_descriptor device_descriptor = {
-        .bLength = USB_DT_DEVICE_SIZE,
-        .bDescriptorType = USB_DT_DEVICE,
-        .bcdUSB = USB_FS_BCD_REVISION,                  /* USB 1.1. Updated before setting new device descriptors for USB 2.0 and 3.0. */
-        .bDeviceClass = 0,                              /* Defined at interface level. */
-        .bDeviceSubClass = 0,                           /* Defined at interface level. */
-        .bDeviceProtocol = 0,                           /* Defined at interface level. */
-        .bMaxPacketSize0 = USB_FS_EP0_MAX_PACKET_SIZE,  /* Updated before setting the USB 3.0 device descriptor. */
-        .idVendor = USB_DEV_VID,
-        .idProduct = USB_DEV_PID,
-        .bcdDevice = USB_DEV_BCD_REL,
-        .iManufacturer = 0,                             /* Filled at a later time. */
-        .iProduct = 0,                                  /* Filled at a later time. */
-        .iSerialNumber = 0,                             /* Filled at a later time. */
-        .bNumConfigurations = 1
-    };
-
-    static const u16 supported_langs[] = { USB_LANGID_ENUS };
-    static const u16 num_supported_langs = (u16)MAX_ELEMENTS(supported_langs);
-
-    u8 bos[USB_BOS_SIZE] = {0};
-
-    struct usb_bos_descriptor *bos_desc = (struct usb_bos_descriptor*)bos;
-    struct usb_2_0_extension_descriptor *usb2_ext_desc = (struct usb_2_0_extension_descriptor*)(bos + sizeof(struct usb_bos_descriptor));
-    struct usb_ss_usb_device_capability_descriptor *usb3_devcap_desc = (struct usb_ss_usb_device_capability_descriptor*)((u8*)usb2_ext_desc + sizeof(struct usb_2_0_extension_descriptor));
-
-    bos_desc->bLength = sizeof(struct usb_bos_descriptor);
-    bos_desc->bDescriptorType = USB_DT_BOS;
-    bos_desc->wTotalLength = USB_BOS_SIZE;
-    bos_desc->bNumDeviceCaps = 2;   /* USB 2.0 + USB 3.0. No extra capabilities for USB 1.x. */
-
-    usb2_ext_desc->bLength = sizeof(struct usb_2_0_extension_descriptor);
-    usb2_ext_desc->bDescriptorType = USB_DT_DEVICE_CAPABILITY;
-    usb2_ext_desc->bDevCapabilityType = USB_BT_USB_2_0_EXTENSION;
-    usb2_ext_desc->bmAttributes = USB_BM_LPM_SUPPORT;
-
-    usb3_devcap_desc->bLength = sizeof(struct usb_ss_usb_device_capability_descriptor);
-    usb3_devcap_desc->bDescriptorType = USB_DT_DEVICE_CAPABILITY;
-    usb3_devcap_desc->bDevCapabilityType = USB_BT_SS_USB_DEVICE_CAPABILITY;
-    usb3_devcap_desc->bmAttributes = 0;
-    usb3_devcap_desc->wSpeedsSupported = (USB_SUPER_SPEED_OPERATION | USB_HIGH_SPEED_OPERATION | USB_FULL_SPEED_OPERATION);
-    usb3_devcap_desc->bFunctionalitySupport = 1;    /* We can fully work under USB 1.x. */
-    usb3_devcap_desc->bU1DevExitLat = 0;
-    usb3_devcap_desc->bU2DevExitLat = 0;
-
-    struct usb_interface_descriptor interface_descriptor = {
-        .bLength = USB_DT_INTERFACE_SIZE,
-        .bDescriptorType = USB_DT_INTERFACE,
-        .bInterfaceNumber = USBDS_DEFAULT_InterfaceNumber,
-        .bAlternateSetting = 0,
-        .bNumEndpoints = 2,
-        .bInterfaceClass = USB_CLASS_VENDOR_SPEC,
-        .bInterfaceSubClass = USB_CLASS_VENDOR_SPEC,
-        .bInterfaceProtocol = USB_CLASS_VENDOR_SPEC,
-        .iInterface = 0
-    };
-
-    struct usb_endpoint_descriptor endpoint_descriptor_in = {
-        .bLength = USB_DT_ENDPOINT_SIZE,
-        .bDescriptorType = USB_DT_ENDPOINT,
-        .bEndpointAddress = USB_ENDPOINT_IN,
-        .bmAttributes = USB_TRANSFER_TYPE_BULK,
-        .wMaxPacketSize = USB_FS_EP_MAX_PACKET_SIZE,    /* Updated before setting new device descriptors for USB 2.0 and 3.0. */
-        .bInterval = 0
-    };
-
-    struct usb_endpoint_descriptor endpoint_descriptor_out = {
-        .bLength = USB_DT_ENDPOINT_SIZE,
-        .bDescriptorType = USB_DT_ENDPOINT,
-        .bEndpointAddress = USB_ENDPOINT_OUT,
-        .bmAttributes = USB_TRANSFER_TYPE_BULK,
-        .wMaxPacketSize = USB_FS_EP_MAX_PACKET_SIZE,    /* Updated before setting new device descriptors for USB 2.0 and 3.0. */
-        .bInterval = 0
-    };
-
-    struct usb_ss_endpoint_companion_descriptor endpoint_companion = {
-        .bLength = sizeof(struct usb_ss_endpoint_companion_descriptor),
-        .bDescriptorType = USB_DT_SS_ENDPOINT_COMPANION,
-        .bMaxBurst = 0x0F,
-        .bmAttributes = 0,
-        .wBytesPerInterval = 0
-    };
-
-    /* Set language string descriptor. */
-    rc = usbDsAddUsbLanguageStringDescriptor(NULL, supported_langs, num_supported_langs);
-    if (R_FAILED(rc))
+    u8 *data_u8 = (u8*)data;
+    bool zlt_required = false, last_chunk = false;
+
+    /* Buffers returned by usbGetFileDataBuffer() must be committed in the same order they were acquired, and regular data chunks can't be sent while any of them is still outstanding. */
+    /* The last chunk must also be sent with no other buffers outstanding, since the status block from the host device is read into the USB transfer buffer. */
+    if (!g_usbTransferBuffer || !g_usbInterfaceInit || !g_usbHostAvailable || !g_usbSessionStarted || !g_usbTransferRemainingSize || g_usbFileResumeOffset || !data || !data_size || data_size > USB_TRANSFER_BUFFER_SIZE || \
+        data_size > g_usbTransferRemainingSize || (!in_place && g_usbAcquiredTransferCount) || (in_place && (!g_usbAcquiredTransferCount || data_size > usbGetFileDataBufferSize() || \
+        data != (usbGetTransferSlotBuffer(g_usbPendingTransferCount) + usbGetFileDataBufferOffset()) || \
+        (data_size == g_usbTransferRemainingSize && g_usbAcquiredTransferCount > 1))))
     {
-        LOG_MSG_ERROR("usbDsAddUsbLanguageStringDescriptor failed! (0x%X).", rc);
+        LOG_MSG_ERROR("Invalid parameters!");
         goto end;
     }
 
-    /* Set manufacturer string descriptor. */
-    rc = usbDsAddUsbStringDescriptor(&(device_descriptor.iManufacturer), APP_AUTHOR);
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsAddUsbStringDescriptor failed! (0x%X) (manufacturer).", rc);
-        goto end;
-    }
+    last_chunk = ((g_usbTransferRemainingSize - data_size) == 0);
 
-    /* Set product string descriptor. */
-    rc = usbDsAddUsbStringDescriptor(&(device_descriptor.iProduct), APP_TITLE);
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsAddUsbStringDescriptor failed! (0x%X) (product).", rc);
-        goto end;
-    }
+    ret = usbSendStreamData(data_u8, data_size, in_place, !g_usbTransferWrittenSize, last_chunk, &zlt_required);
 
-    /* Set serial number string descriptor. */
-    rc = usbDsAddUsbStringDescriptor(&(device_descriptor.iSerialNumber), APP_VERSION);
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsAddUsbStringDescriptor failed! (0x%X) (serial number).", rc);
-        goto end;
-    }
+    if (ret && in_place) g_usbAcquiredTransferCount--;
 
-    /* Set device descriptors. */
-    rc = usbDsSetUsbDeviceDescriptor(UsbDeviceSpeed_Full, &device_descriptor);  /* Full Speed is USB 1.1. */
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsSetUsbDeviceDescriptor failed! (0x%X) (USB 1.1).", rc);
-        goto end;
-    }
+    /* Switch to the next auto-tuning candidate if needed. */
+    if (ret && !last_chunk) ret = usbUpdateTransferTuning();
 
-    device_descriptor.bcdUSB = USB_HS_BCD_REVISION;
-    rc = usbDsSetUsbDeviceDescriptor(UsbDeviceSpeed_High, &device_descriptor);  /* High Speed is USB 2.0. */
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsSetUsbDeviceDescriptor failed! (0x%X) (USB 2.0).", rc);
-        goto end;
-    }
+    /* Wait for all URBs to be reaped if this is the last chunk. */
+    if (ret && last_chunk) ret = usbFlushTransferQueue();
 
-    device_descriptor.bcdUSB = USB_SS_BCD_REVISION;
-    device_descriptor.bMaxPacketSize0 = USB_SS_EP0_MAX_PACKET_SIZE;
-    rc = usbDsSetUsbDeviceDescriptor(UsbDeviceSpeed_Super, &device_descriptor); /* Super Speed is USB 3.0. */
-    if (R_FAILED(rc))
+    if (!ret)
     {
-        LOG_MSG_ERROR("usbDsSetUsbDeviceDescriptor failed! (0x%X) (USB 3.0).", rc);
+        LOG_MSG_ERROR("Failed to write 0x%lX bytes long file data chunk from offset 0x%lX! (total size: 0x%lX).", data_size, g_usbTransferWrittenSize, \
+                                                                                                                  g_usbTransferRemainingSize + g_usbTransferWrittenSize);
         goto end;
     }
 
-    /* Set Binary Object Store. */
-    rc = usbDsSetBinaryObjectStore(bos, USB_BOS_SIZE);
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsSetBinaryObjectStore failed! (0x%X).", rc);
-        goto end;
-    }
+    g_usbTransferRemainingSize -= data_size;
+    g_usbTransferWrittenSize += data_size;
 
-    /* Setup interface. */
-    rc = usbDsRegisterInterface(&g_usbInterface);
-    if (R_FAILED(rc))
+    /* Check if this is the last chunk. */
+    if (!g_usbTransferRemainingSize)
     {
-        LOG_MSG_ERROR("usbDsRegisterInterface failed! (0x%X).", rc);
-        goto end;
-    }
+        /* Check response from host device. */
+        if (!(ret = usbRead(g_usbTransferBuffer, sizeof(UsbStatus))))
+        {
+            LOG_MSG_ERROR("Failed to read 0x%lX bytes long status block!", sizeof(UsbStatus));
+            goto end;
+        }
 
-    interface_descriptor.bInterfaceNumber = g_usbInterface->interface_index;
-    endpoint_descriptor_in.bEndpointAddress += (interface_descriptor.bInterfaceNumber + 1);
-    endpoint_descriptor_out.bEndpointAddress += (interface_descriptor.bInterfaceNumber + 1);
+        UsbStatus *cmd_status = (UsbStatus*)g_usbTransferBuffer;
 
-    /* Full Speed config (USB 1.1). */
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Full, &interface_descriptor, USB_DT_INTERFACE_SIZE);
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 1.1) (interface).", rc);
-        goto end;
-    }
+        if (!(ret = (cmd_status->magic == __builtin_bswap32(USB_CMD_HEADER_MAGIC))))
+        {
+            LOG_MSG_ERROR("Invalid status block magic word! (0x%08X).", __builtin_bswap32(cmd_status->magic));
+            goto end;
+        }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Full, &endpoint_descriptor_in, USB_DT_ENDPOINT_SIZE);
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 1.1) (in endpoint).", rc);
-        goto end;
+        ret = (cmd_status->status == UsbStatusType_Success);
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+        if (!ret) usbLogStatusDetail(cmd_status->status);
+#endif
+
+        g_fileBatchTransferMode = false;
     }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Full, &endpoint_descriptor_out, USB_DT_ENDPOINT_SIZE);
-    if (R_FAILED(rc))
+end:
+    /* Disable ZLT if it was previously enabled. */
+    /* It may also be enabled if we failed halfway through a compressed stream. */
+    if (zlt_required || !ret) usbSetZltPacket(false);
+
+    /* Reset variables in case of errors. */
+    if (!ret)
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 1.1) (out endpoint).", rc);
-        goto end;
+        usbCancelTransferQueue();
+        g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
+        g_nspTransferMode = g_fileBatchTransferMode = false;
     }
 
-    /* High Speed config (USB 2.0). */
-    endpoint_descriptor_in.wMaxPacketSize = endpoint_descriptor_out.wMaxPacketSize = USB_HS_EP_MAX_PACKET_SIZE;
+    return ret;
+}
+
+static bool usbSendStreamData(u8 *data, u64 data_size, bool in_place, bool first_chunk, bool last_chunk, bool *out_zlt_required)
+{
+    bool ret = false, checksum = usbIsChecksumEnabled();
+    u64 data_offset = 0;
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_High, &interface_descriptor, USB_DT_INTERFACE_SIZE);
-    if (R_FAILED(rc))
+    if (checksum)
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 2.0) (interface).", rc);
-        goto end;
+        /* Every integrity block is sent as a single URB followed by its trailer, so ZLT is enabled for the whole stream. */
+        /* This lets the host device read each block with a single transfer, and keeps us from having to flush the transfer queue before the last URB. */
+        if (first_chunk)
+        {
+            usbSetZltPacket(true);
+            LOG_MSG_DEBUG("ZLT enabled (integrity block checksums).");
+        }
+
+        *out_zlt_required = last_chunk;
     }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_High, &endpoint_descriptor_in, USB_DT_ENDPOINT_SIZE);
-    if (R_FAILED(rc))
+    if (usbIsCompressionEnabled())
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 2.0) (in endpoint).", rc);
-        goto end;
+        if (first_chunk)
+        {
+            /* Every compressed frame is sent as a single URB, so ZLT is enabled for the whole stream. */
+            usbSetZltPacket(true);
+            LOG_MSG_DEBUG("ZLT enabled (compressed stream).");
+
+            /* Reset compression stats. */
+            g_usbCompressionStreamEnabled = true;
+            g_usbCompressionRawSize = g_usbCompressionPayloadSize = 0;
+        }
+
+        *out_zlt_required = last_chunk;
+
+        ret = usbSendCompressedTransferData(data, data_size, in_place);
+    } else {
+        /* Disable ZLT if this is the first of multiple data chunks. */
+        if (!checksum && !last_chunk && first_chunk)
+        {
+            usbSetZltPacket(false);
+            LOG_MSG_DEBUG("ZLT disabled (first chunk).");
+        }
+
+        if (g_fileBatchTransferMode)
+        {
+            /* Data from consecutive file batch entries is packed into full URBs. This avoids posting a tiny URB per file, and also makes the ZLT logic match the one used for regular files. */
+            ret = usbStageTransferData(data, data_size, last_chunk, out_zlt_required);
+        } else {
+            /* Queue the data chunk as multiple URBs. usbQueueTransferData() copies the provided data unless it already lives in the next URB slot, so the caller is free to reuse its buffer right away. */
+            /* Up to g_usbTransferQueueDepth URBs are kept in flight at any given time, which keeps the bus busy while the caller prepares the next data chunk. */
+            while(data_offset < data_size)
+            {
+                u32 urb_size = (u32)MIN(data_size - data_offset, (u64)g_usbTransferUrbSize);
+                bool last_urb = (last_chunk && (data_offset + urb_size) == data_size);
+
+                /* Determine if we'll need to set a Zero Length Termination (ZLT) packet. */
+                /* This is automatically handled by g_usbTransport->post_buffer_async(), depending on the ZLT setting from the input (write) endpoint. */
+                /* Since the ZLT setting applies to the whole endpoint, all pending URBs must be reaped before enabling it for the very last URB. */
+                if (!checksum && last_urb && IS_ALIGNED(urb_size, g_usbEndpointMaxPacketSize))
+                {
+                    if (!(ret = usbFlushTransferQueue())) break;
+                    *out_zlt_required = true;
+                    usbSetZltPacket(true);
+                    LOG_MSG_DEBUG("ZLT enabled. Last URB size: 0x%X bytes.", urb_size);
+                }
+
+                if (!(ret = usbQueueTransferData(data + data_offset, urb_size))) break;
+
+                data_offset += urb_size;
+            }
+        }
     }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_High, &endpoint_descriptor_out, USB_DT_ENDPOINT_SIZE);
-    if (R_FAILED(rc))
+    return ret;
+}
+
+NX_INLINE bool usbIsHostAvailable(void)
+{
+    UsbState state = UsbState_Detached;
+    Result rc = g_usbTransport->get_state(&state);
+    return (R_SUCCEEDED(rc) && state == UsbState_Configured);
+}
+
+NX_INLINE void usbSetZltPacket(bool enable)
+{
+    g_usbTransport->set_zlt(g_usbEndpointIn, enable);
+}
+
+NX_INLINE bool usbRead(void *buf, u64 size)
+{
+    return usbTransferData(buf, size, g_usbEndpointOut);
+}
+
+NX_INLINE bool usbWrite(void *buf, u64 size)
+{
+    return usbTransferData(buf, size, g_usbEndpointIn);
+}
+
+static bool usbTransferData(void *buf, u64 size, UsbDsEndpoint *endpoint)
+{
+    if (!buf || !IS_ALIGNED((u64)buf, USB_TRANSFER_ALIGNMENT) || !size || !endpoint)
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 2.0) (out endpoint).", rc);
-        goto end;
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
     }
 
-    /* Super Speed config (USB 3.0). */
-    endpoint_descriptor_in.wMaxPacketSize = endpoint_descriptor_out.wMaxPacketSize = USB_SS_EP_MAX_PACKET_SIZE;
+    if (!usbIsHostAvailable())
+    {
+        LOG_MSG_ERROR("USB host unavailable!");
+        return false;
+    }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &interface_descriptor, USB_DT_INTERFACE_SIZE);
-    if (R_FAILED(rc))
+    /* Make sure all queued file data URBs have been reaped before issuing a synchronous transfer. */
+    /* This also guarantees our USB transfer buffer isn't overwritten while the hardware is still reading from it. */
+    if (g_usbPendingTransferCount && !usbFlushTransferQueue())
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (interface).", rc);
-        goto end;
+        LOG_MSG_ERROR("Failed to flush USB transfer queue!");
+        return false;
     }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &endpoint_descriptor_in, USB_DT_ENDPOINT_SIZE);
+    Result rc = 0;
+    UsbDsReportData report_data = {0};
+    u32 urb_id = 0, transferred_size = 0;
+    bool thread_exit = false;
+
+    /* Start a USB transfer using the provided endpoint. */
+    rc = g_usbTransport->post_buffer_async(endpoint, buf, size, &urb_id);
     if (R_FAILED(rc))
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (in endpoint).", rc);
-        goto end;
+        LOG_MSG_ERROR("usbDsEndpoint_PostBufferAsync failed! (0x%X) (URB ID %u).", rc, urb_id);
+        return false;
     }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &endpoint_companion, USB_DT_SS_ENDPOINT_COMPANION_SIZE);
-    if (R_FAILED(rc))
+    /* Wait for the transfer to finish. */
+    if (g_usbSessionStarted)
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (in endpoint companion).", rc);
-        goto end;
+        /* If the USB session has already been established, then use a regular timeout value. */
+        rc = eventWait(&(endpoint->CompletionEvent), USB_TRANSFER_TIMEOUT * (u64)1000000000);
+    } else {
+        /* If we're starting a USB session, wait indefinitely inside a loop to let the user start the host script. */
+        int idx = 0;
+        Waiter completion_event_waiter = waiterForEvent(&(endpoint->CompletionEvent));
+        Waiter exit_event_waiter = waiterForUEvent(&g_usbDetectionThreadExitEvent);
+
+        rc = waitMulti(&idx, -1, completion_event_waiter, exit_event_waiter);
+        if (R_SUCCEEDED(rc) && idx == 1)
+        {
+            /* Exit event triggered. */
+            rc = MAKERESULT(Module_Kernel, KernelError_TimedOut);
+            g_usbDetectionThreadExitFlag = thread_exit = true;
+        }
     }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &endpoint_descriptor_out, USB_DT_ENDPOINT_SIZE);
+    /* Clear the endpoint completion event. */
+    if (!thread_exit) eventClear(&(endpoint->CompletionEvent));
+
     if (R_FAILED(rc))
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (out endpoint).", rc);
-        goto end;
+        /* Cancel transfer. */
+        g_usbTransport->cancel(endpoint);
+
+        /* Safety measure: wait until the completion event is triggered again before proceeding. */
+        eventWait(&(endpoint->CompletionEvent), UINT64_MAX);
+        eventClear(&(endpoint->CompletionEvent));
+
+        /* Signal user-mode USB timeout event if needed. */
+        /* This will "reset" the USB connection by making the background thread wait until a new session is established. */
+        if (g_usbSessionStarted) ueventSignal(&g_usbTimeoutEvent);
+
+        if (!thread_exit) LOG_MSG_ERROR("eventWait failed! (0x%X) (URB ID %u).", rc, urb_id);
+
+        return false;
     }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &endpoint_companion, USB_DT_SS_ENDPOINT_COMPANION_SIZE);
+    rc = g_usbTransport->get_report_data(endpoint, &report_data);
     if (R_FAILED(rc))
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (out endpoint companion).", rc);
-        goto end;
+        LOG_MSG_ERROR("usbDsEndpoint_GetReportData failed! (0x%X) (URB ID %u).", rc, urb_id);
+        return false;
     }
 
-    /* Setup endpoints. */
-    rc = usbDsInterface_RegisterEndpoint(g_usbInterface, &g_usbEndpointIn, endpoint_descriptor_in.bEndpointAddress);
+    rc = usbDsParseReportData(&report_data, urb_id, NULL, &transferred_size);
     if (R_FAILED(rc))
     {
-        LOG_MSG_ERROR("usbDsInterface_RegisterEndpoint failed! (0x%X) (in endpoint).", rc);
-        goto end;
+        LOG_MSG_ERROR("usbDsParseReportData failed! (0x%X) (URB ID %u).", rc, urb_id);
+        return false;
     }
 
-    rc = usbDsInterface_RegisterEndpoint(g_usbInterface, &g_usbEndpointOut, endpoint_descriptor_out.bEndpointAddress);
-    if (R_FAILED(rc))
+    if (transferred_size != size)
     {
-        LOG_MSG_ERROR("usbDsInterface_RegisterEndpoint failed! (0x%X) (out endpoint).", rc);
-        goto end;
+        LOG_MSG_ERROR("USB transfer failed! Expected 0x%lX bytes, got 0x%X bytes (URB ID %u).", size, transferred_size, urb_id);
+        return false;
     }
 
-    ret = true;
+    return true;
+}
 
-end:
-    return ret;
+static bool usbQueueTransferData(const void *data, u32 size)
+{
+    if (!g_usbTransferBuffer || !data || !size || size > g_usbTransferUrbSize || !g_usbEndpointIn)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    u32 slot = ((g_usbPendingTransferIdx + g_usbPendingTransferCount) % g_usbTransferQueueDepth);
+    UsbPendingTransfer *pending = &(g_usbPendingTransfers[slot]);
+    u8 *buf = usbGetTransferSlotBuffer(g_usbPendingTransferCount);
+    if (data != buf)
+    {
+        /* Reap the oldest URB if the queue is full. */
+        if (g_usbPendingTransferCount >= usbGetTransferQueueLimit() && !usbReapTransfer()) return false;
+
+        /* Copy data to the URB buffer. */
+        memcpy(buf, data, size);
+    }
+
+    pending->size = size;
+    pending->attempts = 0;
+    pending->post_tick = armGetSystemTick();
+
+    if (usbIsChecksumEnabled())
+    {
+        /* The block data stays in its URB slot until the host device verifies it, so the trailer only needs to be generated once. */
+        UsbChecksumBlockTrailer *trailer = usbGetChecksumBlockTrailer(slot);
+        memset(trailer, 0, sizeof(UsbChecksumBlockTrailer));
+
+        trailer->magic = __builtin_bswap32(USB_CHECKSUM_TRAILER_MAGIC);
+        trailer->crc32 = crc32Calculate(buf, size);
+        trailer->block_size = size;
+        trailer->block_idx = g_usbChecksumBlockCount++;
+    }
+
+    /* Account for the URB right away, so it gets cancelled if posting a trailer or status block read fails afterwards. */
+    g_usbPendingTransferCount++;
+
+    if (!usbPostTransfer(slot)) return false;
+
+    /* Keep track of the current auto-tuning sample. */
+    if (g_usbTransferTuningActive) g_usbTransferTuningSampleSize += size;
+
+    return true;
 }
 
-static bool usbInitializeComms1x(void)
+static bool usbPostTransfer(u32 slot)
 {
     Result rc = 0;
-    bool ret = false;
+    UsbPendingTransfer *pending = &(g_usbPendingTransfers[slot]);
+    u8 *buf = (g_usbTransferBuffer + (slot * g_usbTransferUrbSize));
 
-    static const UsbDsDeviceInfo device_info = {
-        .idVendor = USB_DEV_VID,
-        .idProduct = USB_DEV_PID,
-        .bcdDevice = USB_DEV_BCD_REL,
-        .Manufacturer = APP_AUTHOR,
-        .Product = APP_TITLE,
-        .SerialNumber = APP_VERSION
-    };
-
-    struct usb_interface_descriptor interface_descriptor = {
-        .bLength = USB_DT_INTERFACE_SIZE,
-        .bDescriptorType = USB_DT_INTERFACE,
-        .bInterfaceNumber = 0,
-        .bAlternateSetting = 0,
-        .bInterfaceClass = USB_CLASS_VENDOR_SPEC,
-        .bInterfaceSubClass = USB_CLASS_VENDOR_SPEC,
-        .bInterfaceProtocol = USB_CLASS_VENDOR_SPEC,
-        .iInterface = 0
-    };
-
-    struct usb_endpoint_descriptor endpoint_descriptor_in = {
-        .bLength = USB_DT_ENDPOINT_SIZE,
-        .bDescriptorType = USB_DT_ENDPOINT,
-        .bEndpointAddress = USB_ENDPOINT_IN,
-        .bmAttributes = USB_TRANSFER_TYPE_BULK,
-        .wMaxPacketSize = USB_HS_EP_MAX_PACKET_SIZE,
-        .bInterval = 0
-    };
-
-    struct usb_endpoint_descriptor endpoint_descriptor_out = {
-        .bLength = USB_DT_ENDPOINT_SIZE,
-        .bDescriptorType = USB_DT_ENDPOINT,
-        .bEndpointAddress = USB_ENDPOINT_OUT,
-        .bmAttributes = USB_TRANSFER_TYPE_BULK,
-        .wMaxPacketSize = USB_HS_EP_MAX_PACKET_SIZE,
-        .bInterval = 0
-    };
-
-    /* Set VID, PID and BCD. */
-    rc = usbDsSetVidPidBcd(&device_info);
+    /* Post URB to the input endpoint. */
+    rc = g_usbTransport->post_buffer_async(g_usbEndpointIn, buf, pending->size, &(pending->urb_id));
     if (R_FAILED(rc))
     {
-        LOG_MSG_ERROR("usbDsSetVidPidBcd failed! (0x%X).", rc);
-        goto end;
+        LOG_MSG_ERROR("usbDsEndpoint_PostBufferAsync failed! (0x%X).", rc);
+        return false;
     }
 
-    /* Setup interface. */
-    rc = usbDsGetDsInterface(&g_usbInterface, &interface_descriptor, "usb");
+    if (!usbIsChecksumEnabled()) return true;
+
+    /* Post the integrity block trailer right after the block data. */
+    rc = g_usbTransport->post_buffer_async(g_usbEndpointIn, usbGetChecksumBlockTrailer(slot), sizeof(UsbChecksumBlockTrailer), &(pending->trailer_urb_id));
     if (R_FAILED(rc))
     {
-        LOG_MSG_ERROR("usbDsGetDsInterface failed! (0x%X).", rc);
-        goto end;
+        LOG_MSG_ERROR("usbDsEndpoint_PostBufferAsync failed! (0x%X) (trailer).", rc);
+        return false;
     }
 
-    /* Setup endpoints. */
-    rc = usbDsInterface_GetDsEndpoint(g_usbInterface, &g_usbEndpointIn, &endpoint_descriptor_in);
+    /* Post a read for the status block sent by the host device after verifying this block. It's checked once this block becomes the oldest pending one. */
+    rc = g_usbTransport->post_buffer_async(g_usbEndpointOut, usbGetChecksumBlockStatus(slot), sizeof(UsbStatus), &(pending->status_urb_id));
     if (R_FAILED(rc))
     {
-        LOG_MSG_ERROR("usbDsInterface_GetDsEndpoint failed! (0x%X) (in endpoint).", rc);
-        goto end;
+        LOG_MSG_ERROR("usbDsEndpoint_PostBufferAsync failed! (0x%X) (status).", rc);
+        return false;
+    }
+
+    return true;
+}
+
+static bool usbWaitForTransfer(UsbDsEndpoint *endpoint, u32 urb_id, u32 size)
+{
+    Result rc = 0;
+    UsbDsReportData report_data = {0};
+    u32 transferred_size = 0;
+    u64 deadline = (armTicksToNs(armGetSystemTick()) + (USB_TRANSFER_TIMEOUT * (u64)1000000000));
+
+    /* URBs complete in the same order they were posted, so we only ever need to look for the oldest one. */
+    /* The completion event is shared by all URBs posted to the endpoint, so it must be cleared before checking the report data to avoid missing a signal. */
+    while(true)
+    {
+        eventClear(&(endpoint->CompletionEvent));
+
+        rc = g_usbTransport->get_report_data(endpoint, &report_data);
+        if (R_FAILED(rc))
+        {
+            LOG_MSG_ERROR("usbDsEndpoint_GetReportData failed! (0x%X) (URB ID %u).", rc, urb_id);
+            break;
+        }
+
+        rc = usbDsParseReportData(&report_data, urb_id, NULL, &transferred_size);
+        if (R_SUCCEEDED(rc)) break;
+
+        /* Wait for another URB to complete. */
+        u64 now = armTicksToNs(armGetSystemTick());
+        rc = (now < deadline ? eventWait(&(endpoint->CompletionEvent), deadline - now) : MAKERESULT(Module_Kernel, KernelError_TimedOut));
+        if (R_FAILED(rc))
+        {
+            LOG_MSG_ERROR("eventWait failed! (0x%X) (URB ID %u).", rc, urb_id);
+
+            /* Cancel all pending URBs and signal the user-mode USB timeout event. */
+            /* This will "reset" the USB connection by making the background thread wait until a new session is established. */
+            usbCancelTransferQueue();
+            if (g_usbSessionStarted) ueventSignal(&g_usbTimeoutEvent);
+
+            return false;
+        }
     }
 
-    rc = usbDsInterface_GetDsEndpoint(g_usbInterface, &g_usbEndpointOut, &endpoint_descriptor_out);
     if (R_FAILED(rc))
     {
-        LOG_MSG_ERROR("usbDsInterface_GetDsEndpoint failed! (0x%X) (out endpoint).", rc);
-        goto end;
+        usbCancelTransferQueue();
+        return false;
+    }
+
+    if (transferred_size != size)
+    {
+        LOG_MSG_ERROR("USB transfer failed! Expected 0x%X bytes, got 0x%X bytes (URB ID %u).", size, transferred_size, urb_id);
+        usbCancelTransferQueue();
+        return false;
     }
 
-    ret = true;
+    return true;
+}
 
-end:
-    return ret;
+NX_INLINE bool usbIsTransferComplete(UsbDsEndpoint *endpoint, u32 urb_id)
+{
+    UsbDsReportData report_data = {0};
+    return (R_SUCCEEDED(g_usbTransport->get_report_data(endpoint, &report_data)) && R_SUCCEEDED(usbDsParseReportData(&report_data, urb_id, NULL, NULL)));
 }
 
-static void usbCloseComms(void)
+static bool usbReapTransfer(void)
 {
-    bool is_5x = hosversionAtLeast(5, 0, 0);
+    if (!g_usbPendingTransferCount) return true;
+
+    UsbPendingTransfer *pending = &(g_usbPendingTransfers[g_usbPendingTransferIdx]);
 
-    if (is_5x && g_usbHos5xEnabled)
+    /* While auto-tuning, only time URBs we actually have to block on because the queue is full. */
+    bool timed = (g_usbTransferTuningActive && (g_usbPendingTransferCount + g_usbAcquiredTransferCount) >= usbGetTransferQueueLimit() && \
+                  !usbIsTransferComplete(g_usbEndpointIn, pending->urb_id));
+
+    if (!usbWaitForTransfer(g_usbEndpointIn, pending->urb_id, pending->size)) return false;
+
+    if (g_usbTransferTuningActive) usbSampleTransferTuning(pending, timed);
+
+    /* Integrity blocks keep their URB slot until the host device has verified them. */
+    if (usbIsChecksumEnabled() && !usbReapChecksumBlock()) return false;
+
+    g_usbPendingTransferIdx = ((g_usbPendingTransferIdx + 1) % g_usbTransferQueueDepth);
+    g_usbPendingTransferCount--;
+
+    return true;
+}
+
+static bool usbFlushTransferQueue(void)
+{
+    while(g_usbPendingTransferCount)
+    {
+        if (!usbReapTransfer()) return false;
+    }
+
+    return true;
+}
+
+static void usbCancelTransferQueue(void)
+{
+    if (!g_usbPendingTransferCount)
     {
-        usbDsDisable();
-        g_usbHos5xEnabled = false;
+        /* Drop acquired buffers and staged data. */
+        g_usbAcquiredTransferCount = g_usbStagedTransferSize = 0;
+        return;
     }
 
-    if (g_usbEndpointOut)
+    /* Cancel all URBs posted to the input endpoint. */
+    g_usbTransport->cancel(g_usbEndpointIn);
+
+    /* Safety measure: wait until the completion event is triggered again before proceeding. */
+    eventWait(&(g_usbEndpointIn->CompletionEvent), USB_TRANSFER_TIMEOUT * (u64)1000000000);
+    eventClear(&(g_usbEndpointIn->CompletionEvent));
+
+    /* Integrity blocks also keep status block reads posted to the output endpoint. */
+    if (usbIsChecksumEnabled())
     {
-        usbDsEndpoint_Close(g_usbEndpointOut);
-        g_usbEndpointOut = NULL;
+        g_usbTransport->cancel(g_usbEndpointOut);
+        eventWait(&(g_usbEndpointOut->CompletionEvent), USB_TRANSFER_TIMEOUT * (u64)1000000000);
+        eventClear(&(g_usbEndpointOut->CompletionEvent));
     }
 
-    if (g_usbEndpointIn)
+    usbResetTransferQueue();
+}
+
+NX_INLINE void usbResetTransferQueue(void)
+{
+    memset(g_usbPendingTransfers, 0, sizeof(g_usbPendingTransfers));
+    g_usbPendingTransferIdx = g_usbPendingTransferCount = g_usbAcquiredTransferCount = g_usbStagedTransferSize = 0;
+}
+
+NX_INLINE u32 usbGetTransferQueueLimit(void)
+{
+    return (usbIsChecksumEnabled() ? MIN(g_usbTransferQueueDepth, (u32)USB_CHECKSUM_MAX_QUEUE_DEPTH) : g_usbTransferQueueDepth);
+}
+
+NX_INLINE u8 *usbGetTransferSlotBuffer(u32 pos)
+{
+    /* 'pos' is relative to the oldest pending URB. */
+    return (g_usbTransferBuffer + (((g_usbPendingTransferIdx + pos) % g_usbTransferQueueDepth) * g_usbTransferUrbSize));
+}
+
+static bool usbStageTransferData(const u8 *data, u64 size, bool flush, bool *out_zlt_required)
+{
+    u8 *buf = NULL;
+    u64 offset = 0;
+
+    while(offset < size)
     {
-        usbDsEndpoint_Close(g_usbEndpointIn);
-        g_usbEndpointIn = NULL;
+        /* Make sure the next URB slot is free before staging data into it. */
+        if (!g_usbStagedTransferSize && g_usbPendingTransferCount >= usbGetTransferQueueLimit() && !usbReapTransfer()) return false;
+
+        buf = usbGetTransferSlotBuffer(g_usbPendingTransferCount);
+
+        u32 copy_size = (u32)MIN(size - offset, (u64)(g_usbTransferUrbSize - g_usbStagedTransferSize));
+        memcpy(buf + g_usbStagedTransferSize, data + offset, copy_size);
+
+        g_usbStagedTransferSize += copy_size;
+        offset += copy_size;
+
+        /* Post the URB as soon as it's full, unless it's the very last one. */
+        if (g_usbStagedTransferSize == g_usbTransferUrbSize && (!flush || offset < size))
+        {
+            if (!usbQueueTransferData(buf, g_usbStagedTransferSize)) return false;
+            g_usbStagedTransferSize = 0;
+        }
     }
 
-    if (g_usbInterface)
+    if (!flush || !g_usbStagedTransferSize) return true;
+
+    /* Enable ZLT if the last URB size is aligned to the USB endpoint max packet size. */
+    /* Since the ZLT setting applies to the whole endpoint, all pending URBs must be reaped first. This doesn't affect the staged URB slot. */
+    if (!usbIsChecksumEnabled() && IS_ALIGNED(g_usbStagedTransferSize, g_usbEndpointMaxPacketSize))
     {
-        /* usbDsInterface_DisableInterface() is internally called here. */
-        usbDsInterface_Close(g_usbInterface);
-        g_usbInterface = NULL;
+        if (!usbFlushTransferQueue()) return false;
+        *out_zlt_required = true;
+        usbSetZltPacket(true);
+        LOG_MSG_DEBUG("ZLT enabled. Last URB size: 0x%X bytes.", g_usbStagedTransferSize);
     }
 
-    if (is_5x) usbDsClearDeviceData();
+    buf = usbGetTransferSlotBuffer(g_usbPendingTransferCount);
+    if (!usbQueueTransferData(buf, g_usbStagedTransferSize)) return false;
+
+    g_usbStagedTransferSize = 0;
+
+    return true;
 }
 
-static bool _usbSendFileProperties(u64 file_size, const char *filename, u32 nsp_header_size, bool enforce_nsp_mode)
+static void usbConfigureTransferQueue(const UsbStatus *status)
 {
-    bool ret = false;
-    size_t filename_length = 0;
+    const UsbTransferQueueConfig *config = &(g_usbTransferQueueConfigs[usbGetDefaultTransferQueueConfigIndex()]);
 
-    /* Disallow sending new files if we're not in NSP transfer mode and the remaining transfer size isn't zero. */
-    /* Allow empty files if we're not in NSP transfer mode. */
-    /* Disallow sending new NSPs if we're already in NSP transfer mode. */
-    if (!g_usbInterfaceInit || !g_usbTransferBuffer || !g_usbHostAvailable || !g_usbSessionStarted || (!g_nspTransferMode && g_usbTransferRemainingSize) || \
-        !filename || !(filename_length = strlen(filename)) || filename_length >= FS_MAX_PATH || (!enforce_nsp_mode && nsp_header_size) || \
-        (enforce_nsp_mode && (g_nspTransferMode || !file_size || !nsp_header_size || nsp_header_size >= file_size)))
+    g_usbTransferTuningActive = false;
+    usbResetTransferTuningSample();
+
+    if (g_usbSessionCapabilities & UsbSessionCapability_TransferTuning)
     {
-        LOG_MSG_ERROR("Invalid parameters!");
-        return false;
+        if (status->queue_depth || status->urb_size)
+        {
+            /* Use the queue configuration requested by the host device, as long as it's valid. */
+            if (usbIsValidTransferQueueConfig(status->urb_size, status->queue_depth))
+            {
+                usbSetTransferQueueConfig(status->urb_size, status->queue_depth);
+                LOG_MSG_INFO("Using USB transfer queue configuration requested by the host device (%u URBs, 0x%X bytes each).", g_usbTransferQueueDepth, g_usbTransferUrbSize);
+                return;
+            }
+
+            LOG_MSG_WARNING("Invalid USB transfer queue configuration requested by the host device (%u URBs, 0x%X bytes each). Using defaults.", status->queue_depth, status->urb_size);
+        } else
+        if (g_usbEndpointMaxPacketSize != USB_FS_EP_MAX_PACKET_SIZE)
+        {
+            /* Auto-tune the queue configuration by sending a sample from the next file data streams with each candidate. */
+            /* This is skipped under USB 1.x, since sending each sample would take way too long. */
+            g_usbTransferTuningActive = true;
+            g_usbTransferTuningBestRate = 0;
+            g_usbTransferTuningIdx = g_usbTransferTuningBestIdx = usbGetNextTransferQueueConfigIndex(0);
+            config = &(g_usbTransferQueueConfigs[g_usbTransferTuningIdx]);
+            LOG_MSG_INFO("USB transfer queue auto-tuning enabled.");
+        }
     }
 
-    /* Prepare command data. */
-    usbPrepareCommandHeader(UsbCommandType_SendFileProperties, (u32)sizeof(UsbCommandSendFileProperties));
+    usbSetTransferQueueConfig(config->urb_size, config->queue_depth);
+}
 
-    UsbCommandSendFileProperties *cmd_block = (UsbCommandSendFileProperties*)(g_usbTransferBuffer + sizeof(UsbCommandHeader));
-    memset(cmd_block, 0, sizeof(UsbCommandSendFileProperties));
+NX_INLINE bool usbIsValidTransferQueueConfig(u32 urb_size, u32 queue_depth)
+{
+    return (queue_depth > 0 && queue_depth <= USB_TRANSFER_MAX_QUEUE_DEPTH && urb_size >= USB_TRANSFER_MIN_URB_SIZE && IS_ALIGNED(urb_size, USB_TRANSFER_ALIGNMENT) && \
+            ((u64)urb_size * queue_depth) <= USB_TRANSFER_BUFFER_SIZE && (!usbIsCompressionEnabled() || urb_size >= USB_COMPRESSION_MIN_URB_SIZE));
+}
 
-    cmd_block->file_size = file_size;
-    cmd_block->filename_length = (u32)filename_length;
-    cmd_block->nsp_header_size = nsp_header_size;
-    snprintf(cmd_block->filename, sizeof(cmd_block->filename), "%s", filename);
+NX_INLINE u32 usbGetDefaultTransferQueueConfigIndex(void)
+{
+    /* Use the max packet size as a speed hint, since usbDsGetSpeed() is only available under HOS 8.0.0+. */
+    u32 idx = (g_usbEndpointMaxPacketSize == USB_SS_EP_MAX_PACKET_SIZE ? 2 : (g_usbEndpointMaxPacketSize == USB_HS_EP_MAX_PACKET_SIZE ? 1 : 0));
+    return usbGetNextTransferQueueConfigIndex(idx);
+}
 
-    /* Send command. */
-    ret = usbSendCommand();
-    if (ret)
+NX_INLINE u32 usbGetNextTransferQueueConfigIndex(u32 idx)
+{
+    /* Skip candidates that can't be used under the current session, e.g. URBs that are too small for compressed frames. */
+    while(idx < g_usbTransferQueueConfigsCount && !usbIsValidTransferQueueConfig(g_usbTransferQueueConfigs[idx].urb_size, g_usbTransferQueueConfigs[idx].queue_depth)) idx++;
+    return idx;
+}
+
+static void usbSetTransferQueueConfig(u32 urb_size, u32 queue_depth)
+{
+    /* URB slots are laid out right away, so the transfer queue must be empty at this point. */
+    g_usbTransferUrbSize = urb_size;
+    g_usbTransferQueueDepth = queue_depth;
+    usbResetTransferQueue();
+}
+
+static bool usbUpdateTransferTuning(void)
+{
+    /* URB slots can only be rearranged if there are no outstanding buffers and no staged data. */
+    if (!g_usbTransferTuningActive || (g_usbTransferTuningTimedSize < USB_TRANSFER_TUNING_SAMPLE_SIZE && g_usbTransferTuningSampleSize < USB_TRANSFER_TUNING_MAX_SAMPLE_SIZE) || \
+        g_usbAcquiredTransferCount || g_usbStagedTransferSize) return true;
+
+    /* Slots can't be rearranged while URBs are in flight. */
+    if (!usbFlushTransferQueue()) return false;
+
+    const UsbTransferQueueConfig *config = &(g_usbTransferQueueConfigs[g_usbTransferTuningIdx]);
+    u64 elapsed = armTicksToNs(g_usbTransferTuningTimedTicks);
+    u64 rate = (elapsed ? ((g_usbTransferTuningTimedSize * 1000000000UL) / elapsed) : 0);
+
+    LOG_MSG_DEBUG("USB transfer queue candidate #%u (%u URBs, 0x%X bytes each): %lu KiB/s (0x%lX out of 0x%lX bytes timed).", g_usbTransferTuningIdx, config->queue_depth, config->urb_size, rate / 1024, \
+                  g_usbTransferTuningTimedSize, g_usbTransferTuningSampleSize);
+
+    if (rate > g_usbTransferTuningBestRate)
     {
-        g_usbTransferRemainingSize = file_size;
-        g_usbTransferWrittenSize = 0;
-        if (!g_nspTransferMode && enforce_nsp_mode) g_nspTransferMode = true;
+        g_usbTransferTuningBestRate = rate;
+        g_usbTransferTuningBestIdx = g_usbTransferTuningIdx;
+    }
+
+    usbResetTransferTuningSample();
+    g_usbTransferTuningIdx = usbGetNextTransferQueueConfigIndex(g_usbTransferTuningIdx + 1);
+
+    if (g_usbTransferTuningIdx < g_usbTransferQueueConfigsCount)
+    {
+        config = &(g_usbTransferQueueConfigs[g_usbTransferTuningIdx]);
     } else {
-        g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
-        g_nspTransferMode = false;
+        /* All candidates have been measured. Settle on the fastest one for the rest of the session. */
+        g_usbTransferTuningActive = false;
+        config = &(g_usbTransferQueueConfigs[g_usbTransferTuningBestIdx]);
+        LOG_MSG_INFO("USB transfer queue auto-tuning finished (%u URBs, 0x%X bytes each, %lu KiB/s).", config->queue_depth, config->urb_size, g_usbTransferTuningBestRate / 1024);
     }
 
-    return ret;
+    usbSetTransferQueueConfig(config->urb_size, config->queue_depth);
+
+    return true;
 }
 
-NX_INLINE bool usbIsHostAvailable(void)
+static void usbSampleTransferTuning(const UsbPendingTransfer *pending, bool timed)
 {
-    UsbState state = UsbState_Detached;
-    Result rc = usbDsGetState(&state);
-    return (R_SUCCEEDED(rc) && state == UsbState_Configured);
+    u64 now = armGetSystemTick();
+
+    /* Only the time between two consecutive timed completions is measured, which is how long the endpoint took to send this URB while the queue was saturated. */
+    /* If the URB was posted after the previous one completed, the queue ran empty in between, so the sample is dropped. */
+    if (timed && g_usbTransferTuningLastTick && pending->post_tick <= g_usbTransferTuningLastTick)
+    {
+        g_usbTransferTuningTimedTicks += (now - g_usbTransferTuningLastTick);
+        g_usbTransferTuningTimedSize += pending->size;
+    }
+
+    g_usbTransferTuningLastTick = (timed ? now : 0);
 }
 
-NX_INLINE void usbSetZltPacket(bool enable)
+NX_INLINE void usbResetTransferTuningSample(void)
 {
-    usbDsEndpoint_SetZlt(g_usbEndpointIn, enable);
+    g_usbTransferTuningSampleSize = g_usbTransferTuningTimedSize = g_usbTransferTuningTimedTicks = g_usbTransferTuningLastTick = 0;
 }
 
-NX_INLINE bool usbRead(void *buf, u64 size)
+NX_INLINE bool usbIsCompressionEnabled(void)
 {
-    return usbTransferData(buf, size, g_usbEndpointOut);
+    return ((g_usbSessionCapabilities & UsbSessionCapability_Lz4Compression) != 0);
 }
 
-NX_INLINE bool usbWrite(void *buf, u64 size)
+NX_INLINE u32 usbGetFileDataBufferOffset(void)
 {
-    return usbTransferData(buf, size, g_usbEndpointIn);
+    return (usbIsCompressionEnabled() ? (u32)sizeof(UsbCompressedFrameHeader) : 0);
 }
 
-static bool usbTransferData(void *buf, u64 size, UsbDsEndpoint *endpoint)
+static bool usbSendCompressedTransferData(const u8 *data, u64 size, bool in_place)
 {
-    if (!buf || !IS_ALIGNED((u64)buf, USB_TRANSFER_ALIGNMENT) || !size || !endpoint)
+    u64 offset = 0;
+
+    /* Buffers returned by usbGetFileDataBuffer() already live right after the frame header in the next URB slot, so they're sent as stored frames. */
+    if (in_place)
     {
-        LOG_MSG_ERROR("Invalid parameters!");
-        return false;
+        UsbCompressionJob job = { .data = data, .raw_size = (u32)size, .compress = false, .frame = usbGetTransferSlotBuffer(g_usbPendingTransferCount) };
+        usbProcessCompressionJob(&job);
+        return usbQueueTransferData(job.frame, job.frame_size);
     }
 
-    if (!usbIsHostAvailable())
+    while(offset < size)
     {
-        LOG_MSG_ERROR("USB host unavailable!");
-        return false;
+        /* Reap the oldest URB if the queue is full. */
+        if (g_usbPendingTransferCount >= usbGetTransferQueueLimit() && !usbReapTransfer()) return false;
+
+        /* Generate as many frames as we have free URB slots. These are compressed in parallel. */
+        u32 job_count = 0, free_slots = (usbGetTransferQueueLimit() - g_usbPendingTransferCount);
+
+        for(; job_count < free_slots && offset < size; job_count++)
+        {
+            UsbCompressionJob *job = &(g_usbCompressionJobs[job_count]);
+
+            job->data = (data + offset);
+            job->raw_size = (u32)MIN(size - offset, (u64)USB_COMPRESSION_BLOCK_SIZE);
+            job->compress = g_usbCompressionStreamEnabled;
+            job->frame = usbGetTransferSlotBuffer(g_usbPendingTransferCount + job_count);
+            job->frame_size = 0;
+
+            offset += job->raw_size;
+        }
+
+        usbRunCompressionJobs(job_count);
+
+        /* Post frames in order. */
+        for(u32 i = 0; i < job_count; i++)
+        {
+            UsbCompressionJob *job = &(g_usbCompressionJobs[i]);
+
+            if (!usbQueueTransferData(job->frame, job->frame_size)) return false;
+
+            if (job->compress)
+            {
+                g_usbCompressionRawSize += job->raw_size;
+                g_usbCompressionPayloadSize += (job->frame_size - sizeof(UsbCompressedFrameHeader));
+            }
+        }
+
+        /* Stop compressing data for the rest of the stream if we're saving less than ~6%. It'll most likely be encrypted or already compressed. */
+        if (g_usbCompressionStreamEnabled && g_usbCompressionRawSize >= USB_COMPRESSION_PROBE_SIZE && (g_usbCompressionPayloadSize * 16) > (g_usbCompressionRawSize * 15))
+        {
+            LOG_MSG_DEBUG("Disabling compression for the current stream (0x%lX -> 0x%lX).", g_usbCompressionRawSize, g_usbCompressionPayloadSize);
+            g_usbCompressionStreamEnabled = false;
+        }
     }
 
-    Result rc = 0;
-    UsbDsReportData report_data = {0};
-    u32 urb_id = 0, transferred_size = 0;
-    bool thread_exit = false;
+    return true;
+}
 
-    /* Start a USB transfer using the provided endpoint. */
-    rc = usbDsEndpoint_PostBufferAsync(endpoint, buf, size, &urb_id);
-    if (R_FAILED(rc))
+static void usbProcessCompressionJob(UsbCompressionJob *job)
+{
+    UsbCompressedFrameHeader *frame_header = (UsbCompressedFrameHeader*)job->frame;
+    u8 *payload = (job->frame + sizeof(UsbCompressedFrameHeader));
+    int payload_size = 0;
+
+    if (job->compress) payload_size = LZ4_compress_default((const char*)job->data, (char*)payload, (int)job->raw_size, (int)(g_usbTransferUrbSize - sizeof(UsbCompressedFrameHeader)));
+
+    /* Store raw data if compression failed or if it didn't shrink the data. */
+    /* Raw data is already in place if this frame was built from a buffer returned by usbGetFileDataBuffer(). */
+    if (payload_size <= 0 || (u32)payload_size >= job->raw_size)
     {
-        LOG_MSG_ERROR("usbDsEndpoint_PostBufferAsync failed! (0x%X) (URB ID %u).", rc, urb_id);
-        return false;
+        if (job->data != payload) memcpy(payload, job->data, job->raw_size);
+        payload_size = (int)job->raw_size;
     }
 
-    /* Wait for the transfer to finish. */
-    if (g_usbSessionStarted)
+    frame_header->magic = __builtin_bswap32(USB_FRAME_HEADER_MAGIC);
+    frame_header->raw_size = job->raw_size;
+    frame_header->payload_size = (u32)payload_size;
+    memset(frame_header->reserved, 0, sizeof(frame_header->reserved));
+
+    job->frame_size = (u32)(sizeof(UsbCompressedFrameHeader) + payload_size);
+}
+
+static void usbRunCompressionJobs(u32 job_count)
+{
+    if (!job_count) return;
+
+    /* Don't bother waking up the compression threads if there's nothing to compress. */
+    if (job_count == 1 || !g_usbCompressionJobs[0].compress || (!g_usbCompressionThreadCount && !usbCreateCompressionThreads()))
     {
-        /* If the USB session has already been established, then use a regular timeout value. */
-        rc = eventWait(&(endpoint->CompletionEvent), USB_TRANSFER_TIMEOUT * (u64)1000000000);
-    } else {
-        /* If we're starting a USB session, wait indefinitely inside a loop to let the user start the host script. */
-        int idx = 0;
-        Waiter completion_event_waiter = waiterForEvent(&(endpoint->CompletionEvent));
-        Waiter exit_event_waiter = waiterForUEvent(&g_usbDetectionThreadExitEvent);
+        for(u32 i = 0; i < job_count; i++) usbProcessCompressionJob(&(g_usbCompressionJobs[i]));
+        return;
+    }
 
-        rc = waitMulti(&idx, -1, completion_event_waiter, exit_event_waiter);
-        if (R_SUCCEEDED(rc) && idx == 1)
+    /* Dispatch jobs. */
+    SCOPED_LOCK(&g_usbCompressionMutex)
+    {
+        g_usbCompressionJobCount = job_count;
+        g_usbCompressionNextJob = g_usbCompressionDoneCount = 0;
+        condvarWakeAll(&g_usbCompressionJobCondvar);
+    }
+
+    /* Process jobs in this thread as well. */
+    while(true)
+    {
+        u32 job_idx = 0;
+
+        mutexLock(&g_usbCompressionMutex);
+        job_idx = g_usbCompressionNextJob;
+        if (job_idx < g_usbCompressionJobCount) g_usbCompressionNextJob++;
+        mutexUnlock(&g_usbCompressionMutex);
+
+        if (job_idx >= job_count) break;
+
+        usbProcessCompressionJob(&(g_usbCompressionJobs[job_idx]));
+
+        mutexLock(&g_usbCompressionMutex);
+        g_usbCompressionDoneCount++;
+        mutexUnlock(&g_usbCompressionMutex);
+    }
+
+    /* Wait until all jobs have been processed. */
+    SCOPED_LOCK(&g_usbCompressionMutex)
+    {
+        while(g_usbCompressionDoneCount < g_usbCompressionJobCount) condvarWait(&g_usbCompressionDoneCondvar, &g_usbCompressionMutex);
+        g_usbCompressionJobCount = g_usbCompressionNextJob = g_usbCompressionDoneCount = 0;
+    }
+}
+
+static bool usbCreateCompressionThreads(void)
+{
+    g_usbCompressionThreadExitFlag = false;
+
+    for(u32 i = 0; i < USB_COMPRESSION_THREAD_COUNT; i++)
+    {
+        if (!utilsCreateThread(&(g_usbCompressionThreads[i]), usbCompressionThreadFunc, NULL, (int)i))
         {
-            /* Exit event triggered. */
-            rc = MAKERESULT(Module_Kernel, KernelError_TimedOut);
-            g_usbDetectionThreadExitFlag = thread_exit = true;
+            LOG_MSG_ERROR("Failed to create USB compression thread #%u!", i);
+            usbDestroyCompressionThreads();
+            return false;
         }
+
+        g_usbCompressionThreadCount++;
     }
 
-    /* Clear the endpoint completion event. */
-    if (!thread_exit) eventClear(&(endpoint->CompletionEvent));
+    return true;
+}
 
-    if (R_FAILED(rc))
+static void usbDestroyCompressionThreads(void)
+{
+    if (!g_usbCompressionThreadCount) return;
+
+    /* Signal the exit flag and wake up all compression threads. */
+    SCOPED_LOCK(&g_usbCompressionMutex)
     {
-        /* Cancel transfer. */
-        usbDsEndpoint_Cancel(endpoint);
+        g_usbCompressionThreadExitFlag = true;
+        condvarWakeAll(&g_usbCompressionJobCondvar);
+    }
 
-        /* Safety measure: wait until the completion event is triggered again before proceeding. */
-        eventWait(&(endpoint->CompletionEvent), UINT64_MAX);
-        eventClear(&(endpoint->CompletionEvent));
+    for(u32 i = 0; i < g_usbCompressionThreadCount; i++) utilsJoinThread(&(g_usbCompressionThreads[i]));
 
-        /* Signal user-mode USB timeout event if needed. */
-        /* This will "reset" the USB connection by making the background thread wait until a new session is established. */
-        if (g_usbSessionStarted) ueventSignal(&g_usbTimeoutEvent);
+    g_usbCompressionThreadCount = 0;
+    g_usbCompressionThreadExitFlag = false;
+}
 
-        if (!thread_exit) LOG_MSG_ERROR("eventWait failed! (0x%X) (URB ID %u).", rc, urb_id);
+static void usbCompressionThreadFunc(void *arg)
+{
+    (void)arg;
 
-        return false;
+    while(true)
+    {
+        u32 job_idx = 0;
+
+        /* Wait until a job is available. */
+        mutexLock(&g_usbCompressionMutex);
+
+        while(!g_usbCompressionThreadExitFlag && g_usbCompressionNextJob >= g_usbCompressionJobCount) condvarWait(&g_usbCompressionJobCondvar, &g_usbCompressionMutex);
+
+        if (g_usbCompressionThreadExitFlag)
+        {
+            mutexUnlock(&g_usbCompressionMutex);
+            break;
+        }
+
+        job_idx = g_usbCompressionNextJob++;
+
+        mutexUnlock(&g_usbCompressionMutex);
+
+        usbProcessCompressionJob(&(g_usbCompressionJobs[job_idx]));
+
+        /* Wake up the dispatcher once all jobs have been processed. */
+        SCOPED_LOCK(&g_usbCompressionMutex)
+        {
+            if (++g_usbCompressionDoneCount >= g_usbCompressionJobCount) condvarWakeAll(&g_usbCompressionDoneCondvar);
+        }
     }
 
-    rc = usbDsEndpoint_GetReportData(endpoint, &report_data);
-    if (R_FAILED(rc))
+    threadExit();
+}
+
+NX_INLINE bool usbIsChecksumEnabled(void)
+{
+    return ((g_usbSessionCapabilities & UsbSessionCapability_ChunkChecksum) != 0);
+}
+
+NX_INLINE u64 usbGetFileDataBufferSize(void)
+{
+    return (usbIsCompressionEnabled() ? USB_COMPRESSION_BLOCK_SIZE : g_usbTransferUrbSize);
+}
+
+NX_INLINE UsbChecksumBlockTrailer *usbGetChecksumBlockTrailer(u32 slot)
+{
+    return (UsbChecksumBlockTrailer*)(g_usbTransferBuffer + USB_TRANSFER_BUFFER_SIZE + (slot * 2 * USB_TRANSFER_ALIGNMENT));
+}
+
+NX_INLINE UsbStatus *usbGetChecksumBlockStatus(u32 slot)
+{
+    return (UsbStatus*)(g_usbTransferBuffer + USB_TRANSFER_BUFFER_SIZE + (((slot * 2) + 1) * USB_TRANSFER_ALIGNMENT));
+}
+
+static bool usbWaitForChecksumBlockReply(u32 slot, u32 *out_status)
+{
+    UsbPendingTransfer *pending = &(g_usbPendingTransfers[slot]);
+    UsbStatus *cmd_status = usbGetChecksumBlockStatus(slot);
+
+    if (!usbWaitForTransfer(g_usbEndpointIn, pending->trailer_urb_id, sizeof(UsbChecksumBlockTrailer)) || \
+        !usbWaitForTransfer(g_usbEndpointOut, pending->status_urb_id, sizeof(UsbStatus))) return false;
+
+    if (cmd_status->magic != __builtin_bswap32(USB_CMD_HEADER_MAGIC))
     {
-        LOG_MSG_ERROR("usbDsEndpoint_GetReportData failed! (0x%X) (URB ID %u).", rc, urb_id);
+        LOG_MSG_ERROR("Invalid status block magic word! (0x%08X).", __builtin_bswap32(cmd_status->magic));
+        usbCancelTransferQueue();
         return false;
     }
 
-    rc = usbDsParseReportData(&report_data, urb_id, NULL, &transferred_size);
-    if (R_FAILED(rc))
+    *out_status = cmd_status->status;
+
+    return true;
+}
+
+static bool usbReapChecksumBlock(void)
+{
+    UsbPendingTransfer *pending = &(g_usbPendingTransfers[g_usbPendingTransferIdx]);
+    u32 block_idx = usbGetChecksumBlockTrailer(g_usbPendingTransferIdx)->block_idx, status = 0;
+
+    while(true)
     {
-        LOG_MSG_ERROR("usbDsParseReportData failed! (0x%X) (URB ID %u).", rc, urb_id);
-        return false;
+        if (!usbWaitForChecksumBlockReply(g_usbPendingTransferIdx, &status)) break;
+
+        if (status == UsbStatusType_Success) return true;
+
+        if (status != UsbStatusType_ChecksumMismatch)
+        {
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+            usbLogStatusDetail(status);
+#endif
+            usbCancelTransferQueue();
+            break;
+        }
+
+        LOG_MSG_WARNING("Integrity block #%u (0x%X bytes) failed verification! (attempt %u/%u).", block_idx, pending->size, pending->attempts + 1, USB_CHECKSUM_MAX_ATTEMPTS);
+
+        if (++pending->attempts >= USB_CHECKSUM_MAX_ATTEMPTS)
+        {
+            usbCancelTransferQueue();
+            break;
+        }
+
+        /* Send all pending blocks again, then wait for the data from this one to go through. */
+        if (!usbResendChecksumBlocks() || !usbWaitForTransfer(g_usbEndpointIn, pending->urb_id, pending->size)) break;
     }
 
-    if (transferred_size != size)
+    LOG_MSG_ERROR("Failed to send integrity block #%u!", block_idx);
+
+    return false;
+}
+
+static bool usbResendChecksumBlocks(void)
+{
+    u32 status = 0;
+
+    /* The host device drops every block it receives after a corrupted one, replying with a ChecksumMismatch status to each of them. */
+    /* Collect the replies for the blocks that were already in flight, so the output endpoint is back in sync. */
+    for(u32 i = 1; i < g_usbPendingTransferCount; i++)
     {
-        LOG_MSG_ERROR("USB transfer failed! Expected 0x%lX bytes, got 0x%X bytes (URB ID %u).", size, transferred_size, urb_id);
+        u32 slot = ((g_usbPendingTransferIdx + i) % g_usbTransferQueueDepth);
+        UsbPendingTransfer *pending = &(g_usbPendingTransfers[slot]);
+
+        if (!usbWaitForTransfer(g_usbEndpointIn, pending->urb_id, pending->size) || !usbWaitForChecksumBlockReply(slot, &status)) return false;
+
+        if (status == UsbStatusType_ChecksumMismatch) continue;
+
+        /* Anything else means the host device didn't drop this block (or failed), so both sides are no longer in sync. */
+        LOG_MSG_ERROR("Unexpected status for in-flight integrity block #%u! (%u).", usbGetChecksumBlockTrailer(slot)->block_idx, status);
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+        usbLogStatusDetail(status);
+#endif
+        usbCancelTransferQueue();
         return false;
     }
 
+    /* Post all pending blocks again, in order. Their data is still held by their URB slots, so nothing needs to be copied. */
+    for(u32 i = 0; i < g_usbPendingTransferCount; i++)
+    {
+        if (!usbPostTransfer((g_usbPendingTransferIdx + i) % g_usbTransferQueueDepth))
+        {
+            usbCancelTransferQueue();
+            return false;
+        }
+    }
+
     return true;
 }
@@ -0,0 +1,573 @@
+/*
+ * usb_ds_transport.c
+ *
+ * Heavily based in usb_comms from libnx.
+ *
+ * Copyright (c) 2018-2020, Switchbrew and libnx contributors.
+ * Copyright (c) 2020-2023, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "nxdt_utils.h"
+#include "usb_transport.h"
+
+#define USB_DEV_VID                 0x057E                      /* VID officially used by Nintendo in usb:ds. */
+#define USB_DEV_PID                 0x3000                      /* PID officially used by Nintendo in usb:ds. */
+#define USB_DEV_BCD_REL             0x0100                      /* Device release number. Always 1.0. */
+
+#define USB_FS_BCD_REVISION         0x0110                      /* USB 1.1. */
+#define USB_FS_EP0_MAX_PACKET_SIZE  0x40                        /* 64 bytes. */
+
+#define USB_HS_BCD_REVISION         0x0200                      /* USB 2.0. */
+#define USB_HS_EP0_MAX_PACKET_SIZE  0x40                        /* 64 bytes. */
+
+#define USB_SS_BCD_REVISION         0x0300                      /* USB 3.0. */
+#define USB_SS_EP0_MAX_PACKET_SIZE  9                           /* 512 bytes (1 << 9). */
+
+#define USB_BOS_SIZE                0x16                        /* usb_bos_descriptor + usb_2_0_extension_descriptor + usb_ss_usb_device_capability_descriptor. */
+
+#define USB_LANGID_ENUS             0x0409
+
+/* Type definitions. */
+
+/// Imported from libusb, with some adjustments.
+enum usb_bos_type {
+    USB_BT_WIRELESS_USB_DEVICE_CAPABILITY = 1,
+    USB_BT_USB_2_0_EXTENSION              = 2,
+    USB_BT_SS_USB_DEVICE_CAPABILITY       = 3,
+    USB_BT_CONTAINER_ID                   = 4
+};
+
+/// Imported from libusb, with some adjustments.
+enum usb_2_0_extension_attributes {
+    USB_BM_LPM_SUPPORT = 2
+};
+
+/// Imported from libusb, with some adjustments.
+enum usb_ss_usb_device_capability_attributes {
+    USB_BM_LTM_SUPPORT = 2
+};
+
+/// Imported from libusb, with some adjustments.
+enum usb_supported_speed {
+    USB_LOW_SPEED_OPERATION   = BIT(0),
+    USB_FULL_SPEED_OPERATION  = BIT(1),
+    USB_HIGH_SPEED_OPERATION  = BIT(2),
+    USB_SUPER_SPEED_OPERATION = BIT(3)
+};
+
+/// Imported from libusb, with some adjustments.
+struct PACKED usb_bos_descriptor {
+    u8 bLength;
+    u8 bDescriptorType; ///< Must match USB_DT_BOS.
+    u16 wTotalLength;   ///< Length of this descriptor and all of its sub descriptors.
+    u8 bNumDeviceCaps;  ///< The number of separate device capability descriptors in the BOS.
+};
+
+NXDT_ASSERT(struct usb_bos_descriptor, 0x5);
+
+/// Imported from libusb, with some adjustments.
+struct PACKED usb_2_0_extension_descriptor {
+    u8 bLength;
+    u8 bDescriptorType;     ///< Must match USB_DT_DEVICE_CAPABILITY.
+    u8 bDevCapabilityType;  ///< Must match USB_BT_USB_2_0_EXTENSION.
+    u32 bmAttributes;       ///< usb_2_0_extension_attributes.
+};
+
+NXDT_ASSERT(struct usb_2_0_extension_descriptor, 0x7);
+
+/// Imported from libusb, with some adjustments.
+struct PACKED usb_ss_usb_device_capability_descriptor {
+    u8 bLength;
+    u8 bDescriptorType;         ///< Must match USB_DT_DEVICE_CAPABILITY.
+    u8 bDevCapabilityType;      ///< Must match USB_BT_SS_USB_DEVICE_CAPABILITY.
+    u8 bmAttributes;            ///< usb_ss_usb_device_capability_attributes.
+    u16 wSpeedsSupported;       ///< usb_supported_speed.
+    u8 bFunctionalitySupport;   ///< The lowest speed at which all the functionality that the device supports is available to the user.
+    u8 bU1DevExitLat;           ///< U1 Device Exit Latency.
+    u16 bU2DevExitLat;          ///< U2 Device Exit Latency.
+};
+
+NXDT_ASSERT(struct usb_ss_usb_device_capability_descriptor, 0xA);
+
+/* Global variables. */
+
+static UsbDsInterface *g_usbInterface = NULL;
+static UsbDsEndpoint *g_usbEndpointIn = NULL, *g_usbEndpointOut = NULL;
+static bool g_usbHos5xEnabled = false;
+
+/* Function prototypes. */
+
+static bool usbDsTransportInitialize(UsbDsEndpoint **out_endpoint_in, UsbDsEndpoint **out_endpoint_out);
+
+static bool usbInitializeComms(void);
+static bool usbInitializeComms5x(void);
+static bool usbInitializeComms1x(void);
+static void usbCloseComms(void);
+
+static const UsbTransport g_usbDsTransport = {
+    .initialize = &usbDsTransportInitialize,
+    .exit = &usbCloseComms,
+    .get_state_change_event = &usbDsGetStateChangeEvent,
+    .get_state = &usbDsGetState,
+    .post_buffer_async = &usbDsEndpoint_PostBufferAsync,
+    .get_report_data = &usbDsEndpoint_GetReportData,
+    .cancel = &usbDsEndpoint_Cancel,
+    .set_zlt = &usbDsEndpoint_SetZlt
+};
+
+const UsbTransport *usbGetTransport(void)
+{
+    return &g_usbDsTransport;
+}
+
+static bool usbDsTransportInitialize(UsbDsEndpoint **out_endpoint_in, UsbDsEndpoint **out_endpoint_out)
+{
+    if (!out_endpoint_in || !out_endpoint_out)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    if (!usbInitializeComms()) return false;
+
+    *out_endpoint_in = g_usbEndpointIn;
+    *out_endpoint_out = g_usbEndpointOut;
+
+    return true;
+}
+
+static bool usbInitializeComms(void)
+{
+    Result rc = 0;
+    bool ret = false, is_5x = hosversionAtLeast(5, 0, 0);
+
+    /* Carry out USB comms initialization steps for this HOS version. */
+    ret = (is_5x ? usbInitializeComms5x() : usbInitializeComms1x());
+    if (!ret) goto end;
+
+    /* Enable USB interface. */
+    /* This is always needed regardless of the HOS version. */
+    rc = usbDsInterface_EnableInterface(g_usbInterface);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_EnableInterface failed! (0x%X).", rc);
+        goto end;
+    }
+
+    /* Additional step needed under HOS 5.0.0+. */
+    if (is_5x)
+    {
+        rc = usbDsEnable();
+        if (R_FAILED(rc))
+        {
+            LOG_MSG_ERROR("usbDsEnable failed! (0x%X).", rc);
+            goto end;
+        }
+
+        g_usbHos5xEnabled = true;
+    }
+
+    ret = true;
+
+end:
+    if (!ret) usbCloseComms();
+
+    return ret;
+}
+
+static bool usbInitializeComms5x(void)
+{
+    Result rc = 0;
+    bool ret = false;
+
+    struct usb_device_descriptor device_descriptor = {
+        .bLength = USB_DT_DEVICE_SIZE,
+        .bDescriptorType = USB_DT_DEVICE,
+        .bcdUSB = USB_FS_BCD_REVISION,                  /* USB 1.1. Updated before setting new device descriptors for USB 2.0 and 3.0. */
+        .bDeviceClass = 0,                              /* Defined at interface level. */
+        .bDeviceSubClass = 0,                           /* Defined at interface level. */
+        .bDeviceProtocol = 0,                           /* Defined at interface level. */
+        .bMaxPacketSize0 = USB_FS_EP0_MAX_PACKET_SIZE,  /* Updated before setting the USB 3.0 device descriptor. */
+        .idVendor = USB_DEV_VID,
+        .idProduct = USB_DEV_PID,
+        .bcdDevice = USB_DEV_BCD_REL,
+        .iManufacturer = 0,                             /* Filled at a later time. */
+        .iProduct = 0,                                  /* Filled at a later time. */
+        .iSerialNumber = 0,                             /* Filled at a later time. */
+        .bNumConfigurations = 1
+    };
+
+    static const u16 supported_langs[] = { USB_LANGID_ENUS };
+    static const u16 num_supported_langs = (u16)MAX_ELEMENTS(supported_langs);
+
+    u8 bos[USB_BOS_SIZE] = {0};
+
+    struct usb_bos_descriptor *bos_desc = (struct usb_bos_descriptor*)bos;
+    struct usb_2_0_extension_descriptor *usb2_ext_desc = (struct usb_2_0_extension_descriptor*)(bos + sizeof(struct usb_bos_descriptor));
+    struct usb_ss_usb_device_capability_descriptor *usb3_devcap_desc = (struct usb_ss_usb_device_capability_descriptor*)((u8*)usb2_ext_desc + sizeof(struct usb_2_0_extension_descriptor));
+
+    bos_desc->bLength = sizeof(struct usb_bos_descriptor);
+    bos_desc->bDescriptorType = USB_DT_BOS;
+    bos_desc->wTotalLength = USB_BOS_SIZE;
+    bos_desc->bNumDeviceCaps = 2;   /* USB 2.0 + USB 3.0. No extra capabilities for USB 1.x. */
+
+    usb2_ext_desc->bLength = sizeof(struct usb_2_0_extension_descriptor);
+    usb2_ext_desc->bDescriptorType = USB_DT_DEVICE_CAPABILITY;
+    usb2_ext_desc->bDevCapabilityType = USB_BT_USB_2_0_EXTENSION;
+    usb2_ext_desc->bmAttributes = USB_BM_LPM_SUPPORT;
+
+    usb3_devcap_desc->bLength = sizeof(struct usb_ss_usb_device_capability_descriptor);
+    usb3_devcap_desc->bDescriptorType = USB_DT_DEVICE_CAPABILITY;
+    usb3_devcap_desc->bDevCapabilityType = USB_BT_SS_USB_DEVICE_CAPABILITY;
+    usb3_devcap_desc->bmAttributes = 0;
+    usb3_devcap_desc->wSpeedsSupported = (USB_SUPER_SPEED_OPERATION | USB_HIGH_SPEED_OPERATION | USB_FULL_SPEED_OPERATION);
+    usb3_devcap_desc->bFunctionalitySupport = 1;    /* We can fully work under USB 1.x. */
+    usb3_devcap_desc->bU1DevExitLat = 0;
+    usb3_devcap_desc->bU2DevExitLat = 0;
+
+    struct usb_interface_descriptor interface_descriptor = {
+        .bLength = USB_DT_INTERFACE_SIZE,
+        .bDescriptorType = USB_DT_INTERFACE,
+        .bInterfaceNumber = USBDS_DEFAULT_InterfaceNumber,
+        .bAlternateSetting = 0,
+        .bNumEndpoints = 2,
+        .bInterfaceClass = USB_CLASS_VENDOR_SPEC,
+        .bInterfaceSubClass = USB_CLASS_VENDOR_SPEC,
+        .bInterfaceProtocol = USB_CLASS_VENDOR_SPEC,
+        .iInterface = 0
+    };
+
+    struct usb_endpoint_descriptor endpoint_descriptor_in = {
+        .bLength = USB_DT_ENDPOINT_SIZE,
+        .bDescriptorType = USB_DT_ENDPOINT,
+        .bEndpointAddress = USB_ENDPOINT_IN,
+        .bmAttributes = USB_TRANSFER_TYPE_BULK,
+        .wMaxPacketSize = USB_FS_EP_MAX_PACKET_SIZE,    /* Updated before setting new device descriptors for USB 2.0 and 3.0. */
+        .bInterval = 0
+    };
+
+    struct usb_endpoint_descriptor endpoint_descriptor_out = {
+        .bLength = USB_DT_ENDPOINT_SIZE,
+        .bDescriptorType = USB_DT_ENDPOINT,
+        .bEndpointAddress = USB_ENDPOINT_OUT,
+        .bmAttributes = USB_TRANSFER_TYPE_BULK,
+        .wMaxPacketSize = USB_FS_EP_MAX_PACKET_SIZE,    /* Updated before setting new device descriptors for USB 2.0 and 3.0. */
+        .bInterval = 0
+    };
+
+    struct usb_ss_endpoint_companion_descriptor endpoint_companion = {
+        .bLength = sizeof(struct usb_ss_endpoint_companion_descriptor),
+        .bDescriptorType = USB_DT_SS_ENDPOINT_COMPANION,
+        .bMaxBurst = 0x0F,
+        .bmAttributes = 0,
+        .wBytesPerInterval = 0
+    };
+
+    /* Set language string descriptor. */
+    rc = usbDsAddUsbLanguageStringDescriptor(NULL, supported_langs, num_supported_langs);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsAddUsbLanguageStringDescriptor failed! (0x%X).", rc);
+        goto end;
+    }
+
+    /* Set manufacturer string descriptor. */
+    rc = usbDsAddUsbStringDescriptor(&(device_descriptor.iManufacturer), APP_AUTHOR);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsAddUsbStringDescriptor failed! (0x%X) (manufacturer).", rc);
+        goto end;
+    }
+
+    /* Set product string descriptor. */
+    rc = usbDsAddUsbStringDescriptor(&(device_descriptor.iProduct), APP_TITLE);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsAddUsbStringDescriptor failed! (0x%X) (product).", rc);
+        goto end;
+    }
+
+    /* Set serial number string descriptor. */
+    rc = usbDsAddUsbStringDescriptor(&(device_descriptor.iSerialNumber), APP_VERSION);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsAddUsbStringDescriptor failed! (0x%X) (serial number).", rc);
+        goto end;
+    }
+
+    /* Set device descriptors. */
+    rc = usbDsSetUsbDeviceDescriptor(UsbDeviceSpeed_Full, &device_descriptor);  /* Full Speed is USB 1.1. */
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsSetUsbDeviceDescriptor failed! (0x%X) (USB 1.1).", rc);
+        goto end;
+    }
+
+    device_descriptor.bcdUSB = USB_HS_BCD_REVISION;
+    rc = usbDsSetUsbDeviceDescriptor(UsbDeviceSpeed_High, &device_descriptor);  /* High Speed is USB 2.0. */
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsSetUsbDeviceDescriptor failed! (0x%X) (USB 2.0).", rc);
+        goto end;
+    }
+
+    device_descriptor.bcdUSB = USB_SS_BCD_REVISION;
+    device_descriptor.bMaxPacketSize0 = USB_SS_EP0_MAX_PACKET_SIZE;
+    rc = usbDsSetUsbDeviceDescriptor(UsbDeviceSpeed_Super, &device_descriptor); /* Super Speed is USB 3.0. */
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsSetUsbDeviceDescriptor failed! (0x%X) (USB 3.0).", rc);
+        goto end;
+    }
+
+    /* Set Binary Object Store. */
+    rc = usbDsSetBinaryObjectStore(bos, USB_BOS_SIZE);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsSetBinaryObjectStore failed! (0x%X).", rc);
+        goto end;
+    }
+
+    /* Setup interface. */
+    rc = usbDsRegisterInterface(&g_usbInterface);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsRegisterInterface failed! (0x%X).", rc);
+        goto end;
+    }
+
+    interface_descriptor.bInterfaceNumber = g_usbInterface->interface_index;
+    endpoint_descriptor_in.bEndpointAddress += (interface_descriptor.bInterfaceNumber + 1);
+    endpoint_descriptor_out.bEndpointAddress += (interface_descriptor.bInterfaceNumber + 1);
+
+    /* Full Speed config (USB 1.1). */
+    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Full, &interface_descriptor, USB_DT_INTERFACE_SIZE);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 1.1) (interface).", rc);
+        goto end;
+    }
+
+    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Full, &endpoint_descriptor_in, USB_DT_ENDPOINT_SIZE);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 1.1) (in endpoint).", rc);
+        goto end;
+    }
+
+    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Full, &endpoint_descriptor_out, USB_DT_ENDPOINT_SIZE);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 1.1) (out endpoint).", rc);
+        goto end;
+    }
+
+    /* High Speed config (USB 2.0). */
+    endpoint_descriptor_in.wMaxPacketSize = endpoint_descriptor_out.wMaxPacketSize = USB_HS_EP_MAX_PACKET_SIZE;
+
+    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_High, &interface_descriptor, USB_DT_INTERFACE_SIZE);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 2.0) (interface).", rc);
+        goto end;
+    }
+
+    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_High, &endpoint_descriptor_in, USB_DT_ENDPOINT_SIZE);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 2.0) (in endpoint).", rc);
+        goto end;
+    }
+
+    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_High, &endpoint_descriptor_out, USB_DT_ENDPOINT_SIZE);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 2.0) (out endpoint).", rc);
+        goto end;
+    }
+
+    /* Super Speed config (USB 3.0). */
+    endpoint_descriptor_in.wMaxPacketSize = endpoint_descriptor_out.wMaxPacketSize = USB_SS_EP_MAX_PACKET_SIZE;
+
+    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &interface_descriptor, USB_DT_INTERFACE_SIZE);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (interface).", rc);
+        goto end;
+    }
+
+    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &endpoint_descriptor_in, USB_DT_ENDPOINT_SIZE);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (in endpoint).", rc);
+        goto end;
+    }
+
+    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &endpoint_companion, USB_DT_SS_ENDPOINT_COMPANION_SIZE);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (in endpoint companion).", rc);
+        goto end;
+    }
+
+    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &endpoint_descriptor_out, USB_DT_ENDPOINT_SIZE);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (out endpoint).", rc);
+        goto end;
+    }
+
+    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &endpoint_companion, USB_DT_SS_ENDPOINT_COMPANION_SIZE);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (out endpoint companion).", rc);
+        goto end;
+    }
+
+    /* Setup endpoints. */
+    rc = usbDsInterface_RegisterEndpoint(g_usbInterface, &g_usbEndpointIn, endpoint_descriptor_in.bEndpointAddress);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_RegisterEndpoint failed! (0x%X) (in endpoint).", rc);
+        goto end;
+    }
+
+    rc = usbDsInterface_RegisterEndpoint(g_usbInterface, &g_usbEndpointOut, endpoint_descriptor_out.bEndpointAddress);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_RegisterEndpoint failed! (0x%X) (out endpoint).", rc);
+        goto end;
+    }
+
+    ret = true;
+
+end:
+    return ret;
+}
+
+static bool usbInitializeComms1x(void)
+{
+    Result rc = 0;
+    bool ret = false;
+
+    static const UsbDsDeviceInfo device_info = {
+        .idVendor = USB_DEV_VID,
+        .idProduct = USB_DEV_PID,
+        .bcdDevice = USB_DEV_BCD_REL,
+        .Manufacturer = APP_AUTHOR,
+        .Product = APP_TITLE,
+        .SerialNumber = APP_VERSION
+    };
+
+    struct usb_interface_descriptor interface_descriptor = {
+        .bLength = USB_DT_INTERFACE_SIZE,
+        .bDescriptorType = USB_DT_INTERFACE,
+        .bInterfaceNumber = 0,
+        .bAlternateSetting = 0,
+        .bInterfaceClass = USB_CLASS_VENDOR_SPEC,
+        .bInterfaceSubClass = USB_CLASS_VENDOR_SPEC,
+        .bInterfaceProtocol = USB_CLASS_VENDOR_SPEC,
+        .iInterface = 0
+    };
+
+    struct usb_endpoint_descriptor endpoint_descriptor_in = {
+        .bLength = USB_DT_ENDPOINT_SIZE,
+        .bDescriptorType = USB_DT_ENDPOINT,
+        .bEndpointAddress = USB_ENDPOINT_IN,
+        .bmAttributes = USB_TRANSFER_TYPE_BULK,
+        .wMaxPacketSize = USB_HS_EP_MAX_PACKET_SIZE,
+        .bInterval = 0
+    };
+
+    struct usb_endpoint_descriptor endpoint_descriptor_out = {
+        .bLength = USB_DT_ENDPOINT_SIZE,
+        .bDescriptorType = USB_DT_ENDPOINT,
+        .bEndpointAddress = USB_ENDPOINT_OUT,
+        .bmAttributes = USB_TRANSFER_TYPE_BULK,
+        .wMaxPacketSize = USB_HS_EP_MAX_PACKET_SIZE,
+        .bInterval = 0
+    };
+
+    /* Set VID, PID and BCD. */
+    rc = usbDsSetVidPidBcd(&device_info);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsSetVidPidBcd failed! (0x%X).", rc);
+        goto end;
+    }
+
+    /* Setup interface. */
+    rc = usbDsGetDsInterface(&g_usbInterface, &interface_descriptor, "usb");
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsGetDsInterface failed! (0x%X).", rc);
+        goto end;
+    }
+
+    /* Setup endpoints. */
+    rc = usbDsInterface_GetDsEndpoint(g_usbInterface, &g_usbEndpointIn, &endpoint_descriptor_in);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_GetDsEndpoint failed! (0x%X) (in endpoint).", rc);
+        goto end;
+    }
+
+    rc = usbDsInterface_GetDsEndpoint(g_usbInterface, &g_usbEndpointOut, &endpoint_descriptor_out);
+    if (R_FAILED(rc))
+    {
+        LOG_MSG_ERROR("usbDsInterface_GetDsEndpoint failed! (0x%X) (out endpoint).", rc);
+        goto end;
+    }
+
+    ret = true;
+
+end:
+    return ret;
+}
+
+static void usbCloseComms(void)
+{
+    bool is_5x = hosversionAtLeast(5, 0, 0);
+
+    if (is_5x && g_usbHos5xEnabled)
+    {
+        usbDsDisable();
+        g_usbHos5xEnabled = false;
+    }
+
+    if (g_usbEndpointOut)
+    {
+        usbDsEndpoint_Close(g_usbEndpointOut);
+        g_usbEndpointOut = NULL;
+    }
+
+    if (g_usbEndpointIn)
+    {
+        usbDsEndpoint_Close(g_usbEndpointIn);
+        g_usbEndpointIn = NULL;
+    }
+
+    if (g_usbInterface)
+    {
+        /* usbDsInterface_DisableInterface() is internally called here. */
+        usbDsInterface_Close(g_usbInterface);
+        g_usbInterface = NULL;
+    }
+
+    if (is_5x) usbDsClearDeviceData();
+}